@@ -0,0 +1,246 @@
+/* arena.c
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Allocates the nodes of the file index and ban table. In prefork mode
+*  they come from one anonymous shared mapping made before the workers are
+*  forked, so a node's address is the same in every worker and the lists can
+*  be linked with ordinary pointers. Blocks are carved from the end of the
+*  mapping and recycled through a free list per size class. Without an arena
+*  (threaded mode) calloc() and free() are used instead.
+*
+*  Records held once per file are instead packed into blocks by a slab, which
+*  saves each of them the block header and the rounding up to a size class.
+*
+*  The mutexes guarding shared lists are process-shared and robust: if a
+*  worker dies holding one, the next locker is told, marks it consistent, and
+*  carries on, so one crashed worker cannot hang the others.
+*/
+
+#include "arena.h"
+#include "log.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+/* arenaCreate
+*PURPOSE: Maps a shared arena of the given size, to be inherited by processes
+*  forked afterwards. Pages are only backed once used. Returns NULL if the
+*  mapping fails.
+*INPUT: uint64_t size in bytes
+*OUTPUTS: SharedArena* arena
+*/
+SharedArena *arenaCreate(uint64_t size)
+{
+  SharedArena *arena = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+  if(arena == MAP_FAILED)
+  {
+    arena = NULL;
+  }
+  else
+  { //mapping is zeroed
+    arenaMutexInit(&(arena->mutex), true);
+    arena->size = size;
+    arena->used = (sizeof(SharedArena) + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+  }
+
+  return arena;
+}
+
+/* arenaAlloc
+*PURPOSE: Returns a zeroed block of at least size bytes, or NULL if the arena
+*  is full. Without an arena, calloc() is used.
+*INPUT: SharedArena* arena (may be NULL), size_t size
+*OUTPUTS: void* block
+*/
+void *arenaAlloc(SharedArena *arena, size_t size)
+{
+  void *block = NULL;
+  size_t class = (size + ARENA_ALIGN - 1) / ARENA_ALIGN;
+
+  if(arena == NULL)
+  {
+    block = calloc(1, size);
+  }
+  else if(class < ARENA_CLASSES)
+  {
+    arenaLock(&(arena->mutex));
+
+    if(arena->free[class] != NULL)
+    { //first word of a free block links to the next
+      block = arena->free[class];
+      arena->free[class] = *(void**)block;
+    }
+    else if(arena->used + (class + 1) * ARENA_ALIGN <= arena->size)
+    { //header, holding the size class, precedes the block
+      uint64_t *header = (uint64_t*)((char*)arena + arena->used);
+
+      *header = class;
+      block = (char*)header + ARENA_ALIGN;
+      arena->used += (class + 1) * ARENA_ALIGN;
+    }
+
+    if(block != NULL)
+    {
+      arena->allocated += class * ARENA_ALIGN;
+    }
+
+    pthread_mutex_unlock(&(arena->mutex));
+
+    if(block != NULL)
+    {
+      memset(block, 0, class * ARENA_ALIGN);
+    }
+  }
+
+  return block;
+}
+
+/* arenaFree
+*PURPOSE: Returns a block from arenaAlloc() to the arena.
+*INPUT: SharedArena* arena (may be NULL), void* block
+*OUTPUTS: -
+*/
+void arenaFree(SharedArena *arena, void *block)
+{
+  if(arena == NULL)
+  {
+    free(block);
+  }
+  else if(block != NULL)
+  {
+    size_t class = *(uint64_t*)((char*)block - ARENA_ALIGN);
+
+    arenaLock(&(arena->mutex));
+
+    *(void**)block = arena->free[class];
+    arena->free[class] = block;
+    arena->allocated -= class * ARENA_ALIGN;
+
+    pthread_mutex_unlock(&(arena->mutex));
+  }
+}
+
+/* slabInit
+*PURPOSE: Prepares an empty slab of records of the given size, which must be
+*  less than SLAB_BLOCK. Records are aligned to a pointer.
+*INPUT: ArenaSlab* slab, size_t size, int shared (boolean, the slab is in the
+*  arena)
+*OUTPUTS: -
+*/
+void slabInit(ArenaSlab *slab, size_t size, int shared)
+{
+  arenaMutexInit(&(slab->mutex), shared);
+  slab->size = (size + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*);
+  slab->free = NULL;
+  slab->block = NULL;
+  slab->carved = 0;
+  slab->records = 0;
+  slab->blocks = 0;
+}
+
+/* slabAlloc
+*PURPOSE: Returns a zeroed record from the slab, reusing a freed one if there
+*  is one, otherwise carving it from the slab's block, taking a new block from
+*  the arena (or the heap, without one) when that is used up. Returns NULL if
+*  the arena is full.
+*INPUT: ArenaSlab* slab, SharedArena* arena (may be NULL)
+*OUTPUTS: void* record
+*/
+void *slabAlloc(ArenaSlab *slab, SharedArena *arena)
+{
+  void *record = NULL;
+
+  arenaLock(&(slab->mutex));
+
+  if(slab->free != NULL)
+  {
+    record = slab->free;
+    slab->free = *(void**)record;
+  }
+  else
+  {
+    if(slab->block == NULL || slab->carved + slab->size > SLAB_BLOCK)
+    { //the rest of a used up block is left unused
+      slab->block = arenaAlloc(arena, SLAB_BLOCK);
+      slab->carved = 0;
+      slab->blocks += slab->block != NULL;
+    }
+
+    if(slab->block != NULL)
+    {
+      record = slab->block + slab->carved;
+      slab->carved += slab->size;
+    }
+  }
+
+  if(record != NULL)
+  {
+    slab->records++;
+    memset(record, 0, slab->size);
+  }
+
+  pthread_mutex_unlock(&(slab->mutex));
+
+  return record;
+}
+
+/* slabFree
+*PURPOSE: Returns a record from slabAlloc() to the slab, for reuse by the next
+*  slabAlloc(). Its block is never freed.
+*INPUT: ArenaSlab* slab, void* record (may be NULL)
+*OUTPUTS: -
+*/
+void slabFree(ArenaSlab *slab, void *record)
+{
+  if(record != NULL)
+  {
+    arenaLock(&(slab->mutex));
+
+    *(void**)record = slab->free;
+    slab->free = record;
+    slab->records--;
+
+    pthread_mutex_unlock(&(slab->mutex));
+  }
+}
+
+/* arenaMutexInit
+*PURPOSE: Initialises a mutex, which if shared can be locked from any process
+*  mapping it, and survives its owner dying.
+*INPUT: pthread_mutex_t* mutex, int shared (boolean)
+*OUTPUTS: -
+*/
+void arenaMutexInit(pthread_mutex_t *mutex, int shared)
+{
+  pthread_mutexattr_t attr;
+
+  pthread_mutexattr_init(&attr);
+
+  if(shared)
+  {
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  }
+
+  pthread_mutex_init(mutex, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
+
+/* arenaLock
+*PURPOSE: Locks a mutex from arenaMutexInit(), recovering it if its previous
+*  owner died while holding it, so the other workers carry on. A change the
+*  dead worker was partway through may be lost.
+*INPUT: pthread_mutex_t* mutex
+*OUTPUTS: -
+*/
+void arenaLock(pthread_mutex_t *mutex)
+{
+  if(pthread_mutex_lock(mutex) == EOWNERDEAD)
+  {
+    pthread_mutex_consistent(mutex);
+    logMsg(LOG_WARN, "server", "Recovered a lock held by a worker process which died.");
+  }
+}
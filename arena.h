@@ -0,0 +1,56 @@
+/* arena.h
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Header for arena.c. Allocator for the index and ban table, which in
+*  prefork mode are kept in memory shared by every worker process.
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define DEFAULT_SHARED_MEMORY 256 //MiB reserved for the shared index in prefork mode
+#define ARENA_ALIGN 16 //bytes, also the size of each block's header
+#define ARENA_CLASSES 512 //size classes of ARENA_ALIGN bytes each, so the largest block is 8KiB
+#define SLAB_BLOCK ((ARENA_CLASSES - 1) * ARENA_ALIGN) //bytes of each block a slab carves records from, the largest the arena has
+
+typedef struct SharedArena
+{ //at the start of the shared mapping, which is at the same address in every process
+  pthread_mutex_t mutex; //process-shared and robust
+  size_t size; //bytes mapped
+  size_t used; //bytes handed out from the end of the mapping so far
+  void* free[ARENA_CLASSES]; //freed blocks of each size class
+  uint64_t allocated; //statistics, bytes in live blocks
+} SharedArena;
+
+typedef struct ArenaSlab
+{ //records of one size packed into arena blocks, without a header each, for structures held once per file
+  pthread_mutex_t mutex; //process-shared if the slab is in the arena
+  size_t size; //of each record
+  void* free; //first word of a free record links to the next
+  char* block; //being carved into records, NULL once used up
+  size_t carved; //bytes of it handed out
+  uint64_t records; //statistics, live records
+  uint64_t blocks; //statistics, blocks taken from the arena, never returned
+} ArenaSlab;
+
+SharedArena *arenaCreate(uint64_t size);
+
+void *arenaAlloc(SharedArena* arena, size_t size);
+
+void arenaFree(SharedArena* arena, void* block);
+
+void slabInit(ArenaSlab* slab, size_t size, int shared);
+
+void *slabAlloc(ArenaSlab* slab, SharedArena* arena);
+
+void slabFree(ArenaSlab* slab, void* record);
+
+void arenaMutexInit(pthread_mutex_t* mutex, int shared);
+
+void arenaLock(pthread_mutex_t* mutex);
+
+#endif
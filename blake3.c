@@ -0,0 +1,571 @@
+/* blake3.c
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: BLAKE3 message digest (O'Connor, Aumasson, Neves & Wilcox-O'Hearn),
+*  unkeyed. The message is split into 1KiB chunks which are hashed
+*  independently and combined as a binary tree, so whole chunks are hashed
+*  eight at a time, one per SIMD lane. The lanes are written once with GCC
+*  vector extensions and compiled for both AVX2 and the baseline instruction
+*  set; which is used is chosen when first needed by what the CPU supports.
+*/
+
+#include "blake3.h"
+#include <string.h>
+#include <pthread.h>
+
+//flag defines, of each compression
+#define CHUNK_START 1
+#define CHUNK_END 2
+#define PARENT 4
+#define ROOT 8
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define G(v, a, b, c, d, x, y) \
+  v[a] = v[a] + v[b] + (x); v[d] = ROTR(v[d] ^ v[a], 16); \
+  v[c] = v[c] + v[d]; v[b] = ROTR(v[b] ^ v[c], 12); \
+  v[a] = v[a] + v[b] + (y); v[d] = ROTR(v[d] ^ v[a], 8); \
+  v[c] = v[c] + v[d]; v[b] = ROTR(v[b] ^ v[c], 7)
+#define ROUND(v, m, s) \
+  G(v, 0, 4, 8, 12, m[s[0]], m[s[1]]); G(v, 1, 5, 9, 13, m[s[2]], m[s[3]]); \
+  G(v, 2, 6, 10, 14, m[s[4]], m[s[5]]); G(v, 3, 7, 11, 15, m[s[6]], m[s[7]]); \
+  G(v, 0, 5, 10, 15, m[s[8]], m[s[9]]); G(v, 1, 6, 11, 12, m[s[10]], m[s[11]]); \
+  G(v, 2, 7, 8, 13, m[s[12]], m[s[13]]); G(v, 3, 4, 9, 14, m[s[14]], m[s[15]])
+
+typedef uint32_t Lanes __attribute__((vector_size(BLAKE3_LANES * sizeof(uint32_t))));
+
+static const uint32_t iv[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+  0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+static const uint8_t schedule[7][16] = { //message word order of each round
+  {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+  {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+  {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+  {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+  {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+  {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+  {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13}};
+
+static pthread_once_t selected = PTHREAD_ONCE_INIT;
+static void (*hashLanes)(const uint8_t*, uint64_t, uint32_t[][8]);
+static const char *implementation;
+
+/* load32
+*PURPOSE: Reads a little-endian word, regardless of host byte order.
+*INPUT: uint8_t* bytes
+*OUTPUTS: uint32_t word
+*/
+static inline uint32_t load32(const uint8_t *bytes)
+{
+  return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+/* store32
+*PURPOSE: Writes a word little-endian.
+*INPUT: uint32_t word
+*OUTPUTS: uint8_t* bytes
+*/
+static inline void store32(uint8_t *bytes, uint32_t word)
+{
+  bytes[0] = (uint8_t)word;
+  bytes[1] = (uint8_t)(word >> 8);
+  bytes[2] = (uint8_t)(word >> 16);
+  bytes[3] = (uint8_t)(word >> 24);
+}
+
+/* compress
+*PURPOSE: Runs the compression function over one block, leaving the whole
+*  16 word state for the caller to fold into a chaining value or output.
+*INPUT: uint32_t cv[8], uint8_t block[64], uint8_t block length, uint64_t
+*  counter, uint8_t flags
+*OUTPUTS: uint32_t state[16]
+*/
+static void compress(uint32_t state[16], const uint32_t cv[8], const uint8_t *block, uint8_t length, uint64_t counter, uint8_t flags)
+{
+  uint32_t m[16];
+
+  for(int i = 0; i < 16; i++)
+  {
+    m[i] = load32(block + i * 4);
+  }
+
+  memcpy(state, cv, 8 * sizeof(uint32_t));
+  memcpy(state + 8, iv, 4 * sizeof(uint32_t));
+  state[12] = (uint32_t)counter;
+  state[13] = (uint32_t)(counter >> 32);
+  state[14] = length;
+  state[15] = flags;
+
+  for(int r = 0; r < 7; r++)
+  {
+    ROUND(state, m, schedule[r]);
+  }
+}
+
+/* compressCv
+*PURPOSE: Compresses one block into the chaining value.
+*INPUT: uint32_t cv[8], uint8_t block[64], uint8_t block length, uint64_t
+*  counter, uint8_t flags
+*OUTPUTS: uint32_t cv[8]
+*/
+static void compressCv(uint32_t cv[8], const uint8_t *block, uint8_t length, uint64_t counter, uint8_t flags)
+{
+  uint32_t state[16];
+
+  compress(state, cv, block, length, counter, flags);
+
+  for(int i = 0; i < 8; i++)
+  {
+    cv[i] = state[i] ^ state[i + 8];
+  }
+}
+
+/* parentCv
+*PURPOSE: Combines the chaining values of two sibling subtrees into their
+*  parent's, written over the right child's.
+*INPUT: uint32_t left[8], uint32_t right[8]
+*OUTPUTS: uint32_t right[8] parent
+*/
+static void parentCv(const uint32_t left[8], uint32_t right[8])
+{
+  uint8_t block[BLAKE3_BLOCK_LENGTH];
+
+  for(int i = 0; i < 8; i++)
+  {
+    store32(block + i * 4, left[i]);
+    store32(block + 32 + i * 4, right[i]);
+  }
+
+  memcpy(right, iv, sizeof(iv));
+  compressCv(right, block, BLAKE3_BLOCK_LENGTH, 0, PARENT);
+}
+
+/* hashLanesBody
+*PURPOSE: Hashes BLAKE3_LANES consecutive whole chunks at once, each in its
+*  own lane of every vector. Inlined into each of the dispatched variants, so
+*  the compiler generates it once per instruction set.
+*INPUT: uint8_t* chunks, uint64_t number of the first chunk
+*OUTPUTS: uint32_t cvs[BLAKE3_LANES][8]
+*/
+static inline __attribute__((always_inline)) void hashLanesBody(const uint8_t *data, uint64_t chunk, uint32_t cvs[][8])
+{
+  Lanes h[8];
+  Lanes counterLow;
+  Lanes counterHigh;
+
+  for(int i = 0; i < 8; i++)
+  {
+    h[i] = (Lanes){0} + iv[i];
+  }
+
+  for(int l = 0; l < BLAKE3_LANES; l++)
+  {
+    counterLow[l] = (uint32_t)(chunk + l);
+    counterHigh[l] = (uint32_t)((chunk + l) >> 32);
+  }
+
+  for(int b = 0; b < BLAKE3_CHUNK_LENGTH / BLAKE3_BLOCK_LENGTH; b++)
+  {
+    uint32_t words[16][BLAKE3_LANES];
+    Lanes m[16];
+    Lanes v[16];
+
+    for(int l = 0; l < BLAKE3_LANES; l++)
+    { //transposed, so each vector holds the same word of every chunk's block
+      const uint8_t *block = data + l * BLAKE3_CHUNK_LENGTH + b * BLAKE3_BLOCK_LENGTH;
+
+      for(int i = 0; i < 16; i++)
+      {
+        words[i][l] = load32(block + i * 4);
+      }
+    }
+
+    for(int i = 0; i < 16; i++)
+    {
+      memcpy(&m[i], words[i], sizeof(Lanes));
+    }
+
+    for(int i = 0; i < 8; i++)
+    {
+      v[i] = h[i];
+    }
+
+    for(int i = 0; i < 4; i++)
+    {
+      v[i + 8] = (Lanes){0} + iv[i];
+    }
+
+    v[12] = counterLow;
+    v[13] = counterHigh;
+    v[14] = (Lanes){0} + BLAKE3_BLOCK_LENGTH;
+    v[15] = (Lanes){0} + (uint32_t)((b == 0 ? CHUNK_START : 0) | (b == BLAKE3_CHUNK_LENGTH / BLAKE3_BLOCK_LENGTH - 1 ? CHUNK_END : 0));
+
+    for(int r = 0; r < 7; r++)
+    {
+      ROUND(v, m, schedule[r]);
+    }
+
+    for(int i = 0; i < 8; i++)
+    {
+      h[i] = v[i] ^ v[i + 8];
+    }
+  }
+
+  for(int l = 0; l < BLAKE3_LANES; l++)
+  {
+    for(int i = 0; i < 8; i++)
+    {
+      cvs[l][i] = h[i][l];
+    }
+  }
+}
+
+#if defined(__x86_64__)
+/* hashLanesAvx2
+*PURPOSE: hashLanesBody, with the lanes in 256 bit AVX2 registers.
+*INPUT: uint8_t* chunks, uint64_t number of the first chunk
+*OUTPUTS: uint32_t cvs[BLAKE3_LANES][8]
+*/
+__attribute__((target("avx2"))) static void hashLanesAvx2(const uint8_t *data, uint64_t chunk, uint32_t cvs[][8])
+{
+  hashLanesBody(data, chunk, cvs);
+}
+#endif
+
+/* hashLanesGeneric
+*PURPOSE: hashLanesBody, with the lanes in whatever vectors the baseline
+*  instruction set has (a pair of SSE2 registers on x86-64), or in scalars.
+*INPUT: uint8_t* chunks, uint64_t number of the first chunk
+*OUTPUTS: uint32_t cvs[BLAKE3_LANES][8]
+*/
+static void hashLanesGeneric(const uint8_t *data, uint64_t chunk, uint32_t cvs[][8])
+{
+  hashLanesBody(data, chunk, cvs);
+}
+
+/* selectLanes
+*PURPOSE: Chooses the widest variant of hashLanes the CPU supports. Run once.
+*INPUT: -
+*OUTPUTS: -
+*/
+static void selectLanes(void)
+{
+  hashLanes = hashLanesGeneric;
+#if defined(__x86_64__)
+  implementation = "sse2";
+
+  __builtin_cpu_init();
+
+  if(__builtin_cpu_supports("avx2"))
+  {
+    hashLanes = hashLanesAvx2;
+    implementation = "avx2";
+  }
+#else
+  implementation = "generic";
+#endif
+}
+
+/* blake3Implementation
+*PURPOSE: Returns the name of the instruction set whole chunks are hashed with.
+*INPUT: -
+*OUTPUTS: char* name
+*/
+const char *blake3Implementation(void)
+{
+  pthread_once(&selected, selectLanes);
+
+  return implementation;
+}
+
+/* pushChunk
+*PURPOSE: Adds the chaining value of a finished chunk, which is not the last
+*  of the message, to the stack. Every subtree it completes (one per trailing
+*  zero bit of the number of chunks so far) is merged into its parent first.
+*INPUT: Blake3Context* context, uint32_t cv[8], uint64_t chunks so far
+*OUTPUTS: -
+*/
+static void pushChunk(Blake3Context *ctx, uint32_t cv[8], uint64_t chunks)
+{
+  while((chunks & 1) == 0)
+  {
+    ctx->stackLength--;
+    parentCv(ctx->stack[ctx->stackLength], cv);
+    chunks >>= 1;
+  }
+
+  memcpy(ctx->stack[ctx->stackLength], cv, sizeof(ctx->stack[0]));
+  ctx->stackLength++;
+}
+
+/* blake3Init
+*PURPOSE: Sets up a context to hash a new message.
+*INPUT: Blake3Context* context
+*OUTPUTS: -
+*/
+void blake3Init(Blake3Context *ctx)
+{
+  memcpy(ctx->cv, iv, sizeof(iv));
+  ctx->chunk = 0;
+  ctx->start = 0;
+  ctx->bufferLength = 0;
+  ctx->blocks = 0;
+  ctx->stackLength = 0;
+}
+
+/* blake3Update
+*PURPOSE: Adds data to the message. Nothing is compressed until more data is
+*  known to follow it, as the last block of the message is compressed
+*  differently. Whole chunks which start on a chunk boundary are hashed
+*  straight from the data, BLAKE3_LANES at a time.
+*INPUT: Blake3Context* context, void* data, size_t length
+*OUTPUTS: -
+*/
+void blake3Update(Blake3Context *ctx, const void *data, size_t length)
+{
+  const uint8_t *bytes = (const uint8_t*)data;
+
+  pthread_once(&selected, selectLanes);
+
+  while(length > 0)
+  {
+    if(ctx->blocks == BLAKE3_CHUNK_LENGTH / BLAKE3_BLOCK_LENGTH - 1 && ctx->bufferLength == BLAKE3_BLOCK_LENGTH)
+    { //the chunk is full, and more follows, so it is not the root
+      compressCv(ctx->cv, ctx->buffer, BLAKE3_BLOCK_LENGTH, ctx->chunk, CHUNK_END);
+      ctx->chunk++;
+      pushChunk(ctx, ctx->cv, ctx->chunk - ctx->start);
+      memcpy(ctx->cv, iv, sizeof(iv));
+      ctx->blocks = 0;
+      ctx->bufferLength = 0;
+    }
+
+    if(ctx->blocks == 0 && ctx->bufferLength == 0 && length > BLAKE3_CHUNK_LENGTH)
+    { //whole chunks, each with more data after it
+      uint32_t cvs[BLAKE3_LANES][8];
+      size_t chunks = (length - 1) / BLAKE3_CHUNK_LENGTH;
+      int lanes = chunks >= BLAKE3_LANES ? BLAKE3_LANES : 1;
+
+      if(lanes == BLAKE3_LANES)
+      {
+        hashLanes(bytes, ctx->chunk, cvs);
+      }
+      else
+      { //too few left to fill the lanes
+        memcpy(cvs[0], iv, sizeof(iv));
+
+        for(int b = 0; b < BLAKE3_CHUNK_LENGTH / BLAKE3_BLOCK_LENGTH; b++)
+        {
+          compressCv(cvs[0], bytes + b * BLAKE3_BLOCK_LENGTH, BLAKE3_BLOCK_LENGTH, ctx->chunk,
+            (b == 0 ? CHUNK_START : 0) | (b == BLAKE3_CHUNK_LENGTH / BLAKE3_BLOCK_LENGTH - 1 ? CHUNK_END : 0));
+        }
+      }
+
+      for(int l = 0; l < lanes; l++)
+      {
+        ctx->chunk++;
+        pushChunk(ctx, cvs[l], ctx->chunk - ctx->start);
+      }
+
+      bytes += (size_t)lanes * BLAKE3_CHUNK_LENGTH;
+      length -= (size_t)lanes * BLAKE3_CHUNK_LENGTH;
+    }
+    else
+    { //fill the chunk a block at a time
+      size_t take = BLAKE3_BLOCK_LENGTH - ctx->bufferLength;
+
+      if(ctx->bufferLength == BLAKE3_BLOCK_LENGTH)
+      { //the block is full, and more follows, so it is not the chunk's last
+        compressCv(ctx->cv, ctx->buffer, BLAKE3_BLOCK_LENGTH, ctx->chunk, ctx->blocks == 0 ? CHUNK_START : 0);
+        ctx->blocks++;
+        ctx->bufferLength = 0;
+        take = BLAKE3_BLOCK_LENGTH;
+      }
+
+      if(take > length)
+      {
+        take = length;
+      }
+
+      memcpy(ctx->buffer + ctx->bufferLength, bytes, take);
+      ctx->bufferLength += take;
+      bytes += take;
+      length -= take;
+    }
+  }
+}
+
+/* foldStack
+*PURPOSE: Folds a node, the right-most of the tree, into the first depth
+*  subtrees on the stack in turn, leaving the inputs of the top node: their
+*  parent, or the node itself if depth is 0.
+*INPUT: Blake3Context* context, int depth, the node's uint32_t cv[8], uint8_t
+*  block[64], uint8_t block length, uint64_t counter and uint8_t flags
+*OUTPUTS: the top node's cv, block, block length, counter and flags
+*/
+static void foldStack(const Blake3Context *ctx, int depth, uint32_t cv[8], uint8_t *block, uint8_t *length, uint64_t *counter, uint8_t *flags)
+{
+  for(int i = depth - 1; i >= 0; i--)
+  {
+    uint32_t child[8];
+
+    memcpy(child, cv, sizeof(child));
+    compressCv(child, block, *length, *counter, *flags);
+
+    for(int w = 0; w < 8; w++)
+    {
+      store32(block + w * 4, ctx->stack[i][w]);
+      store32(block + 32 + w * 4, child[w]);
+    }
+
+    memcpy(cv, iv, sizeof(iv));
+    *length = BLAKE3_BLOCK_LENGTH;
+    *counter = 0;
+    *flags = PARENT;
+  }
+}
+
+/* chunkNode
+*PURPOSE: Returns the inputs of the node of the chunk being hashed, which
+*  compress its last block.
+*INPUT: Blake3Context* context
+*OUTPUTS: uint32_t cv[8], uint8_t block[64], uint8_t block length, uint64_t
+*  counter, uint8_t flags
+*/
+static void chunkNode(const Blake3Context *ctx, uint32_t cv[8], uint8_t *block, uint8_t *length, uint64_t *counter, uint8_t *flags)
+{
+  memcpy(cv, ctx->cv, sizeof(ctx->cv));
+  memset(block, 0, BLAKE3_BLOCK_LENGTH);
+  memcpy(block, ctx->buffer, ctx->bufferLength);
+  *length = ctx->bufferLength;
+  *counter = ctx->chunk;
+  *flags = CHUNK_END | (ctx->blocks == 0 ? CHUNK_START : 0);
+}
+
+/* rootOutput
+*PURPOSE: Writes out the digest, of any length, from the root node.
+*INPUT: the root's uint32_t cv[8], uint8_t block[64], uint8_t block length and
+*  uint8_t flags, size_t length of digest
+*OUTPUTS: uint8_t digest[length]
+*/
+static void rootOutput(const uint32_t cv[8], const uint8_t *block, uint8_t blockLength, uint8_t flags, uint8_t *digest, size_t length)
+{
+  for(uint64_t out = 0; out * BLAKE3_BLOCK_LENGTH < length; out++)
+  { //compressed once per 64 bytes of output
+    uint32_t state[16];
+    uint8_t bytes[BLAKE3_BLOCK_LENGTH];
+    size_t take = length - out * BLAKE3_BLOCK_LENGTH;
+
+    compress(state, cv, block, blockLength, out, flags | ROOT);
+
+    for(int w = 0; w < 8; w++)
+    {
+      store32(bytes + w * 4, state[w] ^ state[w + 8]);
+      store32(bytes + 32 + w * 4, state[w + 8] ^ cv[w]);
+    }
+
+    if(take > BLAKE3_BLOCK_LENGTH)
+    {
+      take = BLAKE3_BLOCK_LENGTH;
+    }
+
+    memcpy(digest + out * BLAKE3_BLOCK_LENGTH, bytes, take);
+  }
+}
+
+/* blake3Final
+*PURPOSE: Writes out the digest of the message so far, of any length. The
+*  context is left as it was, so more data may still be added.
+*INPUT: Blake3Context* context, size_t length of digest
+*OUTPUTS: uint8_t digest[length]
+*/
+void blake3Final(const Blake3Context *ctx, uint8_t *digest, size_t length)
+{
+  uint32_t cv[8];
+  uint8_t block[BLAKE3_BLOCK_LENGTH];
+  uint8_t blockLength;
+  uint64_t counter;
+  uint8_t flags;
+
+  chunkNode(ctx, cv, block, &blockLength, &counter, &flags);
+  foldStack(ctx, ctx->stackLength, cv, block, &blockLength, &counter, &flags);
+  rootOutput(cv, block, blockLength, flags, digest, length);
+}
+
+/* blake3Subtree
+*PURPOSE: Hashes part of a message into the chaining value of the subtree
+*  holding it, which is not the root. The part must start at a chunk number
+*  divisible by the largest power of two no greater than its number of
+*  chunks, and either be a power of two chunks long, or be the end of the
+*  message, for the subtree to be one of the message's tree.
+*INPUT: void* data, size_t length, uint64_t number of the first chunk
+*OUTPUTS: uint8_t cv[BLAKE3_CV_LENGTH]
+*/
+void blake3Subtree(const void *data, size_t length, uint64_t chunk, uint8_t out[BLAKE3_CV_LENGTH])
+{
+  Blake3Context ctx;
+  uint32_t cv[8];
+  uint8_t block[BLAKE3_BLOCK_LENGTH];
+  uint8_t blockLength;
+  uint64_t counter;
+  uint8_t flags;
+
+  blake3Init(&ctx);
+  ctx.chunk = chunk;
+  ctx.start = chunk;
+  blake3Update(&ctx, data, length);
+
+  chunkNode(&ctx, cv, block, &blockLength, &counter, &flags);
+  foldStack(&ctx, ctx.stackLength, cv, block, &blockLength, &counter, &flags);
+  compressCv(cv, block, blockLength, counter, flags);
+
+  for(int w = 0; w < 8; w++)
+  {
+    store32(out + w * 4, cv[w]);
+  }
+}
+
+/* blake3PushSubtree
+*PURPOSE: Adds a subtree hashed by blake3Subtree to the message, in place of
+*  its data, when it is not the last. The context must be at a chunk number
+*  divisible by the subtree's number of chunks, a power of two.
+*INPUT: Blake3Context* context, uint8_t cv[BLAKE3_CV_LENGTH], uint64_t chunks
+*OUTPUTS: -
+*/
+void blake3PushSubtree(Blake3Context *ctx, const uint8_t cv[BLAKE3_CV_LENGTH], uint64_t chunks)
+{
+  uint32_t words[8];
+
+  for(int w = 0; w < 8; w++)
+  {
+    words[w] = load32(cv + w * 4);
+  }
+
+  ctx->chunk += chunks;
+  pushChunk(ctx, words, (ctx->chunk - ctx->start) / chunks); //every subtree on the stack is at least as large
+}
+
+/* blake3FinalSubtree
+*PURPOSE: Writes out the digest of a message whose last subtree, following
+*  at least one pushed by blake3PushSubtree, has the chaining value last.
+*INPUT: Blake3Context* context, uint8_t last[BLAKE3_CV_LENGTH], size_t length
+*  of digest
+*OUTPUTS: uint8_t digest[length]
+*/
+void blake3FinalSubtree(const Blake3Context *ctx, const uint8_t last[BLAKE3_CV_LENGTH], uint8_t *digest, size_t length)
+{
+  uint32_t cv[8];
+  uint8_t block[BLAKE3_BLOCK_LENGTH];
+  uint8_t blockLength = BLAKE3_BLOCK_LENGTH;
+  uint64_t counter = 0;
+  uint8_t flags = PARENT;
+
+  //the parent of the last subtree and the top of the stack, folded into the rest
+  for(int w = 0; w < 8; w++)
+  {
+    store32(block + w * 4, ctx->stack[ctx->stackLength - 1][w]);
+  }
+
+  memcpy(block + 32, last, BLAKE3_CV_LENGTH);
+  memcpy(cv, iv, sizeof(iv));
+  foldStack(ctx, ctx->stackLength - 1, cv, block, &blockLength, &counter, &flags);
+  rootOutput(cv, block, blockLength, flags, digest, length);
+}
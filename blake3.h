@@ -0,0 +1,46 @@
+/* blake3.h
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Header for blake3.c. In-process BLAKE3, hashing several chunks of a
+*  message at once with SIMD where the CPU supports it.
+*/
+
+#ifndef BLAKE3_H
+#define BLAKE3_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BLAKE3_BLOCK_LENGTH 64
+#define BLAKE3_CHUNK_LENGTH 1024
+#define BLAKE3_MAX_DEPTH 54 //of the tree, enough for 2^64 bytes
+#define BLAKE3_LANES 8 //chunks hashed side by side
+#define BLAKE3_CV_LENGTH 32 //bytes of a subtree's chaining value
+
+typedef struct Blake3Context
+{
+  uint32_t cv[8]; //chaining value of the chunk being hashed
+  uint64_t chunk; //number of the chunk being hashed
+  uint64_t start; //number of the first chunk, 0 unless hashing a subtree
+  uint8_t buffer[BLAKE3_BLOCK_LENGTH]; //partial block
+  uint8_t bufferLength;
+  uint8_t blocks; //of the chunk already compressed
+  uint8_t stackLength;
+  uint32_t stack[BLAKE3_MAX_DEPTH][8]; //chaining values of completed subtrees, left to right
+} Blake3Context;
+
+const char *blake3Implementation(void);
+
+void blake3Init(Blake3Context* ctx);
+
+void blake3Update(Blake3Context* ctx, const void* data, size_t length);
+
+void blake3Final(const Blake3Context* ctx, uint8_t* digest, size_t length);
+
+void blake3Subtree(const void* data, size_t length, uint64_t chunk, uint8_t cv[BLAKE3_CV_LENGTH]);
+
+void blake3PushSubtree(Blake3Context* ctx, const uint8_t cv[BLAKE3_CV_LENGTH], uint64_t chunks);
+
+void blake3FinalSubtree(const Blake3Context* ctx, const uint8_t last[BLAKE3_CV_LENGTH], uint8_t* digest, size_t length);
+
+#endif
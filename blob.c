@@ -0,0 +1,591 @@
+/* blob.c
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Stores object contents. Objects up to the pack threshold are appended
+*  to a shared pack file and read back with a single pread(), instead of each
+*  costing a file (inode, directory entry and block) and an open/close per
+*  request. Larger objects keep a file of their own. Deleting a packed object
+*  only marks its bytes dead; the server's compactor later moves the live
+*  objects out of mostly-dead packs so the pack files can be removed.
+*/
+
+#include "blob.h"
+#include "ioengine.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/* packPath
+*PURPOSE: Writes the file name of the pack.
+*INPUT: int pack
+*OUTPUTS: char path[MAXPATHLENGTH]
+*/
+static void packPath(int pack, char *path)
+{
+  snprintf(path, MAXPATHLENGTH, "pack_%d", pack);
+}
+
+/* writeAll
+*PURPOSE: pwrite()s the whole buffer, continuing after short writes. Returns
+*  'true' if an error occurs.
+*INPUT: int fd, char* data, uint64_t length, uint64_t offset
+*OUTPUTS: int error occured (boolean)
+*/
+static int writeAll(int fd, const char *data, uint64_t length, uint64_t offset)
+{
+  int error = false;
+  TRACE_BEGIN(traceStart);
+
+  while(!error && length > 0)
+  {
+    ssize_t written = pwrite(fd, data, length, offset);
+
+    if(written > 0)
+    {
+      data += written;
+      offset += written;
+      length -= written;
+    }
+    else if(written < 0 && errno == EINTR)
+    {
+      error = false;
+    }
+    else
+    {
+      error = true;
+    }
+  }
+
+  TRACE_END(traceStart, "pwrite", "disk");
+
+  return !error;
+}
+
+/* readAll
+*PURPOSE: pread()s the whole range, continuing after short reads. Returns
+*  'true' if an error occurs.
+*INPUT: int fd, uint64_t length, uint64_t offset
+*OUTPUTS: int error occured (boolean), char* data
+*/
+static int readAll(int fd, char *data, uint64_t length, uint64_t offset)
+{
+  int error = false;
+  TRACE_BEGIN(traceStart);
+
+  while(!error && length > 0)
+  {
+    ssize_t got = pread(fd, data, length, offset);
+
+    if(got > 0)
+    {
+      data += got;
+      offset += got;
+      length -= got;
+    }
+    else if(got < 0 && errno == EINTR)
+    {
+      error = false;
+    }
+    else
+    { //error, or the pack is shorter than expected
+      error = true;
+    }
+  }
+
+  TRACE_END(traceStart, "pread", "disk");
+
+  return !error;
+}
+
+/* reserve
+*PURPOSE: Reserves length bytes at the end of the active pack, starting a new
+*  pack if there is none or it would grow past PACK_MAX_SIZE. Returns 'true'
+*  if an error occurs (eg no free pack slot), in which case the caller should
+*  fall back to a file of its own.
+*INPUT: BlobStore* store, uint64_t length
+*OUTPUTS: int error occured (boolean), BlobRef* reserved location, int* fd
+*/
+static int reserve(BlobStore *store, uint64_t length, BlobRef *ref, int *fd)
+{
+  int error = false;
+
+  pthread_mutex_lock(store->mutex);
+
+  if(store->active == NO_PACK || store->packs[store->active].size + length > PACK_MAX_SIZE)
+  { //start a new pack in the first unused slot
+    int pack = 0;
+    char path[MAXPATHLENGTH];
+
+    while(pack < MAX_PACKS && store->packs[pack].fd != -1)
+    {
+      pack++;
+    }
+
+    if(pack < MAX_PACKS)
+    {
+      packPath(pack, path);
+
+      if((store->packs[pack].fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) != -1)
+      {
+        if(store->durable)
+        { //once per pack, so stores into it only need to sync the pack itself
+          int dir = open(".", O_RDONLY | O_DIRECTORY);
+
+          if(dir != -1)
+          {
+            fsync(dir);
+            close(dir);
+          }
+        }
+
+        store->packs[pack].size = 0;
+        store->packs[pack].dead = 0;
+        store->active = pack;
+      }
+      else
+      {
+        error = true;
+      }
+    }
+    else
+    { //every slot in use
+      error = true;
+    }
+  }
+
+  if(!error)
+  {
+    ref->pack = store->active;
+    ref->offset = store->packs[store->active].size;
+    ref->length = length;
+    *fd = store->packs[store->active].fd;
+    store->packs[store->active].size += length;
+  }
+
+  pthread_mutex_unlock(store->mutex);
+
+  return !error;
+}
+
+/* markDead
+*PURPOSE: Counts the referenced bytes as dead in their pack.
+*INPUT: BlobStore* store, BlobRef* ref
+*OUTPUTS: -
+*/
+static void markDead(BlobStore *store, const BlobRef *ref)
+{
+  pthread_mutex_lock(store->mutex);
+  store->packs[ref->pack].dead += ref->length;
+  pthread_mutex_unlock(store->mutex);
+}
+
+/* blobCreate
+*PURPOSE: Allocates an empty blob store.
+*INPUT: uint64_t pack threshold in bytes (0 disables packing), int durable
+*  (boolean)
+*OUTPUTS: BlobStore* store
+*/
+BlobStore *blobCreate(uint64_t threshold, int durable)
+{
+  BlobStore *store = calloc(1, sizeof(BlobStore));
+  store->mutex = malloc(sizeof(pthread_mutex_t));
+  pthread_mutex_init(store->mutex, NULL);
+  store->threshold = threshold;
+  store->durable = durable;
+  store->active = NO_PACK;
+
+  for(int i = 0; i < MAX_PACKS; i++)
+  {
+    store->packs[i].fd = -1;
+  }
+
+  return store;
+}
+
+/* blobDestroy
+*PURPOSE: Closes every pack and frees the store. Files are left on disk.
+*INPUT: BlobStore* store
+*OUTPUTS: -
+*/
+void blobDestroy(BlobStore *store)
+{
+  for(int i = 0; i < MAX_PACKS; i++)
+  {
+    if(store->packs[i].fd != -1)
+    {
+      close(store->packs[i].fd);
+    }
+  }
+
+  pthread_mutex_destroy(store->mutex);
+  free(store->mutex);
+  free(store);
+}
+
+/* blobPath
+*PURPOSE: Writes the path of the file an unpacked object is stored in.
+*INPUT: unsigned int id
+*OUTPUTS: char path[MAXPATHLENGTH]
+*/
+void blobPath(unsigned int id, char *path)
+{
+  snprintf(path, MAXPATHLENGTH, "file_%u", id);
+}
+
+/* treePath
+*PURPOSE: Writes the path of the sidecar file holding the tree of an object
+*  with its own file.
+*INPUT: unsigned int id
+*OUTPUTS: char path[MAXPATHLENGTH]
+*/
+static void treePath(unsigned int id, char *path)
+{
+  snprintf(path, MAXPATHLENGTH, "file_%u.tree", id);
+}
+
+/* blobWriteTree
+*PURPOSE: Writes the chaining values of an object's segments (see
+*  treehash.c) to a sidecar file beside its own file, to check its contents
+*  against later. Not synced, as a tree lost in a crash only means the object
+*  can no longer be checked. Returns 'true' if an error occurs.
+*INPUT: unsigned int id, char* tree, uint64_t length
+*OUTPUTS: int error occured (boolean)
+*/
+int blobWriteTree(unsigned int id, const char *tree, uint64_t length)
+{
+  char path[MAXPATHLENGTH];
+
+  treePath(id, path);
+
+  return ioWriteFile(path, tree, length);
+}
+
+/* blobReadTree
+*PURPOSE: Reads the tree of an object with its own file, which is expected
+*  to be length bytes long. Returns 'true' if an error occurs, including if
+*  the object has no tree.
+*INPUT: unsigned int id, uint64_t length
+*OUTPUTS: int error occured (boolean), char** tree
+*/
+int blobReadTree(unsigned int id, char **tree, uint64_t length)
+{
+  char path[MAXPATHLENGTH];
+
+  treePath(id, path);
+
+  return ioReadFile(path, tree, length);
+}
+
+/* blobWrite
+*PURPOSE: Stores the object's contents, packed if it is no larger than the
+*  threshold, and writes where it was stored into ref. Returns 'true' if an
+*  error occurs.
+*INPUT: BlobStore* store, unsigned int id, char* data, uint64_t length
+*OUTPUTS: int error occured (boolean), BlobRef* ref
+*/
+int blobWrite(BlobStore *store, unsigned int id, const char *data, uint64_t length, BlobRef *ref)
+{
+  int error = false;
+  int fd;
+
+  if(length <= store->threshold && reserve(store, length, ref, &fd))
+  {
+    if(!writeAll(fd, data, length, ref->offset))
+    {
+      markDead(store, ref);
+      error = true;
+    }
+  }
+  else
+  { //too large to pack, or no pack available
+    char path[MAXPATHLENGTH];
+
+    blobPath(id, path);
+    ref->pack = NO_PACK;
+    ref->offset = 0;
+    ref->length = length;
+    error = !ioWriteFile(path, data, length);
+  }
+
+  return !error;
+}
+
+/* blobRead
+*PURPOSE: Allocates a buffer for the object's contents and reads them into it.
+*  Returns 'true' if an error occurs, in which case no buffer is left allocated.
+*INPUT: BlobStore* store, unsigned int id, BlobRef* ref
+*OUTPUTS: int error occured (boolean), char** data
+*/
+int blobRead(BlobStore *store, unsigned int id, const BlobRef *ref, char **data)
+{
+  int error = false;
+
+  *data = NULL;
+
+  if(ref->pack != NO_PACK)
+  {
+    pthread_mutex_lock(store->mutex);
+    int fd = store->packs[ref->pack].fd;
+    pthread_mutex_unlock(store->mutex);
+
+    if((*data = malloc(ref->length + 1)) == NULL || !readAll(fd, *data, ref->length, ref->offset))
+    {
+      error = true;
+    }
+  }
+  else
+  {
+    char path[MAXPATHLENGTH];
+
+    blobPath(id, path);
+    error = !ioReadFile(path, data, ref->length);
+  }
+
+  if(error)
+  {
+    free(*data);
+    *data = NULL;
+  }
+
+  return !error;
+}
+
+/* blobReadPart
+*PURPOSE: Reads length bytes of the object's contents, starting offset bytes
+*  in, into a buffer the caller provides, so large objects can be handled a
+*  piece at a time. Returns 'true' if an error occurs.
+*INPUT: BlobStore* store, unsigned int id, BlobRef* ref, uint64_t offset,
+*  uint64_t length
+*OUTPUTS: int error occured (boolean), char* data
+*/
+int blobReadPart(BlobStore *store, unsigned int id, const BlobRef *ref, uint64_t offset, uint64_t length, char *data)
+{
+  int error = offset + length > ref->length;
+
+  if(!error && ref->pack != NO_PACK)
+  {
+    pthread_mutex_lock(store->mutex);
+    int fd = store->packs[ref->pack].fd;
+    pthread_mutex_unlock(store->mutex);
+
+    error = !readAll(fd, data, length, ref->offset + offset);
+  }
+  else if(!error)
+  {
+    char path[MAXPATHLENGTH];
+
+    blobPath(id, path);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    error = fd < 0 || !readAll(fd, data, length, offset);
+
+    if(fd >= 0)
+    {
+      close(fd);
+    }
+  }
+
+  return !error;
+}
+
+/* blobRemove
+*PURPOSE: Deletes the object's contents. Packed objects are only marked dead,
+*  their space is reclaimed when the pack is compacted. Returns 'true' if an
+*  error occurs.
+*INPUT: BlobStore* store, unsigned int id, BlobRef* ref
+*OUTPUTS: int error occured (boolean)
+*/
+int blobRemove(BlobStore *store, unsigned int id, const BlobRef *ref)
+{
+  int error = false;
+
+  if(ref->pack != NO_PACK)
+  {
+    markDead(store, ref);
+  }
+  else
+  {
+    char path[MAXPATHLENGTH];
+
+    blobPath(id, path);
+    error = !ioRemove(path);
+    treePath(id, path);
+    ioRemove(path); //most objects have no tree
+  }
+
+  return !error;
+}
+
+/* blobSyncFd
+*PURPOSE: Returns a new descriptor for the file holding the object, for it to
+*  be synced to disk by, or -1 if an error occurs. The caller closes it. The
+*  pack's own descriptor is not returned, as the pack could be retired (and the
+*  descriptor number reused) before the sync happens.
+*INPUT: BlobStore* store, unsigned int id, BlobRef* ref
+*OUTPUTS: int fd
+*/
+int blobSyncFd(BlobStore *store, unsigned int id, const BlobRef *ref)
+{
+  int fd;
+
+  if(ref->pack != NO_PACK)
+  {
+    pthread_mutex_lock(store->mutex);
+    fd = dup(store->packs[ref->pack].fd);
+    pthread_mutex_unlock(store->mutex);
+  }
+  else
+  {
+    char path[MAXPATHLENGTH];
+
+    blobPath(id, path);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+  }
+
+  return fd;
+}
+
+/* blobMove
+*PURPOSE: Copies a packed object to the end of the active pack, and marks the
+*  old copy dead. Used by compaction. Returns 'true' if an error occurs.
+*INPUT: BlobStore* store, BlobRef* from
+*OUTPUTS: int error occured (boolean), BlobRef* to
+*/
+int blobMove(BlobStore *store, const BlobRef *from, BlobRef *to)
+{
+  int error = false;
+  char *data = NULL;
+  int fd;
+
+  if(blobRead(store, 0, from, &data) && reserve(store, from->length, to, &fd))
+  {
+    if(writeAll(fd, data, from->length, to->offset))
+    {
+      markDead(store, from);
+    }
+    else
+    {
+      markDead(store, to);
+      error = true;
+    }
+  }
+  else
+  {
+    error = true;
+  }
+
+  free(data);
+
+  return !error;
+}
+
+/* blobCompactable
+*PURPOSE: Returns a full (no longer active) pack which is mostly dead and
+*  worth compacting, or NO_PACK if there is none.
+*INPUT: BlobStore* store
+*OUTPUTS: int pack
+*/
+int blobCompactable(BlobStore *store)
+{
+  int found = NO_PACK;
+
+  pthread_mutex_lock(store->mutex);
+
+  for(int i = 0; found == NO_PACK && i < MAX_PACKS; i++)
+  {
+    Pack *pack = &(store->packs[i]);
+
+    if(i != store->active && pack->fd != -1 && pack->dead * 100 >= pack->size * PACK_COMPACT_PERCENT)
+    {
+      found = i;
+    }
+  }
+
+  pthread_mutex_unlock(store->mutex);
+
+  return found;
+}
+
+/* blobAdopt
+*PURPOSE: Reopens the pack holding a packed object found when replaying the
+*  journal, and counts the object's bytes as live. Once every object has been
+*  adopted, blobAdopted() works out how much of each pack is dead. Returns
+*  'true' if an error occurs.
+*INPUT: BlobStore* store, BlobRef* ref
+*OUTPUTS: int error occured (boolean)
+*/
+int blobAdopt(BlobStore *store, const BlobRef *ref)
+{
+  int error = false;
+
+  if(ref->pack != NO_PACK)
+  {
+    pthread_mutex_lock(store->mutex);
+
+    if(store->packs[ref->pack].fd == -1)
+    {
+      char path[MAXPATHLENGTH];
+
+      packPath(ref->pack, path);
+      store->packs[ref->pack].fd = open(path, O_RDWR | O_CLOEXEC);
+    }
+
+    error = store->packs[ref->pack].fd == -1;
+    store->packs[ref->pack].dead += ref->length; //live bytes, until blobAdopted()
+
+    pthread_mutex_unlock(store->mutex);
+  }
+
+  return !error;
+}
+
+/* blobAdopted
+*PURPOSE: Sets the size and dead bytes of every pack reopened by blobAdopt().
+*  New objects go into a new pack.
+*INPUT: BlobStore* store
+*OUTPUTS: -
+*/
+void blobAdopted(BlobStore *store)
+{
+  struct stat info;
+
+  pthread_mutex_lock(store->mutex);
+
+  for(int i = 0; i < MAX_PACKS; i++)
+  {
+    Pack *pack = &(store->packs[i]);
+
+    if(pack->fd != -1 && fstat(pack->fd, &info) == 0)
+    {
+      pack->size = info.st_size;
+      pack->dead = pack->size > pack->dead ? pack->size - pack->dead : 0;
+    }
+  }
+
+  store->active = NO_PACK;
+
+  pthread_mutex_unlock(store->mutex);
+}
+
+/* blobRetirePack
+*PURPOSE: Closes and deletes a pack that no longer holds any live object, so
+*  its slot can be reused.
+*INPUT: BlobStore* store, int pack
+*OUTPUTS: -
+*/
+void blobRetirePack(BlobStore *store, int pack)
+{
+  char path[MAXPATHLENGTH];
+
+  pthread_mutex_lock(store->mutex);
+
+  close(store->packs[pack].fd);
+  store->packs[pack].fd = -1;
+  store->packs[pack].size = 0;
+  store->packs[pack].dead = 0;
+
+  pthread_mutex_unlock(store->mutex);
+
+  packPath(pack, path);
+  remove(path);
+}
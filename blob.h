@@ -0,0 +1,74 @@
+/* blob.h
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Header for blob.c. Stores object contents either packed together
+*  into large pack files (small objects) or in a file of their own.
+*/
+
+#ifndef BLOB_H
+#define BLOB_H
+
+#include "common.h"
+#include <pthread.h>
+
+#define DEFAULT_PACK_THRESHOLD 8192 //bytes; larger objects get their own file, 0 disables packing
+#define PACK_MAX_SIZE (64 * 1024 * 1024) //a new pack is started once the active one would exceed this
+#define PACK_COMPACT_PERCENT 50 //percentage of a full pack which must be dead before it is compacted
+#define PACK_COMPACT_INTERVAL 5 //seconds between compactor passes
+#define MAX_PACKS 1024
+#define NO_PACK -1
+
+typedef struct BlobRef
+{ //where an object's contents are stored
+  int pack; //NO_PACK if the object has its own file
+  uint64_t offset; //within the pack
+  uint64_t length;
+} BlobRef;
+
+typedef struct Pack
+{
+  int fd; //-1 if the slot is unused
+  uint64_t size; //bytes appended so far
+  uint64_t dead; //bytes of deleted or moved objects
+} Pack;
+
+typedef struct BlobStore
+{
+  pthread_mutex_t* mutex; //protects the pack table, not the pack contents
+  uint64_t threshold;
+  int durable; //new packs are synced into the directory as they are created
+  int active; //pack being appended to, or NO_PACK
+  Pack packs[MAX_PACKS];
+} BlobStore;
+
+BlobStore *blobCreate(uint64_t threshold, int durable);
+
+void blobDestroy(BlobStore* store);
+
+void blobPath(unsigned int id, char* path);
+
+int blobWrite(BlobStore* store, unsigned int id, const char* data, uint64_t length, BlobRef* ref);
+
+int blobRead(BlobStore* store, unsigned int id, const BlobRef* ref, char** data);
+
+int blobReadPart(BlobStore* store, unsigned int id, const BlobRef* ref, uint64_t offset, uint64_t length, char* data);
+
+int blobRemove(BlobStore* store, unsigned int id, const BlobRef* ref);
+
+int blobWriteTree(unsigned int id, const char* tree, uint64_t length);
+
+int blobReadTree(unsigned int id, char** tree, uint64_t length);
+
+int blobSyncFd(BlobStore* store, unsigned int id, const BlobRef* ref);
+
+int blobMove(BlobStore* store, const BlobRef* from, BlobRef* to);
+
+int blobCompactable(BlobStore* store);
+
+int blobAdopt(BlobStore* store, const BlobRef* ref);
+
+void blobAdopted(BlobStore* store);
+
+void blobRetirePack(BlobStore* store, int pack);
+
+#endif
@@ -0,0 +1,128 @@
+/* budget.c
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Counts the bytes held by requests in flight against a server-wide
+*  limit. A request reserves its size before its buffer is allocated, waiting
+*  (up to a time limit) for other requests to release theirs if the budget is
+*  full, so memory use stays bounded however many large requests arrive at once.
+*/
+
+#include "budget.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include <errno.h>
+
+/* budgetCreate
+*PURPOSE: Allocates a budget.
+*INPUT: uint64_t limit in bytes, 0 for unlimited
+*OUTPUTS: MemoryBudget* budget
+*/
+MemoryBudget *budgetCreate(uint64_t limit)
+{
+  MemoryBudget *budget = calloc(1, sizeof(MemoryBudget));
+
+  budget->mutex = malloc(sizeof(pthread_mutex_t));
+  budget->freed = malloc(sizeof(pthread_cond_t));
+  pthread_mutex_init(budget->mutex, NULL);
+  pthread_cond_init(budget->freed, NULL);
+  budget->limit = limit;
+
+  return budget;
+}
+
+/* budgetDestroy
+*PURPOSE: Frees the budget.
+*INPUT: MemoryBudget* budget
+*OUTPUTS: -
+*/
+void budgetDestroy(MemoryBudget *budget)
+{
+  pthread_cond_destroy(budget->freed);
+  pthread_mutex_destroy(budget->mutex);
+  free(budget->freed);
+  free(budget->mutex);
+  free(budget);
+}
+
+/* budgetAcquire
+*PURPOSE: Reserves bytes from the budget, waiting up to wait milliseconds for
+*  enough to be released. Returns 'true' if the bytes were reserved, in which
+*  case they must later be given back with budgetRelease(). Requests larger
+*  than the whole budget are refused immediately.
+*INPUT: MemoryBudget* budget, uint64_t bytes, unsigned int wait in milliseconds
+*OUTPUTS: int reserved (boolean)
+*/
+int budgetAcquire(MemoryBudget *budget, uint64_t bytes, unsigned int wait)
+{
+  int reserved = false;
+  int timedOut = false;
+  struct timespec deadline;
+
+  pthread_mutex_lock(budget->mutex);
+
+  if(budget->limit == 0)
+  {
+    reserved = true;
+  }
+  else if(bytes <= budget->limit)
+  {
+    if(budget->used + bytes > budget->limit && wait > 0)
+    { //queue until other requests finish
+      budget->queued++;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec += wait / 1000;
+      deadline.tv_nsec += (long)(wait % 1000) * 1000000;
+
+      if(deadline.tv_nsec >= 1000000000)
+      {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+      }
+
+      while(!timedOut && budget->used + bytes > budget->limit)
+      {
+        timedOut = pthread_cond_timedwait(budget->freed, budget->mutex, &deadline) == ETIMEDOUT;
+      }
+    }
+
+    reserved = budget->used + bytes <= budget->limit;
+  }
+
+  if(reserved)
+  {
+    budget->used += bytes;
+
+    if(budget->used > budget->peak)
+    {
+      budget->peak = budget->used;
+    }
+  }
+  else
+  {
+    budget->rejected++;
+  }
+
+  pthread_mutex_unlock(budget->mutex);
+
+  return reserved;
+}
+
+/* budgetRelease
+*PURPOSE: Gives back bytes reserved with budgetAcquire(), waking any requests
+*  waiting for them.
+*INPUT: MemoryBudget* budget, uint64_t bytes
+*OUTPUTS: -
+*/
+void budgetRelease(MemoryBudget *budget, uint64_t bytes)
+{
+  if(bytes > 0)
+  {
+    pthread_mutex_lock(budget->mutex);
+
+    budget->used -= bytes;
+    pthread_cond_broadcast(budget->freed);
+
+    pthread_mutex_unlock(budget->mutex);
+  }
+}
@@ -0,0 +1,38 @@
+/* budget.h
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Header for budget.c. Server-wide limit on the bytes held by requests
+*  in flight.
+*/
+
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define DEFAULT_MEMORY_BUDGET 2048 //MiB, 0 is unlimited
+#define DEFAULT_MAX_REQUEST 1024 //MiB, largest STORE accepted
+#define DEFAULT_ADMIT_WAIT 5000 //milliseconds a request may queue for the budget
+#define SMALL_REQUEST_MAX 4096 //bytes, largest body accepted for any command other than STORE
+
+typedef struct MemoryBudget
+{
+  pthread_mutex_t* mutex;
+  pthread_cond_t* freed; //broadcast whenever bytes are released
+  uint64_t limit; //bytes, 0 is unlimited
+  uint64_t used;
+  uint64_t peak; //statistics, protected by mutex
+  uint64_t queued; //requests which had to wait
+  uint64_t rejected; //requests which gave up waiting, or could never fit
+} MemoryBudget;
+
+MemoryBudget *budgetCreate(uint64_t limit);
+
+void budgetDestroy(MemoryBudget* budget);
+
+int budgetAcquire(MemoryBudget* budget, uint64_t bytes, unsigned int wait);
+
+void budgetRelease(MemoryBudget* budget, uint64_t bytes);
+
+#endif
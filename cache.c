@@ -0,0 +1,361 @@
+/* cache.c
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Size-bounded cache of file contents for GET, evicting least recently
+*  used entries. A new object is only admitted over a victim if it has been
+*  requested more often recently (TinyLFU), so a one-off scan of cold keys
+*  cannot flush the hot set. Entries are refcounted and immutable, so
+*  concurrent GETs send the same buffer without copying it.
+*/
+
+#include "cache.h"
+#include <stdlib.h>
+#include <stdbool.h>
+
+/* mix
+*PURPOSE: Hashes a file id, with a different seed for each sketch row.
+*INPUT: unsigned int id, unsigned int seed
+*OUTPUTS: uint32_t hash
+*/
+static uint32_t mix(unsigned int id, unsigned int seed)
+{
+  uint32_t h = id ^ (seed * 0x9E3779B9u);
+
+  h ^= h >> 16;
+  h *= 0x85EBCA6Bu;
+  h ^= h >> 13;
+  h *= 0xC2B2AE35u;
+  h ^= h >> 16;
+
+  return h;
+}
+
+/* recordAccess
+*PURPOSE: Counts an access to the id in the frequency sketch, halving every
+*  counter once per period so that popularity decays.
+*INPUT: ObjectCache* cache, unsigned int id
+*OUTPUTS: -
+*/
+static void recordAccess(ObjectCache *cache, unsigned int id)
+{ //mutex for this function handled by calling function
+  for(int row = 0; row < CACHE_SKETCH_DEPTH; row++)
+  {
+    uint8_t *counter = &(cache->sketch[row][mix(id, row) & (CACHE_SKETCH_WIDTH - 1)]);
+
+    if(*counter < CACHE_SKETCH_MAX)
+    {
+      (*counter)++;
+    }
+  }
+
+  if(++(cache->samples) >= CACHE_SKETCH_PERIOD)
+  {
+    for(int row = 0; row < CACHE_SKETCH_DEPTH; row++)
+    {
+      for(int i = 0; i < CACHE_SKETCH_WIDTH; i++)
+      {
+        cache->sketch[row][i] >>= 1;
+      }
+    }
+
+    cache->samples = 0;
+  }
+}
+
+/* frequency
+*PURPOSE: Returns the estimated recent access count of the id.
+*INPUT: ObjectCache* cache, unsigned int id
+*OUTPUTS: int frequency
+*/
+static int frequency(ObjectCache *cache, unsigned int id)
+{ //mutex for this function handled by calling function
+  int min = CACHE_SKETCH_MAX;
+
+  for(int row = 0; row < CACHE_SKETCH_DEPTH; row++)
+  {
+    int count = cache->sketch[row][mix(id, row) & (CACHE_SKETCH_WIDTH - 1)];
+
+    if(count < min)
+    {
+      min = count;
+    }
+  }
+
+  return min;
+}
+
+/* unlinkEntry
+*PURPOSE: Removes the entry from the hash table and LRU list and drops the
+*  cache's reference to it. It is freed once no request is still sending it.
+*INPUT: ObjectCache* cache, CacheEntry* entry
+*OUTPUTS: -
+*/
+static void unlinkEntry(ObjectCache *cache, CacheEntry *entry)
+{ //mutex for this function handled by calling function
+  CacheEntry **link = &(cache->buckets[mix(entry->id, 0) & (CACHE_BUCKETS - 1)]);
+
+  while(*link != entry)
+  {
+    link = &((*link)->next);
+  }
+
+  *link = entry->next;
+
+  if(entry->newer != NULL)
+  {
+    entry->newer->older = entry->older;
+  }
+  else
+  {
+    cache->newest = entry->older;
+  }
+
+  if(entry->older != NULL)
+  {
+    entry->older->newer = entry->newer;
+  }
+  else
+  {
+    cache->oldest = entry->newer;
+  }
+
+  entry->cached = false;
+  cache->used -= entry->length;
+
+  cacheRelease(entry);
+}
+
+/* cacheCreate
+*PURPOSE: Allocates an empty cache holding at most budget bytes of contents.
+*  Returns NULL if the budget is 0, which disables caching.
+*INPUT: uint64_t budget in bytes
+*OUTPUTS: ObjectCache* cache
+*/
+ObjectCache *cacheCreate(uint64_t budget)
+{
+  ObjectCache *cache = NULL;
+
+  if(budget > 0)
+  {
+    cache = calloc(1, sizeof(ObjectCache));
+    cache->budget = budget;
+    cache->mutex = malloc(sizeof(pthread_mutex_t));
+    pthread_mutex_init(cache->mutex, NULL);
+  }
+
+  return cache;
+}
+
+/* cacheDestroy
+*PURPOSE: Drops every entry and frees the cache.
+*INPUT: ObjectCache* cache (may be NULL)
+*OUTPUTS: -
+*/
+void cacheDestroy(ObjectCache *cache)
+{
+  if(cache != NULL)
+  {
+    pthread_mutex_lock(cache->mutex);
+
+    while(cache->oldest != NULL)
+    {
+      unlinkEntry(cache, cache->oldest);
+    }
+
+    pthread_mutex_unlock(cache->mutex);
+    pthread_mutex_destroy(cache->mutex);
+    free(cache->mutex);
+    free(cache);
+  }
+}
+
+/* cacheGet
+*PURPOSE: Records an access to the id and returns its entry with a reference
+*  held for the caller, or NULL if it is not cached. The caller must
+*  cacheRelease() the entry once finished with it.
+*INPUT: ObjectCache* cache (may be NULL), unsigned int id
+*OUTPUTS: CacheEntry* entry
+*/
+CacheEntry *cacheGet(ObjectCache *cache, unsigned int id)
+{
+  CacheEntry *entry = NULL;
+
+  if(cache != NULL)
+  {
+    pthread_mutex_lock(cache->mutex);
+
+    recordAccess(cache, id);
+
+    entry = cache->buckets[mix(id, 0) & (CACHE_BUCKETS - 1)];
+
+    while(entry != NULL && entry->id != id)
+    {
+      entry = entry->next;
+    }
+
+    if(entry != NULL)
+    {
+      __atomic_fetch_add(&(entry->refs), 1, __ATOMIC_RELAXED);
+
+      if(entry != cache->newest)
+      { //move to the front of the LRU list
+        entry->newer->older = entry->older;
+
+        if(entry->older != NULL)
+        {
+          entry->older->newer = entry->newer;
+        }
+        else
+        {
+          cache->oldest = entry->newer;
+        }
+
+        entry->older = cache->newest;
+        entry->newer = NULL;
+        cache->newest->newer = entry;
+        cache->newest = entry;
+      }
+
+      cache->hits++;
+    }
+    else
+    {
+      cache->misses++;
+    }
+
+    pthread_mutex_unlock(cache->mutex);
+  }
+
+  return entry;
+}
+
+/* cacheInsert
+*PURPOSE: Wraps freshly read file contents in an entry, taking ownership of the
+*  data, and offers it to the cache. It is admitted if it fits, or if it is
+*  more popular than the least recently used entries it would evict. Either
+*  way the entry is returned with a reference held for the caller, so it can be
+*  sent without copying, and must be cacheRelease()d afterwards.
+*INPUT: ObjectCache* cache (may be NULL), unsigned int id, char* data,
+*  uint64_t length
+*OUTPUTS: CacheEntry* entry
+*/
+CacheEntry *cacheInsert(ObjectCache *cache, unsigned int id, char *data, uint64_t length)
+{
+  CacheEntry *entry = calloc(1, sizeof(CacheEntry));
+  entry->id = id;
+  entry->data = data;
+  entry->length = length;
+  entry->refs = 1; //caller's reference
+
+  if(cache != NULL && length <= cache->budget / CACHE_MAX_FRACTION)
+  {
+    pthread_mutex_lock(cache->mutex);
+
+    CacheEntry *existing = cache->buckets[mix(id, 0) & (CACHE_BUCKETS - 1)];
+
+    while(existing != NULL && existing->id != id)
+    {
+      existing = existing->next;
+    }
+
+    if(existing == NULL)
+    { //not inserted by a concurrent miss
+      int candidate = frequency(cache, id);
+      int admit = true;
+      uint64_t freed = 0;
+      CacheEntry *victim = cache->oldest;
+
+      while(admit && cache->used - freed + length > cache->budget)
+      { //check every victim would lose to the candidate before evicting any
+        if(victim != NULL && frequency(cache, victim->id) < candidate)
+        {
+          freed += victim->length;
+          victim = victim->newer;
+        }
+        else
+        {
+          admit = false;
+        }
+      }
+
+      if(admit)
+      {
+        while(cache->used + length > cache->budget)
+        {
+          unlinkEntry(cache, cache->oldest);
+        }
+
+        CacheEntry **bucket = &(cache->buckets[mix(id, 0) & (CACHE_BUCKETS - 1)]);
+        entry->next = *bucket;
+        *bucket = entry;
+
+        entry->older = cache->newest;
+
+        if(cache->newest != NULL)
+        {
+          cache->newest->newer = entry;
+        }
+        else
+        {
+          cache->oldest = entry;
+        }
+
+        cache->newest = entry;
+        cache->used += length;
+        entry->cached = true;
+        entry->refs++; //cache's reference
+      }
+      else
+      {
+        cache->rejects++;
+      }
+    }
+
+    pthread_mutex_unlock(cache->mutex);
+  }
+
+  return entry;
+}
+
+/* cacheRemove
+*PURPOSE: Drops the id's entry from the cache, if present. Requests still
+*  sending it keep their reference.
+*INPUT: ObjectCache* cache (may be NULL), unsigned int id
+*OUTPUTS: -
+*/
+void cacheRemove(ObjectCache *cache, unsigned int id)
+{
+  if(cache != NULL)
+  {
+    pthread_mutex_lock(cache->mutex);
+
+    CacheEntry *entry = cache->buckets[mix(id, 0) & (CACHE_BUCKETS - 1)];
+
+    while(entry != NULL && entry->id != id)
+    {
+      entry = entry->next;
+    }
+
+    if(entry != NULL)
+    {
+      unlinkEntry(cache, entry);
+    }
+
+    pthread_mutex_unlock(cache->mutex);
+  }
+}
+
+/* cacheRelease
+*PURPOSE: Drops a reference to the entry, freeing it once it is neither cached
+*  nor being sent.
+*INPUT: CacheEntry* entry
+*OUTPUTS: -
+*/
+void cacheRelease(CacheEntry *entry)
+{
+  if(__atomic_sub_fetch(&(entry->refs), 1, __ATOMIC_ACQ_REL) == 0)
+  {
+    free(entry->data);
+    free(entry);
+  }
+}
@@ -0,0 +1,60 @@
+/* cache.h
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Header for cache.c. Size-bounded in-memory cache of file contents.
+*/
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define DEFAULT_CACHE_SIZE 64 //MiB, 0 disables the cache
+#define CACHE_BUCKETS 4096 //must be a power of two
+#define CACHE_SKETCH_DEPTH 4 //rows of the frequency sketch
+#define CACHE_SKETCH_WIDTH 8192 //counters per row, must be a power of two
+#define CACHE_SKETCH_MAX 15 //counters saturate here
+#define CACHE_SKETCH_PERIOD (CACHE_SKETCH_WIDTH * 8) //accesses between halving all counters, so old popularity fades
+#define CACHE_MAX_FRACTION 8 //objects larger than budget/CACHE_MAX_FRACTION are never cached
+
+typedef struct CacheEntry
+{ //immutable once created; shared by every request serving it
+  struct CacheEntry* next; //hash bucket chain
+  struct CacheEntry* newer; //LRU order
+  struct CacheEntry* older;
+  unsigned int id; //file id
+  int refs; //one per request using it, plus one while it is held by the cache
+  int cached; //currently indexed by the cache
+  uint64_t length;
+  char* data;
+} CacheEntry;
+
+typedef struct ObjectCache
+{
+  pthread_mutex_t* mutex;
+  uint64_t budget; //bytes
+  uint64_t used;
+  CacheEntry* buckets[CACHE_BUCKETS];
+  CacheEntry* newest;
+  CacheEntry* oldest;
+  uint8_t sketch[CACHE_SKETCH_DEPTH][CACHE_SKETCH_WIDTH];
+  unsigned int samples; //accesses since the sketch was last halved
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t rejects; //objects not admitted
+} ObjectCache;
+
+ObjectCache *cacheCreate(uint64_t budget);
+
+void cacheDestroy(ObjectCache* cache);
+
+CacheEntry *cacheGet(ObjectCache* cache, unsigned int id);
+
+CacheEntry *cacheInsert(ObjectCache* cache, unsigned int id, char* data, uint64_t length);
+
+void cacheRemove(ObjectCache* cache, unsigned int id);
+
+void cacheRelease(CacheEntry* entry);
+
+#endif
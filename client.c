@@ -1,125 +1,335 @@
 /* client.c
 *AUTHOR: Jhi Morris (19173632)
-*MODIFIED: 2020-09-12
-*PURPOSE: Handles client user interface and communication
+*MODIFIED: 2026-10-19
+*PURPOSE: Handles client user interface and communication. Given several
+*  servers, each file is stored on the one its key maps to (see shard.c), with
+*  one connection kept open to each server.
 */
 
+#define _GNU_SOURCE //memmem()
 #include "client.h"
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
 
 /* main
 *PURPOSE: Reads in and validates the connection parameters from the command
-*  line arguments and establishes a connection to the server.
-*INPUT: argv[1] server address (ip or hostname), argv[2] port
-*OUTPUTS: -
+*  line arguments and establishes a connection to each server.
+*INPUT: argv[1] server address (ip or hostname), argv[2] port, then optionally
+*  further address and port pairs, then optionally '--option value' pairs,
+*  which may follow a '--'
+*OUTPUTS: int exit status
 */
 int main(int argc, char *argv[])
 { //parses args and starts client cli
   int error = false;
-  int sock;
-  struct sockaddr_in6 ip;
-  long portTest;
+  ShardSet shards;
+  ConnectConfig config = {DEFAULT_CONNECT_TIMEOUT, DEFAULT_ATTEMPT_DELAY};
+  int servers = 1; //index past the last 'ip port' pair
+  int options; //index of the first option
+  char *endptr;
 
-  if(argc != 3)
+  memset(&shards, 0, sizeof(shards));
+
+  while(servers < argc && strncmp(argv[servers], "--", 2))
+  {
+    servers++;
+  }
+
+  if(servers < 3 || servers % 2 == 0 || (servers - 1) / 2 > MAX_SHARDS)
   {
     printf("Invalid number of arguments.\n");
     error = true;
   }
+
+  options = servers < argc && !strcmp(argv[servers], "--") ? servers + 1 : servers;
+
+  for(int argi = options; !error && argi < argc; argi += 2)
+  { //options all take exactly one value
+    long value = argi + 1 < argc ? strtol(argv[argi + 1], &endptr, 10) : -1;
+
+    if(argi + 1 >= argc)
+    {
+      printf("Option %s requires a value.\n", argv[argi]);
+      error = true;
+    }
+    else if(!strcmp(argv[argi], "--connect-timeout") && value > 0 && argv[argi + 1] != endptr)
+    {
+      config.timeout = value;
+    }
+    else if(!strcmp(argv[argi], "--attempt-delay") && value > 0 && argv[argi + 1] != endptr)
+    {
+      config.attemptDelay = value;
+    }
+    else
+    {
+      printf("Unknown option %s, or its value is not a positive integer (milliseconds).\n", argv[argi]);
+      error = true;
+    }
+  }
+
+  for(int argi = 1; !error && argi < servers; argi += 2)
+  { //every server is connected to up front, so a missing one is noticed before any request
+    Shard *shard = &(shards.shards[shards.count++]);
+
+    shard->host = argv[argi];
+    shard->port = argv[argi + 1];
+    shard->hash = HASH_MD5;
+    error = !connectServer(shard, &config);
+  }
+
+  if(!error)
+  {
+    signal(SIGPIPE, SIG_IGN); //failed socket operations are handled as they occur
+    error = client(&shards);
+  }
   else
   {
-    portTest = strtol(argv[2], NULL, 10); //used to check for negative or out of range values
-    ip.sin6_port = htons(strtol(argv[2], NULL, 10));
+    printf("Expected usage: './client ip port [ip port ...] [--connect-timeout milliseconds] [--attempt-delay milliseconds]', where ip is the hostname or "\
+    "IP address of the server, (IP addresses must be in dot-decimal notation "\
+    "[IPv4] or colon-hexidecimal notation [IPv6]), and port is the network "\
+    "port that the server is running at. Given several servers, files are "\
+    "spread between them by key; new servers must be added to the end of the list. "\
+    "Every address a hostname resolves to is tried, a new attempt starting each attempt delay (default 250) "\
+    "until one connects, or the connect timeout (default 10000) passes.\nExample: './client 192.168.1.234 "\
+    "1234' to connect to a server running at 192.168.1.234 on port 1234\n"\
+    "Example: './client localhost 52001' to connect to a server running on "\
+    "the same machine as the client, on port 52001.\n"\
+    "Example: './client localhost 52001 localhost 52002' to spread files "\
+    "between two servers running on the same machine as the client.\n");
+  }
+
+  for(int i = 0; i < shards.count; i++)
+  {
+    if(shards.shards[i].sock != -1)
+    {
+      close(shards.shards[i].sock);
+    }
   }
 
-  struct hostent *hostname = gethostbyname(argv[1]);
+  return error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* clientNow
+*PURPOSE: Returns a monotonic timestamp in milliseconds.
+*INPUT: -
+*OUTPUTS: uint64_t milliseconds
+*/
+static uint64_t clientNow(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/* orderAddresses
+*PURPOSE: Lists up to MAX_ADDRESSES of the resolved addresses, alternating
+*  between address families (starting with the family of the first, which the
+*  resolver has sorted as preferred), so a dead family only delays the other
+*  by one attempt. Returns how many were listed.
+*INPUT: struct addrinfo* resolved addresses
+*OUTPUTS: int count, struct addrinfo** ordered addresses
+*/
+static int orderAddresses(struct addrinfo *addrs, struct addrinfo **order)
+{
+  int count = 0;
+  struct addrinfo *next[2] = {addrs, addrs}; //next of the preferred family, and of any other
 
-  if(hostname != NULL)
+  while(next[1] != NULL && next[1]->ai_family == addrs->ai_family)
   {
-    ip.sin6_addr = *((struct in6_addr*)hostname->h_addr_list[0]);
-    ip.sin6_family = hostname->h_addrtype;
+    next[1] = next[1]->ai_next;
   }
-  else
-  { //not routable hostname
+
+  for(int turn = 0; count < MAX_ADDRESSES && (next[0] != NULL || next[1] != NULL); turn = !turn)
+  {
+    if(next[turn] != NULL)
+    {
+      order[count++] = next[turn];
+
+      do
+      { //on to the next address of the same kind
+        next[turn] = next[turn]->ai_next;
+      } while(next[turn] != NULL && (next[turn]->ai_family == addrs->ai_family) == turn);
+    }
+  }
+
+  return count;
+}
+
+/* connectServer
+*PURPOSE: Resolves every address of the server and connects to the first that
+*  answers (Happy Eyeballs, RFC 8305): an attempt is started on the next
+*  address whenever the last has failed or not connected within the attempt
+*  delay, without giving up on the earlier ones, and the first to connect is
+*  kept. So an unreachable address costs one attempt delay rather than a full
+*  connect timeout. Returns 'true' if an error occurs, in which case the
+*  shard's sock is -1.
+*INPUT: Shard* shard (host and port set), ConnectConfig* config
+*OUTPUTS: int error occured (boolean)
+*/
+int connectServer(Shard *shard, const ConnectConfig *config)
+{
+  int error = false;
+  struct addrinfo hints;
+  struct addrinfo *addrs = NULL;
+  struct addrinfo *order[MAX_ADDRESSES];
+  struct pollfd pending[MAX_ADDRESSES]; //attempts still connecting
+  int count = 0;
+  int started = 0;
+  int active = 0;
+  char *endptr;
+  long portTest = strtol(shard->port, &endptr, 10); //used to check for negative or out of range values
+
+  shard->sock = -1;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  if(portTest < 1 || portTest > 65535 || *endptr != '\0')
+  { //check port validity
+    printf("Port %s must be an integer between 1 and 65535, inclusive.\n", shard->port);
     error = true;
-    if(!error && inet_pton(AF_INET, argv[1], &ip.sin6_addr) > 0)
-    { //check ip validity and type
-      ip.sin6_family = AF_INET;
+  }
+  else
+  {
+    int result = getaddrinfo(shard->host, shard->port, &hints, &addrs);
+
+    if(result != 0)
+    { //not routable hostname, nor an ip address
+      printf("%s is not a valid hostname or IP address (%s). IP addresses must be in dot-decimal notation (IPv4) or colon-hexidecimal notation (IPv6).\n", shard->host, gai_strerror(result));
+      error = true;
     }
     else
-    { //not IPv4
-      if(inet_pton(AF_INET6, argv[1], &ip.sin6_addr) > 0)
+    {
+      count = orderAddresses(addrs, order);
+    }
+  }
+
+  uint64_t now = clientNow();
+  uint64_t deadline = now + config->timeout;
+  uint64_t nextAttempt = now;
+
+  while(!error && shard->sock == -1)
+  {
+    now = clientNow();
+
+    if(started < count && (now >= nextAttempt || active == 0))
+    { //the next address, if the others are slow or have all failed
+      struct addrinfo *addr = order[started++];
+      int sock = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK, addr->ai_protocol);
+
+      nextAttempt = now + config->attemptDelay;
+
+      if(sock >= 0 && connect(sock, addr->ai_addr, addr->ai_addrlen) == 0)
+      { //local addresses may connect immediately
+        shard->sock = sock;
+      }
+      else if(sock >= 0 && errno == EINPROGRESS)
       {
-        ip.sin6_family = AF_INET6;
+        pending[active].fd = sock;
+        pending[active].events = POLLOUT;
+        active++;
       }
-      else
-      { //not IPv6
-        printf("First argument is not a valid hostname or IP address. IP addresses must be in dot-decimal notation (IPv4) or colon-hexidecimal notation (IPv6).\n");
+      else if(sock >= 0)
+      { //refused outright
+        close(sock);
       }
     }
-  }
+    else if(active == 0)
+    { //every address failed
+      printf("Connection error. Check network connectivity of this machine and the remote server.\n");
+      error = true;
+    }
+    else if(now >= deadline)
+    {
+      printf("Connection error. %s:%s did not answer within %ums.\n", shard->host, shard->port, config->timeout);
+      error = true;
+    }
+    else
+    {
+      uint64_t wake = started < count && nextAttempt < deadline ? nextAttempt : deadline;
 
-  if(!error && (sock = socket(ip.sin6_family, SOCK_STREAM, 0)) < 0)
-  { //check able to make socket for ip type
-    printf("Socket error. Check network connectivity of this machine.\n");
-    error = true;
-  }
+      poll(pending, active, (int)(wake - now));
 
-  if(!error && (portTest < 1 || portTest > 65535))
-  { //check port validity
-    printf("Second argument (port) must be an integer between 1 and 65535, inclusive.\n");
-    error = true;
+      for(int i = active - 1; i >= 0 && shard->sock == -1; i--)
+      {
+        if(pending[i].revents != 0)
+        {
+          int result = -1;
+          socklen_t length = sizeof(result);
+
+          getsockopt(pending[i].fd, SOL_SOCKET, SO_ERROR, &result, &length);
+
+          if(result == 0)
+          {
+            shard->sock = pending[i].fd;
+          }
+          else
+          {
+            close(pending[i].fd);
+          }
+
+          pending[i] = pending[--active]; //the winner is not closed below
+        }
+      }
+    }
   }
 
-  if(!error && connect(sock, (struct sockaddr*)&ip, sizeof(ip)) < 0)
-  {
-    printf("Connection error. Check network connectivity of this machine and the remote server.\n");
-    error = true;
+  for(int i = 0; i < active; i++)
+  { //the attempts which lost
+    close(pending[i].fd);
   }
 
-  if(!error)
-  {
-    signal(SIGPIPE, SIG_IGN); //failed socket operations are handled as they occur
-    error = client(sock);
+  if(shard->sock != -1)
+  { //requests block as before
+    fcntl(shard->sock, F_SETFL, fcntl(shard->sock, F_GETFL) & ~O_NONBLOCK);
   }
-  else
-  {
-    printf("Expected usage: './client ip port', where ip is the hostname or "\
-    "IP address of the server, (IP addresses must be in dot-decimal notation "\
-    "[IPv4] or colon-hexidecimal notation [IPv6]), and port is the network "\
-    "port that the server is running at.\nExample: './client 192.168.1.234 "\
-    "1234' to connect to a server running at 192.168.1.234 on port 1234\n"\
-    "Example: './client localhost 52001' to connect to a server running on"\
-    "the same machine as the client, on port 52001.\n");
 
+  if(addrs != NULL)
+  {
+    freeaddrinfo(addrs);
   }
 
   return !error;
 }
 
-/* client
-*PURPOSE: Sends & recieves messages to/from the server.
-*INPUT: int sock descriptor
+/* welcome
+*PURPOSE: Recieves and prints the server's welcome message. Returns 'true' if
+*  an error occurs; the server may instead refuse the connection (eg if this
+*  address is banned), which is printed and sets the shard's sock to -1.
+*INPUT: Shard* shard
 *OUTPUTS: int error occured (boolean)
 */
-int client(int sock)
+int welcome(Shard *shard)
 {
-  Message msgOut;
   Message msgIn;
-
   int error = false;
-  int quit = false;
 
-  if(recieveMessage(&msgIn, sock))
+  if(recieveMessage(&msgIn, shard->sock, NULL))
   { //catch welcome message (or ban notice)
     if(msgIn.command == MESSAGE)
     {
+      char *named = strstr(msgIn.body, "Keys: ");
+
       printf("SERVER %.*s\n", (int)msgIn.length, msgIn.body); //print response
+      shard->hash = HASH_MD5; //servers which do not say compute MD5 keys
+
+      if(named != NULL)
+      { //the algorithm's name ends at the full stop
+        named += strlen("Keys: ");
+        named[strcspn(named, ".")] = '\0';
+        shard->hash = hashParseEngine(named) != -1 ? hashParseEngine(named) : HASH_MD5;
+      }
     }
     else
     { //not general welcome
       if(msgIn.command == DISCON)
       {
-        quit = true;
         printf("SERVER %.*s\n", (int)msgIn.length, msgIn.body); //print response
+        close(shard->sock);
+        shard->sock = -1;
       }
       else
       { //invalid command
@@ -136,94 +346,523 @@ int client(int sock)
     error = true;
   }
 
+  return !error;
+}
+
+/* client
+*PURPOSE: Sends & recieves messages to/from the servers. Each request goes to
+*  the server its key maps to; for STORE, the key is computed here from the
+*  file's contents, just as the server will.
+*INPUT: ShardSet* servers
+*OUTPUTS: int error occured (boolean)
+*/
+int client(ShardSet *shards)
+{
+  Message msgOut;
+  Message msgIn;
+
+  int error = false;
+  int quit = false;
+
+  for(int i = 0; !error && !quit && i < shards->count; i++)
+  {
+    error = !welcome(&(shards->shards[i]));
+    quit = shards->shards[i].sock == -1;
+
+    if(!error && !quit && shards->shards[i].hash != shards->shards[0].hash)
+    { //STOREs are routed by the key the first server would give
+      printf("LOCAL Warning: %s:%s computes keys with %s, but %s:%s uses %s. Stored files may not be found again.\n",
+        shards->shards[i].host, shards->shards[i].port, hashEngineName(shards->shards[i].hash),
+        shards->shards[0].host, shards->shards[0].port, hashEngineName(shards->shards[0].hash));
+    }
+  }
+
   while(!error && !quit)
   {
     char *fileName; //used only for GET operations
+    long number; //used only for REBALANCE, LIST, EVENTS and EXPIRE
+    int sock;
 
-    msgOut = prepareMessage(&fileName);
+    msgOut = prepareMessage(&fileName, &number);
 
-    if(sendMessage(msgOut, sock))
+    if(msgOut.command == REBALANCE)
     {
-      free(msgOut.body);
+      if(number < 1 || number >= shards->count)
+      {
+        printf("LOCAL Error: The number of servers before the new ones were added must be between 1 and %d.\n", shards->count - 1);
+      }
+      else
+      {
+        error = !rebalance(shards, number, msgOut.body);
+      }
 
-      if(recieveMessage(&msgIn, sock))
+      free(msgOut.body);
+    }
+    else if(msgOut.command == LIST)
+    { //every server is asked, and their keys merged
+      error = !listShards(shards, msgOut.body, number);
+      free(msgOut.body);
+    }
+    else if(msgOut.command == EVENTS)
+    { //every server is asked in turn
+      error = !eventShards(shards, msgOut.body, number);
+      free(msgOut.body);
+    }
+    else
+    {
+      if(msgOut.command == STORE && shards->count > 1)
       {
-        if(msgIn.command == MESSAGE)
-        { //MESSAGE is always a valid response for any request
-          printf("SERVER %.*s\n", (int)msgIn.length, msgIn.body); //print response
+        char key[KEYLENGTH];
 
-          if(msgOut.command == QUIT)
+        hashKey(shards->shards[0].hash, msgOut.body, msgOut.length, key);
+        sock = shards->shards[shardForKey(key, shards->count)].sock;
+      }
+      else if(msgOut.command == QUIT)
+      { //the other servers are told first, the first server's reply ends the session below
+        for(int i = 1; i < shards->count; i++)
+        {
+          if(exchange(&(shards->shards[i]), msgOut, &msgIn))
           {
-            quit = true;
+            printf("SERVER %.*s\n", (int)msgIn.length, msgIn.body); //print response
+            free(msgIn.body);
           }
         }
-        else
+
+        sock = shards->shards[0].sock;
+      }
+      else if(msgOut.command == EXPIRE)
+      { //the key follows the seconds
+        sock = shards->shards[shardForKey(strchr(msgOut.body, '\n') + 1, shards->count)].sock;
+      }
+      else
+      { //only a key; an invalid key goes to the first server, which refuses it
+        sock = shards->shards[msgOut.command == STORE ? 0 : shardForKey(msgOut.body, shards->count)].sock;
+      }
+
+      if(sendMessage(msgOut, sock))
+      {
+        free(msgOut.body);
+
+        if(recieveMessage(&msgIn, sock, NULL))
         {
-          if(msgIn.command == FILECONT && msgOut.command == GET)
-          { //a FILECONT response is only valid for the GET command
-            if(writeFile(msgIn.body, msgIn.length, fileName))
+          if(msgIn.command == MESSAGE)
+          { //MESSAGE is always a valid response for any request
+            printf("SERVER %.*s\n", (int)msgIn.length, msgIn.body); //print response
+
+            if(msgOut.command == QUIT)
             {
-              printf("LOCAL Info: File retrieved successfully.\n");
+              quit = true;
             }
-            else
-            { //failed to save file - not a communication error, program does not exit
-              printf("LOCAL Error: Failed to save file.\n");
+          }
+          else
+          {
+            if(msgIn.command == FILECONT && msgOut.command == GET)
+            { //a FILECONT response is only valid for the GET command
+              if(writeFile(msgIn.body, msgIn.length, fileName))
+              {
+                printf("LOCAL Info: File retrieved successfully.\n");
+              }
+              else
+              { //failed to save file - not a communication error, program does not exit
+                printf("LOCAL Error: Failed to save file.\n");
+              }
+
+              if(fileName != NULL)
+              {
+                free(fileName);
+              }
             }
+            else
+            { //invalid or discon response
 
-            if(fileName != NULL)
-            {
-              free(fileName);
+              if(msgIn.command == DISCON)
+              {
+                printf("SERVER %.*s\n", (int)msgIn.length, msgIn.body); //print response
+                quit = true;
+              }
+              else
+              {
+                error = true;
+                printf("LOCAL Error: Server sent an invalid response.\n");
+              }
             }
           }
+
+          free(msgIn.body);
+        }
+        else
+        { //failed to recv message
+          error = true;
+          printf("NETWORK Error: Failed to recieve message. Connection closed.\n");
+        }
+      }
+      else
+      { //failed to send message
+        printf("NETWORK Error: Failed to send message.\n");
+        error = true;
+      }
+    }
+  }
+
+  return error;
+}
+
+/* exchange
+*PURPOSE: Sends a request to the server and recieves its response, which the
+*  caller must free. Returns 'true' if an error occurs.
+*INPUT: Shard* shard, Message request
+*OUTPUTS: int error occured (boolean), Message* response
+*/
+int exchange(Shard *shard, const Message msgOut, Message *msgIn)
+{
+  int error = shard->sock == -1 || !sendMessage(msgOut, shard->sock) || !recieveMessage(msgIn, shard->sock, NULL);
+
+  return !error;
+}
+
+/* rebalance
+*PURPOSE: After servers have been added to the end of the list, moves each
+*  file whose key now maps to a different server onto it: the file is fetched
+*  from the server it was on when there were oldCount servers, stored on its
+*  new server, and only deleted from the old one once the new server has
+*  confirmed it under the same key. Keys whose server has not changed (about
+*  oldCount out of every count) are not touched. The keys are read from a
+*  file, one per line, eg as noted down when the files were stored. Files not
+*  found on their old server are assumed to have been moved already, so it can
+*  be run again after an interruption. Returns 'true' if an error occurs.
+*INPUT: ShardSet* servers, int oldCount of servers, char* key file path
+*OUTPUTS: int error occured (boolean)
+*/
+int rebalance(ShardSet *shards, int oldCount, const char *keyFile)
+{
+  int error = false;
+  char key[MAXPATHLENGTH + 1];
+  unsigned int checked = 0;
+  unsigned int moved = 0;
+  unsigned int missing = 0;
+  unsigned int failed = 0;
+  FILE *keys = fopen(keyFile, "r");
+
+  if(keys == NULL)
+  {
+    printf("LOCAL Error: Failed to open key file.\n");
+  }
+
+  while(keys != NULL && !error && fscanf(keys, "%"MAXPATHLENGTHSTR"s", key) == 1)
+  {
+    Shard *from = &(shards->shards[shardForKey(key, oldCount)]);
+    Shard *to = &(shards->shards[shardForKey(key, shards->count)]);
+    Message request = {GET, strlen(key), key, BODY_STATIC, NULL};
+    Message file;
+    Message reply;
+
+    checked++;
+
+    if(from != to)
+    {
+      int fetched = exchange(from, request, &file);
+
+      if(!fetched)
+      {
+        error = true;
+      }
+      else if(file.command != FILECONT)
+      { //not there, or cannot be read
+        missing++;
+        error = file.command == DISCON;
+      }
+      else
+      {
+        file.command = STORE;
+
+        if(!exchange(to, file, &reply))
+        {
+          error = true;
+        }
+        else if(reply.command != MESSAGE || memmem(reply.body, reply.length, key, strlen(key)) == NULL)
+        { //left where it is
+          printf("LOCAL Error: Failed to move %s to %s:%s.\n", key, to->host, to->port);
+          failed++;
+          error = reply.command == DISCON;
+          free(reply.body);
+        }
+        else
+        {
+          free(reply.body);
+          request.command = DELETE;
+
+          if(exchange(from, request, &reply))
+          {
+            moved++;
+            free(reply.body);
+          }
           else
-          { //invalid or discon response
+          {
+            error = true;
+          }
+        }
+      }
+
+      if(fetched)
+      {
+        free(file.body);
+      }
+    }
+  }
+
+  if(keys != NULL)
+  {
+    fclose(keys);
+    printf("LOCAL Info: Rebalanced %u keys, %u moved, %u not found on their old server, %u failed.\n", checked, moved, missing, failed);
+  }
+
+  if(error)
+  {
+    printf("NETWORK Error: Lost a connection while rebalancing.\n");
+  }
+
+  return !error;
+}
+
+/* listShards
+*PURPOSE: Lists the keys of every server, merged into key order, up to the
+*  limit (0 for every key). Each server is asked for a page of keys at a
+*  time, starting after the last key it sent, and the smallest key at the
+*  head of any server's page is printed next, so the listing can be resumed
+*  after its last key whatever servers it is spread across. Returns 'true'
+*  if an error occurs.
+*INPUT: ShardSet* servers, char* request: the prefix and key to list after,
+*  each followed by a newline, long limit
+*OUTPUTS: int error occured (boolean)
+*/
+int listShards(ShardSet *shards, const char *request, long limit)
+{
+  ListPage pages[MAX_SHARDS];
+  char after[MAX_SHARDS][KEYLENGTH]; //last key each server sent, the next page starts after it
+  char last[KEYLENGTH] = ""; //printed
+  long listed = 0;
+  int error = false;
+  int stop = false;
+  int remaining = false;
+
+  //the key given to list after ends the request, so each server's pages replace it
+  size_t prefixLength = strchr(request, '\n') + 1 - request;
+  strncpy(after[0], request + prefixLength, KEYLENGTH - 1);
+  after[0][KEYLENGTH - 1] = '\0';
+  after[0][strcspn(after[0], "\n")] = '\0';
+
+  for(int s = 0; s < shards->count; s++)
+  {
+    pages[s].keys = calloc(LIST_MAX_KEYS, KEYLENGTH);
+    pages[s].count = 0;
+    pages[s].next = 0;
+    pages[s].more = true;
+    strcpy(after[s], after[0]);
+  }
+
+  while(!error && !stop && (limit == 0 || listed < limit))
+  {
+    int smallest = -1;
+    uint8_t smallestBytes[HASH_KEY_BYTES];
+
+    for(int s = 0; !error && !stop && s < shards->count; s++)
+    {
+      ListPage *page = &(pages[s]);
 
-            if(msgIn.command == DISCON)
+      if(page->next == page->count && page->more)
+      { //fetch its next page
+        Message msgOut;
+        Message msgIn;
+        char body[64 + MAXPATHLENGTH];
+        long wanted = limit == 0 || limit - listed > LIST_MAX_KEYS ? LIST_MAX_KEYS : limit - listed;
+
+        msgOut.command = LIST;
+        msgOut.length = snprintf(body, sizeof(body), "%ld\n%.*s%s", wanted, (int)prefixLength, request, after[s]);
+        msgOut.body = body;
+        page->count = 0;
+        page->next = 0;
+        page->more = false;
+
+        if(!exchange(&(shards->shards[s]), msgOut, &msgIn))
+        {
+          error = true;
+        }
+        else if(msgIn.command != MESSAGE || strstr(msgIn.body, "Info: Listed") == NULL)
+        { //refused, the server's reason is printed
+          printf("SERVER %.*s\n", (int)msgIn.length, msgIn.body);
+          stop = true;
+          error = msgIn.command == DISCON;
+          free(msgIn.body);
+        }
+        else
+        {
+          char *save;
+
+          for(char *line = strtok_r(msgIn.body, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save))
+          {
+            if(hashKeyEngine(line) != -1 && page->count < LIST_MAX_KEYS)
             {
-              printf("SERVER %.*s\n", (int)msgIn.length, msgIn.body); //print response
-              quit = true;
+              strcpy(page->keys[page->count++], line);
+              strcpy(after[s], line);
             }
             else
-            {
-              error = true;
-              printf("LOCAL Error: Server sent an invalid response.\n");
+            { //the last line
+              page->more = strstr(line, "more follow") != NULL;
             }
           }
-        }
 
-        free(msgIn.body);
+          free(msgIn.body);
+        }
       }
-      else
-      { //failed to recv message
-        error = true;
-        printf("NETWORK Error: Failed to recieve message. Connection closed.\n");
+
+      if(!error && !stop && page->next < page->count)
+      {
+        uint8_t bytes[HASH_KEY_BYTES];
+
+        hashKeyBytes(page->keys[page->next], bytes);
+
+        if(smallest == -1 || memcmp(bytes, smallestBytes, HASH_KEY_BYTES) < 0)
+        {
+          smallest = s;
+          memcpy(smallestBytes, bytes, HASH_KEY_BYTES);
+        }
       }
     }
-    else
-    { //failed to send message
-      printf("NETWORK Error: Failed to send message.\n");
-      error = true;
+
+    if(!error && !stop && smallest == -1)
+    { //every server has run out
+      stop = true;
+    }
+    else if(!error && !stop)
+    {
+      strcpy(last, pages[smallest].keys[pages[smallest].next++]);
+      printf("%s\n", last);
+      listed++;
     }
+  }
 
+  for(int s = 0; s < shards->count; s++)
+  {
+    remaining = remaining || pages[s].next < pages[s].count || pages[s].more;
+    free(pages[s].keys);
   }
 
-  if(sock != -1)
+  if(error)
+  {
+    printf("NETWORK Error: Lost a connection while listing.\n");
+  }
+  else if(!stop && remaining)
+  {
+    printf("LOCAL Info: Listed %ld keys, more follow after %s.\n", listed, last);
+  }
+  else
   {
-    close(sock);
+    printf("LOCAL Info: Listed %ld keys.\n", listed);
   }
 
-  return error;
+  return !error;
+}
+
+/* eventShards
+*PURPOSE: Lists the events recorded by each server in turn, newest first, up
+*  to the limit from each (0 for every event). Each server is asked for a page
+*  of events at a time, before the oldest it last sent. Servers number their
+*  events separately, so a server's listing can be resumed from its last
+*  event's number with that server alone. Returns 'true' if an error occurs.
+*INPUT: ShardSet* servers, char* request: the start and end of the time
+*  range and the address, each followed by a newline, long limit
+*OUTPUTS: int error occured (boolean)
+*/
+int eventShards(ShardSet *shards, const char *request, long limit)
+{
+  int error = false;
+  int stop = false;
+
+  for(int s = 0; !error && !stop && s < shards->count; s++)
+  {
+    char before[32] = ""; //number of the oldest event the server sent, the next page is before it
+    long found = 0;
+    int more = true;
+
+    while(!error && !stop && more && (limit == 0 || found < limit))
+    {
+      Message msgOut;
+      Message msgIn;
+      char body[64 + MAXPATHLENGTH];
+      long wanted = limit == 0 || limit - found > EVENTS_MAX ? EVENTS_MAX : limit - found;
+
+      msgOut.command = EVENTS;
+      msgOut.length = snprintf(body, sizeof(body), "%ld\n%s%s", wanted, request, before);
+      msgOut.body = body;
+      more = false;
+
+      if(!exchange(&(shards->shards[s]), msgOut, &msgIn))
+      {
+        error = true;
+      }
+      else if(msgIn.command != MESSAGE || strstr(msgIn.body, "Info: Found") == NULL)
+      { //refused, the server's reason is printed
+        printf("SERVER %.*s\n", (int)msgIn.length, msgIn.body);
+        stop = true;
+        error = msgIn.command == DISCON;
+        free(msgIn.body);
+      }
+      else
+      {
+        char *save;
+
+        for(char *line = strtok_r(msgIn.body, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save))
+        {
+          char *next = strstr(line, "more follow before #");
+
+          if(line[0] == '#')
+          {
+            printf("%s\n", line);
+            found++;
+          }
+          else if(next != NULL)
+          { //the last line
+            snprintf(before, sizeof(before), "%.*s", (int)strspn(next + strlen("more follow before #"), "0123456789"), next + strlen("more follow before #"));
+            more = true;
+          }
+        }
+
+        free(msgIn.body);
+      }
+    }
+
+    if(error)
+    {
+      printf("NETWORK Error: Lost the connection to %s:%s while listing events.\n", shards->shards[s].host, shards->shards[s].port);
+    }
+    else if(!stop && more)
+    {
+      printf("LOCAL Info: Found %ld events on %s:%s, more follow before #%s.\n", found, shards->shards[s].host, shards->shards[s].port, before);
+    }
+    else if(!stop)
+    {
+      printf("LOCAL Info: Found %ld events on %s:%s.\n", found, shards->shards[s].host, shards->shards[s].port);
+    }
+  }
+
+  return !error;
 }
 
 /* prepareMessage
 *PURPOSE: Takes command and parameter inputs from the user for the server.
 *  Returns a Message struct containing all the information to be sent to the
 *  server for the request. If the user has selected GET, then the filename for
-*  the response to be saved at will be written to the filename pointer. 
+*  the response to be saved at will be written to the filename pointer. For
+*  REBALANCE, LIST and EVENTS, which are handled by the client, the number of
+*  servers before the new ones were added, or the most keys or events to list,
+*  is written to the number pointer. REBALANCE's body is the key file's path,
+*  LIST's the prefix and the key to list after, and EVENTS' the start and end
+*  of the time range and the address, each followed by a newline. EXPIRE's
+*  body is the seconds to keep the file for, a newline, and the file's key.
 *INPUT: -
-*OUTPUTS: Message request message, char** file name
+*OUTPUTS: Message request message, char** file name, long* number
 */
-Message prepareMessage(char **fileName)
+Message prepareMessage(char **fileName, long *number)
 { //handles ui and file io to prepare a message
   Message msg;
   int valid = false;
@@ -257,6 +896,12 @@ Message prepareMessage(char **fileName)
         i++; //even once found we increment, as the integers for commands starts at 1
       }
 
+      if(!found && !strcmp(input, "rebalance"))
+      { //not a server command
+        found = true;
+        i = REBALANCE;
+      }
+
       if(found)
       {
         msg.command = i;
@@ -314,6 +959,78 @@ Message prepareMessage(char **fileName)
               printf("LOCAL Error: File key required.\n");
             }
 
+            break;
+          case REBALANCE: //second argument is the old number of servers, third is the key file path
+            if(scanf("%ld", number) == 1 && scanf("%"MAXPATHLENGTHSTR"s", input) == 1)
+            {
+              msg.length = strlen(input);
+              msg.body = calloc(msg.length + 1, sizeof(char));
+              strcpy(msg.body, input);
+              valid = true;
+            }
+            else
+            { //no count or no key file
+              valid = false;
+              printf("LOCAL Error: Number of servers before the new ones were added, and key filename required.\n");
+            }
+
+            break;
+          case LIST: //prefix, key to list after, and limit, '-' for none
+            if(scanf("%"MAXPATHLENGTHSTR"s", input) == 1 && strlen(input) < KEYLENGTH)
+            {
+              char after[MAXPATHLENGTH];
+
+              if(scanf("%"MAXPATHLENGTHSTR"s", after) == 1 && strlen(after) < KEYLENGTH && scanf("%ld", number) == 1 && *number >= 0)
+              {
+                msg.body = calloc(strlen(input) + strlen(after) + 3, sizeof(char));
+                sprintf(msg.body, "%s\n%s\n", strcmp(input, "-") ? input : "", strcmp(after, "-") ? after : "");
+                msg.length = strlen(msg.body);
+                valid = true;
+              }
+            }
+
+            if(!valid)
+            {
+              printf("LOCAL Error: Prefix, key to list after, and number of keys (0 for all) required.\n");
+            }
+
+            break;
+          case EVENTS: //time range start and end, address, and limit, '-' for none
+            if(scanf("%"MAXPATHLENGTHSTR"s", input) == 1 && strlen(input) < 64)
+            {
+              char to[MAXPATHLENGTH];
+              char ip[MAXPATHLENGTH];
+
+              if(scanf("%"MAXPATHLENGTHSTR"s", to) == 1 && strlen(to) < 64 && scanf("%"MAXPATHLENGTHSTR"s", ip) == 1 && strlen(ip) < INET6_ADDRSTRLEN &&
+                scanf("%ld", number) == 1 && *number >= 0)
+              {
+                msg.body = calloc(strlen(input) + strlen(to) + strlen(ip) + 4, sizeof(char));
+                sprintf(msg.body, "%s\n%s\n%s\n", strcmp(input, "-") ? input : "", strcmp(to, "-") ? to : "", strcmp(ip, "-") ? ip : "");
+                msg.length = strlen(msg.body);
+                valid = true;
+              }
+            }
+
+            if(!valid)
+            {
+              printf("LOCAL Error: Start and end of the time range, address, and number of events (0 for all) required.\n");
+            }
+
+            break;
+          case EXPIRE: //key, and seconds to keep the file for, 0 to keep it until deleted
+            if(scanf("%"MAXPATHLENGTHSTR"s", input) == 1 && strlen(input) < KEYLENGTH && scanf("%ld", number) == 1 && *number >= 0)
+            {
+              msg.body = calloc(strlen(input) + 24, sizeof(char));
+              sprintf(msg.body, "%ld\n%s", *number, input);
+              msg.length = strlen(msg.body);
+              valid = true;
+            }
+            else
+            {
+              valid = false;
+              printf("LOCAL Error: File key, and seconds to keep it for (0 until deleted), required.\n");
+            }
+
             break;
           case QUIT: //no second argument
             msg.length = 1;
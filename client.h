@@ -1,12 +1,45 @@
 /* client.h
 *AUTHOR: Jhi Morris (19173632)
-*MODIFIED: 2020-09-12
+*MODIFIED: 2026-10-19
 *PURPOSE: Header for client.c
 */
 
 #include "common.h"
+#include "hash.h"
+#include "shard.h"
 #include <netdb.h>
 
-int client(int sock);
+#define REBALANCE (COMMANDMAX + 1) //handled by the client, never sent
+#define DEFAULT_CONNECT_TIMEOUT 10000 //milliseconds to connect to a server, across all of its addresses
+#define DEFAULT_ATTEMPT_DELAY 250 //milliseconds before the next address is tried alongside the last
+#define MAX_ADDRESSES 16 //of one server tried
 
-Message prepareMessage(char **fileName);
+typedef struct ListPage
+{ //the keys of one server's last LIST response not yet printed
+  char (*keys)[KEYLENGTH]; //up to LIST_MAX_KEYS
+  int count;
+  int next; //to print
+  int more; //boolean, the server has keys after the last in the page
+} ListPage;
+
+typedef struct ConnectConfig
+{ //parsed from the command line
+  unsigned int timeout; //milliseconds
+  unsigned int attemptDelay; //milliseconds
+} ConnectConfig;
+
+int client(ShardSet* shards);
+
+int connectServer(Shard* shard, const ConnectConfig* config);
+
+int welcome(Shard* shard);
+
+int exchange(Shard* shard, const Message msgOut, Message* msgIn);
+
+int rebalance(ShardSet* shards, int oldCount, const char* keyFile);
+
+int listShards(ShardSet* shards, const char* request, long limit);
+
+int eventShards(ShardSet* shards, const char* request, long limit);
+
+Message prepareMessage(char **fileName, long* number);
@@ -0,0 +1,307 @@
+/* commit.c
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Makes stored files durable before STORE replies. In group mode,
+*  STOREs queue a ticket and sleep; a committer thread takes every ticket that
+*  arrived within the commit delay and syncs each distinct file once (small
+*  files share a pack, so a batch usually needs a single fdatasync()), plus the
+*  directory once if any new file was created, then wakes the whole batch. The
+*  syncs of a batch are submitted together through the I/O engine.
+*/
+
+#include "commit.h"
+#include "common.h"
+#include "log.h"
+#include "ioengine.h"
+#include <fcntl.h>
+#include <time.h>
+
+static const char *const modes[] = {"none", "op", "group"};
+
+/* commitNow
+*PURPOSE: Returns a monotonic timestamp in microseconds.
+*INPUT: -
+*OUTPUTS: uint64_t microseconds
+*/
+static uint64_t commitNow(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* commitBatch
+*PURPOSE: Syncs every file in the batch, once per group, and the directory
+*  once if any ticket needs it, all submitted together, recording the result in
+*  each ticket. Called without the queue locked. Returns the number of syncs
+*  made.
+*INPUT: CommitQueue* queue, CommitTicket* batch
+*OUTPUTS: unsigned int syncs
+*/
+static unsigned int commitBatch(CommitQueue *queue, CommitTicket *batch)
+{
+  int count = 1; //room for the directory
+  int syncs = 0;
+  int dirSlot = -1;
+
+  for(CommitTicket *ticket = batch; ticket != NULL; ticket = ticket->next)
+  {
+    count++;
+  }
+
+  int *fds = calloc(count, sizeof(int));
+  int *directory = calloc(count, sizeof(int));
+  int *failed = calloc(count, sizeof(int));
+
+  for(CommitTicket *ticket = batch; ticket != NULL; ticket = ticket->next)
+  {
+    ticket->slot = -1;
+
+    if(ticket->group != -1)
+    { //find an earlier ticket whose sync also covers this one
+      for(CommitTicket *other = batch; ticket->slot == -1 && other != ticket; other = other->next)
+      {
+        if(other->group == ticket->group)
+        {
+          ticket->slot = other->slot;
+        }
+      }
+    }
+
+    if(ticket->slot == -1)
+    {
+      ticket->slot = syncs;
+      fds[syncs++] = ticket->fd;
+    }
+
+    if(ticket->dir && dirSlot == -1)
+    {
+      dirSlot = syncs;
+      fds[syncs] = queue->dirFd;
+      directory[syncs++] = true;
+    }
+  }
+
+  ioSyncAll(fds, directory, failed, syncs);
+
+  for(CommitTicket *ticket = batch; ticket != NULL; ticket = ticket->next)
+  {
+    ticket->error = failed[ticket->slot] || (ticket->dir && failed[dirSlot]);
+  }
+
+  free(fds);
+  free(directory);
+  free(failed);
+
+  return syncs;
+}
+
+/* committer
+*PURPOSE: Thread function which commits the queued tickets in batches, waiting
+*  up to the commit delay after the first ticket for others to join it. Tickets
+*  queued while a batch is being synced form the next batch.
+*INPUT: void* to the CommitQueue
+*OUTPUTS: -
+*/
+static void *committer(void *arg)
+{
+  CommitQueue *queue = (CommitQueue*)arg;
+
+  pthread_mutex_lock(queue->mutex);
+
+  while(!queue->stop || queue->head != NULL)
+  {
+    if(queue->head == NULL)
+    {
+      pthread_cond_wait(queue->queued, queue->mutex);
+    }
+    else
+    {
+      CommitTicket *batch;
+      unsigned int count = 0;
+      unsigned int syncs;
+      uint64_t start;
+
+      if(queue->delay > 0 && !queue->stop)
+      { //let more stores join
+        pthread_mutex_unlock(queue->mutex);
+        usleep(queue->delay);
+        pthread_mutex_lock(queue->mutex);
+      }
+
+      batch = queue->head;
+      queue->head = NULL;
+      pthread_mutex_unlock(queue->mutex);
+
+      start = commitNow();
+      syncs = commitBatch(queue, batch);
+
+      pthread_mutex_lock(queue->mutex);
+
+      for(CommitTicket *ticket = batch; ticket != NULL; ticket = ticket->next)
+      { //waiters cannot see this (and return, freeing their ticket) until the queue is unlocked
+        ticket->done = true;
+        count++;
+      }
+
+      queue->batches++;
+      queue->syncs += syncs;
+      pthread_cond_broadcast(queue->committed);
+
+      logMsg(LOG_DEBUG, "server", "Committed %u stores with %u syncs in %llu us.", count, syncs,
+        (unsigned long long)(commitNow() - start));
+    }
+  }
+
+  pthread_mutex_unlock(queue->mutex);
+
+  return NULL;
+}
+
+/* commitParseMode
+*PURPOSE: Returns the durability define for a mode name, or -1 if unknown.
+*INPUT: char* name
+*OUTPUTS: int mode
+*/
+int commitParseMode(const char *name)
+{
+  int mode = -1;
+
+  for(int i = 0; mode == -1 && i < (int)(sizeof(modes) / sizeof(modes[0])); i++)
+  {
+    if(!strcmp(modes[i], name))
+    {
+      mode = i;
+    }
+  }
+
+  return mode;
+}
+
+/* commitModeName
+*PURPOSE: Returns the name of a durability define.
+*INPUT: int mode
+*OUTPUTS: char* name
+*/
+const char *commitModeName(int mode)
+{
+  return modes[mode];
+}
+
+/* commitCreate
+*PURPOSE: Allocates a commit queue, and starts its committer thread in group
+*  mode.
+*INPUT: int mode (DURABILITY_ define), unsigned int delay in microseconds
+*OUTPUTS: CommitQueue* queue
+*/
+CommitQueue *commitCreate(int mode, unsigned int delay)
+{
+  CommitQueue *queue = calloc(1, sizeof(CommitQueue));
+
+  queue->mutex = malloc(sizeof(pthread_mutex_t));
+  queue->queued = malloc(sizeof(pthread_cond_t));
+  queue->committed = malloc(sizeof(pthread_cond_t));
+  pthread_mutex_init(queue->mutex, NULL);
+  pthread_cond_init(queue->queued, NULL);
+  pthread_cond_init(queue->committed, NULL);
+  queue->mode = mode;
+  queue->delay = delay;
+  queue->dirFd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  if(mode == DURABILITY_GROUP)
+  {
+    pthread_create(&(queue->thread), NULL, committer, (void*)queue);
+  }
+
+  return queue;
+}
+
+/* commitDestroy
+*PURPOSE: Commits any queued tickets, stops the committer thread and frees the
+*  queue.
+*INPUT: CommitQueue* queue
+*OUTPUTS: -
+*/
+void commitDestroy(CommitQueue *queue)
+{
+  if(queue->mode == DURABILITY_GROUP)
+  {
+    pthread_mutex_lock(queue->mutex);
+    queue->stop = true;
+    pthread_cond_signal(queue->queued);
+    pthread_mutex_unlock(queue->mutex);
+    pthread_join(queue->thread, NULL);
+  }
+
+  if(queue->dirFd != -1)
+  {
+    close(queue->dirFd);
+  }
+
+  pthread_cond_destroy(queue->queued);
+  pthread_cond_destroy(queue->committed);
+  pthread_mutex_destroy(queue->mutex);
+  free(queue->queued);
+  free(queue->committed);
+  free(queue->mutex);
+  free(queue);
+}
+
+/* commitWait
+*PURPOSE: Returns once the file (and the directory, if the file is new) is on
+*  disk, syncing it directly in op mode or via the committer in group mode.
+*  Returns immediately in none mode. Returns 'true' if an error occurs, in which
+*  case the file may not be durable.
+*INPUT: CommitQueue* queue, int fd, int group (eg pack number, -1 if the file
+*  is not shared), int dir (boolean)
+*OUTPUTS: int error occured (boolean)
+*/
+int commitWait(CommitQueue *queue, int fd, int group, int dir)
+{
+  int error = false;
+  uint64_t start = commitNow();
+
+  if(queue->mode == DURABILITY_OP)
+  {
+    int fds[2] = {fd, queue->dirFd};
+    int directory[2] = {false, true};
+    int failed[2];
+    unsigned int syncs = dir ? 2 : 1;
+
+    error = !ioSyncAll(fds, directory, failed, syncs);
+
+    pthread_mutex_lock(queue->mutex);
+    queue->stores++;
+    queue->batches++;
+    queue->syncs += syncs;
+    queue->waitTime += commitNow() - start;
+    pthread_mutex_unlock(queue->mutex);
+  }
+  else if(queue->mode == DURABILITY_GROUP)
+  {
+    CommitTicket ticket = {NULL, fd, group, dir, false, false, 0};
+
+    pthread_mutex_lock(queue->mutex);
+
+    ticket.next = queue->head;
+    queue->head = &ticket;
+
+    if(ticket.next == NULL)
+    { //first of a new batch
+      pthread_cond_signal(queue->queued);
+    }
+
+    while(!ticket.done)
+    {
+      pthread_cond_wait(queue->committed, queue->mutex);
+    }
+
+    error = ticket.error;
+    queue->stores++;
+    queue->waitTime += commitNow() - start;
+    pthread_mutex_unlock(queue->mutex);
+  }
+
+  return !error;
+}
@@ -0,0 +1,60 @@
+/* commit.h
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Header for commit.c. Makes stored files durable before STORE replies,
+*  either one fdatasync() per store or shared between concurrent stores.
+*/
+
+#ifndef COMMIT_H
+#define COMMIT_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+//durability defines
+#define DURABILITY_NONE 0 //replies once written to the page cache, as before
+#define DURABILITY_OP 1 //each STORE syncs its own file before replying
+#define DURABILITY_GROUP 2 //concurrent STOREs share one sync per file per batch
+
+#define DEFAULT_COMMIT_DELAY 500 //microseconds a batch waits for more stores to join
+#define COMMIT_MAX_DELAY 1000000
+
+typedef struct CommitTicket
+{ //one per waiting STORE, lives on the waiting thread's stack
+  struct CommitTicket* next;
+  int fd; //to sync, owned by the waiter
+  int group; //tickets with the same group (pack) share a single sync, -1 for none
+  int dir; //the file is new, so the directory must be synced too
+  int done;
+  int error;
+  int slot; //committer only: which of the batch's syncs covers it
+} CommitTicket;
+
+typedef struct CommitQueue
+{
+  pthread_mutex_t* mutex;
+  pthread_cond_t* queued; //signalled when the first ticket joins an empty batch
+  pthread_cond_t* committed; //broadcast when a batch has been synced
+  pthread_t thread; //committer, only started in DURABILITY_GROUP
+  int stop;
+  int mode; //DURABILITY_ define
+  unsigned int delay; //microseconds
+  int dirFd; //working directory, synced when new files were created
+  CommitTicket* head; //pending batch
+  uint64_t stores; //statistics, protected by mutex
+  uint64_t batches;
+  uint64_t syncs;
+  uint64_t waitTime; //microseconds, summed over every store
+} CommitQueue;
+
+int commitParseMode(const char* name);
+
+const char *commitModeName(int mode);
+
+CommitQueue *commitCreate(int mode, unsigned int delay);
+
+void commitDestroy(CommitQueue* queue);
+
+int commitWait(CommitQueue* queue, int fd, int group, int dir);
+
+#endif
@@ -1,85 +1,307 @@
 /* common.c
 *AUTHOR: Jhi Morris (19173632)
-*MODIFIED: 2020-09-12
+*MODIFIED: 2026-10-19
 *PURPOSE: Provides functions used by both the client and server executables
 */
 
 #include "common.h"
 
 //used for string comparison to commands, or for printing command names
-const char *const commands[] = {"store", "get", "delete", "history", "quit", "filecont", "message", "discon"};
+const char *const commands[] = {"store", "get", "delete", "history", "quit", "filecont", "message", "discon", "list", "events", "expire"};
 const size_t commandsLen = sizeof(commands) / sizeof(commands[0]);
 
 
 /* sendMessage
-*PURPOSE: Sends the contents of the Message struct over the socket connection. It returns 'true' if an error occurs.
+*PURPOSE: Sends the contents of the Message struct over the socket connection.
+*  The command, length and body are gathered into as few send calls as the
+*  socket allows, normally one. It returns 'true' if an error occurs.
 *INPUT: Message message, int sock descriptor
 *OUTPUTS: int error occured (boolean)
 */
 int sendMessage(const Message msg, int sock)
 {
   int error = false;
+  TRACE_BEGIN(traceStart);
+  struct iovec parts[3];
+  struct msghdr header;
 
-  if(send(sock, &(msg.command), sizeof(msg.command), 0))
+  parts[0].iov_base = (void*)&(msg.command);
+  parts[0].iov_len = sizeof(msg.command);
+  parts[1].iov_base = (void*)&(msg.length);
+  parts[1].iov_len = sizeof(msg.length);
+  parts[2].iov_base = msg.body;
+  parts[2].iov_len = sizeof(char) * msg.length;
+
+  memset(&header, 0, sizeof(header));
+  header.msg_iov = parts;
+  header.msg_iovlen = 3;
+
+  while(!error && header.msg_iovlen > 0)
   {
-    if(send(sock, &(msg.length), sizeof(msg.length), 0))
-    {
-      if(!send(sock, msg.body, sizeof(char) * msg.length, 0))
-      { //failed to send body
-        error = true;
+    ssize_t sent = sendmsg(sock, &header, 0);
+
+    if(sent > 0)
+    { //skip past whatever was sent, which may end part way through a part
+      while(header.msg_iovlen > 0 && (size_t)sent >= header.msg_iov->iov_len)
+      {
+        sent -= header.msg_iov->iov_len;
+        header.msg_iov++;
+        header.msg_iovlen--;
       }
+
+      if(header.msg_iovlen > 0)
+      {
+        header.msg_iov->iov_base = (char*)header.msg_iov->iov_base + sent;
+        header.msg_iov->iov_len -= sent;
+      }
+    }
+    else if(sent < 0 && errno == EINTR)
+    { //interrupted before anything was sent, try again
+      error = false;
     }
     else
-    { //failed to send length
+    { //connection failed
       error = true;
     }
   }
-  else
-  { //failed to send command
-    error = true;
-  }
+
+  TRACE_END(traceStart, "send", "net");
 
   return !error;
 }
 
-/* recieveMessage
-*PURPOSE: Recieves the contents of a message from the socket connection and writes it into the Message struct at the pointer passed into it. It returns 'true' if an error occurs.
+/* recieveHeader
+*PURPOSE: Recieves the command and length of a message, but not its body, so
+*  the receiver can decide whether to accept a body of that length. Returns
+*  'true' if an error occurs.
 *INPUT: int sock descriptor
-*OUTPUTS: int error occured (boolean), Message msg
+*OUTPUTS: int error occured (boolean), Message* message (command and length)
 */
-int recieveMessage(Message *msg, int sock)
+int recieveHeader(Message *msg, int sock)
 {
   int error = false;
 
+  msg->body = NULL;
+  msg->ref = NULL;
+  msg->owner = BODY_STATIC; //nothing to release until the body is recieved
+
+  TRACE_BEGIN(traceStart);
+
   if(recv(sock, &(msg->command), sizeof(msg->command), MSG_WAITALL) == sizeof(msg->command))
   {
     if(recv(sock, &(msg->length), sizeof(msg->length), MSG_WAITALL) == sizeof(msg->length))
     {
-      msg->body = calloc(msg->length + 1, sizeof(char));
+      error = false;
+    }
+    else
+    { //failed to get length info
+      error = true;
+    }
+  }
+  else
+  { //failed to get command info or connection closed
+    error = true;
+  }
+
+  TRACE_END(traceStart, "recv", "net");
+
+  return !error;
+}
+
+/* recieveBody
+*PURPOSE: Allocates a buffer for the body of a message whose header has been
+*  recieved, from the pool if one is given, and recieves the body into it.
+*  Returns 'true' if an error occurs, in which case no buffer is left allocated.
+*INPUT: Message* message (command and length), int sock descriptor,
+*  BufferPool* pool (or NULL to calloc)
+*OUTPUTS: int error occured (boolean), Message* message (body)
+*/
+int recieveBody(Message *msg, int sock, BufferPool *pool)
+{
+  return recieveBodyProgress(msg, sock, pool, NULL, NULL);
+}
+
+/* recieveBodyProgress
+*PURPOSE: As recieveBody, but if progress is given, recieves the body
+*  RECV_PIECE bytes at a time, and calls progress with the body and the
+*  number of bytes recieved so far after each piece, so the body can be
+*  worked on as it arrives. If the body cannot be recieved, progress is
+*  called with a NULL body before the buffer is freed.
+*INPUT: Message* message (command and length), int sock descriptor,
+*  BufferPool* pool (or NULL to calloc), progress function (or NULL), void*
+*  argument to it
+*OUTPUTS: int error occured (boolean), Message* message (body)
+*/
+int recieveBodyProgress(Message *msg, int sock, BufferPool *pool, void (*progress)(void*, const char*, uint64_t), void *arg)
+{
+  int error = false;
+  uint64_t received = 0;
+
+  if(pool != NULL)
+  {
+    msg->body = poolAlloc(pool, msg->length + 1);
+    msg->owner = BODY_POOL;
+  }
+  else
+  {
+    msg->body = calloc(msg->length + 1, sizeof(char));
+    msg->owner = BODY_HEAP;
+  }
+
+  TRACE_BEGIN(traceStart);
+
+  //an empty body is not received at all, as a zero length recv() waits for a byte
+  while(!error && msg->body != NULL && received < msg->length)
+  {
+    uint64_t piece = msg->length - received;
+
+    if(progress != NULL && piece > RECV_PIECE)
+    {
+      piece = RECV_PIECE;
+    }
 
-      if(recv(sock, msg->body, sizeof(char) * msg->length, MSG_WAITALL) == sizeof(char) * msg->length)
+    if(recv(sock, msg->body + received, sizeof(char) * piece, MSG_WAITALL) == (ssize_t)(sizeof(char) * piece))
+    {
+      received += piece;
+
+      if(progress != NULL)
       {
-        msg->body[msg->length] = '\0'; //ensure null termination
-        error = false;
-      }
-      else
-      { //failed to get full body
-        error = true;
+        progress(arg, msg->body, received);
       }
     }
     else
-    { //failed to get length info
+    {
       error = true;
     }
   }
+
+  TRACE_END(traceStart, "recv", "net");
+
+  if(msg->body != NULL && !error)
+  {
+    msg->body[msg->length] = '\0'; //ensure null termination
+  }
   else
-  { //failed to get command info or connection closed
+  { //failed to allocate or get full body
     error = true;
   }
 
+  if(error && msg->body != NULL)
+  {
+    if(progress != NULL)
+    {
+      progress(arg, NULL, received);
+    }
+
+    if(msg->owner == BODY_POOL)
+    {
+      poolFree(pool, msg->body);
+    }
+    else
+    {
+      free(msg->body);
+    }
+  }
+
+  if(error)
+  {
+    msg->body = NULL;
+    msg->owner = BODY_STATIC;
+  }
+
   return !error;
 }
 
+/* recieveMessage
+*PURPOSE: Recieves a whole message, allocating its body from the pool if one
+*  is given. Returns 'true' if an error occurs.
+*INPUT: int sock descriptor, BufferPool* pool (or NULL to calloc)
+*OUTPUTS: int error occured (boolean), Message* message
+*/
+int recieveMessage(Message *msg, int sock, BufferPool *pool)
+{
+  int error = !recieveHeader(msg, sock) || !recieveBody(msg, sock, pool);
+
+  return !error;
+}
+
+/* poolAlloc
+*PURPOSE: Returns an uninitialised buffer of at least size bytes, reusing one
+*  of the pool's free buffers of the right size class when there is one.
+*  Buffers too large for any class are malloc'd and freed individually. Must
+*  be released with poolFree(). Returns NULL if allocation fails.
+*INPUT: BufferPool* pool, uint64_t size
+*OUTPUTS: char* buffer
+*/
+char *poolAlloc(BufferPool *pool, uint64_t size)
+{
+  int class = 0;
+  uint64_t classSize = POOL_MIN_SIZE;
+  char *block = NULL;
+
+  while(class < POOL_CLASSES && size > classSize)
+  {
+    class++;
+    classSize *= 16;
+  }
+
+  if(class < POOL_CLASSES && pool->free[class] != NULL)
+  { //reuse a free buffer
+    block = pool->free[class] - POOL_HEADER;
+    pool->free[class] = *(char**)(block + sizeof(int64_t));
+    pool->count[class]--;
+  }
+  else if(size < UINT64_MAX - POOL_HEADER && (block = malloc(POOL_HEADER + (class < POOL_CLASSES ? classSize : size))) != NULL)
+  {
+    *(int*)block = class; //remembered so poolFree() knows where it belongs
+  }
+
+  return block != NULL ? block + POOL_HEADER : NULL;
+}
+
+/* poolFree
+*PURPOSE: Returns a buffer from poolAlloc() to the pool, or frees it if the
+*  pool already holds enough buffers of its size (or it has no size class).
+*INPUT: BufferPool* pool, char* buffer
+*OUTPUTS: -
+*/
+void poolFree(BufferPool *pool, char *buffer)
+{
+  char *block = buffer - POOL_HEADER;
+  int class = *(int*)block;
+
+  if(class < POOL_CLASSES && pool->count[class] < POOL_KEEP)
+  {
+    *(char**)(block + sizeof(int64_t)) = pool->free[class];
+    pool->free[class] = buffer;
+    pool->count[class]++;
+  }
+  else
+  {
+    free(block);
+  }
+}
+
+/* poolDestroy
+*PURPOSE: Frees every free buffer held by the pool.
+*INPUT: BufferPool* pool
+*OUTPUTS: -
+*/
+void poolDestroy(BufferPool *pool)
+{
+  for(int class = 0; class < POOL_CLASSES; class++)
+  {
+    while(pool->free[class] != NULL)
+    {
+      char *block = pool->free[class] - POOL_HEADER;
+      pool->free[class] = *(char**)(block + sizeof(int64_t));
+      free(block);
+    }
+
+    pool->count[class] = 0;
+  }
+}
+
 /* writeFile
 *PURPOSE: Writes the file contents (of length as per the second parameter)
 *  into a file at the path filename. Returns 'true' if an error occurs.
@@ -88,6 +310,7 @@ int recieveMessage(Message *msg, int sock)
 */
 int writeFile(const char *const fileContents, const uint64_t length, const char *const filename)
 {
+  TRACE_BEGIN(traceStart);
   FILE *file = fopen(filename, "w");
   int error = false;
 
@@ -109,6 +332,8 @@ int writeFile(const char *const fileContents, const uint64_t length, const char
     error = true;
   }
 
+  TRACE_END(traceStart, "writeFile", "disk");
+
   return !error;
 }
 
@@ -121,6 +346,7 @@ int writeFile(const char *const fileContents, const uint64_t length, const char
 */
 int readFile(char **fileContents, uint64_t *length, const char *const filename)
 {
+  TRACE_BEGIN(traceStart);
   FILE *file = fopen(filename, "rb");
   int error = false;
 
@@ -155,5 +381,7 @@ int readFile(char **fileContents, uint64_t *length, const char *const filename)
     error = true;
   }
 
+  TRACE_END(traceStart, "readFile", "disk");
+
   return !error;
 }
@@ -1,12 +1,16 @@
 /* common.h
 *AUTHOR: Jhi Morris (19173632)
-*MODIFIED: 2020-09-12
+*MODIFIED: 2026-10-19
 *PURPOSE: Header for common.c. Provides many structs and defines used by server and client executables.
 */
 
+#ifndef COMMON_H
+#define COMMON_H
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 #include <netinet/in.h>
@@ -14,10 +18,13 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <signal.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include "trace.h"
 
 #define MAXPATHLENGTH 4096
 #define MAXPATHLENGTHSTR "4096"
-#define KEYLENGTH 33 //128bit MD5, represented in hex as 32 chars, with a null terminator
+#define KEYLENGTH 36 //longest key: a 3 char algorithm tag, 128 bits in hex as 32 chars, and a null terminator
 
 //COMMAND defines
 #define COMMANDMIN 1
@@ -29,22 +36,67 @@
 #define FILECONT 6 //file content response
 #define MESSAGE 7 //message response
 #define DISCON 8 //message + disconnect notice
-#define COMMANDMAX 8
+#define LIST 9
+#define EVENTS 10
+#define EXPIRE 11
+#define COMMANDMAX 11
 
 //used for string comparison. commands[i] should match above defines name and value
 extern const char* const commands[];
 extern const size_t commandsLen;
 
+//body ownership defines, used to release a Message body correctly once sent
+#define BODY_HEAP 0 //calloc'd, free()'d
+#define BODY_STATIC 1 //constant string, never freed
+#define BODY_POOL 2 //from a BufferPool, returned with poolFree()
+#define BODY_SHARED 3 //server only: borrowed from the refcounted buffer at ref
+
+#define POOL_CLASSES 3 //size classes of recycled buffers
+#define POOL_MIN_SIZE 256 //smallest class, each class is 16 times the last (256B, 4KiB, 64KiB)
+#define POOL_KEEP 4 //free buffers kept per class
+#define POOL_HEADER 16 //bytes before each buffer recording its class and, while free, the next free buffer
+
+#define RECV_PIECE (1024 * 1024) //bytes received between progress reports
+
+#define LIST_MAX_KEYS 1000 //keys in one LIST response
+#define EVENTS_MAX 1000 //events in one EVENTS response
+#define HISTORY_MAX 1000 //events in one HISTORY response, a file's STORE and its newest
+
 typedef struct Message {
   uint8_t command;
   uint64_t length;
   char *body;
+  uint8_t owner; //BODY_ define
+  void *ref; //shared buffer the body belongs to, if owner is BODY_SHARED
 } Message;
 
+//builds a Message around a string literal, eg for constant responses
+#define STATIC_MESSAGE(cmd, text) {cmd, sizeof(text), (char*)(text), BODY_STATIC, NULL}
+
+typedef struct BufferPool
+{ //per-connection free lists of message buffers, so repeat requests do not malloc
+  char *free[POOL_CLASSES]; //each free buffer holds the next one at its start
+  int count[POOL_CLASSES];
+} BufferPool;
+
 int writeFile(const char* const fileContents, const uint64_t length, const char* const filename);
 
 int readFile(char** fileContents, uint64_t* length, const char* const filename);
 
 int sendMessage(const Message msg, int sock);
 
-int recieveMessage(Message* msg, int sock);
+int recieveHeader(Message* msg, int sock);
+
+int recieveBody(Message* msg, int sock, BufferPool* pool);
+
+int recieveBodyProgress(Message* msg, int sock, BufferPool* pool, void (*progress)(void*, const char*, uint64_t), void* arg);
+
+int recieveMessage(Message* msg, int sock, BufferPool* pool);
+
+char *poolAlloc(BufferPool* pool, uint64_t size);
+
+void poolFree(BufferPool* pool, char* buffer);
+
+void poolDestroy(BufferPool* pool);
+
+#endif
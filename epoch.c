@@ -0,0 +1,180 @@
+/* epoch.c
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Epoch based reclamation for the file index, so that GET and HISTORY
+*  can find nodes without taking the file list lock. A reader counts itself in
+*  a slot for the current epoch's parity while it uses the index, and out
+*  again afterwards. A writer which has unlinked a node (under the lock, as
+*  before) calls epochSynchronize() before freeing it: that advances the epoch
+*  so new readers count themselves under the other parity, and waits for both
+*  parities to drain, by which time every reader which could have found the
+*  node has finished with it. Readers never wait on anything, and only write
+*  to their own thread's slot, so they do not contend with each other.
+*  Based on the counter pairs of sleepable RCU in the Linux kernel.
+*
+*  In prefork mode the slots are divided between the worker processes, and the
+*  supervisor clears a worker's slots once it has died, so a worker killed
+*  partway through a read cannot leave writers waiting forever.
+*/
+
+#include "epoch.h"
+#include "arena.h"
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+
+static int owner = 0; //worker process number of this process
+static unsigned int assigned = 0; //reader threads given a slot in this process
+static __thread int slot = -1; //this thread's
+
+/* readers
+*PURPOSE: Returns how many readers are counted under one parity.
+*INPUT: EpochDomain* domain, int parity
+*OUTPUTS: uint64_t readers
+*/
+static uint64_t readers(EpochDomain *domain, int parity)
+{
+  uint64_t count = 0;
+
+  for(int i = 0; i < EPOCH_SLOTS; i++)
+  {
+    count += __atomic_load_n(&(domain->slots[i].active[parity]), __ATOMIC_SEQ_CST);
+  }
+
+  return count;
+}
+
+/* drain
+*PURPOSE: Waits until no reader is counted under the parity, yielding at
+*  first, then sleeping between checks for readers in the middle of long reads.
+*INPUT: EpochDomain* domain, int parity
+*OUTPUTS: -
+*/
+static void drain(EpochDomain *domain, int parity)
+{
+  struct timespec pause = {0, EPOCH_SLEEP * 1000};
+  int spins = 0;
+
+  while(readers(domain, parity) > 0)
+  {
+    if(spins++ < EPOCH_SPINS)
+    {
+      sched_yield();
+    }
+    else
+    {
+      nanosleep(&pause, NULL);
+    }
+  }
+}
+
+/* epochCreate
+*PURPOSE: Creates a domain with its slots divided between the given number of
+*  worker processes. With shared set, the domain is mapped so that processes
+*  forked afterwards share it. Returns NULL if it cannot be mapped.
+*INPUT: int processes, int shared (boolean)
+*OUTPUTS: EpochDomain* domain
+*/
+EpochDomain *epochCreate(int processes, int shared)
+{
+  EpochDomain *domain = mmap(NULL, sizeof(EpochDomain), PROT_READ | PROT_WRITE, (shared ? MAP_SHARED : MAP_PRIVATE) | MAP_ANONYMOUS, -1, 0);
+
+  if(domain == MAP_FAILED)
+  {
+    domain = NULL;
+  }
+  else
+  { //anonymous mappings start zeroed
+    arenaMutexInit(&(domain->mutex), shared);
+    domain->slotsEach = EPOCH_SLOTS / (processes > 0 ? processes : 1);
+  }
+
+  return domain;
+}
+
+/* epochJoin
+*PURPOSE: Sets which worker process this is, and so which slots its threads
+*  read in. Called in each worker as it starts.
+*INPUT: int process number, from 0
+*OUTPUTS: -
+*/
+void epochJoin(int process)
+{
+  owner = process;
+}
+
+/* epochRelease
+*PURPOSE: Clears the slots of a worker process which has died, which may have
+*  been partway through reads that will now never finish.
+*INPUT: EpochDomain* domain, int process number
+*OUTPUTS: -
+*/
+void epochRelease(EpochDomain *domain, int process)
+{
+  for(int i = process * domain->slotsEach; i < (process + 1) * domain->slotsEach; i++)
+  {
+    __atomic_store_n(&(domain->slots[i].active[0]), 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&(domain->slots[i].active[1]), 0, __ATOMIC_SEQ_CST);
+  }
+}
+
+/* epochEnter
+*PURPOSE: Begins a read. Nodes found in the index from here until the matching
+*  epochExit() will not be freed meanwhile. Returns a token for epochExit().
+*INPUT: EpochDomain* domain
+*OUTPUTS: int token
+*/
+int epochEnter(EpochDomain *domain)
+{
+  if(slot == -1)
+  { //threads are spread over this process's slots as they first read
+    slot = owner * domain->slotsEach + __atomic_fetch_add(&assigned, 1, __ATOMIC_RELAXED) % domain->slotsEach;
+  }
+
+  int parity = __atomic_load_n(&(domain->epoch), __ATOMIC_RELAXED) & 1;
+
+  //sequentially consistent, so either a writer's check sees this count, or this read sees that writer's unlink
+  __atomic_fetch_add(&(domain->slots[slot].active[parity]), 1, __ATOMIC_SEQ_CST);
+
+  return slot * 2 + parity;
+}
+
+/* epochExit
+*PURPOSE: Ends a read begun by epochEnter(). Nothing found during it may be
+*  used afterwards.
+*INPUT: EpochDomain* domain, int token
+*OUTPUTS: -
+*/
+void epochExit(EpochDomain *domain, int token)
+{
+  __atomic_fetch_sub(&(domain->slots[token / 2].active[token % 2]), 1, __ATOMIC_RELEASE);
+}
+
+/* epochSynchronize
+*PURPOSE: Returns once every read which began before the call has ended, so
+*  anything unlinked from the index beforehand can be freed. Must not be called
+*  during a read, which it would wait for, and is best called with the file
+*  list unlocked, as it takes as long as the slowest read in progress.
+*INPUT: EpochDomain* domain
+*OUTPUTS: -
+*/
+void epochSynchronize(EpochDomain *domain)
+{
+  struct timespec start;
+  struct timespec end;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  arenaLock(&(domain->mutex));
+
+  int parity = domain->epoch & 1;
+
+  drain(domain, parity ^ 1); //readers which read the epoch before it last advanced, but were counted after
+  __atomic_store_n(&(domain->epoch), domain->epoch + 1, __ATOMIC_SEQ_CST);
+  drain(domain, parity); //new readers are counted under the other parity, so this finishes
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  __atomic_fetch_add(&(domain->waits), 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&(domain->waited), (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000, __ATOMIC_RELAXED);
+
+  pthread_mutex_unlock(&(domain->mutex));
+}
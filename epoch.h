@@ -0,0 +1,48 @@
+/* epoch.h
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Header for epoch.c. Lets requests read the file index without its
+*  lock, by making whoever removes a node wait until no reader can still be
+*  using it before it is freed.
+*/
+
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define EPOCH_SLOTS 256 //reader counters, divided between the worker processes
+#define EPOCH_LINE 64 //bytes, each slot has a cache line of its own
+#define EPOCH_SPINS 100 //yields while waiting for readers, before sleeping between checks
+#define EPOCH_SLEEP 100 //microseconds
+
+typedef struct EpochSlot
+{ //readers which entered while the epoch was even, and odd
+  uint64_t active[2];
+  char pad[EPOCH_LINE - 2 * sizeof(uint64_t)];
+} EpochSlot;
+
+typedef struct EpochDomain
+{ //in its own mapping, shared by every worker process in prefork mode
+  EpochSlot slots[EPOCH_SLOTS]; //first, so each is aligned to a cache line like the mapping
+  pthread_mutex_t mutex; //held by a writer while it waits for readers
+  uint64_t epoch;
+  int slotsEach; //slots belonging to each worker process
+  uint64_t waits; //grace periods waited for, statistics
+  uint64_t waited; //microseconds spent waiting, statistics
+} EpochDomain;
+
+EpochDomain *epochCreate(int processes, int shared);
+
+void epochJoin(int process);
+
+void epochRelease(EpochDomain* domain, int process);
+
+int epochEnter(EpochDomain* domain);
+
+void epochExit(EpochDomain* domain, int token);
+
+void epochSynchronize(EpochDomain* domain);
+
+#endif
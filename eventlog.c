@@ -0,0 +1,491 @@
+/* eventlog.c
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: The event log: every STORE, GET, HISTORY and DELETE of a file, as
+*  (time, command, file number, client address), numbered in order by a seq.
+*  Events are kept in columns, in segments of EVENT_SEGMENT consecutive events
+*  held in a ring, so the log's memory is fixed and the oldest segment is
+*  overwritten once the ring is full. Each segment partitions the log by time:
+*  once full it is sealed with the earliest and latest time of its events, and
+*  a query by time skips any sealed segment outside its range, and scans the
+*  time column of the rest with vector instructions.
+*  Two secondary indexes are threaded through the log: each event links to the
+*  file's previous event, from the newest one recorded in the file's node, so
+*  HISTORY follows the file's events without scanning, and to the previous
+*  event from the same client address, from the newest one recorded in an
+*  index of addresses, so a query by address does the same.
+*
+*  Appending takes no lock: a seq is reserved with an atomic add, the row is
+*  written with its stamp cleared, and the stamp (the segment number) is set
+*  last, so a reader copying a row checks the stamp before and after and
+*  ignores a row being written or already overwritten. The event is then
+*  linked into its two chains with compare and swap, in seq order.
+*/
+
+#include "eventlog.h"
+#include <stdbool.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define EVENT_LANES 8 //times compared at once, in 256 bits
+#define EVENT_BLOCK 64 //rows whose matches are the bits of one word
+
+typedef uint32_t TimeLanes __attribute__((vector_size(EVENT_LANES * sizeof(uint32_t))));
+
+static void (*scanTimes)(const uint32_t*, uint64_t, uint32_t, uint32_t, uint64_t*) = NULL;
+static const char *implementation = NULL;
+static pthread_once_t selected = PTHREAD_ONCE_INIT;
+
+/* scanBody
+*PURPOSE: Compares blocks of EVENT_BLOCK times with a range, setting a bit of
+*  each block's word for every time in the range, EVENT_LANES times at once.
+*INPUT: uint32_t* times, uint64_t blocks, uint32_t from, uint32_t to
+*OUTPUTS: uint64_t matches[blocks]
+*/
+static inline __attribute__((always_inline)) void scanBody(const uint32_t *times, uint64_t blocks, uint32_t from, uint32_t to, uint64_t *matches)
+{
+  TimeLanes lo = {0};
+  TimeLanes hi = {0};
+
+  lo += from;
+  hi += to;
+
+  for(uint64_t b = 0; b < blocks; b++)
+  {
+    uint64_t bits = 0;
+
+    for(int v = 0; v < EVENT_BLOCK / EVENT_LANES; v++)
+    {
+      TimeLanes t;
+
+      memcpy(&t, times + b * EVENT_BLOCK + v * EVENT_LANES, sizeof(t));
+      TimeLanes in = (TimeLanes)((t >= lo) & (t <= hi)); //lanes of all ones or zeros
+
+      for(int i = 0; i < EVENT_LANES; i++)
+      {
+        bits |= (uint64_t)(in[i] & 1) << (v * EVENT_LANES + i);
+      }
+    }
+
+    matches[b] = bits;
+  }
+}
+
+#if defined(__x86_64__)
+/* scanAvx2
+*PURPOSE: scanBody, with the lanes in 256 bit AVX2 registers.
+*INPUT: uint32_t* times, uint64_t blocks, uint32_t from, uint32_t to
+*OUTPUTS: uint64_t matches[blocks]
+*/
+__attribute__((target("avx2"))) static void scanAvx2(const uint32_t *times, uint64_t blocks, uint32_t from, uint32_t to, uint64_t *matches)
+{
+  scanBody(times, blocks, from, to, matches);
+}
+#endif
+
+/* scanGeneric
+*PURPOSE: scanBody, with the lanes in whatever vectors the baseline
+*  instruction set has (a pair of SSE2 registers on x86-64), or in scalars.
+*INPUT: uint32_t* times, uint64_t blocks, uint32_t from, uint32_t to
+*OUTPUTS: uint64_t matches[blocks]
+*/
+static void scanGeneric(const uint32_t *times, uint64_t blocks, uint32_t from, uint32_t to, uint64_t *matches)
+{
+  scanBody(times, blocks, from, to, matches);
+}
+
+/* selectScan
+*PURPOSE: Chooses the widest variant of scanTimes the CPU supports. Run once.
+*INPUT: -
+*OUTPUTS: -
+*/
+static void selectScan(void)
+{
+  scanTimes = scanGeneric;
+#if defined(__x86_64__)
+  implementation = "sse2";
+
+  __builtin_cpu_init();
+
+  if(__builtin_cpu_supports("avx2"))
+  {
+    scanTimes = scanAvx2;
+    implementation = "avx2";
+  }
+#else
+  implementation = "generic";
+#endif
+}
+
+/* eventImplementation
+*PURPOSE: Returns the name of the instruction set times are scanned with.
+*INPUT: -
+*OUTPUTS: char* name
+*/
+const char *eventImplementation(void)
+{
+  pthread_once(&selected, selectScan);
+
+  return implementation;
+}
+
+/* addressHash
+*PURPOSE: Returns where in the address index an address is first looked for.
+*INPUT: struct in6_addr* IP
+*OUTPUTS: uint32_t entry
+*/
+static uint32_t addressHash(const struct in6_addr *ip)
+{
+  uint64_t a;
+  uint64_t b;
+
+  memcpy(&a, ip->s6_addr, sizeof(a));
+  memcpy(&b, ip->s6_addr + sizeof(a), sizeof(b));
+
+  a ^= b * 0x9e3779b97f4a7c15ULL;
+  a ^= a >> 33; //the finalizer of MurmurHash3, so every byte reaches the top bits
+  a *= 0xff51afd7ed558ccdULL;
+  a ^= a >> 33;
+  a *= 0xc4ceb9fe1a85ec53ULL;
+  a ^= a >> 33;
+
+  return (uint32_t)(a % EVENT_ADDRESSES);
+}
+
+/* findAddress
+*PURPOSE: Returns the entry of the address index holding an address, claiming
+*  an unused one for it if create is set. Returns EVENT_NO_ADDRESS if it is not
+*  in the index, or the index is full. An entry left half claimed by a worker
+*  which died is passed over once it has been waited for.
+*INPUT: EventLog* log, struct in6_addr* IP, int create (boolean)
+*OUTPUTS: uint32_t entry
+*/
+static uint32_t findAddress(EventLog *log, const struct in6_addr *ip, int create)
+{
+  uint32_t found = EVENT_NO_ADDRESS;
+  uint32_t i = addressHash(ip);
+  uint32_t probes = 0;
+
+  while(found == EVENT_NO_ADDRESS && probes < EVENT_ADDRESSES)
+  {
+    EventAddress *entry = &(log->addresses[i]);
+    uint32_t state = __atomic_load_n(&(entry->state), __ATOMIC_ACQUIRE);
+    int spins = 0;
+
+    while(state == 1 && spins < EVENT_SPINS)
+    { //being claimed
+      sched_yield();
+      state = __atomic_load_n(&(entry->state), __ATOMIC_ACQUIRE);
+      spins++;
+    }
+
+    if(state == 0 && !create)
+    { //the end of its probe sequence
+      probes = EVENT_ADDRESSES;
+    }
+    else if(state == 0 && __atomic_compare_exchange_n(&(entry->state), &state, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+    {
+      entry->ip = *ip;
+      __atomic_store_n(&(entry->state), 2, __ATOMIC_RELEASE);
+      found = i;
+    }
+    else if(state == 2 && !memcmp(&(entry->ip), ip, sizeof(*ip)))
+    {
+      found = i;
+    }
+    else if(state == 2 || spins == EVENT_SPINS)
+    { //another address's
+      i = (i + 1) % EVENT_ADDRESSES;
+      probes++;
+    } //otherwise claimed by another thread meanwhile, and looked at again
+  }
+
+  return found;
+}
+
+/* prevOf
+*PURPOSE: Returns the field of an event linking to the previous event of its
+*  file, or of its address.
+*INPUT: EventLog* log, uint64_t seq, int byAddress (boolean)
+*OUTPUTS: uint64_t* link
+*/
+static uint64_t *prevOf(EventLog *log, uint64_t seq, int byAddress)
+{
+  EventSegment *segment = &(log->ring[(seq >> EVENT_SEGMENT_BITS) % log->segments]);
+  uint32_t row = seq & (EVENT_SEGMENT - 1);
+
+  return byAddress ? &(segment->addressPrev[row]) : &(segment->filePrev[row]);
+}
+
+/* chain
+*PURPOSE: Links an event into a chain kept newest first: normally at its head,
+*  but after any newer event which was linked first.
+*INPUT: EventLog* log, uint64_t* head of the chain, uint64_t seq, int byAddress
+*  (boolean), which of the event's links the chain uses
+*OUTPUTS: -
+*/
+static void chain(EventLog *log, uint64_t *head, uint64_t seq, int byAddress)
+{
+  uint64_t *at = head;
+  uint64_t *prev = prevOf(log, seq, byAddress);
+  uint64_t next = __atomic_load_n(at, __ATOMIC_ACQUIRE);
+  int linked = false;
+
+  while(!linked)
+  {
+    if(next > seq + 1)
+    { //a newer event, which is not overwritten before this one
+      at = prevOf(log, next - 1, byAddress);
+      next = __atomic_load_n(at, __ATOMIC_ACQUIRE);
+    }
+    else
+    { //released, so the link is seen once the event can be reached; on failure next is reloaded
+      __atomic_store_n(prev, next, __ATOMIC_RELAXED);
+      linked = __atomic_compare_exchange_n(at, &next, seq + 1, false, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE);
+    }
+  }
+}
+
+/* seal
+*PURPOSE: Sets the time bounds of a segment which has just been filled, once
+*  every event in it has been written. A segment with an event which is never
+*  finished (its worker died) is left unsealed, and always scanned.
+*INPUT: EventLog* log, uint64_t number of the segment
+*OUTPUTS: -
+*/
+static void seal(EventLog *log, uint64_t number)
+{
+  EventSegment *segment = &(log->ring[number % log->segments]);
+  uint32_t first = UINT32_MAX;
+  uint32_t last = 0;
+  int written = true;
+
+  for(uint32_t row = 0; written && row < EVENT_SEGMENT; row++)
+  {
+    int spins = 0;
+
+    while(__atomic_load_n(&(segment->stamp[row]), __ATOMIC_ACQUIRE) != (uint32_t)number + 1 && spins < EVENT_SPINS)
+    {
+      sched_yield();
+      spins++;
+    }
+
+    written = spins < EVENT_SPINS;
+    first = segment->time[row] < first ? segment->time[row] : first;
+    last = segment->time[row] > last ? segment->time[row] : last;
+  }
+
+  if(written)
+  {
+    segment->first = first;
+    segment->last = last;
+    __atomic_store_n(&(segment->sealed), number + 1, __ATOMIC_RELEASE);
+  }
+}
+
+/* eventCreate
+*PURPOSE: Creates an empty log holding at least capacity events (whole
+*  segments, at least two), and its address index. With shared set, the log is
+*  mapped so that processes forked afterwards share it. Pages are only backed
+*  once used. Returns NULL if it cannot be mapped.
+*INPUT: uint64_t capacity, int shared (boolean)
+*OUTPUTS: EventLog* log
+*/
+EventLog *eventCreate(uint64_t capacity, int shared)
+{
+  uint64_t segments = (capacity + EVENT_SEGMENT - 1) / EVENT_SEGMENT;
+  size_t header = (sizeof(EventLog) + sizeof(EventAddress) * EVENT_ADDRESSES + 63) / 64 * 64;
+  EventLog *log;
+
+  segments = segments < 2 ? 2 : segments;
+  log = mmap(NULL, header + segments * sizeof(EventSegment), PROT_READ | PROT_WRITE, (shared ? MAP_SHARED : MAP_PRIVATE) | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+  if(log == MAP_FAILED)
+  {
+    log = NULL;
+  }
+  else
+  { //anonymous mappings start zeroed, so every row's stamp is unset
+    log->segments = segments;
+    log->addresses = (EventAddress*)(log + 1);
+    log->ring = (EventSegment*)((char*)log + header);
+    eventImplementation();
+  }
+
+  return log;
+}
+
+/* eventAppend
+*PURPOSE: Records an event, and links it to the file's previous event through
+*  head, which it then becomes, and to its address's previous event.
+*INPUT: EventLog* log, uint8_t command, uint32_t file number, uint64_t* head
+*  of the file's events, struct in6_addr IP, time_t time
+*OUTPUTS: -
+*/
+void eventAppend(EventLog *log, uint8_t command, uint32_t file, uint64_t *head, struct in6_addr ip, time_t when)
+{
+  uint64_t seq = __atomic_fetch_add(&(log->next), 1, __ATOMIC_RELAXED);
+  uint64_t number = seq >> EVENT_SEGMENT_BITS;
+  EventSegment *segment = &(log->ring[number % log->segments]);
+  uint32_t row = seq & (EVENT_SEGMENT - 1);
+  uint32_t address = findAddress(log, &ip, true);
+
+  //cleared first, so a reader never takes the row's old event for this one
+  __atomic_store_n(&(segment->stamp[row]), 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  segment->time[row] = (uint32_t)when;
+  segment->command[row] = command;
+  segment->file[row] = file;
+  segment->address[row] = address;
+  segment->filePrev[row] = 0;
+  segment->addressPrev[row] = 0;
+  __atomic_store_n(&(segment->stamp[row]), (uint32_t)number + 1, __ATOMIC_RELEASE);
+
+  chain(log, head, seq, false);
+
+  if(address != EVENT_NO_ADDRESS)
+  {
+    chain(log, &(log->addresses[address].last), seq, true);
+  }
+
+  if(row == EVENT_SEGMENT - 1)
+  {
+    seal(log, number);
+  }
+}
+
+/* eventRead
+*PURPOSE: Copies an event out of the log. Returns 'false' if it has been
+*  overwritten, or is still being written.
+*INPUT: EventLog* log, uint64_t seq
+*OUTPUTS: int held (boolean), Event* event
+*/
+int eventRead(EventLog *log, uint64_t seq, Event *event)
+{
+  uint64_t number = seq >> EVENT_SEGMENT_BITS;
+  EventSegment *segment = &(log->ring[number % log->segments]);
+  uint32_t row = seq & (EVENT_SEGMENT - 1);
+  int held = __atomic_load_n(&(segment->stamp[row]), __ATOMIC_ACQUIRE) == (uint32_t)number + 1;
+
+  if(held)
+  {
+    uint32_t address = segment->address[row];
+
+    event->seq = seq;
+    event->time = segment->time[row];
+    event->command = segment->command[row];
+    event->file = segment->file[row];
+    event->filePrev = __atomic_load_n(&(segment->filePrev[row]), __ATOMIC_ACQUIRE);
+    event->addressPrev = __atomic_load_n(&(segment->addressPrev[row]), __ATOMIC_ACQUIRE);
+    event->ip = address < EVENT_ADDRESSES ? log->addresses[address].ip : in6addr_any; //entries in use never change
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    held = __atomic_load_n(&(segment->stamp[row]), __ATOMIC_RELAXED) == (uint32_t)number + 1;
+  }
+
+  return held;
+}
+
+/* queryAddress
+*PURPOSE: eventQuery() for one address, following its chain from the newest
+*  event back to the first before the range. As events can be recorded up to
+*  EVENT_SKEW seconds out of order, the chain is followed that far past it.
+*INPUT: EventLog* log, EventQuery* query, int max
+*OUTPUTS: int count, Event* events
+*/
+static int queryAddress(EventLog *log, const EventQuery *query, Event *events, int max)
+{
+  uint32_t address = findAddress(log, &(query->ip), false);
+  uint64_t next = address == EVENT_NO_ADDRESS ? 0 : __atomic_load_n(&(log->addresses[address].last), __ATOMIC_ACQUIRE);
+  int count = 0;
+  Event event;
+
+  while(next != 0 && count < max && eventRead(log, next - 1, &event))
+  {
+    if(event.seq < query->before && event.time >= query->from && event.time <= query->to)
+    {
+      events[count++] = event;
+    }
+
+    next = (uint64_t)event.time + EVENT_SKEW < query->from ? 0 : event.addressPrev;
+  }
+
+  return count;
+}
+
+/* eventQuery
+*PURPOSE: Copies out up to max events, newest first, recorded in the time
+*  range, with a seq below query->before, and from the address if byAddress
+*  is set. Returns how many were copied. Without an address, every segment is
+*  looked at, newest first, and those not skipped by their bounds have their
+*  time column scanned.
+*INPUT: EventLog* log, EventQuery* query, int max
+*OUTPUTS: int count, Event* events
+*/
+int eventQuery(EventLog *log, const EventQuery *query, Event *events, int max)
+{
+  uint64_t matches[EVENT_SEGMENT / EVENT_BLOCK];
+  uint64_t next = __atomic_load_n(&(log->next), __ATOMIC_ACQUIRE);
+  uint64_t held = log->segments << EVENT_SEGMENT_BITS;
+  uint64_t oldest = next > held ? next - held : 0;
+  uint64_t end = query->before < next ? query->before : next; //seqs below it are looked at
+  uint64_t number = end > 0 ? (end - 1) >> EVENT_SEGMENT_BITS : 0;
+  int scanning = end > oldest && query->from <= query->to;
+  int count = 0;
+  Event event;
+
+  if(query->byAddress)
+  {
+    count = queryAddress(log, query, events, max);
+    scanning = false;
+  }
+
+  while(scanning && count < max)
+  {
+    EventSegment *segment = &(log->ring[number % log->segments]);
+    uint64_t base = number << EVENT_SEGMENT_BITS;
+    uint32_t rowLo = oldest > base ? oldest - base : 0;
+    uint32_t rowHi = end < base + EVENT_SEGMENT ? end - base : EVENT_SEGMENT;
+    int skip = false;
+
+    if(__atomic_load_n(&(segment->sealed), __ATOMIC_ACQUIRE) == number + 1)
+    { //checked again, in case the segment was overwritten and sealed meanwhile
+      skip = segment->first > query->to || segment->last < query->from;
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      skip = skip && __atomic_load_n(&(segment->sealed), __ATOMIC_RELAXED) == number + 1;
+    }
+
+    if(!skip)
+    {
+      uint32_t blockLo = rowLo / EVENT_BLOCK;
+      uint32_t blockHi = (rowHi + EVENT_BLOCK - 1) / EVENT_BLOCK;
+
+      scanTimes(segment->time + blockLo * EVENT_BLOCK, blockHi - blockLo, query->from, query->to, matches);
+
+      for(uint32_t b = blockHi; b > blockLo && count < max; b--)
+      {
+        uint64_t bits = matches[b - 1 - blockLo];
+
+        while(bits != 0 && count < max)
+        {
+          int bit = 63 - __builtin_clzll(bits);
+          uint32_t row = (b - 1) * EVENT_BLOCK + bit;
+
+          bits &= ~(1ULL << bit);
+
+          //the row may be outside the part looked at, or rewritten since it was scanned
+          if(row >= rowLo && row < rowHi && eventRead(log, base + row, &event) && event.time >= query->from && event.time <= query->to)
+          {
+            events[count++] = event;
+          }
+        }
+      }
+    }
+
+    scanning = number > (oldest >> EVENT_SEGMENT_BITS);
+    number--;
+  }
+
+  return count;
+}
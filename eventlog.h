@@ -0,0 +1,82 @@
+/* eventlog.h
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Header for eventlog.c. An append-only log of every operation on a
+*  file, kept in columns, which both HISTORY and EVENTS are answered from.
+*/
+
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+#include <stdint.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#define DEFAULT_EVENT_CAPACITY (4 * 1024 * 1024) //events kept before the oldest are dropped
+#define EVENT_SEGMENT_BITS 16
+#define EVENT_SEGMENT (1 << EVENT_SEGMENT_BITS) //events in each segment
+#define EVENT_ADDRESSES (1 << 16) //client addresses indexed, later ones are recorded as unknown
+#define EVENT_NO_ADDRESS UINT32_MAX
+#define EVENT_SKEW 5 //seconds an event may be recorded out of order, see eventQuery()
+#define EVENT_SPINS 1000 //yields waited for a row or address another thread is writing
+
+typedef struct EventAddress
+{ //an entry of the address index
+  struct in6_addr ip;
+  uint64_t last; //seq + 1 of the newest event from the address, 0 if none
+  uint32_t state; //0 unused, 1 being claimed, 2 in use
+} EventAddress;
+
+typedef struct EventSegment
+{ //one partition of the log, EVENT_SEGMENT consecutive events in columns
+  uint64_t sealed; //segment number + 1 once full and its time bounds are set
+  uint32_t first; //earliest and latest time of its events, once sealed
+  uint32_t last;
+  uint32_t stamp[EVENT_SEGMENT]; //segment number + 1 of the event in the row, written last, 0 while being written
+  uint32_t time[EVENT_SEGMENT]; //seconds since 1970
+  uint32_t file[EVENT_SEGMENT]; //number the file was stored as
+  uint32_t address[EVENT_SEGMENT]; //entry in the address index, or EVENT_NO_ADDRESS
+  uint64_t filePrev[EVENT_SEGMENT]; //seq + 1 of the file's previous event, 0 if none
+  uint64_t addressPrev[EVENT_SEGMENT]; //seq + 1 of the address's previous event, 0 if none
+  uint8_t command[EVENT_SEGMENT];
+} EventSegment;
+
+typedef struct EventLog
+{ //in its own mapping, shared by every worker process in prefork mode
+  uint64_t next; //seq of the next event
+  uint64_t segments; //in the ring, the log holds this many times EVENT_SEGMENT events
+  EventAddress* addresses; //EVENT_ADDRESSES of them, open addressed
+  EventSegment* ring; //segment n is at n % segments
+} EventLog;
+
+typedef struct Event
+{ //one event, copied out of the columns
+  uint64_t seq;
+  uint32_t time;
+  uint8_t command;
+  uint32_t file;
+  struct in6_addr ip; //unspecified if not indexed
+  uint64_t filePrev;
+  uint64_t addressPrev;
+} Event;
+
+typedef struct EventQuery
+{
+  uint32_t from; //time range, inclusive
+  uint32_t to;
+  int byAddress; //boolean, only events from ip
+  struct in6_addr ip;
+  uint64_t before; //only events with a lower seq
+} EventQuery;
+
+EventLog *eventCreate(uint64_t capacity, int shared);
+
+void eventAppend(EventLog* log, uint8_t command, uint32_t file, uint64_t* head, struct in6_addr ip, time_t when);
+
+int eventRead(EventLog* log, uint64_t seq, Event* event);
+
+int eventQuery(EventLog* log, const EventQuery* query, Event* events, int max);
+
+const char *eventImplementation(void);
+
+#endif
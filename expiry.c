@@ -0,0 +1,108 @@
+/* expiry.c
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Keeps the times files expire at in a hashed timer wheel: a ring of
+*  EXPIRY_SLOTS lists, one per second, each holding the entries expiring in
+*  that second of every turn of the wheel. Adding an entry is a push onto its
+*  slot's list, and finding the entries which are due looks through the slots
+*  of the seconds which have passed since it was last asked, so no more work is
+*  done than there are expiries (plus one step per second), however many files
+*  there are. An entry is never searched for: one made stale by its file being
+*  deleted, or given a new time to live, is dropped when its slot comes round.
+*/
+
+#include "expiry.h"
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+/* expiryCreate
+*PURPOSE: Creates an empty wheel, starting from the current second. With
+*  shared set, the wheel is mapped so that processes forked afterwards share
+*  it. Returns NULL if it cannot be mapped.
+*INPUT: int shared (boolean)
+*OUTPUTS: ExpiryWheel* wheel
+*/
+ExpiryWheel *expiryCreate(int shared)
+{
+  ExpiryWheel *wheel = mmap(NULL, sizeof(ExpiryWheel), PROT_READ | PROT_WRITE, (shared ? MAP_SHARED : MAP_PRIVATE) | MAP_ANONYMOUS, -1, 0);
+
+  if(wheel == MAP_FAILED)
+  {
+    wheel = NULL;
+  }
+  else
+  { //anonymous mappings start zeroed, so every slot is empty
+    wheel->next = time(NULL);
+  }
+
+  return wheel;
+}
+
+/* expiryAdd
+*PURPOSE: Adds an entry for a file expiring at the given time. An entry for a
+*  second whose slot has been (or is being) looked through is put in the slot
+*  after, so it is found on this turn rather than the next. Returns 'false' if
+*  there is no room for the entry.
+*INPUT: ExpiryWheel* wheel, SharedArena* arena (may be NULL), uint32_t file
+*  number, uint8_t key[HASH_KEY_BYTES], uint32_t expires
+*OUTPUTS: int added (boolean)
+*/
+int expiryAdd(ExpiryWheel *wheel, SharedArena *arena, uint32_t id, const uint8_t *key, uint32_t expires)
+{ //mutex for this function handled by calling function
+  ExpiryEntry *entry = arenaAlloc(arena, sizeof(ExpiryEntry));
+
+  if(entry != NULL)
+  {
+    uint32_t slot = (expires > wheel->next ? expires : wheel->next + 1) % EXPIRY_SLOTS;
+
+    entry->id = id;
+    entry->expires = expires;
+    memcpy(entry->key, key, HASH_KEY_BYTES);
+    entry->next = wheel->slots[slot];
+    wheel->slots[slot] = entry;
+    wheel->count++;
+  }
+
+  return entry != NULL;
+}
+
+/* expiryDue
+*PURPOSE: Takes up to max entries which have expired by now out of the wheel,
+*  looking through the slots of the seconds up to now, and returns how many
+*  were taken. At most EXPIRY_BATCH entries and slots are looked at, so a
+*  backlog is worked through over several calls. The caller checks whether
+*  each entry is still its file's expiry, and frees them with arenaFree().
+*INPUT: ExpiryWheel* wheel, uint32_t now, int max
+*OUTPUTS: int count, ExpiryEntry* due[max]
+*/
+int expiryDue(ExpiryWheel *wheel, uint32_t now, ExpiryEntry **due, int max)
+{ //mutex for this function handled by calling function
+  int count = 0;
+  int looked = 0;
+
+  while(count < max && looked < EXPIRY_BATCH && wheel->next <= now)
+  {
+    ExpiryEntry **link = wheel->kept != NULL ? &(wheel->kept->next) : &(wheel->slots[wheel->next % EXPIRY_SLOTS]);
+
+    looked++;
+
+    if(*link == NULL)
+    { //the rest of the slot expires on later turns
+      wheel->next++;
+      wheel->kept = NULL;
+    }
+    else if((*link)->expires <= now)
+    {
+      due[count++] = *link;
+      *link = (*link)->next;
+      wheel->count--;
+    }
+    else
+    {
+      wheel->kept = *link;
+    }
+  }
+
+  return count;
+}
@@ -0,0 +1,40 @@
+/* expiry.h
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Header for expiry.c. A timer wheel of the times files stored with a
+*  time to live expire at, turned by the reclaimer.
+*/
+
+#ifndef EXPIRY_H
+#define EXPIRY_H
+
+#include "arena.h"
+#include "hash.h"
+#include <stdint.h>
+
+#define EXPIRY_SLOTS 4096 //one second each, expiries further ahead wait for later turns of the wheel
+#define EXPIRY_BATCH 256 //entries and slots looked at in one expiryDue() call at most
+
+typedef struct ExpiryEntry
+{ //one expiry of a file, stale once the file is deleted or given another
+  struct ExpiryEntry* next;
+  uint32_t id; //file number, tells the file apart from a later one with the same key
+  uint32_t expires; //seconds since 1970
+  uint8_t key[HASH_KEY_BYTES]; //binary, to find the file in the index
+} ExpiryEntry;
+
+typedef struct ExpiryWheel
+{ //in its own mapping, shared by every worker process in prefork mode, under the file list lock
+  uint32_t next; //second whose slot is looked through next
+  ExpiryEntry* kept; //last entry looked at in that slot, left for a later turn, NULL to start from the front
+  uint64_t count; //entries, statistics
+  ExpiryEntry* slots[EXPIRY_SLOTS];
+} ExpiryWheel;
+
+ExpiryWheel *expiryCreate(int shared);
+
+int expiryAdd(ExpiryWheel* wheel, SharedArena* arena, uint32_t id, const uint8_t* key, uint32_t expires);
+
+int expiryDue(ExpiryWheel* wheel, uint32_t now, ExpiryEntry** due, int max);
+
+#endif
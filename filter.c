@@ -0,0 +1,236 @@
+/* filter.c
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: A counting Bloom filter of the keys in the file index. Each key is
+*  counted in a few cells chosen from its digest; a key with any of its cells
+*  at zero is certainly not in the index, so requests for unknown keys can be
+*  answered without taking the file list lock, while a key with every cell
+*  set is probably in it and is looked up as before. As the cells are
+*  counters rather than bits, deleted keys can be taken out again. Cells are
+*  updated with atomic compare and swap, and checked with plain atomic loads,
+*  so checks never wait on anything. Keys are added before they are linked
+*  into the index and removed after they are unlinked (both under the file
+*  list lock), so a check never misses a key the index holds. Checks are
+*  counted in stripes, each on a cache line of its own, so a client sending a
+*  stream of bad keys does not make every thread contend for one counter.
+*/
+
+#include "filter.h"
+#include "hash.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static unsigned int assigned = 0; //threads given a stripe in this process
+static __thread int stripe = -1; //this thread's
+
+/* stripeOf
+*PURPOSE: Returns the calling thread's stripe of the filter's counters, giving
+*  it one on its first check. Threads of a process take the stripes in turn,
+*  from a point which depends on the process, so that the workers in prefork
+*  mode start at different stripes.
+*INPUT: KeyFilter* filter
+*OUTPUTS: FilterStripe* stripe
+*/
+static FilterStripe *stripeOf(KeyFilter *filter)
+{
+  if(stripe == -1)
+  {
+    stripe = ((unsigned int)getpid() * 37 + __atomic_fetch_add(&assigned, 1, __ATOMIC_RELAXED)) % FILTER_STRIPES;
+  }
+
+  return &(filter->stripes[stripe]);
+}
+
+/* cellsOf
+*PURPOSE: Works out the cells a key is counted in, by double hashing: the
+*  digest is already uniformly distributed, so its two halves serve as the
+*  two hashes, with the engine mixed in so the same digest under two
+*  algorithms is counted apart.
+*INPUT: KeyFilter* filter, uint8_t key[HASH_KEY_BYTES]
+*OUTPUTS: uint64_t cells[hashes]
+*/
+static void cellsOf(const KeyFilter *filter, const uint8_t *key, uint64_t *cells)
+{
+  uint64_t a;
+  uint64_t b;
+
+  memcpy(&a, key + 1, sizeof(a));
+  memcpy(&b, key + 1 + sizeof(a), sizeof(b));
+  a ^= key[0] * 0x9e3779b97f4a7c15ULL;
+  b |= 1; //never a step of zero
+
+  for(int i = 0; i < filter->hashes; i++)
+  { //scaled into range by the high half of a multiply, rather than a remainder
+    cells[i] = (uint64_t)(((unsigned __int128)a * filter->cells) >> 64);
+    a += b;
+    b += i; //enhanced double hashing, so no two keys share every cell for sharing two
+  }
+}
+
+/* adjust
+*PURPOSE: Adds delta (1 or -1) to a cell, unless it has stuck at
+*  FILTER_MAX_COUNT, or is already zero.
+*INPUT: KeyFilter* filter, uint64_t cell, int delta
+*OUTPUTS: -
+*/
+static void adjust(KeyFilter *filter, uint64_t cell, int delta)
+{
+  uint8_t *byte = &(filter->counters[cell / 2]);
+  int shift = (cell % 2) * 4;
+  uint8_t old = __atomic_load_n(byte, __ATOMIC_RELAXED);
+  uint8_t updated;
+  int done = false;
+
+  while(!done)
+  {
+    int count = (old >> shift) & 0xf;
+
+    if(count == FILTER_MAX_COUNT || (delta < 0 && count == 0))
+    { //left as it is
+      done = true;
+    }
+    else
+    {
+      updated = (old & ~(0xf << shift)) | ((count + delta) << shift);
+      done = __atomic_compare_exchange_n(byte, &old, updated, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+/* filterCreate
+*PURPOSE: Creates an empty filter sized for capacity keys at no more than the
+*  false positive rate. The number of hashes is the smallest k with 2^-k at
+*  most the rate, and the cells are the optimal number for k hashes,
+*  k / ln 2 per key. With shared set, the filter is mapped so that processes
+*  forked afterwards share it. Returns NULL if it cannot be mapped.
+*INPUT: uint64_t capacity, double rate, int shared (boolean)
+*OUTPUTS: KeyFilter* filter
+*/
+KeyFilter *filterCreate(uint64_t capacity, double rate, int shared)
+{
+  KeyFilter *filter;
+  int hashes = 1;
+  double reached = 0.5;
+
+  while(reached > rate && hashes < FILTER_MAX_HASHES)
+  {
+    reached /= 2;
+    hashes++;
+  }
+
+  uint64_t cells = (uint64_t)(capacity * hashes * 1.4426950408889634) + 1; //1 / ln 2
+  size_t size = sizeof(KeyFilter) + (cells + 1) / 2;
+
+  filter = mmap(NULL, size, PROT_READ | PROT_WRITE, (shared ? MAP_SHARED : MAP_PRIVATE) | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+  if(filter == MAP_FAILED)
+  {
+    filter = NULL;
+  }
+  else
+  { //anonymous mappings start zeroed
+    filter->cells = cells;
+    filter->hashes = hashes;
+    filter->capacity = capacity;
+    filter->rate = reached;
+  }
+
+  return filter;
+}
+
+/* filterAdd
+*PURPOSE: Counts a key in the filter.
+*INPUT: KeyFilter* filter, uint8_t key[HASH_KEY_BYTES]
+*OUTPUTS: -
+*/
+void filterAdd(KeyFilter *filter, const uint8_t *key)
+{
+  uint64_t cells[FILTER_MAX_HASHES];
+
+  cellsOf(filter, key, cells);
+
+  for(int i = 0; i < filter->hashes; i++)
+  {
+    adjust(filter, cells[i], 1);
+  }
+
+  __atomic_fetch_add(&(filter->keys), 1, __ATOMIC_RELAXED);
+}
+
+/* filterRemove
+*PURPOSE: Takes a key counted in the filter out of it again.
+*INPUT: KeyFilter* filter, uint8_t key[HASH_KEY_BYTES]
+*OUTPUTS: -
+*/
+void filterRemove(KeyFilter *filter, const uint8_t *key)
+{
+  uint64_t cells[FILTER_MAX_HASHES];
+
+  cellsOf(filter, key, cells);
+
+  for(int i = 0; i < filter->hashes; i++)
+  {
+    adjust(filter, cells[i], -1);
+  }
+
+  __atomic_fetch_sub(&(filter->keys), 1, __ATOMIC_RELAXED);
+}
+
+/* filterCheck
+*PURPOSE: Returns 'false' if the key is certainly not counted in the filter,
+*  and 'true' if it probably is. Counts the check as a hit or a miss.
+*INPUT: KeyFilter* filter, uint8_t key[HASH_KEY_BYTES]
+*OUTPUTS: int present (boolean)
+*/
+int filterCheck(KeyFilter *filter, const uint8_t *key)
+{
+  uint64_t cells[FILTER_MAX_HASHES];
+  int present = true;
+
+  cellsOf(filter, key, cells);
+
+  for(int i = 0; present && i < filter->hashes; i++)
+  {
+    uint8_t byte = __atomic_load_n(&(filter->counters[cells[i] / 2]), __ATOMIC_ACQUIRE);
+
+    present = ((byte >> ((cells[i] % 2) * 4)) & 0xf) != 0;
+  }
+
+  FilterStripe *counts = stripeOf(filter);
+
+  __atomic_fetch_add(present ? &(counts->hits) : &(counts->misses), 1, __ATOMIC_RELAXED);
+
+  return present;
+}
+
+/* filterFalseHit
+*PURPOSE: Counts a hit whose key turned out not to be in the index.
+*INPUT: KeyFilter* filter
+*OUTPUTS: -
+*/
+void filterFalseHit(KeyFilter *filter)
+{
+  __atomic_fetch_add(&(stripeOf(filter)->falseHits), 1, __ATOMIC_RELAXED);
+}
+
+/* filterStats
+*PURPOSE: Sums the check counters of every stripe.
+*INPUT: KeyFilter* filter
+*OUTPUTS: uint64_t* hits, uint64_t* misses, uint64_t* false hits
+*/
+void filterStats(KeyFilter *filter, uint64_t *hits, uint64_t *misses, uint64_t *falseHits)
+{
+  *hits = 0;
+  *misses = 0;
+  *falseHits = 0;
+
+  for(int i = 0; i < FILTER_STRIPES; i++)
+  {
+    *hits += __atomic_load_n(&(filter->stripes[i].hits), __ATOMIC_RELAXED);
+    *misses += __atomic_load_n(&(filter->stripes[i].misses), __ATOMIC_RELAXED);
+    *falseHits += __atomic_load_n(&(filter->stripes[i].falseHits), __ATOMIC_RELAXED);
+  }
+}
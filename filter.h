@@ -0,0 +1,51 @@
+/* filter.h
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Header for filter.c. A counting Bloom filter of the keys in the file
+*  index, which can be checked without the file list lock.
+*/
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdint.h>
+
+#define DEFAULT_FILTER_KEYS 1000000 //keys the filter is sized for, 0 disables it
+#define DEFAULT_FILTER_FPR 0.01 //false positive rate, with that many keys
+#define FILTER_MAX_HASHES 16
+#define FILTER_MAX_COUNT 15 //a counter which reaches this sticks, as it can no longer be decremented safely
+#define FILTER_STRIPES 64 //sets of check counters, spread over the threads
+#define FILTER_LINE 64 //bytes, each set has a cache line of its own
+
+typedef struct FilterStripe
+{ //statistics, counted by the threads given this stripe and summed by filterStats()
+  uint64_t hits; //checks which found every cell set
+  uint64_t misses; //checks which found a clear cell, and so skipped the index
+  uint64_t falseHits; //hits whose key was not in the index after all
+  char pad[FILTER_LINE - 3 * sizeof(uint64_t)];
+} FilterStripe;
+
+typedef struct KeyFilter
+{ //in its own mapping, shared by every worker process in prefork mode
+  FilterStripe stripes[FILTER_STRIPES]; //first, so each is aligned to a cache line like the mapping
+  uint64_t cells; //4 bit counters, two to a byte
+  int hashes; //cells each key is counted in
+  uint64_t capacity; //keys
+  double rate; //false positive rate at capacity
+  uint64_t keys; //counted in, statistics
+  uint8_t counters[]; //cells
+} KeyFilter;
+
+KeyFilter *filterCreate(uint64_t capacity, double rate, int shared);
+
+void filterAdd(KeyFilter* filter, const uint8_t* key);
+
+void filterRemove(KeyFilter* filter, const uint8_t* key);
+
+int filterCheck(KeyFilter* filter, const uint8_t* key);
+
+void filterFalseHit(KeyFilter* filter);
+
+void filterStats(KeyFilter* filter, uint64_t* hits, uint64_t* misses, uint64_t* falseHits);
+
+#endif
@@ -0,0 +1,238 @@
+/* hash.c
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Computes files' keys with the algorithm the server was started
+*  with. Every key is 128 bits of digest in lower case hex, preceded by a tag
+*  naming the algorithm, so files stored under different algorithms can be
+*  held side by side, and any key can be checked for the right form without
+*  knowing which algorithm the server currently uses. MD5 keys have no tag,
+*  as they had none before the algorithm could be chosen.
+*/
+
+#include "hash.h"
+#include "md5.h"
+#include "blake3.h"
+#include <string.h>
+#include <ctype.h>
+
+static const char *engines[HASH_ENGINES] = {"md5", "blake3"};
+static const char *tags[HASH_ENGINES] = {"", "b3:"};
+
+/* nibble
+*PURPOSE: Returns the value of a hex digit, of either case.
+*INPUT: char digit
+*OUTPUTS: int value
+*/
+static int nibble(char digit)
+{
+  return isdigit((unsigned char)digit) ? digit - '0' : tolower((unsigned char)digit) - 'a' + 10;
+}
+
+/* hashParseEngine
+*PURPOSE: Returns the engine define for an algorithm name, or -1 if unknown.
+*INPUT: char* name
+*OUTPUTS: int engine
+*/
+int hashParseEngine(const char *name)
+{
+  int found = -1;
+
+  for(int i = 0; found == -1 && i < HASH_ENGINES; i++)
+  {
+    if(!strcmp(engines[i], name))
+    {
+      found = i;
+    }
+  }
+
+  return found;
+}
+
+/* hashEngineName
+*PURPOSE: Returns the name of an engine define.
+*INPUT: int engine
+*OUTPUTS: char* name
+*/
+const char *hashEngineName(int engine)
+{
+  return engines[engine];
+}
+
+/* hashImplementation
+*PURPOSE: Returns the name of the code path the engine hashes with on this
+*  CPU, for the log.
+*INPUT: int engine
+*OUTPUTS: char* name
+*/
+const char *hashImplementation(int engine)
+{
+  return engine == HASH_BLAKE3 ? blake3Implementation() : "portable";
+}
+
+/* hashKey
+*PURPOSE: Hashes the data in one go and writes its key (see hashKeyDigest).
+*INPUT: int engine, void* data, uint64_t length
+*OUTPUTS: char key[KEYLENGTH]
+*/
+void hashKey(int engine, const void *data, uint64_t length, char *key)
+{
+  uint8_t digest[HASH_DIGEST_LENGTH];
+
+  if(engine == HASH_BLAKE3)
+  {
+    Blake3Context ctx;
+
+    blake3Init(&ctx);
+    blake3Update(&ctx, data, length);
+    blake3Final(&ctx, digest, HASH_DIGEST_LENGTH);
+  }
+  else
+  {
+    MD5Context ctx;
+
+    md5Init(&ctx);
+    md5Update(&ctx, data, length);
+    md5Final(&ctx, digest);
+  }
+
+  hashKeyDigest(engine, digest, key);
+}
+
+/* hashKeyDigest
+*PURPOSE: Writes the key of a digest: the engine's tag, the digest as
+*  HASH_HEX_LENGTH lower case hex characters, and a null terminator.
+*INPUT: int engine, uint8_t digest[HASH_DIGEST_LENGTH]
+*OUTPUTS: char key[KEYLENGTH]
+*/
+void hashKeyDigest(int engine, const uint8_t *digest, char *key)
+{
+  static const char digits[] = "0123456789abcdef";
+  size_t tagLength = strlen(tags[engine]);
+
+  memcpy(key, tags[engine], tagLength);
+
+  for(int i = 0; i < HASH_DIGEST_LENGTH; i++)
+  {
+    key[tagLength + i * 2] = digits[digest[i] >> 4];
+    key[tagLength + i * 2 + 1] = digits[digest[i] & 0xf];
+  }
+
+  key[tagLength + HASH_HEX_LENGTH] = '\0';
+}
+
+/* hashKeyEngine
+*PURPOSE: Returns the engine define of the algorithm a key is tagged with,
+*  or -1 if it is not a well formed key of any algorithm.
+*INPUT: char* key
+*OUTPUTS: int engine
+*/
+int hashKeyEngine(const char *key)
+{
+  int found = -1;
+
+  for(int i = HASH_ENGINES - 1; found == -1 && i >= 0; i--)
+  { //untagged MD5 last, as every tag would otherwise be read as part of one
+    size_t tagLength = strlen(tags[i]);
+    int valid = !strncmp(key, tags[i], tagLength) && strnlen(key + tagLength, HASH_HEX_LENGTH + 1) == HASH_HEX_LENGTH;
+
+    for(int d = 0; valid && d < HASH_HEX_LENGTH; d++)
+    {
+      valid = isxdigit((unsigned char)key[tagLength + d]);
+    }
+
+    if(valid)
+    {
+      found = i;
+    }
+  }
+
+  return found;
+}
+
+/* hashKeyDigits
+*PURPOSE: Returns the hex digest of a well formed key, after its tag.
+*INPUT: char* key
+*OUTPUTS: char* digits
+*/
+const char *hashKeyDigits(const char *key)
+{
+  return key + strlen(tags[hashKeyEngine(key)]);
+}
+
+/* hashKeyBytes
+*PURPOSE: Writes the binary form of a key: its engine define in the first
+*  byte, then the digest. Keys in binary sort by algorithm, then by their hex
+*  digits. Returns 'false' if the key is not well formed.
+*INPUT: char* key
+*OUTPUTS: int valid (boolean), uint8_t bytes[HASH_KEY_BYTES]
+*/
+int hashKeyBytes(const char *key, uint8_t *bytes)
+{
+  int engine = hashKeyEngine(key);
+
+  if(engine != -1)
+  {
+    const char *digits = key + strlen(tags[engine]);
+
+    bytes[0] = engine;
+
+    for(int i = 0; i < HASH_DIGEST_LENGTH; i++)
+    {
+      bytes[i + 1] = (nibble(digits[i * 2]) << 4) | nibble(digits[i * 2 + 1]);
+    }
+  }
+
+  return engine != -1;
+}
+
+/* hashBytesKey
+*PURPOSE: Writes the key of a binary key (see hashKeyBytes).
+*INPUT: uint8_t bytes[HASH_KEY_BYTES]
+*OUTPUTS: char key[KEYLENGTH]
+*/
+void hashBytesKey(const uint8_t *bytes, char *key)
+{
+  hashKeyDigest(bytes[0], bytes + 1, key);
+}
+
+/* hashPrefixBytes
+*PURPOSE: Works out which binary keys of an engine start with a prefix of the
+*  key's text: either part of the engine's tag, or the whole tag followed by
+*  hex digits. Writes the bytes they start with (zero after the prefix) and
+*  how many bits of those are fixed. Returns 'false' if no key of the engine
+*  can start with the prefix.
+*INPUT: int engine, char* prefix
+*OUTPUTS: int possible (boolean), uint8_t bytes[HASH_KEY_BYTES], int* bits
+*/
+int hashPrefixBytes(int engine, const char *prefix, uint8_t *bytes, int *bits)
+{
+  size_t tagLength = strlen(tags[engine]);
+  size_t length = strlen(prefix);
+  int possible;
+
+  memset(bytes, 0, HASH_KEY_BYTES);
+  bytes[0] = engine;
+  *bits = 8;
+
+  if(length <= tagLength)
+  { //every key of the engine
+    possible = !strncmp(prefix, tags[engine], length);
+  }
+  else
+  {
+    possible = !strncmp(prefix, tags[engine], tagLength) && length - tagLength <= HASH_HEX_LENGTH;
+
+    for(size_t d = 0; possible && d < length - tagLength; d++)
+    {
+      possible = isxdigit((unsigned char)prefix[tagLength + d]);
+
+      if(possible)
+      {
+        bytes[1 + d / 2] |= nibble(prefix[tagLength + d]) << (d % 2 ? 0 : 4);
+        *bits += 4;
+      }
+    }
+  }
+
+  return possible;
+}
@@ -0,0 +1,42 @@
+/* hash.h
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Header for hash.c. The algorithms a file's key can be computed
+*  with, and the tagged form keys of each take.
+*/
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+
+//hash engine defines
+#define HASH_MD5 0 //untagged, the key format used before there was a choice
+#define HASH_BLAKE3 1
+#define HASH_ENGINES 2
+
+#define HASH_DIGEST_LENGTH 16 //bytes of digest in every key, whatever the algorithm
+#define HASH_HEX_LENGTH (HASH_DIGEST_LENGTH * 2)
+#define HASH_KEY_BYTES (HASH_DIGEST_LENGTH + 1) //binary form of a key: the engine, then the digest
+
+int hashParseEngine(const char* name);
+
+const char *hashEngineName(int engine);
+
+const char *hashImplementation(int engine);
+
+void hashKey(int engine, const void* data, uint64_t length, char* key);
+
+void hashKeyDigest(int engine, const uint8_t* digest, char* key);
+
+int hashKeyEngine(const char* key);
+
+const char *hashKeyDigits(const char* key);
+
+int hashKeyBytes(const char* key, uint8_t* bytes);
+
+void hashBytesKey(const uint8_t* bytes, char* key);
+
+int hashPrefixBytes(int engine, const char* prefix, uint8_t* bytes, int* bits);
+
+#endif
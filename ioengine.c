@@ -0,0 +1,539 @@
+/* ioengine.c
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: File I/O for stored objects through io_uring. Reading an unpacked
+*  object is an open, a read and a close linked together into a single
+*  submission, so it costs one system call instead of the five made through
+*  stdio. The file is opened into the ring's registered file table, so it never
+*  takes up a descriptor. Syncs of a commit batch are submitted together and
+*  run in parallel. Operations io_uring can only complete on a worker thread
+*  (creating and unlinking files, buffered writes on ext4) measured slower than
+*  the plain system calls, so they are not submitted to the ring. Each thread
+*  uses its own ring, taken from a free list and returned to it when the thread
+*  exits. If io_uring is unavailable (old kernel, or blocked by a seccomp
+*  policy) every function falls back to the stdio and system call path.
+*/
+
+#include "ioengine.h"
+#include "common.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define IO_FILE_SLOT 1 //registered file table index + 1, as used by file_index
+
+static const char *const engines[] = {"auto", "posix", "uring"};
+
+static int engine = IO_ENGINE_POSIX;
+static IoRing *freeRings = NULL;
+static pthread_mutex_t freeMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ringKey;
+static __thread IoRing *threadRing = NULL;
+
+/* ringDestroy
+*PURPOSE: Unmaps and closes a ring.
+*INPUT: IoRing* ring
+*OUTPUTS: -
+*/
+static void ringDestroy(IoRing *ring)
+{
+  if(ring->sqes != NULL && ring->sqes != MAP_FAILED)
+  {
+    munmap(ring->sqes, ring->sqesLength);
+  }
+
+  if(ring->cqMap != NULL && ring->cqMap != MAP_FAILED && ring->cqMap != ring->sqMap)
+  {
+    munmap(ring->cqMap, ring->cqMapLength);
+  }
+
+  if(ring->sqMap != NULL && ring->sqMap != MAP_FAILED)
+  {
+    munmap(ring->sqMap, ring->sqMapLength);
+  }
+
+  close(ring->fd);
+  free(ring);
+}
+
+/* ringCreate
+*PURPOSE: Sets up a ring, maps its queues and registers its (single slot)
+*  file table. Returns NULL if an error occurs.
+*INPUT: -
+*OUTPUTS: IoRing* ring
+*/
+static IoRing *ringCreate(void)
+{
+  struct io_uring_params params;
+  IoRing *ring = NULL;
+  int fd;
+  int files[IO_FILE_SLOT] = {-1}; //empty slot
+  int error = false;
+
+  memset(&params, 0, sizeof(params));
+
+  if((fd = syscall(__NR_io_uring_setup, IO_RING_ENTRIES, &params)) >= 0)
+  {
+    ring = calloc(1, sizeof(IoRing));
+    ring->fd = fd;
+    ring->sqMapLength = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cqMapLength = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqesLength = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+    { //both queues share one mapping
+      if(ring->cqMapLength > ring->sqMapLength)
+      {
+        ring->sqMapLength = ring->cqMapLength;
+      }
+    }
+
+    ring->sqMap = mmap(NULL, ring->sqMapLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+      ring->cqMap = ring->sqMap;
+    }
+    else
+    {
+      ring->cqMap = mmap(NULL, ring->cqMapLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    }
+
+    ring->sqes = mmap(NULL, ring->sqesLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+    if(ring->sqMap != MAP_FAILED && ring->cqMap != MAP_FAILED && ring->sqes != MAP_FAILED)
+    {
+      char *sq = (char*)ring->sqMap;
+      char *cq = (char*)ring->cqMap;
+
+      ring->sqHead = (unsigned int*)(sq + params.sq_off.head);
+      ring->sqTail = (unsigned int*)(sq + params.sq_off.tail);
+      ring->sqMask = (unsigned int*)(sq + params.sq_off.ring_mask);
+      ring->sqArray = (unsigned int*)(sq + params.sq_off.array);
+      ring->cqHead = (unsigned int*)(cq + params.cq_off.head);
+      ring->cqTail = (unsigned int*)(cq + params.cq_off.tail);
+      ring->cqMask = (unsigned int*)(cq + params.cq_off.ring_mask);
+      ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+      error = syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES, files, IO_FILE_SLOT) != 0;
+    }
+    else
+    {
+      error = true;
+    }
+
+    if(error)
+    {
+      ringDestroy(ring);
+      ring = NULL;
+    }
+  }
+
+  return ring;
+}
+
+/* ringRelease
+*PURPOSE: Thread exit destructor, returns the thread's ring to the free list.
+*INPUT: void* ring
+*OUTPUTS: -
+*/
+static void ringRelease(void *arg)
+{
+  IoRing *ring = (IoRing*)arg;
+
+  pthread_mutex_lock(&freeMutex);
+  ring->next = freeRings;
+  freeRings = ring;
+  pthread_mutex_unlock(&freeMutex);
+}
+
+/* ringGet
+*PURPOSE: Returns the calling thread's ring, taking one from the free list or
+*  creating one on first use. Returns NULL if io_uring is not in use or no ring
+*  could be created, in which case the caller should use the posix path.
+*INPUT: -
+*OUTPUTS: IoRing* ring
+*/
+static IoRing *ringGet(void)
+{
+  if(threadRing == NULL && engine == IO_ENGINE_URING)
+  {
+    pthread_mutex_lock(&freeMutex);
+
+    if(freeRings != NULL)
+    {
+      threadRing = freeRings;
+      freeRings = freeRings->next;
+    }
+
+    pthread_mutex_unlock(&freeMutex);
+
+    if(threadRing == NULL)
+    {
+      threadRing = ringCreate();
+    }
+
+    if(threadRing != NULL)
+    {
+      pthread_setspecific(ringKey, threadRing);
+    }
+  }
+
+  return threadRing;
+}
+
+/* ringSqe
+*PURPOSE: Returns the count'th submission queue entry after the tail, cleared.
+*  Entries are not visible to the kernel until ringSubmit() is called.
+*INPUT: IoRing* ring, unsigned int count
+*OUTPUTS: struct io_uring_sqe* entry
+*/
+static struct io_uring_sqe *ringSqe(IoRing *ring, unsigned int count)
+{
+  unsigned int index = (*(ring->sqTail) + count) & *(ring->sqMask);
+  struct io_uring_sqe *sqe = &(ring->sqes[index]);
+
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  ring->sqArray[index] = index;
+  sqe->user_data = count;
+
+  return sqe;
+}
+
+/* ringSubmit
+*PURPOSE: Submits the count entries prepared with ringSqe() and waits for all
+*  of them to complete, writing each result (bytes, or -errno) into results in
+*  the order the entries were prepared. Returns 'true' if an error occurs.
+*INPUT: IoRing* ring, unsigned int count
+*OUTPUTS: int error occured (boolean), int* results
+*/
+static int ringSubmit(IoRing *ring, unsigned int count, int *results)
+{
+  int error = false;
+  unsigned int reaped = 0;
+  unsigned int tail = *(ring->sqTail) + count;
+
+  __atomic_store_n(ring->sqTail, tail, __ATOMIC_RELEASE);
+
+  while(!error && reaped < count)
+  {
+    unsigned int pending = tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+    unsigned int head = *(ring->cqHead);
+
+    if(syscall(__NR_io_uring_enter, ring->fd, pending, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+    {
+      error = true;
+    }
+
+    while(head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+    {
+      struct io_uring_cqe *cqe = &(ring->cqes[head & *(ring->cqMask)]);
+
+      results[cqe->user_data] = cqe->res;
+      head++;
+      reaped++;
+    }
+
+    __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+  }
+
+  if(error)
+  { //entries may still be in flight, so the ring cannot be reused
+    threadRing = NULL;
+    pthread_setspecific(ringKey, NULL);
+  }
+
+  return !error;
+}
+
+/* ioProbe
+*PURPOSE: Checks io_uring works here, by opening the working directory into a
+*  ring's file table and closing it again. Returns 'true' if an error occurs.
+*INPUT: -
+*OUTPUTS: int error occured (boolean)
+*/
+static int ioProbe(void)
+{
+  IoRing *ring = ringCreate();
+  int results[2] = {-1, -1};
+  int error = ring == NULL;
+
+  if(!error)
+  {
+    struct io_uring_sqe *sqe = ringSqe(ring, 0);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)".";
+    sqe->open_flags = O_RDONLY | O_DIRECTORY;
+    sqe->file_index = IO_FILE_SLOT;
+    sqe->flags = IOSQE_IO_LINK;
+
+    sqe = ringSqe(ring, 1);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = IO_FILE_SLOT;
+
+    error = !ringSubmit(ring, 2, results) || results[0] < 0 || results[1] < 0;
+  }
+
+  if(!error)
+  { //keep it for the first thread that needs one
+    ringRelease(ring);
+  }
+  else if(ring != NULL)
+  {
+    ringDestroy(ring);
+  }
+
+  return !error;
+}
+
+/* ioParseEngine
+*PURPOSE: Returns the engine define for an engine name, or -1 if unknown.
+*INPUT: char* name
+*OUTPUTS: int engine
+*/
+int ioParseEngine(const char *name)
+{
+  int found = -1;
+
+  for(int i = 0; found == -1 && i < (int)(sizeof(engines) / sizeof(engines[0])); i++)
+  {
+    if(!strcmp(engines[i], name))
+    {
+      found = i;
+    }
+  }
+
+  return found;
+}
+
+/* ioEngineName
+*PURPOSE: Returns the name of an engine define.
+*INPUT: int engine
+*OUTPUTS: char* name
+*/
+const char *ioEngineName(int id)
+{
+  return engines[id];
+}
+
+/* ioInit
+*PURPOSE: Chooses the I/O engine. IO_ENGINE_AUTO uses io_uring if it works,
+*  otherwise posix. Must be called before any other thread uses the engine.
+*  Returns the engine in use, or -1 if io_uring was required but is not
+*  available.
+*INPUT: int engine
+*OUTPUTS: int engine in use
+*/
+int ioInit(int requested)
+{
+  engine = IO_ENGINE_POSIX;
+
+  if(requested != IO_ENGINE_POSIX)
+  {
+    pthread_key_create(&ringKey, ringRelease);
+
+    if(ioProbe())
+    {
+      engine = IO_ENGINE_URING;
+    }
+    else if(requested == IO_ENGINE_URING)
+    {
+      engine = -1;
+    }
+  }
+
+  return engine;
+}
+
+/* ioEngine
+*PURPOSE: Returns the engine in use.
+*INPUT: -
+*OUTPUTS: int engine
+*/
+int ioEngine(void)
+{
+  return engine;
+}
+
+/* ioWriteFile
+*PURPOSE: Creates (or truncates) the file and writes the data into it.
+*  Returns 'true' if an error occurs.
+*INPUT: char* path, char* data, uint64_t length
+*OUTPUTS: int error occured (boolean)
+*/
+int ioWriteFile(const char *path, const char *data, uint64_t length)
+{
+  int error = false;
+
+  if(engine == IO_ENGINE_URING)
+  { //creating a file, and (on ext4) a buffered write, cannot complete inline in
+    //io_uring and are handed to a worker thread, which costs more than the
+    //syscalls saved; but stdio's buffering is skipped
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    TRACE_BEGIN(traceStart);
+
+    error = fd == -1;
+
+    while(!error && length > 0)
+    {
+      ssize_t written = write(fd, data, length);
+
+      if(written > 0)
+      {
+        data += written;
+        length -= written;
+      }
+      else if(written < 0 && errno == EINTR)
+      {
+        error = false;
+      }
+      else
+      {
+        error = true;
+      }
+    }
+
+    if(fd != -1 && close(fd))
+    {
+      error = true;
+    }
+
+    TRACE_END(traceStart, "write", "disk");
+  }
+  else
+  {
+    error = !writeFile(data, length, path);
+  }
+
+  return !error;
+}
+
+/* ioReadFile
+*PURPOSE: Allocates a buffer and reads the file, which is expected to be
+*  length bytes long, into it. Returns 'true' if an error occurs, in which case
+*  no buffer is left allocated.
+*INPUT: char* path, uint64_t length
+*OUTPUTS: int error occured (boolean), char** data
+*/
+int ioReadFile(const char *path, char **data, uint64_t length)
+{
+  int error = false;
+  IoRing *ring = length <= IO_MAX_RW ? ringGet() : NULL;
+
+  *data = NULL;
+
+  if(ring != NULL)
+  {
+    int results[3] = {-1, -1, -1};
+    struct io_uring_sqe *sqe;
+    TRACE_BEGIN(traceStart);
+
+    *data = malloc(length + 1);
+
+    sqe = ringSqe(ring, 0);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)path;
+    sqe->open_flags = O_RDONLY;
+    sqe->file_index = IO_FILE_SLOT;
+    sqe->flags = IOSQE_IO_LINK;
+
+    sqe = ringSqe(ring, 1);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = IO_FILE_SLOT - 1;
+    sqe->addr = (uint64_t)(uintptr_t)*data;
+    sqe->len = length;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+
+    sqe = ringSqe(ring, 2);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = IO_FILE_SLOT;
+
+    error = !ringSubmit(ring, 3, results) || results[0] < 0 || (uint64_t)results[1] != length || results[2] < 0;
+
+    TRACE_END(traceStart, "uring read", "disk");
+  }
+  else
+  {
+    uint64_t found;
+
+    error = !readFile(data, &found, path) || found != length;
+  }
+
+  if(error)
+  {
+    free(*data);
+    *data = NULL;
+  }
+
+  return !error;
+}
+
+/* ioRemove
+*PURPOSE: Deletes the file. Always a plain unlink(), as io_uring hands every
+*  unlink to a worker thread. Returns 'true' if an error occurs.
+*INPUT: char* path
+*OUTPUTS: int error occured (boolean)
+*/
+int ioRemove(const char *path)
+{
+  return remove(path) == 0;
+}
+
+/* ioSyncAll
+*PURPOSE: Flushes every file to disk, data only (fdatasync) unless it is a
+*  directory, in which case fully (fsync) so its entries are flushed. Through
+*  io_uring the syncs are submitted together and run in parallel. Marks each
+*  file which failed in failed. Returns 'true' if an error occurs with any.
+*INPUT: int* fds, int* directory (booleans), int count
+*OUTPUTS: int error occured (boolean), int* failed (booleans)
+*/
+int ioSyncAll(const int *fds, const int *directory, int *failed, int count)
+{
+  int error = false;
+  IoRing *ring = ringGet();
+  TRACE_BEGIN(traceStart);
+
+  for(int i = 0; i < count; i += IO_RING_ENTRIES)
+  {
+    int batch = count - i < IO_RING_ENTRIES ? count - i : IO_RING_ENTRIES;
+    int results[IO_RING_ENTRIES];
+
+    if(ring != NULL)
+    {
+      for(int j = 0; j < batch; j++)
+      {
+        struct io_uring_sqe *sqe = ringSqe(ring, j);
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fd = fds[i + j];
+        sqe->fsync_flags = directory[i + j] ? 0 : IORING_FSYNC_DATASYNC;
+        results[j] = -1;
+      }
+
+      if(!ringSubmit(ring, batch, results))
+      { //the ring is no longer usable, finish on the posix path
+        ring = NULL;
+      }
+    }
+
+    if(ring == NULL)
+    {
+      for(int j = 0; j < batch; j++)
+      {
+        results[j] = (directory[i + j] ? fsync(fds[i + j]) : fdatasync(fds[i + j]));
+      }
+    }
+
+    for(int j = 0; j < batch; j++)
+    {
+      failed[i + j] = results[j] < 0;
+      error |= failed[i + j];
+    }
+  }
+
+  TRACE_END(traceStart, "sync", "disk");
+
+  return !error;
+}
@@ -0,0 +1,59 @@
+/* ioengine.h
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Header for ioengine.c. File I/O for stored objects, through io_uring
+*  where the kernel supports it, otherwise through ordinary system calls.
+*/
+
+#ifndef IOENGINE_H
+#define IOENGINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+//engine defines
+#define IO_ENGINE_AUTO 0 //io_uring if available, otherwise posix
+#define IO_ENGINE_POSIX 1
+#define IO_ENGINE_URING 2
+
+#define IO_RING_ENTRIES 64 //submission queue size of each ring
+#define IO_MAX_RW (1024 * 1024 * 1024) //larger reads use the posix path, as a single io_uring read is capped below 2GiB
+
+typedef struct IoRing
+{ //one per thread doing file I/O, recycled between threads through a free list
+  struct IoRing* next;
+  int fd;
+  unsigned int* sqHead;
+  unsigned int* sqTail;
+  unsigned int* sqMask;
+  unsigned int* sqArray;
+  unsigned int* cqHead;
+  unsigned int* cqTail;
+  unsigned int* cqMask;
+  struct io_uring_sqe* sqes;
+  struct io_uring_cqe* cqes;
+  void* sqMap;
+  size_t sqMapLength;
+  void* cqMap; //same as sqMap if the kernel maps both rings together
+  size_t cqMapLength;
+  size_t sqesLength;
+} IoRing;
+
+int ioParseEngine(const char* name);
+
+const char *ioEngineName(int engine);
+
+int ioInit(int engine);
+
+int ioEngine(void);
+
+int ioWriteFile(const char* path, const char* data, uint64_t length);
+
+int ioReadFile(const char* path, char** data, uint64_t length);
+
+int ioRemove(const char* path);
+
+int ioSyncAll(const int* fds, const int* directory, int* failed, int count);
+
+#endif
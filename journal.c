@@ -0,0 +1,201 @@
+/* journal.c
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Records every change to the file index (stores, deletes, and moves
+*  made by compaction) as fixed-size records appended to one file. Replaying
+*  it on startup rebuilds the index, so stored files survive a restart, and
+*  the sequence numbers of its stores and deletes give replicas a position to
+*  resume streaming from.
+*/
+
+#include "journal.h"
+#include "log.h"
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/* journalOpen
+*PURPOSE: Opens (creating if needed) the journal. A partial record left at the
+*  end by a crash is cut off. Returns NULL if an error occurs. The latest seq
+*  is only known once the journal has been replayed, see journalSkip(). If
+*  durable, the directory is synced so a newly created journal is not lost.
+*INPUT: char* path, int durable (boolean)
+*OUTPUTS: Journal* journal
+*/
+Journal *journalOpen(const char *path, int durable)
+{
+  Journal *journal = NULL;
+  struct stat info;
+  int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+  if(fd != -1 && fstat(fd, &info) == 0)
+  {
+    journal = calloc(1, sizeof(Journal));
+    journal->mutex = malloc(sizeof(pthread_mutex_t));
+    journal->appended = malloc(sizeof(pthread_cond_t));
+    pthread_mutex_init(journal->mutex, NULL);
+    pthread_cond_init(journal->appended, NULL);
+    journal->fd = fd;
+    journal->size = info.st_size - info.st_size % sizeof(JournalRecord);
+
+    if(journal->size != (uint64_t)info.st_size && ftruncate(fd, journal->size))
+    {
+      logMsg(LOG_WARN, "server", "Failed to cut a partial record off the end of the journal.");
+    }
+
+    if(durable)
+    {
+      char dirPath[MAXPATHLENGTH] = ".";
+      const char *slash = strrchr(path, '/');
+
+      if(slash != NULL)
+      { //the journal may be kept apart from the files
+        snprintf(dirPath, MAXPATHLENGTH, "%.*s", (int)(slash - path + (slash == path)), path);
+      }
+
+      int dir = open(dirPath, O_RDONLY | O_DIRECTORY);
+
+      if(dir != -1)
+      {
+        fsync(dir);
+        close(dir);
+      }
+    }
+  }
+  else if(fd != -1)
+  {
+    close(fd);
+  }
+
+  return journal;
+}
+
+/* journalAppend
+*PURPOSE: Appends the record. A STORE, DELETE or EXPIRE without a seq is given the
+*  next one; replicas keep the primary's. MOVE records take the latest seq.
+*  Waiting for the record to reach the disk is left to the caller. Returns
+*  'true' if an error occurs.
+*INPUT: Journal* journal, JournalRecord* record
+*OUTPUTS: int error occured (boolean), JournalRecord* record (seq filled in)
+*/
+int journalAppend(Journal *journal, JournalRecord *record)
+{
+  int error = false;
+
+  pthread_mutex_lock(journal->mutex);
+
+  if(record->type == JOURNAL_MOVE)
+  {
+    record->seq = journal->seq;
+  }
+  else if(record->seq == 0)
+  {
+    record->seq = journal->seq + 1;
+  }
+
+  if(pwrite(journal->fd, record, sizeof(JournalRecord), journal->size) == sizeof(JournalRecord))
+  {
+    journal->size += sizeof(JournalRecord);
+    journal->seq = record->seq;
+    pthread_cond_broadcast(journal->appended);
+  }
+  else
+  { //the next append overwrites whatever part was written
+    error = true;
+  }
+
+  pthread_mutex_unlock(journal->mutex);
+
+  return !error;
+}
+
+/* journalRead
+*PURPOSE: Reads the record at the offset. Returns 'true' if there is a whole
+*  record there.
+*INPUT: Journal* journal, uint64_t offset in bytes
+*OUTPUTS: int read (boolean), JournalRecord* record
+*/
+int journalRead(Journal *journal, uint64_t offset, JournalRecord *record)
+{
+  int read = false;
+
+  pthread_mutex_lock(journal->mutex);
+  uint64_t size = journal->size;
+  pthread_mutex_unlock(journal->mutex);
+
+  if(offset + sizeof(JournalRecord) <= size)
+  {
+    read = pread(journal->fd, record, sizeof(JournalRecord), offset) == sizeof(JournalRecord);
+  }
+
+  return read;
+}
+
+/* journalWait
+*PURPOSE: Waits up to wait milliseconds for a record to be appended at or past
+*  the offset. Returns 'true' if there is one.
+*INPUT: Journal* journal, uint64_t offset in bytes, unsigned int wait in
+*  milliseconds
+*OUTPUTS: int appended (boolean)
+*/
+int journalWait(Journal *journal, uint64_t offset, unsigned int wait)
+{
+  struct timespec deadline;
+  int timedOut = false;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += wait / 1000;
+  deadline.tv_nsec += (long)(wait % 1000) * 1000000;
+
+  if(deadline.tv_nsec >= 1000000000)
+  {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+
+  pthread_mutex_lock(journal->mutex);
+
+  while(!timedOut && journal->size < offset + sizeof(JournalRecord))
+  {
+    timedOut = pthread_cond_timedwait(journal->appended, journal->mutex, &deadline) == ETIMEDOUT;
+  }
+
+  int appended = journal->size >= offset + sizeof(JournalRecord);
+
+  pthread_mutex_unlock(journal->mutex);
+
+  return appended;
+}
+
+/* journalSkip
+*PURPOSE: Advances the latest seq without recording anything, for replayed
+*  records and for replicated events which leave nothing to record.
+*INPUT: Journal* journal, uint64_t seq
+*OUTPUTS: -
+*/
+void journalSkip(Journal *journal, uint64_t seq)
+{
+  pthread_mutex_lock(journal->mutex);
+
+  if(seq > journal->seq)
+  {
+    journal->seq = seq;
+  }
+
+  pthread_mutex_unlock(journal->mutex);
+}
+
+/* journalSeq
+*PURPOSE: Returns the latest seq.
+*INPUT: Journal* journal
+*OUTPUTS: uint64_t seq
+*/
+uint64_t journalSeq(Journal *journal)
+{
+  pthread_mutex_lock(journal->mutex);
+  uint64_t seq = journal->seq;
+  pthread_mutex_unlock(journal->mutex);
+
+  return seq;
+}
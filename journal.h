@@ -0,0 +1,60 @@
+/* journal.h
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Header for journal.c. Append-only log of changes to the file index,
+*  replayed on startup and streamed to replicas.
+*/
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "common.h"
+#include "blob.h"
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#define DEFAULT_JOURNAL "journal.log" //used when replicating without --journal
+#define JOURNAL_GROUP MAX_PACKS //commit group of the journal's syncs, distinct from every pack
+
+//record type defines
+#define JOURNAL_STORE 1
+#define JOURNAL_DELETE 2
+#define JOURNAL_MOVE 3 //compaction moved the contents, never replicated
+#define JOURNAL_GONE 4 //replication only: stored, but deleted again before it could be sent
+#define JOURNAL_HEARTBEAT 5 //replication only: nothing new, carries the primary's latest seq
+#define JOURNAL_EXPIRE 6 //a time to live was set
+
+typedef struct JournalRecord
+{ //written to the journal and sent to replicas as is
+  uint64_t seq; //position in the replicated history; MOVE records repeat the latest
+  uint32_t type; //JOURNAL_ define
+  uint32_t id; //file number, the same on the primary and its replicas
+  int64_t time; //of the STORE or DELETE, or for EXPIRE when the file expires (0 for never)
+  struct in6_addr ip; //of the client which made it
+  BlobRef blob; //where this server stores the contents, only meaningful locally
+  char key[KEYLENGTH];
+} JournalRecord;
+
+typedef struct Journal
+{
+  pthread_mutex_t* mutex;
+  pthread_cond_t* appended; //broadcast after every record
+  int fd;
+  uint64_t size; //bytes of whole records
+  uint64_t seq; //latest STORE or DELETE, recorded or skipped
+} Journal;
+
+Journal *journalOpen(const char* path, int durable);
+
+int journalAppend(Journal* journal, JournalRecord* record);
+
+int journalRead(Journal* journal, uint64_t offset, JournalRecord* record);
+
+int journalWait(Journal* journal, uint64_t offset, unsigned int wait);
+
+void journalSkip(Journal* journal, uint64_t seq);
+
+uint64_t journalSeq(Journal* journal);
+
+#endif
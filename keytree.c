@@ -0,0 +1,368 @@
+/* keytree.c
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: A crit-bit tree: an ordered index over binary keys of a fixed
+*  length. Each internal node records the first bit at which the keys below it
+*  differ, keys with that bit clear to the left, set to the right, so the
+*  leaves are in key order and a lookup tests one bit per level, at most one
+*  per bit of key, without comparing whole keys until the leaf. The leaves are
+*  the items themselves, which hold their own keys, so the tree adds only one
+*  internal node per item. Pointers to internal nodes are tagged by setting
+*  their lowest bit, as items and nodes are both aligned.
+*
+*  Changes (made under the file list lock) each become visible with a single
+*  pointer store, so keyTreeFind() can run at the same time without a lock:
+*  it sees the tree either before or after the change. An internal node
+*  unlinked by a removal may still be being passed through, so it is handed
+*  back to be freed once no reader can be using it (see epoch.c).
+*  Based on the crit-bit trees of D. J. Bernstein, as written up by A. Langley.
+*/
+
+#include "keytree.h"
+#include <string.h>
+#include <stdbool.h>
+
+typedef struct KeyTreeCursor
+{ //the nodes above the current leaf whose right subtree is still to be visited
+  const KeyTreeNode* pending[KEY_TREE_MAX_LENGTH * 8];
+  int depth;
+} KeyTreeCursor;
+
+static int internal(const void *p)
+{
+  return (uintptr_t)p & 1;
+}
+
+static KeyTreeNode *untag(const void *p)
+{
+  return (KeyTreeNode*)((uintptr_t)p - 1);
+}
+
+static void *load(void *const *p)
+{ //pairs with the release stores that link new nodes, so they are seen complete
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void store(void **p, void *value)
+{
+  __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+static const uint8_t *keyOf(const KeyTree *tree, const void *item)
+{
+  return (const uint8_t*)item + tree->offset;
+}
+
+static int direction(const KeyTreeNode *node, const uint8_t *key)
+{
+  return (1 + (node->otherbits | key[node->byte])) >> 8;
+}
+
+/* critBit
+*PURPOSE: Finds the first bit at which two keys differ, as a byte and every
+*  bit of that byte but it. Returns 'false' if the keys are equal.
+*INPUT: KeyTree* tree, uint8_t* key a, uint8_t* key b
+*OUTPUTS: int differ (boolean), uint32_t* byte, uint8_t* otherbits
+*/
+static int critBit(const KeyTree *tree, const uint8_t *a, const uint8_t *b, uint32_t *byte, uint8_t *otherbits)
+{
+  uint32_t i = 0;
+
+  while(i < tree->length && a[i] == b[i])
+  {
+    i++;
+  }
+
+  if(i < tree->length)
+  {
+    uint32_t bits = a[i] ^ b[i];
+
+    bits |= bits >> 1;
+    bits |= bits >> 2;
+    bits |= bits >> 4;
+    *byte = i;
+    *otherbits = (bits & ~(bits >> 1)) ^ 255; //all but the highest differing bit
+  }
+
+  return i < tree->length;
+}
+
+/* closest
+*PURPOSE: Follows a key's bits down to a leaf, which has the key if any item
+*  does. The tree must not be empty.
+*INPUT: KeyTree* tree, uint8_t* key
+*OUTPUTS: void* item
+*/
+static void *closest(const KeyTree *tree, const uint8_t *key)
+{
+  void *p = load(&(tree->root));
+
+  while(internal(p))
+  {
+    p = load(&(untag(p)->child[direction(untag(p), key)]));
+  }
+
+  return p;
+}
+
+/* leftmost
+*PURPOSE: Returns the first leaf under a subtree, noting the nodes passed on
+*  the cursor.
+*INPUT: void* subtree, KeyTreeCursor* cursor
+*OUTPUTS: void* item
+*/
+static void *leftmost(const void *p, KeyTreeCursor *cursor)
+{
+  while(internal(p))
+  {
+    cursor->pending[cursor->depth++] = untag(p);
+    p = untag(p)->child[0];
+  }
+
+  return (void*)p;
+}
+
+/* next
+*PURPOSE: Returns the leaf after the cursor's current one, or NULL after the
+*  last.
+*INPUT: KeyTreeCursor* cursor
+*OUTPUTS: void* item
+*/
+static void *next(KeyTreeCursor *cursor)
+{
+  return cursor->depth == 0 ? NULL : leftmost(cursor->pending[--cursor->depth]->child[1], cursor);
+}
+
+/* seek
+*PURPOSE: Sets the cursor to the first leaf whose key is after (or, if
+*  inclusive, equal to) a key, which need not be in the tree, and returns it.
+*  Returns NULL if there is none. The tree must not be empty.
+*INPUT: KeyTree* tree, uint8_t* key, int inclusive (boolean), KeyTreeCursor* cursor
+*OUTPUTS: void* item
+*/
+static void *seek(const KeyTree *tree, const uint8_t *key, int inclusive, KeyTreeCursor *cursor)
+{
+  const uint8_t *found = keyOf(tree, closest(tree, key));
+  uint32_t byte = tree->length;
+  uint8_t otherbits = 255;
+  int differ = critBit(tree, found, key, &byte, &otherbits);
+  const void *p = tree->root;
+
+  cursor->depth = 0;
+
+  //down the key's path, until the subtree whose keys all agree with the key before its first differing bit
+  while(internal(p) && (untag(p)->byte < byte || (untag(p)->byte == byte && untag(p)->otherbits < otherbits)))
+  {
+    int dir = direction(untag(p), key);
+
+    if(dir == 0)
+    {
+      cursor->pending[cursor->depth++] = untag(p);
+    }
+
+    p = untag(p)->child[dir];
+  }
+
+  if(!differ)
+  { //p is the key's own leaf
+    return inclusive ? (void*)p : next(cursor);
+  }
+  else if((1 + (otherbits | found[byte])) >> 8)
+  { //the subtree's keys have the differing bit set, where the key has it clear: all are after the key
+    return leftmost(p, cursor);
+  }
+  else
+  { //all are before the key
+    return next(cursor);
+  }
+}
+
+/* keyTreeInit
+*PURPOSE: Sets up an empty tree of items whose keys are at the offset.
+*INPUT: KeyTree* tree, size_t offset, size_t length of the keys
+*OUTPUTS: -
+*/
+void keyTreeInit(KeyTree *tree, size_t offset, size_t length)
+{
+  tree->root = NULL;
+  tree->offset = offset;
+  tree->length = length;
+  tree->count = 0;
+}
+
+/* keyTreeFind
+*PURPOSE: Returns the item with the key, or NULL if there is none. Safe to call
+*  without the lock the tree's changes are made under.
+*INPUT: KeyTree* tree, uint8_t* key
+*OUTPUTS: void* item
+*/
+void *keyTreeFind(const KeyTree *tree, const uint8_t *key)
+{
+  void *item = load(&(tree->root)) == NULL ? NULL : closest(tree, key);
+
+  if(item != NULL && memcmp(keyOf(tree, item), key, tree->length))
+  {
+    item = NULL;
+  }
+
+  return item;
+}
+
+/* keyTreeInsert
+*PURPOSE: Adds an item to the tree. If an item with the same key is already in
+*  it, the new item takes its place, and the old one is written to replaced
+*  (otherwise NULL). Returns 'false' if a node cannot be allocated, leaving
+*  the tree unchanged.
+*INPUT: KeyTree* tree, SharedArena* arena (NULL for the heap), void* item
+*OUTPUTS: int inserted (boolean), void** replaced item
+*/
+int keyTreeInsert(KeyTree *tree, SharedArena *arena, void *item, void **replaced)
+{
+  const uint8_t *key = keyOf(tree, item);
+  void **where = &(tree->root);
+  KeyTreeNode *node = NULL;
+  uint32_t byte;
+  uint8_t otherbits;
+  int differ = true;
+  int error = false;
+
+  *replaced = NULL;
+
+  if(tree->root != NULL)
+  {
+    differ = critBit(tree, keyOf(tree, closest(tree, key)), key, &byte, &otherbits);
+  }
+
+  if(differ && tree->root != NULL)
+  {
+    node = arenaAlloc(arena, sizeof(KeyTreeNode));
+    error = node == NULL; //only in prefork mode, once the shared arena is full
+  }
+
+  //the new node goes above the first node on the key's path which tests a later bit
+  while(!error && internal(*where) && (!differ || untag(*where)->byte < byte || (untag(*where)->byte == byte && untag(*where)->otherbits < otherbits)))
+  {
+    where = &(untag(*where)->child[direction(untag(*where), key)]);
+  }
+
+  if(!error && tree->root == NULL)
+  {
+    store(&(tree->root), item);
+    tree->count++;
+  }
+  else if(!error && !differ)
+  {
+    *replaced = *where;
+    store(where, item);
+  }
+  else if(!error)
+  {
+    int dir = (1 + (otherbits | key[byte])) >> 8;
+
+    node->byte = byte;
+    node->otherbits = otherbits;
+    node->child[dir] = item;
+    node->child[1 - dir] = *where;
+    store(where, (void*)((uintptr_t)node + 1)); //linked last, once the node is complete
+    tree->count++;
+  }
+
+  return !error;
+}
+
+/* keyTreeRemove
+*PURPOSE: Takes the item with the key out of the tree, and returns it. Returns
+*  NULL if there is none. The internal node it no longer needs is written to
+*  unlinked (otherwise NULL), to be freed with arenaFree() once no reader can
+*  still be passing through it.
+*INPUT: KeyTree* tree, uint8_t* key
+*OUTPUTS: void* item, KeyTreeNode** unlinked
+*/
+void *keyTreeRemove(KeyTree *tree, const uint8_t *key, KeyTreeNode **unlinked)
+{
+  void **where = &(tree->root);
+  void **parent = NULL;
+  void *item = NULL;
+  int dir = 0;
+
+  *unlinked = NULL;
+
+  while(internal(*where))
+  {
+    parent = where;
+    dir = direction(untag(*where), key);
+    where = &(untag(*where)->child[dir]);
+  }
+
+  if(*where != NULL && !memcmp(keyOf(tree, *where), key, tree->length))
+  {
+    item = *where;
+    tree->count--;
+
+    if(parent == NULL)
+    {
+      store(&(tree->root), NULL);
+    }
+    else
+    { //the sibling takes the parent's place
+      *unlinked = untag(*parent);
+      store(parent, (*unlinked)->child[1 - dir]);
+    }
+  }
+
+  return item;
+}
+
+/* keyTreeRange
+*PURPOSE: Writes up to max items, in key order, whose keys start with the
+*  first bits of the prefix and come after the key after (if not NULL), and
+*  returns how many were written. The bits of the prefix after the first bits
+*  must be clear.
+*INPUT: KeyTree* tree, uint8_t* prefix, int bits, uint8_t* after key (or NULL), int max
+*OUTPUTS: int count, void* items[max]
+*/
+int keyTreeRange(const KeyTree *tree, const uint8_t *prefix, int bits, const uint8_t *after, void **items, int max)
+{
+  KeyTreeCursor cursor;
+  int whole = bits / 8;
+  uint8_t mask = 0xff << (8 - bits % 8);
+  int order = -1; //of after's first bits against the prefix
+  void *item = NULL;
+  int count = 0;
+
+  if(after != NULL)
+  {
+    order = memcmp(after, prefix, whole);
+
+    if(order == 0 && bits % 8)
+    {
+      order = (int)(after[whole] & mask) - (int)prefix[whole];
+    }
+  }
+
+  if(tree->root != NULL && order < 0)
+  { //the first key with the prefix
+    item = seek(tree, prefix, true, &cursor);
+  }
+  else if(tree->root != NULL && order == 0)
+  {
+    item = seek(tree, after, false, &cursor);
+  }
+
+  while(item != NULL && count < max)
+  {
+    const uint8_t *key = keyOf(tree, item);
+
+    if(memcmp(key, prefix, whole) || (bits % 8 && (key[whole] & mask) != prefix[whole]))
+    { //past the last key with the prefix
+      item = NULL;
+    }
+    else
+    {
+      items[count++] = item;
+      item = next(&cursor);
+    }
+  }
+
+  return count;
+}
@@ -0,0 +1,42 @@
+/* keytree.h
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Header for keytree.c. An ordered index of items by a fixed length
+*  binary key held inside each item.
+*/
+
+#ifndef KEYTREE_H
+#define KEYTREE_H
+
+#include "arena.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define KEY_TREE_MAX_LENGTH 32 //bytes of key, bounds the depth of the tree
+
+typedef struct KeyTreeNode
+{ //internal node, the items are the leaves
+  void* child[2]; //tagged, see keytree.c
+  uint32_t byte; //of the key at which the children first differ
+  uint8_t otherbits; //every bit but the one they differ at
+} KeyTreeNode;
+
+typedef struct KeyTree
+{ //kept in the arena with the items in prefork mode, so holds no function pointers
+  void* root; //tagged, NULL if empty
+  size_t offset; //of the key within each item
+  size_t length; //bytes of key, up to KEY_TREE_MAX_LENGTH
+  uint64_t count; //items
+} KeyTree;
+
+void keyTreeInit(KeyTree* tree, size_t offset, size_t length);
+
+void *keyTreeFind(const KeyTree* tree, const uint8_t* key);
+
+int keyTreeInsert(KeyTree* tree, SharedArena* arena, void* item, void** replaced);
+
+void *keyTreeRemove(KeyTree* tree, const uint8_t* key, KeyTreeNode** unlinked);
+
+int keyTreeRange(const KeyTree* tree, const uint8_t* prefix, int bits, const uint8_t* after, void** items, int max);
+
+#endif
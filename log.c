@@ -0,0 +1,460 @@
+/* log.c
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Asynchronous structured logging. Each thread formats its lines into
+*  its own lock-free ring, and a background flusher thread drains every ring to
+*  stdout. A thread never blocks on logging: if its ring is full the line is
+*  dropped and counted instead.
+*/
+
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+static const char *const levels[] = {"debug", "info", "warn", "error"};
+static const char *const formats[] = {"kv", "json"};
+
+static int minLevel = LOG_INFO;
+static int lineFormat = LOG_FORMAT_KV;
+static int running = false;
+static uint64_t dropped = 0;
+
+static pthread_t flusher;
+static pthread_key_t ringKey;
+static LogRing *joined = NULL; //rings of threads which have logged since the last flush, pushed without a lock
+static LogRing *rings = NULL; //only touched by the flusher
+
+//per-thread context included in every line
+static __thread LogRing *ring = NULL;
+static __thread unsigned long context = 0;
+static __thread char contextIp[INET6_ADDRSTRLEN] = "";
+static __thread const char *contextCommand = NULL;
+
+/* closeRing
+*PURPOSE: Thread-exit destructor; hands the thread's ring to the flusher to free.
+*INPUT: void* LogRing
+*OUTPUTS: -
+*/
+static void closeRing(void *arg)
+{
+  __atomic_store_n(&(((LogRing*)arg)->closed), true, __ATOMIC_RELEASE);
+}
+
+/* getRing
+*PURPOSE: Returns the calling thread's ring, creating it on the thread's first
+*  log line and pushing it onto the list the flusher takes new rings from.
+*  Returns NULL if it cannot be allocated.
+*INPUT: -
+*OUTPUTS: LogRing* ring
+*/
+static LogRing *getRing(void)
+{
+  if(ring == NULL)
+  {
+    ring = calloc(1, sizeof(LogRing));
+
+    if(ring != NULL)
+    {
+      pthread_setspecific(ringKey, ring);
+
+      LogRing *first = __atomic_load_n(&joined, __ATOMIC_RELAXED);
+
+      do
+      {
+        ring->next = first;
+      } while(!__atomic_compare_exchange_n(&joined, &first, ring, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+  }
+
+  return ring;
+}
+
+/* escapeString
+*PURPOSE: Copies src into dest, escaping quotes, backslashes and control
+*  characters so the value can sit inside a quoted key=value or JSON string.
+*  Returns the number of characters written, not counting the terminator.
+*INPUT: char* source, size_t destination size
+*OUTPUTS: size_t length, char* destination
+*/
+static size_t escapeString(char *dest, size_t size, const char *src)
+{
+  size_t len = 0;
+
+  while(*src != '\0' && len + 3 < size)
+  {
+    if(*src == '"' || *src == '\\')
+    {
+      dest[len++] = '\\';
+      dest[len++] = *src;
+    }
+    else if((unsigned char)*src < ' ')
+    { //newlines etc would break the one-line-per-entry format
+      dest[len++] = ' ';
+    }
+    else
+    {
+      dest[len++] = *src;
+    }
+
+    src++;
+  }
+
+  dest[len] = '\0';
+
+  return len;
+}
+
+/* flushRings
+*PURPOSE: Drains every ring to stdout in as few write() calls as possible, and
+*  frees the rings of threads that have exited. Reports any newly dropped lines.
+*  Only called by the flusher, which first moves the rings joined since the
+*  last flush onto its own list, so no lock is held while it writes.
+*INPUT: -
+*OUTPUTS: -
+*/
+static void flushRings(void)
+{
+  static char buffer[LOG_FLUSH_BUFFER];
+  static uint64_t reportedDrops = 0;
+  size_t used = 0;
+
+  LogRing *added = __atomic_exchange_n(&joined, NULL, __ATOMIC_ACQUIRE);
+
+  if(added != NULL)
+  {
+    LogRing *last = added;
+
+    while(last->next != NULL)
+    {
+      last = last->next;
+    }
+
+    last->next = rings;
+    rings = added;
+  }
+
+  LogRing **link = &rings;
+
+  while(*link != NULL)
+  {
+    LogRing *node = *link;
+    int closed = __atomic_load_n(&(node->closed), __ATOMIC_ACQUIRE); //read before head, so no line is missed
+    uint32_t head = __atomic_load_n(&(node->head), __ATOMIC_ACQUIRE);
+    uint32_t tail = node->tail;
+
+    while(tail != head)
+    {
+      char *line = node->lines[tail & (LOG_RING_SLOTS - 1)];
+      size_t len = strlen(line);
+
+      if(used + len > sizeof(buffer))
+      {
+        write(STDOUT_FILENO, buffer, used);
+        used = 0;
+      }
+
+      memcpy(buffer + used, line, len);
+      used += len;
+      tail++;
+    }
+
+    __atomic_store_n(&(node->tail), tail, __ATOMIC_RELEASE);
+
+    if(closed)
+    { //owning thread is gone and its ring is empty
+      *link = node->next;
+      free(node);
+    }
+    else
+    {
+      link = &(node->next);
+    }
+  }
+
+  if(used > 0)
+  {
+    write(STDOUT_FILENO, buffer, used);
+  }
+
+  uint64_t drops = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+
+  if(drops != reportedDrops)
+  {
+    char line[LOG_LINE_MAX];
+    int len;
+
+    if(lineFormat == LOG_FORMAT_JSON)
+    {
+      len = snprintf(line, sizeof(line), "{\"level\":\"warn\",\"src\":\"log\",\"msg\":\"Log lines dropped.\",\"dropped\":%llu,\"total\":%llu}\n",
+        (unsigned long long)(drops - reportedDrops), (unsigned long long)drops);
+    }
+    else
+    {
+      len = snprintf(line, sizeof(line), "level=warn src=log msg=\"Log lines dropped.\" dropped=%llu total=%llu\n",
+        (unsigned long long)(drops - reportedDrops), (unsigned long long)drops);
+    }
+
+    write(STDOUT_FILENO, line, len);
+    reportedDrops = drops;
+  }
+}
+
+/* flushThread
+*PURPOSE: Thread function which periodically drains all rings until shutdown.
+*INPUT: -
+*OUTPUTS: -
+*/
+static void *flushThread(void *arg)
+{
+  struct timespec interval;
+  interval.tv_sec = 0;
+  interval.tv_nsec = LOG_FLUSH_INTERVAL * 1000000L;
+
+  while(__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+  {
+    flushRings();
+    nanosleep(&interval, NULL);
+  }
+
+  flushRings();
+
+  return NULL;
+}
+
+/* logConfigure
+*PURPOSE: Sets the level and format, without starting the flusher thread, for
+*  a process which logs straight to stdout (the prefork supervisor).
+*INPUT: int minimum level, int format
+*OUTPUTS: -
+*/
+void logConfigure(int level, int format)
+{
+  minLevel = level;
+  lineFormat = format;
+}
+
+/* logInit
+*PURPOSE: Sets the level and format, and starts the flusher thread.
+*INPUT: int minimum level, int format
+*OUTPUTS: -
+*/
+void logInit(int level, int format)
+{
+  logConfigure(level, format);
+
+  fflush(stdout); //anything printed before now must come first
+  pthread_key_create(&ringKey, closeRing);
+
+  running = true;
+  pthread_create(&flusher, NULL, flushThread, NULL);
+}
+
+/* logShutdown
+*PURPOSE: Stops the flusher thread after a final flush.
+*INPUT: -
+*OUTPUTS: -
+*/
+void logShutdown(void)
+{
+  if(running)
+  {
+    __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+    pthread_join(flusher, NULL);
+  }
+}
+
+/* logParseLevel
+*PURPOSE: Returns the level define for a level name, or -1 if unknown.
+*INPUT: char* name
+*OUTPUTS: int level
+*/
+int logParseLevel(const char *name)
+{
+  int level = -1;
+
+  for(int i = 0; level == -1 && i < (int)(sizeof(levels) / sizeof(levels[0])); i++)
+  {
+    if(!strcmp(levels[i], name))
+    {
+      level = i;
+    }
+  }
+
+  return level;
+}
+
+/* logParseFormat
+*PURPOSE: Returns the format define for a format name, or -1 if unknown.
+*INPUT: char* name
+*OUTPUTS: int format
+*/
+int logParseFormat(const char *name)
+{
+  int format = -1;
+
+  for(int i = 0; format == -1 && i < (int)(sizeof(formats) / sizeof(formats[0])); i++)
+  {
+    if(!strcmp(formats[i], name))
+    {
+      format = i;
+    }
+  }
+
+  return format;
+}
+
+/* logContext
+*PURPOSE: Sets the connection id and client IP included in the calling
+*  thread's lines, and clears its command. A connection id of 0 clears both.
+*INPUT: unsigned long connection id, char* client IP (may be NULL)
+*OUTPUTS: -
+*/
+void logContext(unsigned long conId, const char *ip)
+{
+  context = conId;
+  contextCommand = NULL;
+
+  if(ip != NULL && conId != 0)
+  {
+    snprintf(contextIp, sizeof(contextIp), "%s", ip);
+  }
+  else
+  {
+    contextIp[0] = '\0';
+  }
+}
+
+/* logCommand
+*PURPOSE: Sets the command included in the calling thread's lines.
+*INPUT: char* command name (must outlive its use, eg a string literal), or NULL
+*OUTPUTS: -
+*/
+void logCommand(const char *command)
+{
+  contextCommand = command;
+}
+
+/* formatLine
+*PURPOSE: Formats a complete, newline-terminated line with a timestamp, level,
+*  source, the thread's context and the escaped message text.
+*INPUT: int level, char* source subsystem, char* message text
+*OUTPUTS: char line[LOG_LINE_MAX]
+*/
+static void formatLine(char *line, int level, const char *source, const char *text)
+{
+  char escaped[LOG_LINE_MAX];
+  char stamp[32];
+  struct timespec now;
+  struct tm utc;
+  int len;
+
+  escapeString(escaped, sizeof(escaped), text);
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  gmtime_r(&(now.tv_sec), &utc);
+  len = strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &utc);
+  snprintf(stamp + len, sizeof(stamp) - len, ".%03ldZ", now.tv_nsec / 1000000);
+
+  if(lineFormat == LOG_FORMAT_JSON)
+  {
+    len = snprintf(line, LOG_LINE_MAX, "{\"ts\":\"%s\",\"level\":\"%s\",\"src\":\"%s\"", stamp, levels[level], source);
+
+    if(context != 0 && len < LOG_LINE_MAX)
+    {
+      len += snprintf(line + len, LOG_LINE_MAX - len, ",\"conn\":%lu,\"ip\":\"%s\"", context, contextIp);
+    }
+
+    if(contextCommand != NULL && len < LOG_LINE_MAX)
+    {
+      len += snprintf(line + len, LOG_LINE_MAX - len, ",\"cmd\":\"%s\"", contextCommand);
+    }
+
+    if(len < LOG_LINE_MAX)
+    {
+      len += snprintf(line + len, LOG_LINE_MAX - len, ",\"msg\":\"%s\"}\n", escaped);
+    }
+  }
+  else
+  {
+    len = snprintf(line, LOG_LINE_MAX, "ts=%s level=%s src=%s", stamp, levels[level], source);
+
+    if(context != 0 && len < LOG_LINE_MAX)
+    {
+      len += snprintf(line + len, LOG_LINE_MAX - len, " conn=%lu ip=%s", context, contextIp);
+    }
+
+    if(contextCommand != NULL && len < LOG_LINE_MAX)
+    {
+      len += snprintf(line + len, LOG_LINE_MAX - len, " cmd=%s", contextCommand);
+    }
+
+    if(len < LOG_LINE_MAX)
+    {
+      len += snprintf(line + len, LOG_LINE_MAX - len, " msg=\"%s\"\n", escaped);
+    }
+  }
+
+  if(len >= LOG_LINE_MAX)
+  { //truncated, keep the line terminated
+    line[LOG_LINE_MAX - 2] = '\n';
+  }
+}
+
+/* logMsg
+*PURPOSE: Queues a formatted line for the flusher. Never blocks; lines below
+*  the minimum level are ignored and lines that do not fit in the thread's ring
+*  are dropped and counted. Before logInit() (or after logShutdown()) lines are
+*  written straight to stdout instead.
+*INPUT: int level, char* source subsystem, char* printf format, ...
+*OUTPUTS: -
+*/
+void logMsg(int level, const char *source, const char *format, ...)
+{
+  if(level >= minLevel)
+  {
+    char text[LOG_LINE_MAX];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+
+    if(__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+    {
+      LogRing *own = getRing();
+
+      if(own != NULL && own->head - __atomic_load_n(&(own->tail), __ATOMIC_ACQUIRE) < LOG_RING_SLOTS)
+      {
+        formatLine(own->lines[own->head & (LOG_RING_SLOTS - 1)], level, source, text);
+        __atomic_store_n(&(own->head), own->head + 1, __ATOMIC_RELEASE);
+      }
+      else
+      { //ring full (flusher is behind) or unavailable
+        __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+      }
+    }
+    else
+    { //no flusher running
+      char line[LOG_LINE_MAX];
+
+      formatLine(line, level, source, text);
+      fputs(line, stdout);
+    }
+  }
+}
+
+/* logDropped
+*PURPOSE: Returns the total number of lines dropped so far.
+*INPUT: -
+*OUTPUTS: uint64_t dropped lines
+*/
+uint64_t logDropped(void)
+{
+  return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
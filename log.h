@@ -0,0 +1,55 @@
+/* log.h
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Header for log.c. Asynchronous structured logging for the server.
+*/
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define LOG_RING_SLOTS 128 //lines buffered per thread, must be a power of two
+#define LOG_LINE_MAX 320 //longer lines are truncated
+#define LOG_FLUSH_INTERVAL 10 //milliseconds between flushes
+#define LOG_FLUSH_BUFFER 65536 //bytes handed to each write() by the flusher
+
+//level defines, in increasing severity
+#define LOG_DEBUG 0
+#define LOG_INFO 1
+#define LOG_WARN 2
+#define LOG_ERROR 3
+
+//format defines
+#define LOG_FORMAT_KV 0 //key=value pairs
+#define LOG_FORMAT_JSON 1 //one JSON object per line
+
+typedef struct LogRing
+{ //single producer (owning thread), single consumer (flusher) line buffer
+  struct LogRing* next;
+  uint32_t head; //next slot to write, only written by the owning thread
+  uint32_t tail; //next slot to flush, only written by the flusher
+  int closed; //owning thread has exited; freed by the flusher once empty
+  char lines[LOG_RING_SLOTS][LOG_LINE_MAX];
+} LogRing;
+
+void logConfigure(int level, int format);
+
+void logInit(int level, int format);
+
+void logShutdown(void);
+
+int logParseLevel(const char* name);
+
+int logParseFormat(const char* name);
+
+void logContext(unsigned long conId, const char* ip);
+
+void logCommand(const char* command);
+
+void logMsg(int level, const char* source, const char* format, ...) __attribute__((format(printf, 3, 4)));
+
+uint64_t logDropped(void);
+
+#endif
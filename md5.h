@@ -0,0 +1,31 @@
+/* md5.h
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Header for md5.c. In-process MD5 (RFC 1321), so hashing a file no
+*  longer needs it written to disk and an md5sum process started.
+*/
+
+#ifndef MD5_H
+#define MD5_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MD5_DIGEST_LENGTH 16
+
+typedef struct MD5Context
+{
+  uint32_t state[4];
+  uint64_t length; //bytes hashed so far
+  uint8_t buffer[64]; //partial block
+} MD5Context;
+
+void md5Init(MD5Context* ctx);
+
+void md5Update(MD5Context* ctx, const void* data, size_t length);
+
+void md5Final(MD5Context* ctx, uint8_t digest[MD5_DIGEST_LENGTH]);
+
+void md5Hex(const void* data, uint64_t length, char* hex);
+
+#endif
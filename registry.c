@@ -0,0 +1,151 @@
+/* registry.c
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Keeps every live session in a hash table keyed by client address, so
+*  that when an address is banned all of its other sessions can be found
+*  without a scan and shut down at once. Shutting down a session's socket
+*  wakes its thread from whatever recv() or send() it is blocked in, and the
+*  thread then closes the connection itself.
+*/
+
+#include "registry.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/socket.h>
+
+/* registryBucket
+*PURPOSE: Returns the bucket index of an address (FNV-1a over its bytes).
+*INPUT: struct in6_addr* IP
+*OUTPUTS: unsigned int bucket
+*/
+static unsigned int registryBucket(const struct in6_addr *ip)
+{
+  uint32_t hash = 2166136261u;
+
+  for(int i = 0; i < (int)sizeof(ip->s6_addr); i++)
+  {
+    hash = (hash ^ ip->s6_addr[i]) * 16777619u;
+  }
+
+  return hash & (REGISTRY_BUCKETS - 1);
+}
+
+/* registryCreate
+*PURPOSE: Allocates an empty registry.
+*INPUT: -
+*OUTPUTS: SessionRegistry* registry
+*/
+SessionRegistry *registryCreate(void)
+{
+  SessionRegistry *registry = calloc(1, sizeof(SessionRegistry));
+
+  registry->mutex = malloc(sizeof(pthread_mutex_t));
+  pthread_mutex_init(registry->mutex, NULL);
+
+  return registry;
+}
+
+/* registryDestroy
+*PURPOSE: Frees the registry. Sessions still registered are left to their
+*  owners.
+*INPUT: SessionRegistry* registry
+*OUTPUTS: -
+*/
+void registryDestroy(SessionRegistry *registry)
+{
+  pthread_mutex_destroy(registry->mutex);
+  free(registry->mutex);
+  free(registry);
+}
+
+/* registryAdd
+*PURPOSE: Registers a session, whose ip and sock must already be set.
+*INPUT: SessionRegistry* registry, Session* session
+*OUTPUTS: -
+*/
+void registryAdd(SessionRegistry *registry, Session *session)
+{
+  Session **bucket = &(registry->buckets[registryBucket(&(session->ip))]);
+
+  session->banned = false;
+  session->prev = NULL;
+
+  pthread_mutex_lock(registry->mutex);
+
+  session->next = *bucket;
+
+  if(*bucket != NULL)
+  {
+    (*bucket)->prev = session;
+  }
+
+  *bucket = session;
+  registry->count++;
+
+  pthread_mutex_unlock(registry->mutex);
+}
+
+/* registryRemove
+*PURPOSE: Unregisters a session. Once this returns, a ban will not touch the
+*  session's socket, so it may be closed.
+*INPUT: SessionRegistry* registry, Session* session
+*OUTPUTS: -
+*/
+void registryRemove(SessionRegistry *registry, Session *session)
+{
+  pthread_mutex_lock(registry->mutex);
+
+  if(session->prev != NULL)
+  {
+    session->prev->next = session->next;
+  }
+  else
+  {
+    registry->buckets[registryBucket(&(session->ip))] = session->next;
+  }
+
+  if(session->next != NULL)
+  {
+    session->next->prev = session->prev;
+  }
+
+  registry->count--;
+
+  pthread_mutex_unlock(registry->mutex);
+}
+
+/* registryCloseAddr
+*PURPOSE: Shuts down the socket of every session from the address, other than
+*  the excepted one (usually the session making the ban, which is only marked
+*  as banned so that later calls leave it to send its ban notice), and marks
+*  them as banned. Returns the number of sessions shut down.
+*INPUT: SessionRegistry* registry, struct in6_addr IP, Session* except (may be NULL)
+*OUTPUTS: int sessions closed
+*/
+int registryCloseAddr(SessionRegistry *registry, struct in6_addr ip, Session *except)
+{
+  int closed = 0;
+
+  pthread_mutex_lock(registry->mutex);
+
+  if(except != NULL)
+  {
+    except->banned = true;
+  }
+
+  for(Session *session = registry->buckets[registryBucket(&ip)]; session != NULL; session = session->next)
+  {
+    if(!session->banned && !memcmp(&(session->ip), &ip, sizeof(ip)))
+    {
+      session->banned = true;
+      shutdown(session->sock, SHUT_RDWR);
+      closed++;
+    }
+  }
+
+  pthread_mutex_unlock(registry->mutex);
+
+  return closed;
+}
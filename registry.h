@@ -0,0 +1,41 @@
+/* registry.h
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Header for registry.c. Every live session, indexed by client address.
+*/
+
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <pthread.h>
+#include <netinet/in.h>
+
+#define REGISTRY_BUCKETS 1024 //power of two
+
+typedef struct Session
+{ //one per connection, registered until just before its socket is closed
+  struct Session* next;
+  struct Session* prev;
+  struct in6_addr ip;
+  int sock;
+  int banned; //set once the session has been shut down by a ban, read after registryRemove()
+} Session;
+
+typedef struct SessionRegistry
+{ //hash table of doubly linked session lists, bucketed by address
+  pthread_mutex_t* mutex;
+  Session* buckets[REGISTRY_BUCKETS];
+  unsigned long count;
+} SessionRegistry;
+
+SessionRegistry *registryCreate(void);
+
+void registryDestroy(SessionRegistry* registry);
+
+void registryAdd(SessionRegistry* registry, Session* session);
+
+void registryRemove(SessionRegistry* registry, Session* session);
+
+int registryCloseAddr(SessionRegistry* registry, struct in6_addr ip, Session* except);
+
+#endif
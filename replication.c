@@ -0,0 +1,805 @@
+/* replication.c
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Rebuilds the file index from the journal on startup, and keeps
+*  read-only replicas up to date with a primary. A replica connects to the
+*  primary's replication port and says the latest seq it has applied; the
+*  primary streams every STORE (with the file's contents), DELETE and EXPIRE after it
+*  from its journal, then each new one as it is recorded. The replica applies
+*  them to its own index and journal, keeping the primary's file numbers and
+*  seqs, so after a restart it replays its journal and resumes from there.
+*  Each side acknowledges or heartbeats every second, and logs how far the
+*  replica is behind.
+*/
+
+#define _GNU_SOURCE //accept4()
+#include "replication.h"
+#include <netdb.h>
+
+/* sendAll
+*PURPOSE: Sends the whole buffer. Returns 'true' if an error occurs.
+*INPUT: int sock descriptor, void* data, uint64_t length
+*OUTPUTS: int error occured (boolean)
+*/
+static int sendAll(int sock, const void *data, uint64_t length)
+{
+  int error = false;
+
+  while(!error && length > 0)
+  {
+    ssize_t sent = send(sock, data, length, MSG_NOSIGNAL);
+
+    if(sent > 0)
+    {
+      data = (const char*)data + sent;
+      length -= sent;
+    }
+    else
+    {
+      error = !(sent < 0 && errno == EINTR);
+    }
+  }
+
+  return !error;
+}
+
+/* recvAll
+*PURPOSE: Recieves exactly length bytes. Returns 'true' if an error occurs,
+*  including the connection closing or timing out first.
+*INPUT: int sock descriptor, uint64_t length
+*OUTPUTS: int error occured (boolean), void* data
+*/
+static int recvAll(int sock, void *data, uint64_t length)
+{
+  int error = false;
+
+  while(!error && length > 0)
+  {
+    ssize_t got = recv(sock, data, length, MSG_WAITALL);
+
+    if(got > 0)
+    {
+      data = (char*)data + got;
+      length -= got;
+    }
+    else
+    {
+      error = !(got < 0 && errno == EINTR);
+    }
+  }
+
+  return !error;
+}
+
+/* newNode
+*PURPOSE: Allocates a file node for a STORE record, and records the record's
+*  STORE in the event log. Returns NULL if it cannot be allocated, or the
+*  record's key is not well formed.
+*INPUT: FileList* file list, JournalRecord* record
+*OUTPUTS: FileNode* node
+*/
+static FileNode *newNode(FileList *fileList, const JournalRecord *record)
+{
+  FileNode *node = slabAlloc(&(fileList->index->nodes), fileList->arena);
+
+  if(node != NULL)
+  {
+    node->id = record->id;
+    node->blob = record->blob;
+    node->stored = record->time;
+    node->accessed = record->time;
+    node->storer = record->ip;
+    node->events = 0;
+  }
+
+  if(node != NULL && !hashKeyBytes(record->key, node->keyBytes))
+  { //a damaged record, which no GET could find
+    logMsg(LOG_ERROR, "server", "Record of file_%u has a malformed key, skipped.", record->id);
+    freeNode(node, fileList);
+    node = NULL;
+  }
+
+  if(node != NULL)
+  {
+    addEvent(fileList, node, STORE, record->ip, record->time); //when it was first stored, not now
+  }
+
+  return node;
+}
+
+/* replayJournal
+*PURPOSE: Rebuilds the file index from the journal, reopening the packs still
+*  holding live files. Nodes are only linked into the index once the whole
+*  journal has been read, in the order they were stored, so the replay does not
+*  have to search the list. Returns 'true' if an error occurs.
+*INPUT: FileList* file list (empty)
+*OUTPUTS: int error occured (boolean)
+*/
+int replayJournal(FileList *fileList)
+{
+  int error = false;
+  JournalRecord record;
+  uint64_t offset = 0;
+  unsigned int records = 0;
+  unsigned int files = 0;
+  unsigned int capacity = 0;
+  unsigned int stored = 0;
+  FileNode **byId = NULL; //live nodes, indexed by file number
+  unsigned int *order = NULL; //file numbers, in the order they were stored
+
+  while(!error && journalRead(fileList->journal, offset, &record))
+  {
+    offset += sizeof(record);
+    records++;
+
+    if(record.id >= capacity)
+    {
+      unsigned int grown = capacity > 0 ? capacity : 1024;
+
+      while(grown <= record.id)
+      {
+        grown *= 2;
+      }
+
+      byId = realloc(byId, grown * sizeof(FileNode*));
+      order = realloc(order, grown * sizeof(unsigned int));
+      memset(byId + capacity, 0, (grown - capacity) * sizeof(FileNode*));
+      capacity = grown;
+    }
+
+    FileNode *node = byId[record.id];
+
+    switch(record.type)
+    {
+      case JOURNAL_STORE:
+        if(node == NULL && (node = newNode(fileList, &record)) != NULL)
+        {
+          byId[record.id] = node;
+          order[stored++] = record.id;
+          files++;
+        }
+        break;
+      case JOURNAL_DELETE:
+        if(node != NULL)
+        { //not linked yet; a file of its own is deleted again, in case the reclaimer had not reached it
+          addEvent(fileList, node, DELETE, record.ip, record.time);
+
+          if(node->blob.pack == NO_PACK)
+          {
+            blobRemove(fileList->blobs, node->id, &(node->blob));
+          }
+
+          freeNode(node, fileList);
+          byId[record.id] = NULL;
+          files--;
+        }
+        break;
+      case JOURNAL_MOVE:
+        if(node != NULL)
+        {
+          node->blob = record.blob;
+        }
+        break;
+      case JOURNAL_EXPIRE:
+        if(node != NULL)
+        {
+          node->expires = record.time;
+        }
+        break;
+      default:
+        logMsg(LOG_ERROR, "server", "Unknown record in the journal, replay stopped.");
+        error = true;
+        break;
+    }
+
+    if(record.id >= fileList->index->count)
+    {
+      fileList->index->count = record.id + 1;
+    }
+
+    journalSkip(fileList->journal, record.seq);
+  }
+
+  for(unsigned int i = 0; i < stored; i++)
+  {
+    FileNode *node = byId[order[i]];
+
+    if(node != NULL)
+    {
+      if(!blobAdopt(fileList->blobs, &(node->blob)))
+      {
+        logMsg(LOG_ERROR, "server", "pack_%d, holding file_%u, is missing.", node->blob.pack, node->id);
+      }
+
+      if(!linkNode(node, fileList))
+      {
+        freeNode(node, fileList);
+      }
+      else if(node->expires != 0 && fileList->removes && !expiryAdd(fileList->index->expiries, fileList->arena, node->id, node->keyBytes, node->expires))
+      { //only in prefork mode, once the shared arena is full
+        logMsg(LOG_ERROR, "server", "Shared memory is full, file_%u will not expire.", node->id);
+      }
+    }
+  }
+
+  blobAdopted(fileList->blobs);
+  free(byId);
+  free(order);
+
+  logMsg(LOG_INFO, "server", "Replayed %u journal records: %u files, up to seq %llu.",
+    records, files, (unsigned long long)journalSeq(fileList->journal));
+
+  return !error;
+}
+
+/* commitJournal
+*PURPOSE: Returns once the journal is on disk, as required by the durability
+*  mode. Journal syncs share a commit group, so concurrent stores share them.
+*  Returns 'true' if an error occurs.
+*INPUT: FileList* file list
+*OUTPUTS: int error occured (boolean)
+*/
+int commitJournal(FileList *fileList)
+{
+  int error = false;
+
+  if(fileList->journal != NULL && fileList->commits->mode != DURABILITY_NONE)
+  {
+    error = !commitWait(fileList->commits, fileList->journal->fd, JOURNAL_GROUP, false);
+  }
+
+  return !error;
+}
+
+/* readPiece
+*PURPOSE: Reads part of a file's contents for a replica, without the file list
+*  lock. The file is found in the key tree during an epochEnter() read, so
+*  compaction cannot retire the pack and a DELETE cannot remove the contents
+*  until the read is done. Any file under the key has the same contents, so it
+*  is read from whichever one the tree holds now. Returns 'true' if an error
+*  occurs, including no file being left under the key.
+*INPUT: FileList* file list, uint8_t* binary key, unsigned int id (for
+*  logging), uint64_t length of the whole file, uint64_t offset, uint64_t
+*  length to read
+*OUTPUTS: int error occured (boolean), char* data
+*/
+static int readPiece(FileList *fileList, const uint8_t *keyBytes, unsigned int id, uint64_t total, uint64_t offset, uint64_t length, char *data)
+{
+  int error = false;
+  BlobRef blob;
+  int epoch = epochEnter(fileList->index->epochs);
+
+  FileNode *node = keyTreeFind(&(fileList->index->keys), keyBytes);
+
+  if(node != NULL)
+  {
+    nodeBlob(fileList, node, &blob);
+  }
+
+  if(node == NULL || blob.length != total)
+  {
+    logMsg(LOG_WARN, "server", "file_%u was deleted while being sent to a replica.", id);
+    error = true;
+  }
+  else if(!blobReadPart(fileList->blobs, node->id, &blob, offset, length, data))
+  {
+    logMsg(LOG_ERROR, "server", "Failed to read file_%u for a replica.", node->id);
+    error = true;
+  }
+
+  epochExit(fileList->index->epochs, epoch);
+
+  return !error;
+}
+
+/* sendRecord
+*PURPOSE: Sends a journal record to a replica, followed by the file's contents
+*  for a STORE, read from wherever the file is now and sent REPLICATION_PIECE
+*  bytes at a time, so a large file neither needs a buffer of its size nor
+*  holds up removals while a slow replica takes it. A file which has been
+*  deleted before its record is sent is sent as JOURNAL_GONE; one deleted
+*  while its contents are being sent ends the connection, and the replica
+*  catches up when it reconnects. Returns 'true' if an error occurs.
+*INPUT: ReplicaThread* replica, JournalRecord* record
+*OUTPUTS: int error occured (boolean)
+*/
+static int sendRecord(ReplicaThread *rep, JournalRecord *record)
+{
+  int error = false;
+  char *data = NULL;
+  uint8_t keyBytes[HASH_KEY_BYTES];
+  FileList *fileList = rep->fileList;
+
+  if(record->type == JOURNAL_STORE)
+  { //found once; the pieces are read without the lock
+    arenaLock(fileList->mutex);
+
+    FileNode *node = checkId(record->id, fileList);
+
+    if(node == NULL)
+    {
+      record->type = JOURNAL_GONE;
+    }
+    else
+    {
+      record->blob = node->blob;
+      memcpy(keyBytes, node->keyBytes, HASH_KEY_BYTES);
+    }
+
+    pthread_mutex_unlock(fileList->mutex);
+  }
+
+  if(record->type == JOURNAL_STORE)
+  {
+    uint64_t size = record->blob.length < REPLICATION_PIECE ? record->blob.length : REPLICATION_PIECE;
+
+    if((data = malloc(size + 1)) == NULL)
+    {
+      logMsg(LOG_ERROR, "server", "Failed to allocate memory to send file_%u to a replica.", record->id);
+      error = true;
+    }
+  }
+
+  error = error || !sendAll(rep->sd, record, sizeof(JournalRecord));
+
+  for(uint64_t offset = 0; !error && data != NULL && offset < record->blob.length; offset += REPLICATION_PIECE)
+  {
+    uint64_t length = record->blob.length - offset < REPLICATION_PIECE ? record->blob.length - offset : REPLICATION_PIECE;
+
+    error = !readPiece(fileList, keyBytes, record->id, record->blob.length, offset, length, data) || !sendAll(rep->sd, data, length);
+  }
+
+  free(data);
+
+  return !error;
+}
+
+/* replicationAcceptor
+*PURPOSE: Thread function which accepts replicas on the replication port, and
+*  creates a replicationSender() thread for each.
+*INPUT: void* to a ReplicationThread
+*OUTPUTS: -
+*/
+void *replicationAcceptor(void *arg)
+{
+  ReplicationThread *rt = (ReplicationThread*)arg;
+  struct pollfd polld;
+  polld.fd = rt->sock;
+  polld.events = POLLIN;
+
+  while(true)
+  {
+    ReplicaThread *rep = calloc(1, sizeof(ReplicaThread));
+    socklen_t len = sizeof(rep->addr);
+
+    if((rep->sd = accept4(rt->sock, (struct sockaddr*)&(rep->addr), &len, SOCK_CLOEXEC)) >= 0)
+    {
+      pthread_t thread;
+      rep->fileList = rt->fileList;
+      rep->config = rt->config;
+
+      pthread_create(&thread, NULL, replicationSender, (void*)rep);
+      pthread_detach(thread);
+    }
+    else
+    {
+      free(rep);
+
+      if(errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        poll(&polld, 1, -1);
+      }
+      else if(errno != EINTR && errno != ECONNABORTED)
+      { //keep trying, clients are unaffected
+        logMsg(LOG_ERROR, "network", "Replication connection error.");
+        sleep(REPLICATION_RETRY);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/* replicationSender
+*PURPOSE: Thread function which streams the journal to one replica, from just
+*  after the seq it asks for, then follows the journal as records are added.
+*  Sends a heartbeat when there is nothing new, reads the replica's
+*  acknowledgements without blocking, and logs how far behind it is.
+*INPUT: void* to a ReplicaThread
+*OUTPUTS: -
+*/
+void *replicationSender(void *arg)
+{
+  ReplicaThread *rep = (ReplicaThread*)arg;
+  Journal *journal = rep->fileList->journal;
+  ReplicationHello hello;
+  JournalRecord record;
+  uint64_t offset = 0;
+  uint64_t acked = 0;
+  char ack[sizeof(uint64_t)]; //acknowledgements may arrive a few bytes at a time
+  size_t ackLength = 0;
+  time_t reported = time(NULL);
+  time_t heard = time(NULL);
+  struct timeval limit = {REPLICATION_TIMEOUT, 0};
+  char ipBuff[INET6_ADDRSTRLEN];
+
+  addrString(rep->addr.sin6_addr, ipBuff);
+  logContext(0, ipBuff);
+  setsockopt(rep->sd, SOL_SOCKET, SO_SNDTIMEO, &limit, sizeof(limit));
+  setsockopt(rep->sd, SOL_SOCKET, SO_RCVTIMEO, &limit, sizeof(limit));
+
+  int ok = recvAll(rep->sd, &hello, sizeof(hello)) && hello.magic == REPLICATION_MAGIC;
+
+  if(!ok)
+  {
+    logMsg(LOG_WARN, "network", "Refused a replication connection which is not a replica of this version.");
+  }
+  else if(hello.seq > journalSeq(journal))
+  { //it has seen history this server has not, eg the journal was removed
+    logMsg(LOG_ERROR, "server", "Refused a replica at seq %llu, ahead of this server's journal at seq %llu.",
+      (unsigned long long)hello.seq, (unsigned long long)journalSeq(journal));
+    ok = false;
+  }
+  else
+  {
+    acked = hello.seq;
+    logMsg(LOG_INFO, "server", "Replica connected, resuming after seq %llu of %llu.",
+      (unsigned long long)hello.seq, (unsigned long long)journalSeq(journal));
+  }
+
+  while(ok)
+  {
+    if(journalRead(journal, offset, &record))
+    {
+      offset += sizeof(record);
+
+      if(record.type != JOURNAL_MOVE && record.seq > hello.seq)
+      {
+        ok = sendRecord(rep, &record);
+      }
+    }
+    else if(!journalWait(journal, offset, REPLICATION_HEARTBEAT * 1000))
+    {
+      memset(&record, 0, sizeof(record));
+      record.type = JOURNAL_HEARTBEAT;
+      record.seq = journalSeq(journal);
+      record.time = time(NULL);
+      ok = sendAll(rep->sd, &record, sizeof(record));
+    }
+
+    ssize_t got = 1;
+
+    while(ok && (got = recv(rep->sd, ack + ackLength, sizeof(ack) - ackLength, MSG_DONTWAIT)) > 0)
+    {
+      ackLength += got;
+      heard = time(NULL);
+
+      if(ackLength == sizeof(ack))
+      {
+        memcpy(&acked, ack, sizeof(ack));
+        ackLength = 0;
+      }
+    }
+
+    if(ok && (got == 0 || time(NULL) - heard > REPLICATION_TIMEOUT))
+    { //closed, or silent for too long
+      ok = false;
+    }
+
+    if(ok && time(NULL) - reported >= REPLICATION_REPORT_INTERVAL)
+    {
+      uint64_t seq = journalSeq(journal);
+
+      logMsg(LOG_INFO, "server", "Replica at seq %llu of %llu, %llu behind.", (unsigned long long)acked,
+        (unsigned long long)seq, (unsigned long long)(seq > acked ? seq - acked : 0));
+      reported = time(NULL);
+    }
+  }
+
+  logMsg(LOG_INFO, "server", "Replica disconnected at seq %llu.", (unsigned long long)acked);
+
+  close(rep->sd);
+  free(rep);
+
+  return NULL;
+}
+
+/* applyStore
+*PURPOSE: Stores a file replicated from the primary, under the primary's file
+*  number, and records it in this server's journal with the primary's seq.
+*  Returns 'true' if an error occurs.
+*INPUT: FileList* file list, JournalRecord* record, char* data
+*OUTPUTS: int error occured (boolean)
+*/
+int applyStore(FileList *fileList, JournalRecord *record, const char *data)
+{
+  int error = false;
+  int written = false;
+  FileNode *fileNode = newNode(fileList, record);
+
+  if(fileNode == NULL)
+  {
+    error = true;
+  }
+  else
+  {
+    written = blobWrite(fileList->blobs, fileNode->id, data, record->blob.length, &(fileNode->blob));
+    error = !written || !commitBlob(fileList, fileNode->id, &(fileNode->blob), fileNode->blob.pack == NO_PACK);
+  }
+
+  if(!error)
+  {
+    record->blob = fileNode->blob;
+
+    arenaLock(fileList->mutex);
+
+    if(journalAppend(fileList->journal, record) && linkNode(fileNode, fileList))
+    {
+      if(fileNode->id >= fileList->index->count)
+      {
+        fileList->index->count = fileNode->id + 1;
+      }
+    }
+    else
+    {
+      error = true;
+    }
+
+    pthread_mutex_unlock(fileList->mutex);
+  }
+
+  if(!error)
+  {
+    if(!commitJournal(fileList))
+    {
+      logMsg(LOG_ERROR, "server", "Failed to sync the journal.");
+    }
+
+    logMsg(LOG_DEBUG, "server", "Replicated file_%u at seq %llu.", fileNode->id, (unsigned long long)record->seq);
+  }
+  else
+  {
+    logMsg(LOG_ERROR, "server", "Failed to store replicated file_%u.", record->id);
+
+    if(written)
+    {
+      blobRemove(fileList->blobs, fileNode->id, &(fileNode->blob));
+    }
+
+    if(fileNode != NULL)
+    { //never linked
+      freeNode(fileNode, fileList);
+    }
+  }
+
+  return !error;
+}
+
+/* applyDelete
+*PURPOSE: Deletes a file as replicated from the primary, and records it in this
+*  server's journal with the primary's seq.
+*INPUT: FileList* file list, JournalRecord* record
+*OUTPUTS: -
+*/
+void applyDelete(FileList *fileList, JournalRecord *record)
+{
+  arenaLock(fileList->mutex);
+
+  FileNode *node = checkId(record->id, fileList);
+  KeyTreeNode *unlinked = NULL;
+  int buried = false;
+
+  if(node != NULL)
+  {
+    logMsg(LOG_DEBUG, "server", "Replicated deletion of file_%u at seq %llu.", node->id, (unsigned long long)record->seq);
+    addEvent(fileList, node, DELETE, record->ip, record->time);
+    unlinked = removeNode(node, fileList);
+    buried = buryNode(node, unlinked, fileList);
+    journalAppend(fileList->journal, record);
+  }
+  else
+  { //nothing to delete; the seq has still been applied
+    journalSkip(fileList->journal, record->seq);
+  }
+
+  pthread_mutex_unlock(fileList->mutex);
+
+  if(node != NULL && !buried)
+  { //once no GET on this replica can still be reading it
+    retireNode(node, unlinked, fileList);
+  }
+}
+
+/* applyExpire
+*PURPOSE: Sets a file's expiry as replicated from the primary, and records it
+*  in this server's journal with the primary's seq. The file is hidden once it
+*  expires, but only deleted when the primary's deletion of it arrives.
+*INPUT: FileList* file list, JournalRecord* record
+*OUTPUTS: -
+*/
+void applyExpire(FileList *fileList, JournalRecord *record)
+{
+  arenaLock(fileList->mutex);
+
+  FileNode *node = checkId(record->id, fileList);
+
+  if(node != NULL)
+  {
+    logMsg(LOG_DEBUG, "server", "Replicated expiry of file_%u at seq %llu.", node->id, (unsigned long long)record->seq);
+    __atomic_store_n(&(node->expires), (uint32_t)record->time, __ATOMIC_RELAXED);
+    addEvent(fileList, node, EXPIRE, record->ip, time(NULL));
+    journalAppend(fileList->journal, record);
+  }
+  else
+  { //deleted since; the seq has still been applied
+    journalSkip(fileList->journal, record->seq);
+  }
+
+  pthread_mutex_unlock(fileList->mutex);
+}
+
+/* connectPrimary
+*PURPOSE: Connects to the primary, trying each address the host resolves to.
+*  Returns -1 if none can be reached.
+*INPUT: char* host, char* port
+*OUTPUTS: int sock descriptor
+*/
+static int connectPrimary(const char *host, const char *port)
+{
+  struct addrinfo hints;
+  struct addrinfo *addrs;
+  int sd = -1;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  if(getaddrinfo(host, port, &hints, &addrs) == 0)
+  {
+    for(struct addrinfo *addr = addrs; sd == -1 && addr != NULL; addr = addr->ai_next)
+    {
+      if((sd = socket(addr->ai_family, addr->ai_socktype | SOCK_CLOEXEC, addr->ai_protocol)) != -1
+        && connect(sd, addr->ai_addr, addr->ai_addrlen))
+      {
+        close(sd);
+        sd = -1;
+      }
+    }
+
+    freeaddrinfo(addrs);
+  }
+
+  return sd;
+}
+
+/* replicate
+*PURPOSE: Applies the primary's stream until the connection fails,
+*  acknowledging the latest applied seq after every record, and logging how
+*  far behind this replica is.
+*INPUT: int sock descriptor, FileList* file list, ServerConfig* config
+*OUTPUTS: -
+*/
+static void replicate(int sd, FileList *fileList, const ServerConfig *config)
+{
+  Journal *journal = fileList->journal;
+  ReplicationHello hello;
+  JournalRecord record;
+  uint64_t primarySeq;
+  uint64_t applied;
+  int64_t latest = time(NULL); //time of the latest event applied
+  time_t reported = time(NULL);
+  struct timeval limit = {REPLICATION_TIMEOUT, 0};
+
+  setsockopt(sd, SOL_SOCKET, SO_SNDTIMEO, &limit, sizeof(limit));
+  setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &limit, sizeof(limit));
+
+  hello.magic = REPLICATION_MAGIC;
+  hello.seq = journalSeq(journal);
+  primarySeq = hello.seq;
+
+  int ok = sendAll(sd, &hello, sizeof(hello));
+
+  if(ok)
+  {
+    logMsg(LOG_INFO, "server", "Replicating from %s:%s, resuming after seq %llu.",
+      config->primaryHost, config->primaryPort, (unsigned long long)hello.seq);
+  }
+
+  while(ok && recvAll(sd, &record, sizeof(record)))
+  {
+    char *data = NULL;
+
+    switch(record.type)
+    {
+      case JOURNAL_HEARTBEAT:
+        break;
+      case JOURNAL_STORE:
+        if(record.blob.length > config->maxRequest || (data = malloc(record.blob.length + 1)) == NULL)
+        {
+          logMsg(LOG_ERROR, "server", "Cannot hold replicated file_%u of %llu bytes.", record.id,
+            (unsigned long long)record.blob.length);
+          ok = false;
+        }
+        else
+        {
+          ok = recvAll(sd, data, record.blob.length) && applyStore(fileList, &record, data);
+        }
+        break;
+      case JOURNAL_DELETE:
+        applyDelete(fileList, &record);
+        break;
+      case JOURNAL_EXPIRE:
+        applyExpire(fileList, &record);
+        break;
+      case JOURNAL_GONE:
+        journalSkip(journal, record.seq);
+        break;
+      default:
+        logMsg(LOG_ERROR, "server", "Unknown record from the primary.");
+        ok = false;
+        break;
+    }
+
+    free(data);
+
+    if(record.seq > primarySeq)
+    {
+      primarySeq = record.seq;
+    }
+
+    if(record.type != JOURNAL_HEARTBEAT && record.type != JOURNAL_EXPIRE)
+    { //an EXPIRE's time is when the file expires, not when it was set
+      latest = record.time;
+    }
+
+    applied = journalSeq(journal);
+    ok = ok && sendAll(sd, &applied, sizeof(applied));
+
+    if(ok && time(NULL) - reported >= REPLICATION_REPORT_INTERVAL)
+    {
+      logMsg(LOG_INFO, "server", "Replicated up to seq %llu of %llu, %llu behind, latest applied change %llds old.",
+        (unsigned long long)applied, (unsigned long long)primarySeq,
+        (unsigned long long)(primarySeq > applied ? primarySeq - applied : 0),
+        (long long)(applied < primarySeq ? time(NULL) - latest : 0));
+      reported = time(NULL);
+    }
+  }
+}
+
+/* replicator
+*PURPOSE: Thread function which keeps this replica connected to its primary,
+*  reconnecting (and resuming) whenever the connection is lost.
+*INPUT: void* to a ReplicationThread
+*OUTPUTS: -
+*/
+void *replicator(void *arg)
+{
+  ReplicationThread *rt = (ReplicationThread*)arg;
+  int reachable = true; //only logged when it changes
+
+  while(true)
+  {
+    int sd = connectPrimary(rt->config->primaryHost, rt->config->primaryPort);
+
+    if(sd == -1)
+    {
+      if(reachable)
+      {
+        logMsg(LOG_WARN, "network", "Cannot reach the primary at %s:%s, retrying.", rt->config->primaryHost, rt->config->primaryPort);
+      }
+
+      reachable = false;
+    }
+    else
+    {
+      reachable = true;
+      replicate(sd, rt->fileList, rt->config);
+      close(sd);
+      logMsg(LOG_WARN, "network", "Lost the connection to the primary, reconnecting.");
+    }
+
+    sleep(REPLICATION_RETRY);
+  }
+
+  return NULL;
+}
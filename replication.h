@@ -0,0 +1,57 @@
+/* replication.h
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Header for replication.c. Rebuilds the file index from the journal,
+*  and streams it from a primary server to read-only replicas.
+*/
+
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include "server.h"
+
+#define REPLICATION_MAGIC (0x52504C3100000000ULL | sizeof(JournalRecord)) //"RPL1", and the record layout
+#define REPLICATION_HEARTBEAT 1 //seconds between heartbeats when there is nothing new to send
+#define REPLICATION_TIMEOUT 10 //seconds without hearing from the other side before giving up on it
+#define REPLICATION_REPORT_INTERVAL 10 //seconds between lag log lines
+#define REPLICATION_RETRY 1 //seconds between attempts to reach the primary
+#define REPLICATION_PIECE 1048576 //bytes of a file read and sent at a time
+
+typedef struct ReplicationHello
+{ //sent by a replica when it connects
+  uint64_t magic;
+  uint64_t seq; //latest applied, streaming resumes after it
+} ReplicationHello;
+
+typedef struct ReplicaThread
+{ //used for replicationSender() threads, one per connected replica
+  int sd;
+  struct sockaddr_in6 addr;
+  FileList* fileList;
+  const ServerConfig* config;
+} ReplicaThread;
+
+typedef struct ReplicationThread
+{ //used for the replicationAcceptor() and replicator() threads
+  int sock; //listening socket, replicationAcceptor() only
+  FileList* fileList;
+  const ServerConfig* config;
+} ReplicationThread;
+
+int replayJournal(FileList* fileList);
+
+int commitJournal(FileList* fileList);
+
+void *replicationAcceptor(void *arg);
+
+void *replicationSender(void *arg);
+
+void *replicator(void *arg);
+
+int applyStore(FileList* fileList, JournalRecord* record, const char* data);
+
+void applyDelete(FileList* fileList, JournalRecord* record);
+
+void applyExpire(FileList* fileList, JournalRecord* record);
+
+#endif
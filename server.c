@@ -1,16 +1,50 @@
 /* server.c
 *AUTHOR: Jhi Morris (19173632)
-*MODIFIED: 2020-09-12
+*MODIFIED: 2026-10-19
 *PURPOSE: Handles server communication and processing
 */
 
+#define _GNU_SOURCE //accept4(), pthread_setaffinity_np()
 #include "server.h"
+#include "replication.h"
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+
+//constant responses, sent straight from static storage without allocating
+static const Message welcomeMsgs[HASH_ENGINES] = { //by the algorithm keys are computed with, which the client reads from the end
+  STATIC_MESSAGE(MESSAGE, "Welcome to our anonymous storage. Keys: md5."),
+  STATIC_MESSAGE(MESSAGE, "Welcome to our anonymous storage. Keys: blake3.")};
+static const Message goodbyeMsg = STATIC_MESSAGE(MESSAGE, "Thank you for using our anonymous storage.");
+static const Message unknownCommandMsg = STATIC_MESSAGE(MESSAGE, "Error: Unrecognized command.");
+static const Message bannedMsg = STATIC_MESSAGE(DISCON, "Error: This address is banned.");
+static const Message banNoticeMsg = STATIC_MESSAGE(DISCON, "Error: Error limit exceeded. IP address banned.");
+static const Message invalidKeyMsg = STATIC_MESSAGE(MESSAGE, "Error: Hash key not valid.");
+static const Message unknownKeyMsg = STATIC_MESSAGE(MESSAGE, "Error: Key does not match any known file.");
+static const Message storeFailedMsg = STATIC_MESSAGE(MESSAGE, "Info: File failed to save. Please try again later.");
+static const Message readFailedMsg = STATIC_MESSAGE(MESSAGE, "Info: Key found, but the file cannot be read. Please try again later.");
+static const Message corruptMsg = STATIC_MESSAGE(MESSAGE, "Error: Key found, but the file stored on the server is damaged.");
+static const Message deletedMsg = STATIC_MESSAGE(MESSAGE, "Info: File with hash key has been deleted.");
+static const Message tooLargeMsg = STATIC_MESSAGE(DISCON, "Error: Request is larger than the server accepts.");
+static const Message busyMsg = STATIC_MESSAGE(DISCON, "Error: Server is too busy to accept this request. Please try again later.");
+static const Message readOnlyMsg = STATIC_MESSAGE(MESSAGE, "Error: This server is a read-only replica.");
+static const Message listDeniedMsg = STATIC_MESSAGE(MESSAGE, "Error: LIST is not allowed from this address.");
+static const Message badListMsg = STATIC_MESSAGE(MESSAGE, "Error: LIST request not valid.");
+static const Message eventsDeniedMsg = STATIC_MESSAGE(MESSAGE, "Error: EVENTS is not allowed from this address.");
+static const Message badEventsMsg = STATIC_MESSAGE(MESSAGE, "Error: EVENTS request not valid.");
+static const Message busyGetMsg = STATIC_MESSAGE(MESSAGE, "Info: Server is too busy to send this file. Please try again later.");
+static const Message fullMsg = STATIC_MESSAGE(MESSAGE, "Info: Server is full. Please try again later.");
+static const Message badExpireMsg = STATIC_MESSAGE(MESSAGE, "Error: EXPIRE request not valid.");
+static const Message expiresMsg = STATIC_MESSAGE(MESSAGE, "Info: File will be deleted once its time to live runs out.");
+static const Message noExpireMsg = STATIC_MESSAGE(MESSAGE, "Info: File will be kept until it is deleted.");
+static const Message expireFailedMsg = STATIC_MESSAGE(MESSAGE, "Info: File's time to live could not be set. Please try again later.");
 
 /* main
 *PURPOSE: Reads in and validates the server parameters from the command line
 *  arguments and binds a two-stack (ipv4 & ipv6) socket for server().
 *INPUT: argv[1] max attempts, argv[2] seconds timeout, argv[3] seconds of idle
-*  before connection timeout, optional argv[4] port.
+*  before connection timeout, optional argv[4] port, followed by any number of
+*  '--option value' pairs.
 *OUTPUTS: -
 */
 int main(int argc, char *argv[])
@@ -18,19 +52,358 @@ int main(int argc, char *argv[])
   int error = false;
   long port = DEFAULT_PORT;
   long attempts, lockout, timeout;
+  long cacheSize = DEFAULT_CACHE_SIZE;
+  long packThreshold = DEFAULT_PACK_THRESHOLD;
+  long commitDelay = DEFAULT_COMMIT_DELAY;
+  int durability = DURABILITY_NONE;
+  int ioEngineId = IO_ENGINE_AUTO;
+  int hashEngine = HASH_MD5;
+  long hashThreads = 0;
+  int verifyReads = false;
+  int listAccess = ACCESS_LOCAL;
+  int eventAccess = ACCESS_LOCAL;
+  long eventCapacity = DEFAULT_EVENT_CAPACITY;
+  long reclaimRate = DEFAULT_RECLAIM_RATE;
+  long diskCap = 0;
+  long filterKeys = DEFAULT_FILTER_KEYS;
+  double filterRate = DEFAULT_FILTER_FPR;
+  long acceptors = 1;
+  long maxRequest = DEFAULT_MAX_REQUEST;
+  long memoryBudget = DEFAULT_MEMORY_BUDGET;
+  long admitWait = DEFAULT_ADMIT_WAIT;
+  long requestTimeout = DEFAULT_REQUEST_TIMEOUT;
+  long minRate = DEFAULT_MIN_RATE;
+  long processes = 1;
+  long sharedMemory = DEFAULT_SHARED_MEMORY;
+  const char *journal = NULL;
+  long replicationPort = 0;
+  char *primaryHost = NULL;
+  char *primaryPort = NULL;
+  int logLevel = LOG_INFO;
+  int logFormat = LOG_FORMAT_KV;
   char *endptr;
+  int argi = 4; //index of the first '--option'
 
-  if(argc != 4)
+  if(argc < 4)
   {
-    if(argc != 5)
+    printf("Invalid number of arguments.\n");
+    error = true;
+  }
+  else if(argc > 4 && strncmp(argv[4], "--", 2))
+  { //optional port argument has been included
+    port = strtol(argv[4], NULL, 10);
+    argi = 5;
+  }
+
+  while(!error && argi < argc)
+  { //options all take exactly one value
+    if(argi + 1 >= argc)
     {
-      printf("Invalid number of arguments.\n");
+      printf("Option %s requires a value.\n", argv[argi]);
       error = true;
     }
+    else if(!strcmp(argv[argi], "--cache-size"))
+    {
+      cacheSize = strtol(argv[argi + 1], &endptr, 10);
+
+      if(cacheSize < 0 || argv[argi + 1] == endptr)
+      {
+        printf("--cache-size must be a positive integer (MiB).\n");
+        error = true;
+      }
+    }
+    else if(!strcmp(argv[argi], "--pack-threshold"))
+    {
+      packThreshold = strtol(argv[argi + 1], &endptr, 10);
+
+      if(packThreshold < 0 || packThreshold > PACK_MAX_SIZE || argv[argi + 1] == endptr)
+      {
+        printf("--pack-threshold must be a positive integer (bytes), no more than %d.\n", PACK_MAX_SIZE);
+        error = true;
+      }
+    }
+    else if(!strcmp(argv[argi], "--durability"))
+    {
+      if((durability = commitParseMode(argv[argi + 1])) < 0)
+      {
+        printf("--durability must be one of none, op or group.\n");
+        error = true;
+      }
+    }
+    else if(!strcmp(argv[argi], "--commit-delay"))
+    {
+      commitDelay = strtol(argv[argi + 1], &endptr, 10);
+
+      if(commitDelay < 0 || commitDelay > COMMIT_MAX_DELAY || argv[argi + 1] == endptr)
+      {
+        printf("--commit-delay must be a positive integer (microseconds), no more than %d.\n", COMMIT_MAX_DELAY);
+        error = true;
+      }
+    }
+    else if(!strcmp(argv[argi], "--acceptors"))
+    {
+      acceptors = strtol(argv[argi + 1], &endptr, 10);
+
+      if(acceptors < 1 || acceptors > MAX_ACCEPTORS || argv[argi + 1] == endptr)
+      {
+        printf("--acceptors must be an integer between 1 and %d, inclusive.\n", MAX_ACCEPTORS);
+        error = true;
+      }
+    }
+    else if(!strcmp(argv[argi], "--max-request"))
+    {
+      maxRequest = strtol(argv[argi + 1], &endptr, 10);
+
+      if(maxRequest < 1 || argv[argi + 1] == endptr)
+      {
+        printf("--max-request must be an integer (MiB) greater than zero.\n");
+        error = true;
+      }
+    }
+    else if(!strcmp(argv[argi], "--memory-budget"))
+    {
+      memoryBudget = strtol(argv[argi + 1], &endptr, 10);
+
+      if(memoryBudget < 0 || argv[argi + 1] == endptr)
+      {
+        printf("--memory-budget must be a positive integer (MiB).\n");
+        error = true;
+      }
+    }
+    else if(!strcmp(argv[argi], "--admit-wait"))
+    {
+      admitWait = strtol(argv[argi + 1], &endptr, 10);
+
+      if(admitWait < 0 || admitWait > 3600000 || argv[argi + 1] == endptr)
+      {
+        printf("--admit-wait must be a positive integer (milliseconds), no more than an hour.\n");
+        error = true;
+      }
+    }
+    else if(!strcmp(argv[argi], "--request-timeout"))
+    {
+      requestTimeout = strtol(argv[argi + 1], &endptr, 10);
+
+      if(requestTimeout < 1 || requestTimeout > 86400 || argv[argi + 1] == endptr)
+      {
+        printf("--request-timeout must be a positive integer (seconds), no more than a day.\n");
+        error = true;
+      }
+    }
+    else if(!strcmp(argv[argi], "--min-rate"))
+    {
+      minRate = strtol(argv[argi + 1], &endptr, 10);
+
+      if(minRate < 1 || argv[argi + 1] == endptr)
+      {
+        printf("--min-rate must be a positive integer (bytes per second).\n");
+        error = true;
+      }
+    }
+    else if(!strcmp(argv[argi], "--processes"))
+    {
+      processes = strtol(argv[argi + 1], &endptr, 10);
+
+      if(processes < 1 || processes > MAX_PROCESSES || argv[argi + 1] == endptr)
+      {
+        printf("--processes must be an integer between 1 and %d, inclusive.\n", MAX_PROCESSES);
+        error = true;
+      }
+    }
+    else if(!strcmp(argv[argi], "--shared-memory"))
+    {
+      sharedMemory = strtol(argv[argi + 1], &endptr, 10);
+
+      if(sharedMemory < 1 || argv[argi + 1] == endptr)
+      {
+        printf("--shared-memory must be an integer (MiB) greater than zero.\n");
+        error = true;
+      }
+    }
+    else if(!strcmp(argv[argi], "--journal"))
+    {
+      journal = argv[argi + 1];
+    }
+    else if(!strcmp(argv[argi], "--replication-port"))
+    {
+      replicationPort = strtol(argv[argi + 1], &endptr, 10);
+
+      if(replicationPort < 1 || replicationPort > 65535 || argv[argi + 1] == endptr)
+      {
+        printf("--replication-port must be an integer between 1 and 65535, inclusive.\n");
+        error = true;
+      }
+    }
+    else if(!strcmp(argv[argi], "--replica-of"))
+    { //host:port, an IPv6 host in brackets, split in a copy so argv can be passed on by an upgrade
+      primaryHost = strdup(argv[argi + 1]);
+      primaryPort = strrchr(primaryHost, ':');
+
+      if(primaryPort == NULL || primaryPort == primaryHost || primaryPort[1] == '\0')
+      {
+        printf("--replica-of must be host:port.\n");
+        error = true;
+      }
+      else
+      {
+        *(primaryPort++) = '\0';
+
+        if(primaryHost[0] == '[' && primaryPort[-2] == ']')
+        {
+          primaryPort[-2] = '\0';
+          primaryHost++;
+        }
+      }
+    }
+    else if(!strcmp(argv[argi], "--io-engine"))
+    {
+      if((ioEngineId = ioParseEngine(argv[argi + 1])) < 0)
+      {
+        printf("--io-engine must be one of auto, posix or uring.\n");
+        error = true;
+      }
+    }
+    else if(!strcmp(argv[argi], "--hash"))
+    {
+      if((hashEngine = hashParseEngine(argv[argi + 1])) < 0)
+      {
+        printf("--hash must be md5 or blake3.\n");
+        error = true;
+      }
+    }
+    else if(!strcmp(argv[argi], "--hash-threads"))
+    {
+      hashThreads = strtol(argv[argi + 1], &endptr, 10);
+
+      if(hashThreads < 0 || hashThreads > MAX_HASH_THREADS || argv[argi + 1] == endptr)
+      {
+        printf("--hash-threads must be an integer between 0 and %d, inclusive.\n", MAX_HASH_THREADS);
+        error = true;
+      }
+    }
+    else if(!strcmp(argv[argi], "--verify-reads"))
+    {
+      if(strcmp(argv[argi + 1], "yes") && strcmp(argv[argi + 1], "no"))
+      {
+        printf("--verify-reads must be yes or no.\n");
+        error = true;
+      }
+
+      verifyReads = !strcmp(argv[argi + 1], "yes");
+    }
+    else if(!strcmp(argv[argi], "--list"))
+    {
+      if(!strcmp(argv[argi + 1], "no"))
+      {
+        listAccess = ACCESS_NONE;
+      }
+      else if(!strcmp(argv[argi + 1], "local"))
+      {
+        listAccess = ACCESS_LOCAL;
+      }
+      else if(!strcmp(argv[argi + 1], "yes"))
+      {
+        listAccess = ACCESS_ALL;
+      }
+      else
+      {
+        printf("--list must be one of no, local or yes.\n");
+        error = true;
+      }
+    }
+    else if(!strcmp(argv[argi], "--events"))
+    {
+      if(!strcmp(argv[argi + 1], "no"))
+      {
+        eventAccess = ACCESS_NONE;
+      }
+      else if(!strcmp(argv[argi + 1], "local"))
+      {
+        eventAccess = ACCESS_LOCAL;
+      }
+      else if(!strcmp(argv[argi + 1], "yes"))
+      {
+        eventAccess = ACCESS_ALL;
+      }
+      else
+      {
+        printf("--events must be one of no, local or yes.\n");
+        error = true;
+      }
+    }
+    else if(!strcmp(argv[argi], "--history-events"))
+    {
+      eventCapacity = strtol(argv[argi + 1], &endptr, 10);
+
+      if(eventCapacity < 1 || argv[argi + 1] == endptr)
+      {
+        printf("--history-events must be a positive integer.\n");
+        error = true;
+      }
+    }
+    else if(!strcmp(argv[argi], "--filter-keys"))
+    {
+      filterKeys = strtol(argv[argi + 1], &endptr, 10);
+
+      if(filterKeys < 0 || argv[argi + 1] == endptr)
+      {
+        printf("--filter-keys must be a positive integer, or 0 to disable the key filter.\n");
+        error = true;
+      }
+    }
+    else if(!strcmp(argv[argi], "--filter-fpr"))
+    {
+      filterRate = strtod(argv[argi + 1], &endptr);
+
+      if(filterRate < 0.00001 || filterRate >= 1 || argv[argi + 1] == endptr)
+      {
+        printf("--filter-fpr must be a rate between 0.00001 and 1, eg 0.01 for 1%%.\n");
+        error = true;
+      }
+    }
+    else if(!strcmp(argv[argi], "--reclaim-rate"))
+    {
+      reclaimRate = strtol(argv[argi + 1], &endptr, 10);
+
+      if(reclaimRate < 0 || argv[argi + 1] == endptr)
+      {
+        printf("--reclaim-rate must be a positive integer, or 0 for unlimited.\n");
+        error = true;
+      }
+    }
+    else if(!strcmp(argv[argi], "--disk-cap"))
+    {
+      diskCap = strtol(argv[argi + 1], &endptr, 10);
+
+      if(diskCap < 0 || argv[argi + 1] == endptr)
+      {
+        printf("--disk-cap must be a positive integer (MiB), or 0 for unlimited.\n");
+        error = true;
+      }
+    }
+    else if(!strcmp(argv[argi], "--log-level"))
+    {
+      if((logLevel = logParseLevel(argv[argi + 1])) < 0)
+      {
+        printf("--log-level must be one of debug, info, warn or error.\n");
+        error = true;
+      }
+    }
+    else if(!strcmp(argv[argi], "--log-format"))
+    {
+      if((logFormat = logParseFormat(argv[argi + 1])) < 0)
+      {
+        printf("--log-format must be kv or json.\n");
+        error = true;
+      }
+    }
     else
-    { //if argc is 5, optional port argument may have been included
-      port = strtol(argv[4], NULL, 10);
+    {
+      printf("Unknown option %s.\n", argv[argi]);
+      error = true;
     }
+
+    argi += 2;
   }
 
   if(!error)
@@ -66,9 +439,179 @@ int main(int argc, char *argv[])
     error = true;
   }
 
+  if(!error && hashThreads > 0 && hashEngine != HASH_BLAKE3)
+  { //MD5 cannot be split into parts hashed separately
+    printf("--hash-threads requires --hash blake3.\n");
+    error = true;
+  }
+
+  if(!error && (journal != NULL || replicationPort > 0 || primaryHost != NULL))
+  {
+    if(processes > 1)
+    { //the journal would need one writer shared between the workers
+      printf("--journal, --replication-port and --replica-of cannot be used with --processes.\n");
+      error = true;
+    }
+    else if(journal == NULL)
+    { //replication streams from, and resumes by, the journal
+      journal = DEFAULT_JOURNAL;
+    }
+  }
+
+  int replicationSock = -1;
+  int socks[MAX_ACCEPTORS];
+  int sockCount = 0;
+  int channel = error ? -1 : upgradeChannel();
+
+  if(channel != -1)
+  { //started by an upgrade, so the old server's sockets are taken over rather than opened
+    if(inheritListeners(channel, acceptors, replicationPort > 0, socks, &replicationSock))
+    {
+      sockCount = acceptors;
+    }
+    else
+    {
+      error = true;
+    }
+  }
+
+  if(!error && channel == -1 && replicationPort > 0 && (replicationSock = openListener(replicationPort, false)) == -1)
+  {
+    error = true;
+  }
+
+  while(!error && channel == -1 && sockCount < acceptors)
+  { //one listening socket per acceptor, all sharing the port
+    if((socks[sockCount] = openListener(port, acceptors > 1)) != -1)
+    {
+      sockCount++;
+    }
+    else
+    {
+      error = true;
+    }
+  }
+
+  if(!error)
+  {
+    ServerConfig config;
+    memset(&config, 0, sizeof(config));
+    config.attempts = attempts;
+    config.lockout = lockout;
+    config.timeout = timeout;
+    config.cacheSize = (uint64_t)cacheSize * 1024 * 1024;
+    config.packThreshold = packThreshold;
+    config.durability = durability;
+    config.commitDelay = commitDelay;
+    config.acceptors = acceptors;
+    config.maxRequest = (uint64_t)maxRequest * 1024 * 1024;
+    config.memoryBudget = (uint64_t)memoryBudget * 1024 * 1024;
+    config.admitWait = admitWait;
+    config.requestTimeout = requestTimeout;
+    config.minRate = minRate;
+    config.processes = processes;
+    config.sharedMemory = (uint64_t)sharedMemory * 1024 * 1024;
+    config.ioEngine = ioEngineId;
+    config.hash = hashEngine;
+    config.hashThreads = hashThreads;
+    config.verifyReads = verifyReads;
+    config.listAccess = listAccess;
+    config.eventAccess = eventAccess;
+    config.eventCapacity = eventCapacity;
+    config.reclaimRate = (uint64_t)reclaimRate * 1024 * 1024;
+    config.diskCap = (uint64_t)diskCap * 1024 * 1024;
+    config.filterKeys = filterKeys;
+    config.filterRate = filterRate;
+    config.logLevel = logLevel;
+    config.logFormat = logFormat;
+    config.journal = journal;
+    config.replicationSock = replicationSock;
+    config.primaryHost = primaryHost;
+    config.primaryPort = primaryPort;
+    config.argv = argv;
+    config.upgradeChannel = channel;
+
+    //blocked before any thread is created, so only the upgrader (if any) recieves it
+    sigset_t upgradeSet;
+    sigemptyset(&upgradeSet);
+    sigaddset(&upgradeSet, UPGRADE_SIGNAL);
+    pthread_sigmask(SIG_BLOCK, &upgradeSet, NULL);
+
+    SharedState *shared = sharedCreate(&config);
+
+    if(shared == NULL)
+    {
+      printf("Failed to map %ld MiB of shared memory for the index.\n", sharedMemory);
+      error = true;
+    }
+    else if(processes > 1)
+    {
+      error = supervise(&config, socks, shared);
+    }
+    else
+    {
+      error = worker(&config, socks, shared);
+    }
+  }
+  else
+  {
+    printf("Expected usage: './server k t1 t2 [port]', where k is the number "\
+    "of attempts a user is given to submit a valid key, t1 is the number of "\
+    "seconds the user is locked out once out of attempts, t2 is the number "\
+    "of seconds allowed between requests before the connection is closed, "\
+    "and optionally, port is the port to run the server at. The default "\
+    "port is 52000.\nExample: './server 5 10.5 120' to start the server that "\
+    "locks the user out for ten and a half seconds after five incorrect keys, "\
+    "and will close an idle connection after two minutes.\n"\
+    "Options: '--cache-size MiB' (default 64, 0 disables), "\
+    "'--pack-threshold bytes' (default 8192, 0 disables packing), "\
+    "'--durability none|op|group' (default none), '--commit-delay microseconds' (default 500), "\
+    "'--io-engine auto|posix|uring' (default auto), '--hash md5|blake3' (default md5), "\
+    "'--hash-threads N' (default 0, needs --hash blake3), '--verify-reads yes|no' (default no), "\
+    "'--list no|local|yes' (default local), '--filter-keys N' (default 1000000, 0 disables), '--filter-fpr rate' (default 0.01), "\
+    "'--events no|local|yes' (default local), '--history-events N' (default 4194304, HISTORY keeps each file's STORE beyond it), "\
+    "'--acceptors N' (default 1), '--max-request MiB' (default 1024), '--memory-budget MiB' (default 2048, 0 is unlimited), "\
+    "'--admit-wait milliseconds' (default 5000), '--request-timeout seconds' (default 30), '--reclaim-rate MiB' (default 256, 0 is unlimited), "\
+    "'--disk-cap MiB' (default 0, unlimited), "\
+    "'--min-rate bytes' (default 16384), '--processes N' (default 1), '--shared-memory MiB' (default 256), "\
+    "'--journal path' (default none, or journal.log when replicating), '--replication-port port' (default none), "\
+    "'--replica-of host:port' (default none), "\
+    "'--log-level debug|info|warn|error' (default info), "\
+    "'--log-format kv|json' (default kv).\n");
+  }
+
+  for(int i = 0; i < sockCount; i++)
+  {
+    close(socks[i]);
+  }
+
+  if(replicationSock != -1)
+  {
+    close(replicationSock);
+  }
+
+  if(channel != -1)
+  { //the old server sees it close if this server could not start
+    close(channel);
+  }
+
+  return !error;
+}
+
+/* openListener
+*PURPOSE: Creates a nonblocking socket listening on the port, for both IPv4
+*  and IPv6. With reusePort, several sockets can listen on the same port and
+*  the kernel spreads new connections between them. Returns -1 if an error
+*  occurs.
+*INPUT: int port, int reusePort (boolean)
+*OUTPUTS: int sock descriptor
+*/
+int openListener(int port, int reusePort)
+{
+  int error = false;
   int sock = -1;
 
-  if(!error && (sock = socket(AF_INET6, SOCK_STREAM, 0)) < 0)
+  if((sock = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
   {
     printf("Socket error.\n");
     error = true;
@@ -80,6 +623,13 @@ int main(int argc, char *argv[])
     printf("setsockopt(IPV6_V6ONLY, 0) failed: only operating in IPv6 mode. . .\n");
   }
 
+  mode = 1;
+  if(!error && reusePort && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (char*)&mode, sizeof(mode)) < 0)
+  {
+    printf("setsockopt(SO_REUSEPORT, 1) failed: cannot run more than one acceptor.\n");
+    error = true;
+  }
+
   //bind to both ipv4 and ipv6
   struct sockaddr_in6 ip;
   memset(&ip, 0, sizeof(ip));
@@ -99,738 +649,2815 @@ int main(int argc, char *argv[])
     error = true;
   }
 
-  if(!error)
-  {
-    printf("Starting server. . .\n");
-    error = server(attempts, lockout, timeout, sock);
-    printf("Server shutting down. . .\n");
-  }
-  else
-  {
-    printf("Expected usage: './server k t1 t2 [port]', where k is the number "\
-    "of attempts a user is given to submit a valid key, t1 is the number of "\
-    "seconds the user is locked out once out of attempts, t2 is the number "\
-    "of seconds allowed between requests before the connection is closed, "\
-    "and optionally, port is the port to run the server at. The default "\
-    "port is 52000.\nExample: './server 5 10.5 120' to start the server that "\
-    "locks the user out for ten and a half seconds after five incorrect keys, "\
-    "and will close an idle connection after two minutes.\n");
-  }
-
-  if(sock != -1)
+  if(error && sock != -1)
   {
     close(sock);
+    sock = -1;
   }
 
-  return !error;
+  return sock;
 }
 
-/* server
-*PURPOSE: Manages the banlist and recieves connections to the socket and creates threads to handle them if they are not from a banned address.
-*INPUT: int max fails, int lockout time, int idle time limit
-*OUTPUTS: int error occured (boolean)
+/* inheritListeners
+*PURPOSE: Recieves the listening sockets of the server being upgraded: one
+*  per acceptor, then the replication port's if replicating, which must match
+*  this server's options. Returns 'true' if an error occurs.
+*INPUT: int channel descriptor, int acceptors, int replicating (boolean)
+*OUTPUTS: int error occured (boolean), int* sock descriptors, int*
+*  replication sock descriptor
 */
-int server(const int attempts, const int lockout, const int timeout, int sock)
+int inheritListeners(int channel, int acceptors, int replicating, int *socks, int *replicationSock)
 {
   int error = false;
-  AddressList banList;
-  banList.head = NULL;
-  banList.mutex = malloc(sizeof(pthread_mutex_t));
-  pthread_mutex_init(banList.mutex, NULL);
-
-  FileList fileList;
-  fileList.head = NULL;
-  fileList.count = 0;
-  fileList.mutex = malloc(sizeof(pthread_mutex_t));
-  pthread_mutex_init(fileList.mutex, NULL);
+  int received[MAX_ACCEPTORS + 1];
+  int count = upgradeRecvSocks(channel, received, MAX_ACCEPTORS + 1);
 
-  while(!error)
+  if(count != acceptors + (replicating ? 1 : 0))
   {
-    Connection *connection = calloc(1, sizeof(Connection));
-
-    unbanAddrs(&banList, lockout);
+    printf("Failed to take over the listening sockets of the server being upgraded.\n");
+    error = true;
 
-    if((connection->sd = accept(sock, NULL, NULL)) < 0)
+    for(int i = 0; i < count; i++)
     {
-      printf("Connection error.\n");
-      error = true;
+      close(received[i]);
     }
-    else
-    {
-      socklen_t addrlen = sizeof(connection->client); //needed to pass ref to getpeername()
+  }
+  else
+  {
+    memcpy(socks, received, acceptors * sizeof(int));
+    *replicationSock = replicating ? received[acceptors] : -1;
+  }
 
-      getpeername(connection->sd, (struct sockaddr*)&(connection->client), &addrlen);
+  return !error;
+}
 
-      if(bannedAddr(&banList, connection->client.sin6_addr))
-      { //if connecting IP is still banned, we send rejection and close the connection
-        Message msgOut;
-        char msg[] = "Error: This address is banned.";
-        msgOut.command = DISCON;
-        msgOut.length = sizeof(msg);
-        msgOut.body = calloc(1, sizeof(msg));
-        memcpy(msgOut.body, msg, sizeof(msg));
+/* sharedCreate
+*PURPOSE: Creates the ban list and file index. With more than one process they
+*  are placed in a shared arena, mapped before any worker is forked so that
+*  every worker sees them at the same address. Returns NULL if the arena
+*  cannot be mapped.
+*INPUT: ServerConfig* config
+*OUTPUTS: SharedState* shared
+*/
+SharedState *sharedCreate(const ServerConfig *config)
+{
+  SharedArena *arena = NULL;
+  SharedState *shared = NULL;
+
+  if(config->processes > 1)
+  {
+    if((arena = arenaCreate(config->sharedMemory)) != NULL)
+    {
+      shared = arenaAlloc(arena, sizeof(SharedState));
+    }
+  }
+  else
+  {
+    shared = calloc(1, sizeof(SharedState));
+  }
+
+  if(shared != NULL)
+  {
+    shared->arena = arena;
+    arenaMutexInit(&(shared->banMutex), arena != NULL);
+    arenaMutexInit(&(shared->fileMutex), arena != NULL);
+    shared->banList.mutex = &(shared->banMutex);
+    shared->banList.head = NULL;
+    shared->banList.arena = arena;
+    shared->index.count = 0;
+    shared->index.head = NULL;
+    keyTreeInit(&(shared->index.keys), offsetof(FileNode, keyBytes), HASH_KEY_BYTES);
+    shared->index.filter = config->filterKeys > 0 ? filterCreate(config->filterKeys, config->filterRate, arena != NULL) : NULL;
+    slabInit(&(shared->index.nodes), sizeof(FileNode), arena != NULL);
+    shared->index.hand = NULL;
+    shared->index.live = 0;
+    shared->index.buriedBytes = 0;
+    shared->index.expired = 0;
+    shared->index.evicted = 0;
+    shared->index.moves = 0;
+    shared->index.buried = NULL;
+    shared->index.lastBuried = NULL;
+    shared->index.burying = 0;
+    shared->index.reclaimed = 0;
+
+    shared->index.events = eventCreate(config->eventCapacity, arena != NULL);
+    shared->index.expiries = expiryCreate(arena != NULL);
+
+    if((shared->index.epochs = epochCreate(config->processes, arena != NULL)) == NULL || shared->index.events == NULL ||
+      shared->index.expiries == NULL)
+    { //unlike the filter, readers cannot do without them
+      shared = NULL;
+    }
+  }
+
+  return shared;
+}
+
+/* supervise
+*PURPOSE: Forks a worker process for each of config->processes, and waits on
+*  them. A worker killed by a signal (a crash) is restarted, having lost only
+*  its own connections; a worker exiting means it could not run at all, so the
+*  others are stopped and the server shuts down. Never starts any threads, so
+*  the workers are always forked from a single-threaded process.
+*INPUT: ServerConfig* config, int* sock descriptors, SharedState* shared
+*OUTPUTS: int error occured (boolean)
+*/
+int supervise(const ServerConfig *config, const int *socks, SharedState *shared)
+{
+  int error = false;
+  pid_t workers[MAX_PROCESSES];
+  time_t started[MAX_PROCESSES];
+  pid_t supervisor = getpid();
+  int status;
 
-        sendMessage(msgOut, connection->sd);
+  setvbuf(stdout, NULL, _IOLBF, 0); //the supervisor logs straight to stdout, so each line is written as it is logged
+  logConfigure(config->logLevel, config->logFormat);
+  logMsg(LOG_INFO, "server", "Starting %d worker processes. . .", config->processes);
 
-        printf("SERVER Info: Rejected connection from banned address.\n");
+  for(int i = 0; i < config->processes; i++)
+  {
+    workers[i] = -1;
+  }
+
+  while(!error)
+  {
+    for(int i = 0; !error && i < config->processes; i++)
+    {
+      if(workers[i] == -1)
+      {
+        fflush(stdout); //or the worker would inherit and repeat anything still buffered
 
-        if(connection->sd != -1)
+        if((workers[i] = fork()) == 0)
+        { //worker, stopped if the supervisor dies
+          prctl(PR_SET_PDEATHSIG, SIGTERM);
+          epochJoin(i);
+          exit(getppid() == supervisor && !worker(config, socks, shared) ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+        else if(workers[i] < 0)
         {
-          close(connection->sd);
+          logMsg(LOG_ERROR, "server", "Failed to fork worker %d.", i);
+          error = true;
+        }
+        else
+        {
+          started[i] = time(NULL);
+          logMsg(LOG_INFO, "server", "Started worker %d (pid %d).", i, (int)workers[i]);
         }
       }
-      else //TODO convert to use PROCESSES, not threads
-      { //if not banned, make thread to handle connection
-        pthread_t thread;
-        ConnectionThread *cont = calloc(1, sizeof(ConnectionThread));
-        cont->con = connection;
-        cont->attempts = attempts;
-        cont->timeout = timeout;
-        cont->banList = &banList;
-        cont->fileList = &fileList;
+    }
 
-        printf("SERVER Info: New connection.\n");
+    pid_t pid = error ? -1 : waitpid(-1, &status, 0);
 
-        pthread_create(&thread, NULL, handleConnection, (void*)cont);
-        pthread_detach(thread);
-      } //the thread will handle closing its own connection
+    for(int i = 0; pid > 0 && i < config->processes; i++)
+    {
+      if(workers[i] == pid)
+      {
+        workers[i] = -1;
+
+        if(WIFSIGNALED(status))
+        {
+          logMsg(LOG_ERROR, "server", "Worker %d (pid %d) was killed by signal %d, restarting it.", i, (int)pid, WTERMSIG(status));
+          epochRelease(shared->index.epochs, i); //any reads it was partway through will never finish
+
+          if(time(NULL) - started[i] < RESPAWN_DELAY)
+          { //crashing on startup, so do not restart it in a tight loop
+            sleep(RESPAWN_DELAY);
+          }
+        }
+        else
+        {
+          logMsg(LOG_ERROR, "server", "Worker %d (pid %d) exited, shutting down.", i, (int)pid);
+          error = true;
+        }
+      }
     }
   }
 
-  pthread_mutex_destroy(banList.mutex);
-  pthread_mutex_destroy(fileList.mutex);
-
-  free(banList.mutex);
-  free(fileList.mutex);
+  for(int i = 0; i < config->processes; i++)
+  {
+    if(workers[i] > 0)
+    {
+      kill(workers[i], SIGTERM);
+      waitpid(workers[i], &status, 0);
+    }
+  }
 
   return error;
 }
 
-/* handleConnection
-*PURPOSE: Thread function to handle a client connection. Recieves Message requests and sends Message responses over the socket.
-*INPUT: void* to a ConnectionThread struct
-*OUTPUTS: -
+/* worker
+*PURPOSE: Starts the I/O engine, tracing and logging, then runs the server
+*  until it fails. In prefork mode, runs in each worker process.
+*INPUT: ServerConfig* config, int* sock descriptors, SharedState* shared
+*OUTPUTS: int error occured (boolean)
 */
-void *handleConnection(void *arg)
-{ //thread function, expects ConnectionThread *argument
-  ConnectionThread *cont = (ConnectionThread*)arg;
-  int quit = false;
-  int valid = false;
-  Message msgIn;
-  Message msgOut;
+int worker(const ServerConfig *config, const int *socks, SharedState *shared)
+{
+  int error = false;
+  int ioEngineId;
 
-  struct sockaddr_in6 addr; //used for logging ip in history
-  socklen_t addrlen = sizeof(addr);
-  getpeername(cont->con->sd, (struct sockaddr*)&addr, &addrlen);
+  if((ioEngineId = ioInit(config->ioEngine)) < 0)
+  {
+    printf("--io-engine uring was requested, but io_uring is not available.\n");
+    error = true;
+  }
 
-  signal(SIGPIPE, SIG_IGN); //failed socket operations are handled as they occur
+  if(!error)
+  {
+    TRACE_INIT(NULL);
+    logInit(config->logLevel, config->logFormat);
+    logMsg(LOG_INFO, "server", "Starting server. . .");
+    logMsg(LOG_INFO, "server", "Using the %s I/O engine.", ioEngineName(ioEngineId));
+    logMsg(LOG_INFO, "server", "Computing keys with %s (%s).", hashEngineName(config->hash), hashImplementation(config->hash));
 
-  struct pollfd polld;
-  polld.fd = cont->con->sd;
-  polld.events = POLLIN;
+    if(shared->index.filter != NULL)
+    {
+      logMsg(LOG_INFO, "server", "Filtering keys with %d hashes in %llu KiB, for %.3g%% false positives at %llu keys.", shared->index.filter->hashes,
+        (unsigned long long)(shared->index.filter->cells / 2048), shared->index.filter->rate * 100, (unsigned long long)config->filterKeys);
+    }
+    else if(config->filterKeys > 0)
+    {
+      logMsg(LOG_WARN, "server", "Failed to map the key filter, every key will be looked up in the index.");
+    }
 
-  cont->con->fails = 0;
+    logMsg(LOG_INFO, "server", "Keeping the last %llu events for HISTORY and EVENTS, scanned with %s.",
+      (unsigned long long)(shared->index.events->segments * EVENT_SEGMENT), eventImplementation());
 
-  char welcome[] = "Welcome to our anonymous storage.";
-  msgOut.length = sizeof(welcome);
-  msgOut.body = calloc(1, sizeof(welcome));
-  msgOut.command = MESSAGE;
-  memcpy(msgOut.body, welcome, sizeof(welcome));
+    if(config->diskCap > 0)
+    {
+      logMsg(LOG_INFO, "server", "Keeping at most %llu MiB of files, evicting the least recently read from %d%% of that.",
+        (unsigned long long)(config->diskCap / (1024 * 1024)), EVICT_HIGH);
+    }
 
-  if(sendMessage(msgOut, cont->con->sd))
-  {
-    free(msgOut.body);
+    error = server(config, socks, shared);
 
-    while(!quit)
-    {
-      switch(poll(&polld, 1, (cont->timeout)*1000))
-      {
-        case -1: //error
-          printf("NETWORK Error: Failed to poll connection.\n");
-          valid = false;
-          break;
-        case 0: //timeout
-          printf("NETWORK Info: Connection timed out.\n");
-          valid = false;
-          break;
-        default: //data available or connection died
-          valid = recieveMessage(&msgIn, cont->con->sd);
-          break;
-      }
+    logMsg(LOG_INFO, "server", "Server shutting down. . .");
+    logShutdown();
+  }
 
-      if(valid)
-      {
-        switch(msgIn.command)
-        {
-          case STORE:
-            store(&msgIn, &msgOut, cont->fileList, addr.sin6_addr);
-            break;
-          case GET:
-            if(get(&msgIn, &msgOut, cont->fileList, addr.sin6_addr))
-            {
-              cont->con->fails = 0;
-            }
-            else
-            { //invalid key
-              cont->con->fails++;
-            }
-            break;
-          case DELETE:
-            if(delete(&msgIn, &msgOut, cont->fileList))
-            {
-              cont->con->fails = 0;
-            }
-            else
-            { //invalid key
-              cont->con->fails++;
-            }
-            break;
-          case HISTORY:
-            if(history(&msgIn, &msgOut, cont->fileList, addr.sin6_addr))
-            {
-              cont->con->fails = 0;
-            }
-            else
-            { //invalid key
-              cont->con->fails++;
-            }
-            break;
-          case QUIT: ;
-            char msg[] = "Thank you for using our anonymous storage.";
-            quit = true;
-            msgOut.command = MESSAGE;
-            msgOut.length = sizeof(msg);
-            msgOut.body = calloc(1, sizeof(msg));
-            memcpy(msgOut.body, msg, sizeof(msg));
-            break;
-          default: ;//server ignores FILECONT, MESSAGE and DISCON commands
-            char errorMsg[] = "Error: Unrecognized command.";
-            msgOut.command = MESSAGE;
-            msgOut.length = sizeof(errorMsg);
-            msgOut.body = calloc(1, sizeof(errorMsg));
-            memcpy(msgOut.body, errorMsg, sizeof(errorMsg));
-            quit = true;
-            break;
-        }
+  return error;
+}
 
-        if(cont->con->fails > cont->attempts)
-        {
-          banAddr(cont->banList, cont->con->client.sin6_addr);
-          printf("Info: Error limit exceeded. IP address banned.\n");
-          char errorMsg[] = "Error: Error limit exceeded. IP address banned.";
-          msgOut.command = DISCON;
-          msgOut.length = sizeof(errorMsg);
-          msgOut.body = calloc(1, sizeof(errorMsg));
-          memcpy(msgOut.body, errorMsg, sizeof(errorMsg));
-          quit = true;
-        }
+/* server
+*PURPOSE: Sets up this process's view of the file list and the background
+*  threads, then starts an acceptor for each listening socket. With several
+*  worker processes, each has its own cache and memory budget (dividing the
+*  configured sizes between them), and packing is disabled, as the pack table
+*  is not shared. With a journal, the index is first rebuilt from it (once the
+*  old server has drained, if this server was started by an upgrade), and the
+*  replication threads this server needs are started. Returns once the calling
+*  thread's acceptor fails; exits once the server has been drained for an
+*  upgrade.
+*INPUT: ServerConfig* config, int* sock descriptors (one per acceptor),
+*  SharedState* shared
+*OUTPUTS: int error occured (boolean)
+*/
+int server(const ServerConfig *config, const int *socks, SharedState *shared)
+{
+  int error = false;
+  AddressList *banList = &(shared->banList);
 
-        if(!sendMessage(msgOut, cont->con->sd))
-        { //failed to send message
-          quit = true;
-          printf("NETWORK Error: Failed to send message.\n");
-        }
+  FileList fileList;
+  fileList.mutex = &(shared->fileMutex);
+  fileList.index = &(shared->index);
+  fileList.arena = shared->arena;
+  fileList.cache = cacheCreate(config->cacheSize / config->processes);
+  fileList.blobs = blobCreate(config->processes > 1 ? 0 : config->packThreshold, config->durability != DURABILITY_NONE);
+  fileList.commits = commitCreate(config->durability, config->commitDelay);
+  fileList.budget = budgetCreate(config->memoryBudget / config->processes);
+  fileList.journal = NULL;
+  fileList.hashes = config->hashThreads > 0 || config->verifyReads ? hashPoolCreate(config->hashThreads) : NULL;
+  fileList.verify = config->verifyReads;
+  fileList.reclaimRate = config->reclaimRate / config->processes;
+  fileList.diskCap = config->diskCap;
+  fileList.removes = config->primaryHost == NULL;
+  TimerHeap *timers = timerCreate();
+  SessionRegistry *sessions = registryCreate();
+  AcceptorStop stop;
+  stop.stopped = false;
+  stop.running = config->acceptors;
+
+  if(pipe2(stop.wake, O_CLOEXEC))
+  {
+    logMsg(LOG_ERROR, "server", "Failed to create the acceptors' stop pipe.");
+    error = true;
+  }
 
-        free(msgOut.body);
-        free(msgIn.body);
-      }
-      else
-      {  //connection has died or invalid request made
-        quit = true;
-        printf("NETWORK Info: Invalid connection dropped.\n");
-      }
+  if(!error && config->upgradeChannel != -1)
+  { //the journal is only complete once the old server has drained
+    takeOver(config->upgradeChannel);
+  }
 
+  if(!error && config->journal != NULL)
+  { //the index is rebuilt before anything can change it
+    if((fileList.journal = journalOpen(config->journal, config->durability != DURABILITY_NONE)) == NULL)
+    {
+      logMsg(LOG_ERROR, "server", "Failed to open the journal %s.", config->journal);
+      error = true;
+    }
+    else
+    {
+      error = !replayJournal(&fileList);
     }
-  }
-  else
-  { //failed to send welcome
-    quit = true;
-    printf("NETWORK Error: Failed to send welcome message.\n");
-    free(msgOut.body);
   }
 
-  if(cont->con->sd != -1)
+  if(!error)
   {
-    close(cont->con->sd);
-  }
+    ReplicationThread replication;
+    replication.sock = config->replicationSock;
+    replication.fileList = &fileList;
+    replication.config = config;
 
-  free(cont->con);
-  free(cont);
+    if(config->replicationSock != -1)
+    {
+      pthread_t replicationThread;
+      pthread_create(&replicationThread, NULL, replicationAcceptor, (void*)&replication);
+      pthread_detach(replicationThread);
+    }
 
-  printf("SERVER Info: Closed connection.\n");
+    if(config->primaryHost != NULL)
+    {
+      pthread_t replicatorThread;
+      pthread_create(&replicatorThread, NULL, replicator, (void*)&replication);
+      pthread_detach(replicatorThread);
+    }
 
-  return NULL;
-}
+    pthread_t compactorThread;
+    pthread_create(&compactorThread, NULL, compactor, (void*)&fileList);
+    pthread_detach(compactorThread);
+
+    pthread_t reclaimerThread;
+    pthread_create(&reclaimerThread, NULL, reclaimer, (void*)&fileList);
+    pthread_detach(reclaimerThread);
+
+    pthread_t janitorThread;
+    JanitorThread jan;
+    jan.banList = banList;
+    jan.fileList = &fileList;
+    jan.timers = timers;
+    jan.sessions = sessions;
+    jan.config = config;
+    pthread_create(&janitorThread, NULL, janitor, (void*)&jan);
+    pthread_detach(janitorThread);
+
+    pthread_t upgraderThread;
+    UpgradeThread up;
+    up.socks = socks;
+    up.stop = &stop;
+    up.fileList = &fileList;
+    up.timers = timers;
+    up.sessions = sessions;
+    up.config = config;
+
+    if(config->processes == 1)
+    { //prefork mode has no journal, which a new server would rebuild the index from
+      pthread_create(&upgraderThread, NULL, upgrader, (void*)&up);
+    }
 
+    AcceptorThread acceptors[MAX_ACCEPTORS];
+
+    for(int i = config->acceptors - 1; i >= 0; i--)
+    { //acceptor 0 runs in this thread, once the others have started
+      acceptors[i].sock = socks[i];
+      acceptors[i].core = config->acceptors > 1 ? i : -1;
+      acceptors[i].stop = &stop;
+      acceptors[i].conCount = &(shared->conCount);
+      acceptors[i].banList = banList;
+      acceptors[i].fileList = &fileList;
+      acceptors[i].timers = timers;
+      acceptors[i].sessions = sessions;
+      acceptors[i].config = config;
+
+      if(i > 0)
+      {
+        pthread_t thread;
+        pthread_create(&thread, NULL, acceptor, (void*)&(acceptors[i]));
+        pthread_detach(thread);
+      }
+    }
 
-/* bannedAddr
-*PURPOSE: Returns true if the IP address is found in the banlist.
-*INPUT: AddressList ban list, struct in6_addr IP.
-*OUTPUTS: int banned (boolean)
-*/
-int bannedAddr(AddressList *banList, struct in6_addr ip)
-{
-  int found = false;
+    error = acceptor((void*)&(acceptors[0])) != NULL;
 
-  pthread_mutex_lock(banList->mutex);
+    if(!error && config->processes == 1)
+    { //acceptors only stop for an upgrade; the other threads still use this frame, so once drained the server exits here
+      pthread_join(upgraderThread, NULL);
+      logMsg(LOG_INFO, "server", "Server handed over, exiting.");
+      logShutdown();
+      exit(EXIT_SUCCESS);
+    }
+  }
 
-  AddressNode *addr = banList->head;
+  cacheDestroy(fileList.cache);
+  commitDestroy(fileList.commits);
+  budgetDestroy(fileList.budget);
+  //timers, sessions and hashing threads are left, detached connection threads may still be using them
 
-  while(!found && addr != NULL)
+  return error;
+}
+
+/* admitRequest
+*PURPOSE: Decides whether to recieve the body of a request, given its header.
+*  STORE bodies may be up to the configured maximum, and reserve their size
+*  from the memory budget, queueing for it if the budget is full; other
+*  commands' bodies are only ever a key, so are limited to SMALL_REQUEST_MAX.
+*  Returns NULL if the request is admitted, otherwise the response to refuse it
+*  with.
+*INPUT: ConnectionThread* connection, Message* message (header only)
+*OUTPUTS: Message* rejection or NULL, uint64_t* bytes reserved
+*/
+const Message *admitRequest(ConnectionThread *cont, const Message *msgIn, uint64_t *reserved)
+{
+  const Message *reject = NULL;
+  uint64_t limit = msgIn->command == STORE ? cont->config->maxRequest : SMALL_REQUEST_MAX;
+
+  if(msgIn->length > limit)
   {
-    if(!memcmp(&(addr->ip), &ip, sizeof(ip)))
+    logMsg(LOG_WARN, "server", "Refused a request of %llu bytes, the limit is %llu bytes.",
+      (unsigned long long)msgIn->length, (unsigned long long)limit);
+    reject = &tooLargeMsg;
+  }
+  else if(msgIn->command == STORE)
+  {
+    if(budgetAcquire(cont->fileList->budget, msgIn->length, cont->config->admitWait))
     {
-      found = true;
+      *reserved = msgIn->length;
     }
     else
     {
-      addr = addr->next;
+      logMsg(LOG_WARN, "server", "Refused a request of %llu bytes, the memory budget is exhausted.",
+        (unsigned long long)msgIn->length);
+      reject = &busyMsg;
     }
   }
 
-  pthread_mutex_unlock(banList->mutex);
-
-  return found;
+  return reject;
 }
 
-/* unbanAddrs
-*PURPOSE: Unbans any addresses on the banlist whose ban time is older than
-*  the lockout duration.
-*INPUT: AddressList* ban list, int lockout duration
+/* rejectRequest
+*PURPOSE: Sends the rejection, then reads and discards (a bounded amount of)
+*  the request body the client is still sending, so that the client can finish
+*  sending and read the rejection rather than have the connection reset.
+*INPUT: int sock descriptor, Message* rejection, uint64_t body length
 *OUTPUTS: -
 */
-void unbanAddrs(AddressList *banList, const int lockout)
+void rejectRequest(int sock, const Message *reject, uint64_t length)
 {
-  pthread_mutex_lock(banList->mutex);
+  char discard[REJECT_DRAIN_BUFFER];
+  time_t giveUp = time(NULL) + REJECT_DRAIN_TIME;
+  struct pollfd polld;
+  polld.fd = sock;
+  polld.events = POLLIN;
+  ssize_t got = 1;
 
-  time_t unbanTime = time(NULL) - lockout; //latest bantime an address could have and still be ready to be unbanned
-  AddressNode *addr = banList->head;
-  AddressNode *prevAddr;
+  sendMessage(*reject, sock);
+  shutdown(sock, SHUT_WR);
 
-  if(addr != NULL)
-  { //handle first element manually, as it has no previous element
-    if(addr->banTime < unbanTime)
-    {
-      banList->head = addr->next;
-    }
+  if(length > REJECT_DRAIN_MAX)
+  { //not worth reading; the client will see the connection reset instead
+    length = 0;
+  }
 
-    prevAddr = addr;
-    addr = addr->next;
+  while(length > 0 && got > 0 && time(NULL) < giveUp && poll(&polld, 1, REJECT_DRAIN_TIME * 1000) > 0)
+  {
+    got = recv(sock, discard, length < sizeof(discard) ? length : sizeof(discard), 0);
 
-    while(addr != NULL)
-    { //handle other elements
-      if(addr->banTime < unbanTime)
-      { //if unbanned, remove from list.
-        prevAddr->next = addr->next;
-        free(addr);
-        addr = prevAddr->next;
-      }
+    if(got > 0)
+    {
+      length -= got;
     }
   }
+}
 
-  pthread_mutex_unlock(banList->mutex);
+/* transferDeadline
+*PURPOSE: Returns the milliseconds allowed to send or recieve a message of
+*  the given length: the request timeout, plus the time to transfer it at the
+*  minimum rate.
+*INPUT: ServerConfig* config, uint64_t length in bytes
+*OUTPUTS: uint64_t milliseconds
+*/
+uint64_t transferDeadline(const ServerConfig *config, uint64_t length)
+{
+  return (uint64_t)config->requestTimeout * 1000 + length / config->minRate * 1000
+    + length % config->minRate * 1000 / config->minRate;
 }
 
-/* banAddr
-*PURPOSE: Adds the IP address to the ban list.
-*INPUT: AddressList* ban list, struct in6_addr IP
-*OUTPUTS: -
+/* acceptor
+*PURPOSE: Thread function which accepts connections on its own listening
+*  socket and creates threads to handle them if they are not from a banned
+*  address. When there are several acceptors, each is pinned to a core, and
+*  the threads it creates inherit the pinning, so a connection is handled on
+*  the core its acceptor runs on. Pending connections are accepted until the
+*  socket would block, then it is polled. Returns once stopped by the upgrader,
+*  leaving any connections still pending for the new server.
+*INPUT: void* to an AcceptorThread
+*OUTPUTS: void* NULL, or non-NULL if the acceptor failed
 */
-void banAddr(AddressList *banList, struct in6_addr ip)
+void *acceptor(void *arg)
 {
-  AddressNode *newNode = calloc(1, sizeof(AddressNode));
+  AcceptorThread *acc = (AcceptorThread*)arg;
+  int error = false;
+  struct pollfd polld[2];
+  polld[0].fd = acc->sock;
+  polld[0].events = POLLIN;
+  polld[1].fd = acc->stop->wake[0];
+  polld[1].events = POLLIN;
+
+  if(acc->core >= 0)
+  {
+    cpu_set_t cores;
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+    CPU_ZERO(&cores);
+    CPU_SET(acc->core % (online > 0 ? online : 1), &cores);
+
+    if(pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores))
+    {
+      logMsg(LOG_WARN, "network", "Failed to pin acceptor %d to a core.", acc->core);
+    }
+  }
+
+  while(!error && !__atomic_load_n(&(acc->stop->stopped), __ATOMIC_ACQUIRE))
+  {
+    Connection *connection = calloc(1, sizeof(Connection));
+    connection->len = sizeof(connection->client);
+
+    //the address comes back with the connection, no getpeername() needed
+    if((connection->sd = accept4(acc->sock, (struct sockaddr*)&(connection->client), &(connection->len), SOCK_CLOEXEC)) >= 0)
+    {
+      char ipBuff[INET6_ADDRSTRLEN];
+      connection->id = __atomic_add_fetch(acc->conCount, 1, __ATOMIC_RELAXED);
+      addrString(connection->client.sin6_addr, ipBuff);
+      logContext(connection->id, ipBuff);
+
+      //registered before the ban check, so a ban made in between will still find it
+      connection->session.ip = connection->client.sin6_addr;
+      connection->session.sock = connection->sd;
+      registryAdd(acc->sessions, &(connection->session));
+
+      if(bannedAddr(acc->banList, connection->client.sin6_addr))
+      { //if connecting IP is still banned, we send rejection and close the connection
+        registryRemove(acc->sessions, &(connection->session));
+        sendMessage(bannedMsg, connection->sd);
+
+        logMsg(LOG_INFO, "server", "Rejected connection from banned address.");
+
+        close(connection->sd);
+        free(connection);
+      }
+      else
+      { //if not banned, make thread to handle connection
+        pthread_t thread;
+        ConnectionThread *cont = calloc(1, sizeof(ConnectionThread));
+        cont->con = connection;
+        cont->config = acc->config;
+        cont->banList = acc->banList;
+        cont->fileList = acc->fileList;
+        cont->timers = acc->timers;
+        cont->sessions = acc->sessions;
+
+        logMsg(LOG_INFO, "server", "New connection.");
+
+        pthread_create(&thread, NULL, handleConnection, (void*)cont);
+        pthread_detach(thread);
+      } //the thread will handle closing its own connection
+
+      logContext(0, NULL);
+    }
+    else
+    {
+      free(connection);
+
+      if(errno == EAGAIN || errno == EWOULDBLOCK)
+      { //nothing pending, the stop pipe is never read so stays readable once written
+        poll(polld, 2, -1);
+      }
+      else if(errno != EINTR && errno != ECONNABORTED)
+      { //the client giving up before being accepted is not an error
+        logMsg(LOG_ERROR, "network", "Connection error.");
+        error = true;
+      }
+    }
+  }
+
+  __atomic_sub_fetch(&(acc->stop->running), 1, __ATOMIC_RELEASE);
+
+  return error ? arg : NULL;
+}
+
+/* janitor
+*PURPOSE: Thread function which unbans expired addresses once a second, so
+*  acceptors do not have to on every connection. Every METRICS_INTERVAL
+*  seconds it also logs the connection, memory budget, key filter, epoch and
+*  reclaimer counters, if any have changed.
+*INPUT: void* to a JanitorThread
+*OUTPUTS: -
+*/
+void *janitor(void *arg)
+{
+  JanitorThread *jan = (JanitorThread*)arg;
+  MemoryBudget *budget = jan->fileList->budget;
+  KeyFilter *filter = jan->fileList->index->filter;
+  EpochDomain *epochs = jan->fileList->index->epochs;
+  uint64_t last[15] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+  uint64_t now[15] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+  unsigned int tick = 0;
+  unsigned long bans = 0;
+
+  while(true)
+  {
+    sleep(1);
+    unbanAddrs(jan->banList, jan->config->lockout);
+
+    if(jan->config->processes > 1 && __atomic_load_n(&(jan->banList->bans), __ATOMIC_RELAXED) != bans)
+    { //the worker making a ban can only close its own sessions
+      bans = closeBannedSessions(jan->banList, jan->sessions);
+    }
+
+    if(++tick % METRICS_INTERVAL == 0)
+    {
+      now[0] = timerExpired(jan->timers, TIMER_IDLE);
+      now[1] = timerExpired(jan->timers, TIMER_SLOW);
+      pthread_mutex_lock(budget->mutex);
+      now[2] = budget->queued;
+      now[3] = budget->rejected;
+      pthread_mutex_unlock(budget->mutex);
+
+      if(filter != NULL)
+      { //shared by every worker in prefork mode, so these are the server's totals
+        filterStats(filter, &(now[5]), &(now[4]), &(now[6]));
+      }
+
+      now[7] = __atomic_load_n(&(epochs->waits), __ATOMIC_RELAXED); //not locked, a removal may be waiting on a slow read
+      now[8] = __atomic_load_n(&(epochs->waited), __ATOMIC_RELAXED);
+      now[9] = __atomic_load_n(&(jan->fileList->index->burying), __ATOMIC_RELAXED);
+      now[10] = __atomic_load_n(&(jan->fileList->index->reclaimed), __ATOMIC_RELAXED);
+      now[11] = __atomic_load_n(&(jan->fileList->index->expiries->count), __ATOMIC_RELAXED);
+      now[12] = __atomic_load_n(&(jan->fileList->index->expired), __ATOMIC_RELAXED);
+      now[13] = __atomic_load_n(&(jan->fileList->index->evicted), __ATOMIC_RELAXED);
+      now[14] = __atomic_load_n(&(jan->fileList->index->live), __ATOMIC_RELAXED);
+
+      if(memcmp(now, last, sizeof(now)))
+      {
+        logMsg(LOG_INFO, "server", "Metrics: %llu idle timeouts, %llu slow connections evicted, "\
+          "%llu requests queued for memory, %llu refused.", (unsigned long long)now[0],
+          (unsigned long long)now[1], (unsigned long long)now[2], (unsigned long long)now[3]);
+
+        if(filter != NULL)
+        {
+          logMsg(LOG_INFO, "server", "Key filter: %llu keys, %llu lookups refused without the lock, %llu passed on to the index, "\
+            "%llu of them not found.", (unsigned long long)__atomic_load_n(&(filter->keys), __ATOMIC_RELAXED),
+            (unsigned long long)now[4], (unsigned long long)now[5], (unsigned long long)now[6]);
+        }
+
+        logMsg(LOG_INFO, "server", "Epochs: removals waited for lock-free readers %llu times, for %llu ms in total.",
+          (unsigned long long)now[7], (unsigned long long)(now[8] / 1000));
+        logMsg(LOG_INFO, "server", "Reclaimer: %llu deleted files waiting, %llu reclaimed.", (unsigned long long)now[9], (unsigned long long)now[10]);
+        logMsg(LOG_INFO, "server", "Capacity: %llu MiB of files kept, %llu waiting to expire, %llu expired, %llu evicted.",
+          (unsigned long long)(now[14] / (1024 * 1024)), (unsigned long long)now[11], (unsigned long long)now[12], (unsigned long long)now[13]);
+
+        memcpy(last, now, sizeof(now));
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/* upgrader
+*PURPOSE: Thread function which waits for UPGRADE_SIGNAL, then starts the
+*  server's binary again and passes it the listening sockets. Once the new
+*  server says it is ready, this one drains and tells it so, then returns for
+*  the server to exit. If the new server exits before it is ready, this one
+*  carries on as before. Needs a journal, for the new server to rebuild the
+*  index from.
+*INPUT: void* to an UpgradeThread
+*OUTPUTS: -
+*/
+void *upgrader(void *arg)
+{
+  UpgradeThread *up = (UpgradeThread*)arg;
+  int handed = false;
+  int socks[MAX_ACCEPTORS + 1];
+  int count = up->config->acceptors;
+  sigset_t set;
+  int sig;
+
+  memcpy(socks, up->socks, count * sizeof(int));
+
+  if(up->config->replicationSock != -1)
+  {
+    socks[count++] = up->config->replicationSock;
+  }
+
+  sigemptyset(&set);
+  sigaddset(&set, UPGRADE_SIGNAL);
+
+  while(!handed && !sigwait(&set, &sig))
+  {
+    int channel = -1;
+    char note = 0;
+    pid_t pid;
+
+    if(up->config->journal == NULL)
+    { //the new server would start with an empty index
+      logMsg(LOG_WARN, "server", "Not upgrading, the new server needs --journal to rebuild the index.");
+    }
+    else if((pid = upgradeSpawn(up->config->argv, &channel)) < 0)
+    {
+      logMsg(LOG_ERROR, "server", "Failed to start the new server for an upgrade.");
+    }
+    else
+    {
+      logMsg(LOG_INFO, "server", "Upgrading, started the new server (pid %d).", (int)pid);
+
+      if(upgradeSendSocks(channel, socks, count) && upgradeWait(channel, &note) && note == UPGRADE_READY)
+      {
+        drain(up);
+        upgradeSend(channel, UPGRADE_DRAINED);
+        handed = true;
+      }
+      else
+      { //it will not take over, so is left to exit
+        logMsg(LOG_ERROR, "server", "The new server (pid %d) exited before it was ready, not upgrading.", (int)pid);
+        waitpid(pid, NULL, 0);
+      }
+
+      close(channel);
+    }
+  }
+
+  return NULL;
+}
+
+/* drain
+*PURPOSE: Stops the acceptors, leaving new connections queued on the
+*  listening sockets for the new server, then closes every idle connection and
+*  waits for those partway through a request to finish it. Finally takes the
+*  file list lock for good, so that nothing more is journaled or deleted by the
+*  background threads before the new server replays the journal.
+*INPUT: UpgradeThread* upgrader
+*OUTPUTS: -
+*/
+void drain(UpgradeThread *up)
+{
+  struct timespec pause = {0, DRAIN_POLL * 1000000L};
+  char wake = 1;
+  unsigned long open = 1;
+  int first = true;
+
+  __atomic_store_n(&(up->stop->stopped), true, __ATOMIC_RELEASE);
+
+  if(write(up->stop->wake[1], &wake, 1) != 1)
+  { //acceptors still stop once their next connection arrives
+    logMsg(LOG_WARN, "server", "Failed to wake the acceptors.");
+  }
+
+  while(__atomic_load_n(&(up->stop->running), __ATOMIC_ACQUIRE) > 0)
+  { //until then, a connection could still be accepted
+    nanosleep(&pause, NULL);
+  }
+
+  timerDrain(up->timers);
+
+  while(open > 0)
+  {
+    pthread_mutex_lock(up->sessions->mutex);
+    open = up->sessions->count;
+    pthread_mutex_unlock(up->sessions->mutex);
+
+    if(first)
+    {
+      logMsg(LOG_INFO, "server", "Stopped accepting, draining %lu connections. . .", open);
+      first = false;
+    }
+
+    if(open > 0)
+    {
+      nanosleep(&pause, NULL);
+    }
+  }
+
+  arenaLock(up->fileList->mutex); //never unlocked, the server exits holding it
+
+  logMsg(LOG_INFO, "server", "Drained, handing over to the new server.");
+}
+
+/* takeOver
+*PURPOSE: In a server started by an upgrade, tells the old server it is
+*  ready and waits for it to drain, after which the journal is complete and
+*  may be replayed. New connections queue on the listening sockets meanwhile,
+*  so none are refused.
+*INPUT: int channel descriptor
+*OUTPUTS: -
+*/
+void takeOver(int channel)
+{
+  char note = 0;
+
+  logMsg(LOG_INFO, "server", "Upgrading, waiting for the old server to drain. . .");
+
+  if(upgradeSend(channel, UPGRADE_READY) && upgradeWait(channel, &note) && note == UPGRADE_DRAINED)
+  {
+    logMsg(LOG_INFO, "server", "The old server has drained, taking over.");
+  }
+  else
+  { //nothing more can be journaled once it has exited either way
+    logMsg(LOG_WARN, "server", "The old server exited without draining, taking over.");
+  }
+}
+
+/* handleConnection
+*PURPOSE: Thread function to handle a client connection. Recieves Message requests and sends Message responses over the socket.
+*INPUT: void* to a ConnectionThread struct
+*OUTPUTS: -
+*/
+void *handleConnection(void *arg)
+{ //thread function, expects ConnectionThread *argument
+  ConnectionThread *cont = (ConnectionThread*)arg;
+  int quit = false;
+  int valid = false;
+  Message msgIn;
+  Message msgOut;
+  const Message *reject;
+  uint64_t reserved = 0; //bytes of the memory budget held by the current request
+  BufferPool pool; //recycles message buffers between this connection's requests
+  memset(&pool, 0, sizeof(pool));
+  TreeHash tree; //of the current STORE, if it is hashed as it arrives
+  int treed = false;
+
+  struct sockaddr_in6 addr = cont->con->client; //used for logging ip in history
+
+  char ipBuff[INET6_ADDRSTRLEN];
+  addrString(addr.sin6_addr, ipBuff);
+  logContext(cont->con->id, ipBuff);
+
+  signal(SIGPIPE, SIG_IGN); //failed socket operations are handled as they occur
+
+  //every blocking recv() and send() runs under a deadline, if it passes the socket is shut down
+  TimerEntry timer;
+  timerInit(&timer, cont->con->sd);
+  timerArm(cont->timers, &timer, transferDeadline(cont->config, welcomeMsgs[cont->config->hash].length), TIMER_SLOW);
+
+  cont->con->fails = 0;
+
+  if(sendMessage(welcomeMsgs[cont->config->hash], cont->con->sd))
+  {
+    while(!quit)
+    {
+      timerArm(cont->timers, &timer, (uint64_t)cont->config->timeout * 1000, TIMER_IDLE);
+      valid = recieveHeader(&msgIn, cont->con->sd);
+
+      if(valid)
+      { //the whole request, including any wait for the memory budget, must arrive in time
+        timerArm(cont->timers, &timer, transferDeadline(cont->config, msgIn.length), TIMER_SLOW);
+      }
+
+      if(valid && (reject = admitRequest(cont, &msgIn, &reserved)) != NULL)
+      { //refused before the body is read, so the connection cannot continue
+        rejectRequest(cont->con->sd, reject, msgIn.length);
+        valid = false;
+      }
+      else if(valid)
+      { //large STOREs are hashed on the pool while they arrive
+        treed = msgIn.command == STORE && cont->config->hashThreads > 0 && cont->config->primaryHost == NULL && msgIn.length > TREE_SEGMENT;
+
+        if(treed)
+        {
+          treeBegin(&tree, cont->fileList->hashes, msgIn.length);
+        }
+
+        if(!recieveBodyProgress(&msgIn, cont->con->sd, &pool, treed ? treeArrived : NULL, &tree))
+        {
+          if(treed)
+          { //abandoned before the body was freed
+            treeFree(&tree);
+            treed = false;
+          }
+
+          budgetRelease(cont->fileList->budget, reserved);
+          reserved = 0;
+          valid = false;
+        }
+      }
+
+      timerDisarm(cont->timers, &timer); //the client is not held to the time the server takes
+
+      if(valid)
+      {
+        TRACE_BEGIN(requestStart);
+        logCommand((msgIn.command >= COMMANDMIN && msgIn.command <= COMMANDMAX) ? commands[msgIn.command - 1] : "unknown");
+
+        switch(msgIn.command)
+        {
+          case STORE:
+            if(cont->config->primaryHost != NULL)
+            { //changes only come from the primary
+              msgOut = readOnlyMsg;
+            }
+            else
+            {
+              store(&msgIn, &msgOut, cont->fileList, addr.sin6_addr, cont->config->hash, treed ? &tree : NULL, &pool);
+            }
+            break;
+          case GET:
+            if(get(&msgIn, &msgOut, cont->fileList, addr.sin6_addr, &reserved))
+            {
+              cont->con->fails = 0;
+            }
+            else
+            { //invalid key
+              cont->con->fails++;
+            }
+            break;
+          case DELETE:
+            if(cont->config->primaryHost != NULL)
+            {
+              msgOut = readOnlyMsg;
+            }
+            else if(delete(&msgIn, &msgOut, cont->fileList, addr.sin6_addr))
+            {
+              cont->con->fails = 0;
+            }
+            else
+            { //invalid key
+              cont->con->fails++;
+            }
+            break;
+          case HISTORY:
+            if(history(&msgIn, &msgOut, cont->fileList, addr.sin6_addr, &pool))
+            {
+              cont->con->fails = 0;
+            }
+            else
+            { //invalid key
+              cont->con->fails++;
+            }
+            break;
+          case LIST:
+            if(!accessAllowed(cont->config->listAccess, addr.sin6_addr))
+            {
+              msgOut = listDeniedMsg;
+            }
+            else if(listKeys(&msgIn, &msgOut, cont->fileList, &pool))
+            {
+              cont->con->fails = 0;
+            }
+            else
+            { //invalid request
+              cont->con->fails++;
+            }
+            break;
+          case EVENTS:
+            if(!accessAllowed(cont->config->eventAccess, addr.sin6_addr))
+            {
+              msgOut = eventsDeniedMsg;
+            }
+            else if(events(&msgIn, &msgOut, cont->fileList, &pool))
+            {
+              cont->con->fails = 0;
+            }
+            else
+            { //invalid request
+              cont->con->fails++;
+            }
+            break;
+          case EXPIRE:
+            if(cont->config->primaryHost != NULL)
+            {
+              msgOut = readOnlyMsg;
+            }
+            else if(expire(&msgIn, &msgOut, cont->fileList, addr.sin6_addr))
+            {
+              cont->con->fails = 0;
+            }
+            else
+            { //invalid key or request
+              cont->con->fails++;
+            }
+            break;
+          case QUIT:
+            quit = true;
+            msgOut = goodbyeMsg;
+            break;
+          default: //server ignores FILECONT, MESSAGE and DISCON commands
+            msgOut = unknownCommandMsg;
+            quit = true;
+            break;
+        }
+
+        if(cont->con->fails > cont->config->attempts)
+        {
+          banAddr(cont->banList, cont->con->client.sin6_addr);
+          logMsg(LOG_WARN, "server", "Error limit exceeded. IP address banned, %d other sessions closed.",
+            registryCloseAddr(cont->sessions, cont->con->client.sin6_addr, &(cont->con->session)));
+          releaseBody(&msgOut, &pool);
+          msgOut = banNoticeMsg;
+          quit = true;
+        }
+
+        timerArm(cont->timers, &timer, transferDeadline(cont->config, msgOut.length), TIMER_SLOW);
+
+        if(!sendMessage(msgOut, cont->con->sd))
+        { //failed to send message
+          quit = true;
+          logMsg(LOG_WARN, "network", "Failed to send message.");
+        }
+
+        TRACE_END(requestStart, (msgIn.command >= COMMANDMIN && msgIn.command <= COMMANDMAX) ? commands[msgIn.command - 1] : "unknown", "request");
+
+        if(treed)
+        { //already finished by store()
+          treeFree(&tree);
+          treed = false;
+        }
+
+        releaseBody(&msgOut, &pool);
+        releaseBody(&msgIn, &pool);
+        budgetRelease(cont->fileList->budget, reserved);
+        reserved = 0;
+        logCommand(NULL);
+      }
+      else
+      {  //connection has died, timed out or invalid request made
+        quit = true;
+
+        if(timer.expired == TIMER_IDLE)
+        {
+          logMsg(LOG_INFO, "network", "Connection timed out.");
+        }
+        else if(timer.expired == TIMER_DRAIN)
+        {
+          logMsg(LOG_INFO, "network", "Connection closed to drain the server.");
+        }
+        else if(timer.expired == TIMER_NONE && !cont->con->session.banned)
+        { //slow and banned connections are logged once closed
+          logMsg(LOG_INFO, "network", "Invalid connection dropped.");
+        }
+      }
+
+    }
+  }
+  else
+  { //failed to send welcome
+    quit = true;
+    logMsg(LOG_WARN, "network", "Failed to send welcome message.");
+  }
+
+  //both must happen before close(), or the reaper or a ban could shut down a reused descriptor
+  timerDisarm(cont->timers, &timer);
+  registryRemove(cont->sessions, &(cont->con->session));
+
+  if(cont->con->session.banned)
+  {
+    logMsg(LOG_INFO, "server", "Closed session of banned address.");
+  }
+
+  if(timer.expired == TIMER_SLOW)
+  {
+    logMsg(LOG_WARN, "network", "Evicted slow connection, %llu evicted so far.",
+      (unsigned long long)timerExpired(cont->timers, TIMER_SLOW));
+  }
+
+  if(cont->con->sd != -1)
+  {
+    close(cont->con->sd);
+  }
+
+  poolDestroy(&pool);
+  free(cont->con);
+  free(cont);
+
+  logMsg(LOG_INFO, "server", "Closed connection.");
+
+  return NULL;
+}
+
+
+/* compactor
+*PURPOSE: Thread function which periodically compacts every pack that is
+*  mostly dead, so that deleted objects' space is reclaimed.
+*INPUT: void* to the FileList
+*OUTPUTS: -
+*/
+void *compactor(void *arg)
+{
+  FileList *fileList = (FileList*)arg;
+  int pack;
+
+  while(true)
+  {
+    sleep(PACK_COMPACT_INTERVAL);
+
+    while((pack = blobCompactable(fileList->blobs)) != NO_PACK)
+    {
+      compactPack(fileList, pack);
+    }
+  }
+
+  return NULL;
+}
+
+/* compactPack
+*PURPOSE: Moves every live object out of the pack into the active pack, then
+*  deletes the pack. The file list is only locked to find the pack's objects
+*  and to point them at their new copies, not while data is being copied. An
+*  object deleted while being moved has its new copy marked dead instead. The
+*  pack is only deleted once no request can still be reading from it.
+*INPUT: FileList* file list, int pack
+*OUTPUTS: -
+*/
+void compactPack(FileList *fileList, int pack)
+{
+  unsigned int count = 0;
+  unsigned int moved = 0;
+  unsigned int *ids = NULL;
+  BlobRef *from = NULL;
+  BlobRef *to = NULL;
+  int *done = NULL;
+  int error = false;
+
+  arenaLock(fileList->mutex);
+
+  for(FileNode *node = fileList->index->head; node != NULL; node = node->next)
+  {
+    if(node->blob.pack == pack)
+    {
+      count++;
+    }
+  }
+
+  if(count > 0)
+  {
+    ids = calloc(count, sizeof(unsigned int));
+    from = calloc(count, sizeof(BlobRef));
+    to = calloc(count, sizeof(BlobRef));
+    done = calloc(count, sizeof(int));
+    count = 0;
+
+    for(FileNode *node = fileList->index->head; node != NULL; node = node->next)
+    {
+      if(node->blob.pack == pack)
+      {
+        ids[count] = node->id;
+        from[count] = node->blob;
+        count++;
+      }
+    }
+  }
+
+  pthread_mutex_unlock(fileList->mutex);
+
+  for(unsigned int i = 0; !error && i < count; i++)
+  {
+    error = !blobMove(fileList->blobs, &(from[i]), &(to[i]));
+    moved = i + (error ? 0 : 1);
+  }
+
+  for(unsigned int i = 0; !error && i < moved; i++)
+  { //the copies must be on disk before the old pack is deleted
+    if(i == 0 || to[i].pack != to[i - 1].pack)
+    {
+      error = !commitBlob(fileList, 0, &(to[i]), false);
+    }
+  }
+
+  arenaLock(fileList->mutex);
+
+  for(FileNode *node = fileList->index->head; node != NULL; node = node->next)
+  {
+    if(node->blob.pack == pack)
+    {
+      for(unsigned int i = 0; i < moved; i++)
+      {
+        if(ids[i] == node->id && from[i].offset == node->blob.offset)
+        {
+          moveBlob(fileList, node, &(to[i]));
+          done[i] = true;
+          error = error || !journalNode(fileList, JOURNAL_MOVE, node, in6addr_any);
+        }
+      }
+    }
+  }
+
+  pthread_mutex_unlock(fileList->mutex);
+
+  for(unsigned int i = 0; i < moved; i++)
+  {
+    if(!done[i])
+    { //deleted while being moved
+      blobRemove(fileList->blobs, ids[i], &(to[i]));
+    }
+  }
+
+  if(!error && !commitJournal(fileList))
+  { //the old pack is still where a replay would look
+    error = true;
+  }
+
+  if(!error)
+  { //a GET which copied a node's old place may still be reading from the pack
+    epochSynchronize(fileList->index->epochs);
+    blobRetirePack(fileList->blobs, pack);
+    logMsg(LOG_INFO, "server", "Compacted pack_%d, moved %u files.", pack, moved);
+  }
+  else
+  { //the remaining objects stay where they are; try again on a later pass
+    logMsg(LOG_ERROR, "server", "Failed to compact pack_%d.", pack);
+  }
+
+  free(ids);
+  free(from);
+  free(to);
+  free(done);
+}
+
+/* reclaimer
+*PURPOSE: Thread function which reclaims the files DELETE has buried, every
+*  RECLAIM_TICK milliseconds, unlinking at most the process's reclaim rate
+*  of their contents, so a burst of large deletions does not saturate the
+*  disk. An allowance builds up by the rate each pass, up to a pass's worth,
+*  and each file's size is taken from it; a file larger than the allowance
+*  is still reclaimed, and the passes after it wait until it is paid off.
+*  Before reclaiming, each pass deletes the files which have expired, and if
+*  the files kept have grown past EVICT_HIGH percent of the disk cap, evicts
+*  files until they are back under EVICT_LOW percent, a batch of each at most
+*  per pass, so requests never wait long for the lock while space is freed.
+*INPUT: void* to the FileList
+*OUTPUTS: -
+*/
+void *reclaimer(void *arg)
+{
+  FileList *fileList = (FileList*)arg;
+  struct timespec pause = {0, RECLAIM_TICK * 1000000L};
+  int64_t perTick = fileList->reclaimRate * RECLAIM_TICK / 1000;
+  int64_t allowance = 0;
+  int evicting = false;
+
+  while(true)
+  {
+    nanosleep(&pause, NULL);
+
+    if(fileList->removes)
+    { //expired files are deleted first, as they may free enough space
+      uint64_t live;
+
+      expireBatch(fileList);
+      live = __atomic_load_n(&(fileList->index->live), __ATOMIC_RELAXED);
+      evicting = fileList->diskCap > 0 && (live > fileList->diskCap / 100 * EVICT_HIGH || (evicting && live > fileList->diskCap / 100 * EVICT_LOW));
+
+      if(evicting)
+      {
+        evictBatch(fileList, fileList->diskCap / 100 * EVICT_LOW);
+      }
+    }
+
+    if(fileList->reclaimRate == 0)
+    { //unlimited
+      allowance = INT64_MAX;
+    }
+    else
+    {
+      allowance = allowance + perTick > perTick ? perTick : allowance + perTick;
+    }
+
+    if(allowance > 0 && __atomic_load_n(&(fileList->index->buried), __ATOMIC_RELAXED) != NULL)
+    {
+      reclaimBatch(fileList, &allowance);
+    }
+  }
+
+  return NULL;
+}
+
+/* reclaimBatch
+*PURPOSE: Takes up to RECLAIM_BATCH buried files off the front of the queue,
+*  while the allowance lasts, then waits once for every request which could
+*  still be using any of them, and deletes their contents and frees their
+*  nodes. Packed contents were already marked dead when they were buried, so
+*  only files of their own are unlinked, and only those count against the
+*  allowance. Returns the number reclaimed.
+*INPUT: FileList* file list, int64_t* allowance in bytes
+*OUTPUTS: int reclaimed, int64_t* allowance left (negative if overspent)
+*/
+int reclaimBatch(FileList *fileList, int64_t *allowance)
+{
+  Tombstone *batch[RECLAIM_BATCH];
+  int count = 0;
+
+  arenaLock(fileList->mutex);
+
+  while(count < RECLAIM_BATCH && *allowance > 0 && fileList->index->buried != NULL)
+  {
+    Tombstone *grave = fileList->index->buried;
+
+    fileList->index->buried = grave->next;
+    fileList->index->lastBuried = grave->next == NULL ? NULL : fileList->index->lastBuried;
+    *allowance -= grave->node->blob.pack == NO_PACK ? (int64_t)grave->node->blob.length : 0;
+    __atomic_fetch_sub(&(fileList->index->buriedBytes), grave->node->blob.length, __ATOMIC_RELAXED);
+    batch[count++] = grave;
+  }
+
+  pthread_mutex_unlock(fileList->mutex);
+
+  if(count > 0)
+  { //one wait covers the whole batch, as every file in it was unlinked before it began
+    epochSynchronize(fileList->index->epochs);
+  }
+
+  for(int i = 0; i < count; i++)
+  {
+    FileNode *node = batch[i]->node;
+
+    if(node->blob.pack == NO_PACK && !blobRemove(fileList->blobs, node->id, &(node->blob)))
+    {
+      logMsg(LOG_ERROR, "server", "Failed to delete the contents of file_%u.", node->id);
+    }
+
+    cacheRemove(fileList->cache, node->id);
+    arenaFree(fileList->arena, batch[i]->unlinked);
+    freeNode(node, fileList);
+    arenaFree(fileList->arena, batch[i]);
+  }
+
+  __atomic_fetch_sub(&(fileList->index->burying), count, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&(fileList->index->reclaimed), count, __ATOMIC_RELAXED);
+
+  return count;
+}
+
+/* expireBatch
+*PURPOSE: Deletes the files whose time to live has run out, up to a batch of
+*  EXPIRY_BATCH from the expiry wheel, under the file list lock. An entry is
+*  only acted on if its file is still in the index, under the same number, and
+*  still expires when the entry says. Returns the number deleted.
+*INPUT: FileList* file list
+*OUTPUTS: int expired
+*/
+int expireBatch(FileList *fileList)
+{
+  ExpiryEntry *due[EXPIRY_BATCH];
+  FileNode *retire[EXPIRY_BATCH]; //could not be buried
+  KeyTreeNode *unlinked[EXPIRY_BATCH];
+  int retiring = 0;
+  int expired = 0;
+  int count;
+
+  arenaLock(fileList->mutex);
+
+  count = expiryDue(fileList->index->expiries, time(NULL), due, EXPIRY_BATCH);
+
+  for(int i = 0; i < count; i++)
+  {
+    FileNode *node = keyTreeFind(&(fileList->index->keys), due[i]->key);
+
+    if(node != NULL && node->id == due[i]->id && node->expires == due[i]->expires)
+    { //otherwise deleted, or given another time to live, since
+      logMsg(LOG_INFO, "server", "Expired file_%u.", node->id);
+      expired++;
+
+      if(!dropNode(node, fileList, in6addr_any, &(unlinked[retiring])))
+      {
+        retire[retiring++] = node;
+      }
+    }
+  }
+
+  pthread_mutex_unlock(fileList->mutex);
+
+  for(int i = 0; i < count; i++)
+  {
+    arenaFree(fileList->arena, due[i]);
+  }
+
+  for(int i = 0; i < retiring; i++)
+  { //no room for a tombstone, so reclaimed now
+    retireNode(retire[i], unlinked[i], fileList);
+  }
+
+  __atomic_fetch_add(&(fileList->index->expired), expired, __ATOMIC_RELAXED);
+
+  return expired;
+}
+
+/* evictBatch
+*PURPOSE: Deletes files until those in the index take up no more than target
+*  bytes, or EVICT_BATCH have gone. Each file evicted is the least recently
+*  read (or stored) of the next EVICT_SAMPLES files in the file list after
+*  the last one looked at, going round the list like a clock hand, so the
+*  files evicted approximate the least recently used without keeping the
+*  index in order of use. The lock is taken for each file, not the batch.
+*  Returns the number evicted.
+*INPUT: FileList* file list, uint64_t target bytes
+*OUTPUTS: int evicted
+*/
+int evictBatch(FileList *fileList, uint64_t target)
+{
+  int evicted = 0;
+  int more = true;
+
+  while(more && evicted < EVICT_BATCH)
+  {
+    FileNode *victim = NULL;
+    uint32_t oldest = 0;
+    KeyTreeNode *unlinked = NULL;
+    int buried = false;
+
+    arenaLock(fileList->mutex);
+
+    more = fileList->index->live > target;
+
+    if(more)
+    {
+      FileNode *node = fileList->index->hand != NULL ? fileList->index->hand : fileList->index->head;
+
+      for(int i = 0; node != NULL && i < EVICT_SAMPLES; i++)
+      { //GET sets the access time without the lock
+        uint32_t accessed = __atomic_load_n(&(node->accessed), __ATOMIC_RELAXED);
+
+        if(victim == NULL || accessed < oldest)
+        {
+          victim = node;
+          oldest = accessed;
+        }
+
+        node = node->next;
+      }
+
+      fileList->index->hand = node; //wraps round to the head at the end of the list
+    }
+
+    if(victim != NULL)
+    {
+      logMsg(LOG_INFO, "server", "Evicted file_%u, last used %lld seconds ago.", victim->id, (long long)(time(NULL) - oldest));
+      buried = dropNode(victim, fileList, in6addr_any, &unlinked);
+      evicted++;
+    }
+
+    pthread_mutex_unlock(fileList->mutex);
+
+    if(victim != NULL && !buried)
+    { //no room for a tombstone, so reclaimed now
+      retireNode(victim, unlinked, fileList);
+    }
+
+    more = more && victim != NULL;
+  }
+
+  __atomic_fetch_add(&(fileList->index->evicted), evicted, __ATOMIC_RELAXED);
+
+  return evicted;
+}
+
+/* commitBlob
+*PURPOSE: Returns once the object's contents are on disk, as required by the
+*  durability mode. Returns 'true' if an error occurs.
+*INPUT: FileList* file list, unsigned int id, BlobRef* ref, int the object's
+*  file is new (boolean)
+*OUTPUTS: int error occured (boolean)
+*/
+int commitBlob(FileList *fileList, unsigned int id, const BlobRef *ref, int created)
+{
+  int error = false;
+
+  if(fileList->commits->mode != DURABILITY_NONE)
+  {
+    int fd = blobSyncFd(fileList->blobs, id, ref);
+
+    if(fd != -1)
+    {
+      error = !commitWait(fileList->commits, fd, ref->pack, created);
+      close(fd);
+    }
+    else
+    {
+      error = true;
+    }
+  }
+
+  return !error;
+}
+
+/* journalNode
+*PURPOSE: Records a change to the node in the journal, if there is one.
+*  File list must be locked. Returns 'true' if an error occurs.
+*INPUT: FileList* file list, uint32_t type (JOURNAL_ define), FileNode* node,
+*  struct in6_addr IP of the client which made the change
+*OUTPUTS: int error occured (boolean)
+*/
+int journalNode(FileList *fileList, uint32_t type, const FileNode *node, struct in6_addr ip)
+{
+  int error = false;
+
+  if(fileList->journal != NULL)
+  {
+    JournalRecord record;
+
+    memset(&record, 0, sizeof(record));
+    record.type = type;
+    record.id = node->id;
+    record.time = type == JOURNAL_EXPIRE ? node->expires : time(NULL);
+    record.ip = ip;
+    record.blob = node->blob;
+    hashBytesKey(node->keyBytes, record.key);
+    error = !journalAppend(fileList->journal, &record);
+  }
+
+  return !error;
+}
+
+/* releaseBody
+*PURPOSE: Releases the message's body according to who owns it.
+*INPUT: Message* message, BufferPool* pool the connection's buffers come from
+*OUTPUTS: -
+*/
+void releaseBody(Message *msg, BufferPool *pool)
+{
+  switch(msg->owner)
+  {
+    case BODY_HEAP:
+      free(msg->body);
+      break;
+    case BODY_POOL:
+      poolFree(pool, msg->body);
+      break;
+    case BODY_SHARED:
+      cacheRelease(msg->ref);
+      break;
+    default: //BODY_STATIC bodies are never freed
+      break;
+  }
+
+  msg->body = NULL;
+}
+
+/* addrString
+*PURPOSE: Writes the IP address as text, with IPv4-mapped addresses shown in
+*  dot-decimal notation.
+*INPUT: struct in6_addr IP
+*OUTPUTS: char buffer[INET6_ADDRSTRLEN]
+*/
+void addrString(struct in6_addr ip, char *buffer)
+{
+  char ipBuff[INET6_ADDRSTRLEN];
+
+  inet_ntop(AF_INET6, &ip, ipBuff, sizeof(ipBuff));
+
+  if(!strncmp("::ffff:", ipBuff, strlen("::ffff:")))
+  { //ipv4-mapped address
+    strcpy(buffer, ipBuff + strlen("::ffff:"));
+  }
+  else
+  { //actual ipv6 address
+    strcpy(buffer, ipBuff);
+  }
+}
+
+/* bannedAddr
+*PURPOSE: Returns true if the IP address is found in the banlist.
+*INPUT: AddressList ban list, struct in6_addr IP.
+*OUTPUTS: int banned (boolean)
+*/
+int bannedAddr(AddressList *banList, struct in6_addr ip)
+{
+  int found = false;
+
+  TRACE_BEGIN(lockWait);
+  arenaLock(banList->mutex);
+  TRACE_END(lockWait, "banList wait", "lock");
+  TRACE_BEGIN(lockHold);
+
+  AddressNode *addr = banList->head;
+
+  while(!found && addr != NULL)
+  {
+    if(!memcmp(&(addr->ip), &ip, sizeof(ip)))
+    {
+      found = true;
+    }
+    else
+    {
+      addr = addr->next;
+    }
+  }
+
+  TRACE_END(lockHold, "banList hold", "lock");
+  pthread_mutex_unlock(banList->mutex);
+
+  return found;
+}
+
+/* closeBannedSessions
+*PURPOSE: Closes this process's sessions from every banned address, for bans
+*  made by other worker processes. Returns the ban count seen.
+*INPUT: AddressList* ban list, SessionRegistry* sessions
+*OUTPUTS: unsigned long bans
+*/
+unsigned long closeBannedSessions(AddressList *banList, SessionRegistry *sessions)
+{
+  int closed = 0;
+
+  arenaLock(banList->mutex);
+
+  unsigned long bans = banList->bans;
+
+  for(AddressNode *addr = banList->head; addr != NULL; addr = addr->next)
+  {
+    closed += registryCloseAddr(sessions, addr->ip, NULL);
+  }
+
+  pthread_mutex_unlock(banList->mutex);
+
+  if(closed > 0)
+  {
+    logMsg(LOG_WARN, "server", "Closed %d sessions of addresses banned by other workers.", closed);
+  }
+
+  return bans;
+}
+
+/* unbanAddrs
+*PURPOSE: Unbans any addresses on the banlist whose ban time is older than
+*  the lockout duration.
+*INPUT: AddressList* ban list, int lockout duration
+*OUTPUTS: -
+*/
+void unbanAddrs(AddressList *banList, const int lockout)
+{
+  TRACE_BEGIN(lockWait);
+  arenaLock(banList->mutex);
+  TRACE_END(lockWait, "banList wait", "lock");
+  TRACE_BEGIN(lockHold);
+
+  time_t unbanTime = time(NULL) - lockout; //latest bantime an address could have and still be ready to be unbanned
+  AddressNode **link = &(banList->head);
+
+  while(*link != NULL)
+  {
+    AddressNode *addr = *link;
+
+    if(addr->banTime < unbanTime)
+    { //if unbanned, remove from list.
+      *link = addr->next;
+      arenaFree(banList->arena, addr);
+    }
+    else
+    {
+      link = &(addr->next);
+    }
+  }
+
+  TRACE_END(lockHold, "banList hold", "lock");
+  pthread_mutex_unlock(banList->mutex);
+}
+
+/* banAddr
+*PURPOSE: Adds the IP address to the ban list.
+*INPUT: AddressList* ban list, struct in6_addr IP
+*OUTPUTS: -
+*/
+void banAddr(AddressList *banList, struct in6_addr ip)
+{
+  AddressNode *newNode = arenaAlloc(banList->arena, sizeof(AddressNode));
+
+  if(newNode == NULL)
+  { //only in prefork mode, once the shared arena is full
+    logMsg(LOG_ERROR, "server", "Shared memory is full, cannot ban another address.");
+    return;
+  }
+
+  TRACE_BEGIN(lockWait);
+  arenaLock(banList->mutex);
+  TRACE_END(lockWait, "banList wait", "lock");
+  TRACE_BEGIN(lockHold);
+
+  newNode->ip = ip;
+  newNode->banTime = time(NULL);
+
+  newNode->next = banList->head;
+  banList->head = newNode;
+  banList->bans++;
+
+  TRACE_END(lockHold, "banList hold", "lock");
+  pthread_mutex_unlock(banList->mutex);
+}
+
+/* keyMayExist
+*PURPOSE: Returns 'false' if the key is certainly not in the file list: it is
+*  not well formed, or the key filter has not counted it. Needs no lock, so
+*  requests for unknown keys can be refused without waiting on the file list.
+*INPUT: FileList* file list, char* key
+*OUTPUTS: int may exist (boolean)
+*/
+int keyMayExist(FileList *list, const char *key)
+{
+  uint8_t bytes[HASH_KEY_BYTES];
+  int may = hashKeyBytes(key, bytes);
+
+  if(may && list->index->filter != NULL)
+  {
+    may = filterCheck(list->index->filter, bytes);
+  }
+
+  return may;
+}
+
+/* checkKey
+*PURPOSE: Searches the file list for a node with a matching key, and returns
+*  a pointer to it if found. Returns NULL if no match is found, or the file has
+*  expired and is only waiting for the reclaimer to delete it. Needs either
+*  the file list locked, or to be called during an epochEnter() read, for as
+*  long as the node is used.
+*INPUT: char* key, FileList* file list
+*OUTPUTS: FileNode* file node
+*/
+FileNode *checkKey(char *key, FileList *list)
+{ //mutex or epoch for this operation handled by calling function
+  FileNode *node = NULL;
+  uint8_t bytes[HASH_KEY_BYTES];
+
+  if(hashKeyBytes(key, bytes))
+  { //anything else cannot match
+    node = keyTreeFind(&(list->index->keys), bytes);
+  }
+
+  if(node != NULL)
+  { //EXPIRE may be setting it meanwhile
+    uint32_t expires = __atomic_load_n(&(node->expires), __ATOMIC_RELAXED);
+
+    node = expires != 0 && expires <= time(NULL) ? NULL : node;
+  }
+
+  return node;
+}
+
+/* nodeBlob
+*PURPOSE: Copies where a node's contents are stored. Compaction can move them
+*  while a request reads the node without the lock, so the copy is made again
+*  until no move was in progress while it was made.
+*INPUT: FileList* file list, FileNode* node
+*OUTPUTS: BlobRef* ref
+*/
+void nodeBlob(FileList *list, const FileNode *node, BlobRef *ref)
+{
+  int copied = false;
+
+  while(!copied)
+  {
+    uint64_t moves = __atomic_load_n(&(list->index->moves), __ATOMIC_ACQUIRE);
+
+    *ref = node->blob;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    copied = moves % 2 == 0 && moves == __atomic_load_n(&(list->index->moves), __ATOMIC_RELAXED);
+  }
+}
+
+/* moveBlob
+*PURPOSE: Points a node at a new copy of its contents, so that nodeBlob()
+*  never copies half of each.
+*INPUT: FileList* file list, FileNode* node, BlobRef* ref
+*OUTPUTS: -
+*/
+void moveBlob(FileList *list, FileNode *node, const BlobRef *ref)
+{ //mutex for this function handled by calling function
+  __atomic_store_n(&(list->index->moves), list->index->moves + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  node->blob = *ref;
+  __atomic_store_n(&(list->index->moves), list->index->moves + 1, __ATOMIC_RELEASE);
+}
+
+/* checkId
+*PURPOSE: Searches the file list for the node stored under the file number.
+*  Returns NULL if there is none.
+*INPUT: unsigned int id, FileList* file list
+*OUTPUTS: FileNode* file node
+*/
+FileNode *checkId(unsigned int id, FileList *list)
+{ //mutex for this operation handled by calling function
+  FileNode *node = list->index->head;
+
+  while(node != NULL && node->id != id)
+  {
+    node = node->next;
+  }
+
+  return node;
+}
+
+/* addEvent
+*PURPOSE: Records an operation on a file in the event log, as the newest of the
+*  file's events. Takes no lock, so GET and HISTORY record their events on the
+*  node they found while reading without the file list lock.
+*INPUT: FileList* file list, FileNode* node, int command code, struct in6_addr
+*  IP, time_t time
+*OUTPUTS: -
+*/
+void addEvent(FileList *list, FileNode *node, uint8_t command, struct in6_addr ip, time_t when)
+{
+  eventAppend(list->index->events, command, node->id, &(node->events), ip, when);
+}
+
+/* linkNode
+*PURPOSE: Adds a node to the front of the file list, and to the index's tree
+*  under its key, in place of any older node with the same contents. Returns
+*  'false' if there is no room for it in the tree, and it has not been added.
+*INPUT: FileNode node, FileList file list.
+*OUTPUTS: int linked (boolean)
+*/
+int linkNode(FileNode *node, FileList *list)
+{ //mutex for this function handled by calling function
+  void *older; //stays in the list, found again if this node is removed
+  int linked;
+
+  if(list->index->filter != NULL)
+  { //before the node can be found, so the filter never misses a key in the index
+    filterAdd(list->index->filter, node->keyBytes);
+  }
+
+  linked = keyTreeInsert(&(list->index->keys), list->arena, node, &older);
+
+  if(linked)
+  {
+    node->next = list->index->head;
+    list->index->head = node;
+    __atomic_fetch_add(&(list->index->live), node->blob.length, __ATOMIC_RELAXED);
+  }
+  else
+  { //only in prefork mode, once the shared arena is full
+    logMsg(LOG_WARN, "server", "Shared memory is full, file_%u not indexed.", node->id);
+
+    if(list->index->filter != NULL)
+    {
+      filterRemove(list->index->filter, node->keyBytes);
+    }
+  }
+
+  return linked;
+}
+
+/* removeNode
+*PURPOSE: Modifies the file list to not include the passed node. Requests
+*  reading the index without the lock may still be using the node, so it is
+*  not freed: once the file list is unlocked, it is passed to retireNode(),
+*  along with the tree node returned.
+*INPUT: FileNode node, FileList file list.
+*OUTPUTS: KeyTreeNode* unlinked tree node (or NULL)
+*/
+KeyTreeNode *removeNode(FileNode *node, FileList *list)
+{ //mutex for this function handled by calling function
+  FileNode *older = node->next;
+  KeyTreeNode *unlinked = NULL;
+
+  if(list->index->hand == node)
+  { //eviction carries on from the next node
+    list->index->hand = node->next;
+  }
+
+  //unlinked before anything is freed, so a worker dying partway through never leaves the index pointing at a freed node
+  if(list->index->head == node)
+  {
+    list->index->head = node->next;
+  }
+  else
+  {
+    FileNode *listNode = list->index->head;
+
+    while(listNode->next != node && listNode->next != NULL)
+    {
+      listNode = listNode->next;
+    }
+
+    if(listNode->next != NULL)
+    { //listNode->next is the node we're looking for
+      listNode->next = node->next;
+    } //otherwise not found - may have been deleted already. . .
+  }
+
+  if(keyTreeFind(&(list->index->keys), node->keyBytes) == node)
+  { //the next newest node with the same contents, if any, takes its place
+    void *replaced;
+
+    while(older != NULL && memcmp(older->keyBytes, node->keyBytes, HASH_KEY_BYTES))
+    {
+      older = older->next;
+    }
+
+    if(older != NULL)
+    { //replacing a leaf allocates nothing, so cannot fail
+      keyTreeInsert(&(list->index->keys), list->arena, older, &replaced);
+    }
+    else
+    {
+      keyTreeRemove(&(list->index->keys), node->keyBytes, &unlinked);
+    }
+  }
+
+  if(list->index->filter != NULL)
+  { //every node was counted, including older ones with the same key
+    filterRemove(list->index->filter, node->keyBytes);
+  }
+
+  __atomic_fetch_sub(&(list->index->live), node->blob.length, __ATOMIC_RELAXED);
+
+  return unlinked;
+}
+
+/* buryNode
+*PURPOSE: Queues a node removeNode() has taken out of the index for the
+*  reclaimer, so DELETE can reply without waiting for readers or the disk.
+*  Packed contents are marked dead now, so compaction never copies them (or
+*  deletes their pack before they are marked). Returns 'false' if there is no
+*  room for the tombstone, in which case nothing is done and the node must be
+*  passed to retireNode() instead.
+*INPUT: FileNode node, KeyTreeNode* unlinked tree node (or NULL), FileList
+*  file list.
+*OUTPUTS: int buried (boolean)
+*/
+int buryNode(FileNode *node, KeyTreeNode *unlinked, FileList *list)
+{ //mutex for this function handled by calling function
+  Tombstone *grave = arenaAlloc(list->arena, sizeof(Tombstone));
+
+  if(grave != NULL)
+  {
+    grave->next = NULL;
+    grave->node = node;
+    grave->unlinked = unlinked;
+
+    if(node->blob.pack != NO_PACK)
+    { //only counts its bytes, so cannot fail
+      blobRemove(list->blobs, node->id, &(node->blob));
+    }
+
+    if(list->index->lastBuried != NULL)
+    {
+      list->index->lastBuried->next = grave;
+    }
+    else
+    {
+      list->index->buried = grave;
+    }
+
+    list->index->lastBuried = grave;
+    __atomic_fetch_add(&(list->index->burying), 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(list->index->buriedBytes), node->blob.length, __ATOMIC_RELAXED);
+  }
+
+  return grave != NULL;
+}
+
+/* dropNode
+*PURPOSE: Deletes a file found in the index, for DELETE, expiry or eviction:
+*  records and journals its deletion, takes it out of the index and buries
+*  it. Returns 'false' if it could not be buried, in which case it must be
+*  passed to retireNode(), with the tree node written to unlinked, once the
+*  file list is unlocked.
+*INPUT: FileNode node, FileList file list, struct in6_addr IP of the client
+*  deleting it (unspecified if the server is)
+*OUTPUTS: int buried (boolean), KeyTreeNode** unlinked tree node (or NULL)
+*/
+int dropNode(FileNode *node, FileList *list, struct in6_addr ip, KeyTreeNode **unlinked)
+{ //mutex for this function handled by calling function
+  addEvent(list, node, DELETE, ip, time(NULL));
+
+  if(!journalNode(list, JOURNAL_DELETE, node, ip))
+  { //the file is gone either way
+    logMsg(LOG_ERROR, "server", "Failed to journal the deletion of file_%u.", node->id);
+  }
+
+  *unlinked = removeNode(node, list);
+
+  return buryNode(node, *unlinked, list);
+}
+
+/* retireNode
+*PURPOSE: Waits until no request which found a node before removeNode() took
+*  it out can still be using it, then deletes its contents, drops it from this
+*  process's cache, and frees it, for a node which could not be buried. File
+*  list must not be locked. Returns 'true'
+*  if an error occurs deleting the contents, which are then left on disk
+*  unreferenced.
+*INPUT: FileNode node, KeyTreeNode* unlinked tree node (or NULL), FileList
+*  file list.
+*OUTPUTS: int error occured (boolean)
+*/
+int retireNode(FileNode *node, KeyTreeNode *unlinked, FileList *list)
+{
+  epochSynchronize(list->index->epochs);
+
+  int removed = blobRemove(list->blobs, node->id, &(node->blob));
+
+  if(!removed)
+  {
+    logMsg(LOG_ERROR, "server", "Failed to delete the contents of file_%u.", node->id);
+  }
+
+  cacheRemove(list->cache, node->id);
+  arenaFree(list->arena, unlinked);
+  freeNode(node, list);
+
+  return removed;
+}
+
+/* freeNode
+*PURPOSE: Frees a node which is not (or no longer) in the file list. Its
+*  events stay in the event log until they are overwritten.
+*INPUT: FileNode node, FileList file list.
+*OUTPUTS: -
+*/
+void freeNode(FileNode *node, FileList *list)
+{
+  slabFree(&(list->index->nodes), node);
+}
+
+/* accessAllowed
+*PURPOSE: Returns 'true' if LIST or EVENTS may be used from the address under
+*  its access setting. LIST reveals every key, and a key is all it takes to
+*  read or delete a file, while EVENTS reveals every client's activity, so by
+*  default only clients on the server's own host may use either.
+*INPUT: int access (ACCESS_ define), struct in6_addr IP
+*OUTPUTS: int allowed (boolean)
+*/
+int accessAllowed(int access, struct in6_addr ip)
+{
+  int loopback = IN6_IS_ADDR_LOOPBACK(&ip) || (IN6_IS_ADDR_V4MAPPED(&ip) && ip.s6_addr[12] == 127);
+
+  return access == ACCESS_ALL || (access == ACCESS_LOCAL && loopback);
+}
+
+/* formatEvent
+*PURPOSE: Writes an event as a line of HISTORY output, eg
+*  "store: 26-08-2020 22:59, 128.225.212.210", or with full set, as a line of
+*  EVENTS output, which adds its seq, seconds and file, eg
+*  "#12 store: 26-08-2020 22:59:03, 128.225.212.210, file_7". Returns the
+*  length of the line, which is terminated, and shorter than
+*  EVENT_LINE_LENGTH.
+*INPUT: Event* event, int full (boolean)
+*OUTPUTS: int length, char* line
+*/
+int formatEvent(const Event *event, int full, char *line)
+{
+  char ipBuff[INET6_ADDRSTRLEN];
+  char dateBuff[20]; //space of, eg "26-08-2020 22:59:03"
+  time_t when = event->time;
+  struct tm local;
+  int length;
+
+  addrString(event->ip, ipBuff);
+  strftime(dateBuff, sizeof(dateBuff), full ? "%d-%m-%Y %H:%M:%S" : "%d-%m-%Y %H:%M", localtime_r(&when, &local));
+
+  if(full)
+  {
+    length = snprintf(line, EVENT_LINE_LENGTH, "#%llu %s: %s, %s, file_%u", (unsigned long long)event->seq,
+      commands[event->command - 1], dateBuff, ipBuff, event->file);
+  }
+  else
+  {
+    length = snprintf(line, EVENT_LINE_LENGTH, "%s: %s, %s", commands[event->command - 1], dateBuff, ipBuff);
+  }
+
+  return length;
+}
+
+/* parseEventTime
+*PURPOSE: Reads a time bound of an EVENTS request: seconds since 1970, or if
+*  negative, seconds before now. Empty leaves the bound as it is. Returns
+*  'false' if the field is not a number.
+*INPUT: char* field, time_t now
+*OUTPUTS: int valid (boolean), uint32_t* bound
+*/
+int parseEventTime(const char *field, time_t now, uint32_t *bound)
+{
+  char *end;
+  long long value = strtoll(field, &end, 10);
+  int valid = *end == '\0';
+
+  if(valid && end != field)
+  {
+    value = value < 0 ? now + value : value;
+    *bound = value < 0 ? 0 : (value > UINT32_MAX ? UINT32_MAX : (uint32_t)value);
+  }
+
+  return valid;
+}
+
+/* parseAddress
+*PURPOSE: Reads an IPv6 address, or an IPv4 address as the IPv4-mapped
+*  address clients connecting over IPv4 are seen as. Returns 'false' if it is
+*  neither.
+*INPUT: char* text
+*OUTPUTS: int valid (boolean), struct in6_addr* IP
+*/
+int parseAddress(const char *text, struct in6_addr *ip)
+{
+  struct in_addr ip4;
+  int valid = inet_pton(AF_INET6, text, ip) == 1;
+
+  if(!valid && inet_pton(AF_INET, text, &ip4) == 1)
+  {
+    memset(ip, 0, sizeof(*ip));
+    ip->s6_addr[10] = 0xff;
+    ip->s6_addr[11] = 0xff;
+    memcpy(ip->s6_addr + 12, &ip4, sizeof(ip4));
+    valid = true;
+  }
+
+  return valid;
+}
+
+/*
+* Below (until the end of the file) are the functions which handle client
+* commands. All of them take pointers for an input message and an output
+* message, as well as the IP address of the client.
+* They all return 'true' if the request constitutes an action which should
+* increment the counter towards a ban, and modify the struct at the pointer to
+* the output message to be the response to the request.
+*/
+
+int store(Message *msgIn, Message *msgOut, FileList *fileList, struct in6_addr ip, int hash, TreeHash *tree, BufferPool *pool)
+{
+  FileNode *fileNode = slabAlloc(&(fileList->index->nodes), fileList->arena);
+  char key[KEYLENGTH]; //text form, only for the reply
+
+  msgOut->command = MESSAGE;
+
+  if(fileNode == NULL)
+  { //only in prefork mode, once the shared arena is full
+    logMsg(LOG_ERROR, "server", "Shared memory is full, cannot index another file.");
+    *msgOut = storeFailedMsg;
+    return true;
+  }
+
+  if(fileList->diskCap > 0 && __atomic_load_n(&(fileList->index->live), __ATOMIC_RELAXED) +
+    __atomic_load_n(&(fileList->index->buriedBytes), __ATOMIC_RELAXED) + msgIn->length > fileList->diskCap)
+  { //eviction keeps room below the cap, unless files arrive faster than it frees them
+    logMsg(LOG_WARN, "server", "Disk cap reached, refused a file of %llu bytes.", (unsigned long long)msgIn->length);
+    freeNode(fileNode, fileList);
+    *msgOut = fullMsg;
+    return true;
+  }
+
+  TRACE_BEGIN(hashStart);
+
+  if(tree != NULL)
+  { //all but the last segment were hashed while the body arrived
+    uint8_t digest[HASH_DIGEST_LENGTH];
+
+    treeFinish(tree, digest, HASH_DIGEST_LENGTH);
+    hashKeyDigest(HASH_BLAKE3, digest, key);
+  }
+  else
+  {
+    hashKey(hash, msgIn->body, msgIn->length, key);
+  }
 
-  pthread_mutex_lock(banList->mutex);
+  hashKeyBytes(key, fileNode->keyBytes);
 
-  newNode->ip = ip;
-  newNode->banTime = time(NULL);
+  TRACE_END(hashStart, hashEngineName(hash), "hash");
 
-  newNode->next = banList->head;
-  banList->head = newNode;
+  TRACE_BEGIN(countWait);
+  arenaLock(fileList->mutex);
+  TRACE_END(countWait, "fileList wait", "lock");
+  TRACE_BEGIN(countHold);
 
-  pthread_mutex_unlock(banList->mutex);
-}
+  fileNode->id = fileList->index->count++;
+  fileNode->stored = time(NULL);
+  fileNode->accessed = fileNode->stored;
+  fileNode->storer = ip;
 
-/* checkKey
-*PURPOSE: Searches the file list for a node with a matching key, and returns
-*  a pointer to it if found. Returns NULL if no match is found.
-*INPUT: char* key, FileList* file list
-*OUTPUTS: FileNode* file node
-*/
-FileNode *checkKey(char *key, FileList *list)
-{ //mutex for this operation handled by calling function
-  FileNode *node = list->head;
+  TRACE_END(countHold, "fileList hold", "lock");
+  pthread_mutex_unlock(fileList->mutex);
 
-  while(node != NULL && memcmp(node->key, key, KEYLENGTH-1))
+  //contents are written (and committed) before the node is added, so no other request can see a partly written file
+  int written = blobWrite(fileList->blobs, fileNode->id, msgIn->body, msgIn->length, &(fileNode->blob));
+  int durable = written && commitBlob(fileList, fileNode->id, &(fileNode->blob), fileNode->blob.pack == NO_PACK);
+
+  if(written && !durable)
   {
-    node = node->next;
+    logMsg(LOG_ERROR, "server", "Failed to sync file_%u for STORE operation.", fileNode->id);
+    blobRemove(fileList->blobs, fileNode->id, &(fileNode->blob));
   }
 
-  return node;
-}
+  if(durable && tree != NULL && fileNode->blob.pack == NO_PACK && !blobWriteTree(fileNode->id, (const char*)tree->cvs, tree->segments * BLAKE3_CV_LENGTH))
+  { //the file is still stored, it just cannot be verified
+    logMsg(LOG_WARN, "server", "Failed to write the tree of file_%u.", fileNode->id);
+  }
 
-/* addHistory
-*PURPOSE: Modifies the history list to then include a new node containing
-*  a timestamp, the operation code, and the IP address.
-*INPUT: FileHistory* history list, int command code, struct in6_addr IP
-*OUTPUTS: -
-*/
-void addHistory(FileHistory *history, uint8_t command, struct in6_addr ip)
-{ //mutex for this function handled by calling function
-  FileHistoryNode *newNode = calloc(1, sizeof(FileHistoryNode));
-  newNode->command = command;
-  newNode->time = time(NULL);
-  memcpy(&(newNode->ip), &(ip), sizeof(ip));
+  int journaled = false;
 
-  if(history->head == NULL)
-  {
-    history->head = newNode;
-  }
-  else
+  if(durable)
   {
-    FileHistoryNode *node = history->head;
-
-    while(node->next != NULL)
-    {
-      node = node->next;
-    }
+    fileNode->events = 0;
 
-    node->next = newNode;
-  }
-}
+    TRACE_BEGIN(lockWait);
+    arenaLock(fileList->mutex);
+    TRACE_END(lockWait, "fileList wait", "lock");
+    TRACE_BEGIN(lockHold);
 
-/* removeNode
-*PURPOSE: Modifies the file list to not include the passed node.
-*INPUT: FileNode node, FileList file list.
-*OUTPUTS: -
-*/
-void removeNode(FileNode *node, FileList *list)
-{ //mutex for this function handled by calling function
-  FileHistoryNode *prevNode = node->history.head;
+    //journaled under the lock, so the journal has files in the order they became visible
+    journaled = journalNode(fileList, JOURNAL_STORE, fileNode, ip);
 
-  if(prevNode != NULL)
-  { //free node's history list
-    FileHistoryNode *histNode = prevNode->next;
+    if(journaled)
+    { //before it can be found, so its STORE is always its first event
+      addEvent(fileList, fileNode, STORE, ip, fileNode->stored);
+    }
 
-    while(histNode != NULL)
-    {
-      free(prevNode);
-      prevNode = histNode;
-      histNode = histNode->next;
+    if(journaled && !linkNode(fileNode, fileList))
+    { //journaled, but no other request can find it, so it is deleted again
+      journaled = false;
+      journalNode(fileList, JOURNAL_DELETE, fileNode, ip);
+      addEvent(fileList, fileNode, DELETE, ip, time(NULL));
     }
 
-    free(prevNode);
+    TRACE_END(lockHold, "fileList hold", "lock");
+    pthread_mutex_unlock(fileList->mutex);
   }
 
-  if(list->head == node)
+  if(durable && !journaled)
   {
-    list->head = node->next;
-    free(node);
+    logMsg(LOG_ERROR, "server", "Failed to journal file_%u for STORE operation.", fileNode->id);
+    blobRemove(fileList->blobs, fileNode->id, &(fileNode->blob));
+  }
+  else if(journaled && !commitJournal(fileList))
+  { //already visible, but may not survive a crash
+    logMsg(LOG_ERROR, "server", "Failed to sync the journal for STORE operation.");
   }
-  else
-  {
-    FileNode *listNode = list->head;
 
-    while(listNode->next != node && listNode->next != NULL)
+  if(journaled)
+  {
+    if(fileNode->blob.pack != NO_PACK)
     {
-      listNode = listNode->next;
-    }
-
-    if(listNode->next != NULL)
-    { //listNode->next is the node we're looking for
-      listNode->next = node->next;
-      free(node);
+      logMsg(LOG_INFO, "server", "Stored file_%u in pack_%d.", fileNode->id, fileNode->blob.pack);
     }
     else
-    { //node not found - may have been deleted already. . .
-      free(node);
+    {
+      logMsg(LOG_INFO, "server", "Stored file_%u.", fileNode->id);
     }
+
+    char errorMsg[] = "Info: File has been stored with hash key: ";
+    msgOut->length = strlen(key) + sizeof(errorMsg);
+    msgOut->body = poolAlloc(pool, msgOut->length);
+    msgOut->owner = BODY_POOL;
+    memset(msgOut->body, 0, msgOut->length);
+    memcpy(msgOut->body, errorMsg, sizeof(errorMsg));
+    memcpy(msgOut->body + sizeof(errorMsg) - 1, key, strlen(key));
   }
-}
+  else
+  { //failed to write, sync or journal
+    if(!written)
+    {
+      logMsg(LOG_ERROR, "server", "Failed to write to file_%u for STORE operation.", fileNode->id);
+    }
 
-/*
-* Below (until the end of the file) are the functions which handle client
-* commands. All of them take pointers for an input message and an output
-* message, as well as the IP address of the client.
-* They all return 'true' if the request constitutes an action which should
-* increment the counter towards a ban, and modify the struct at the pointer to
-* the output message to be the response to the request.
-*/
+    freeNode(fileNode, fileList); //never linked
 
-int store(Message *msgIn, Message *msgOut, FileList *fileList, struct in6_addr ip)
-{
-  FileNode *fileNode;
+    *msgOut = storeFailedMsg;
+  }
 
-  msgOut->command = MESSAGE;
+  return true; //no bannable offences possible with this function
+}
 
-  char path[MAXPATHLENGTH];
+//command function, see above
+int get(Message *msgIn, Message *msgOut, FileList *fileList, struct in6_addr ip, uint64_t *reserved)
+{
+  int error = false;
 
-  pthread_mutex_lock(fileList->mutex);
+  if(!keyMayExist(fileList, msgIn->body))
+  { //refused without taking the lock
+    logMsg(LOG_DEBUG, "server", "Key not found.");
+    *msgOut = invalidKeyMsg;
+    error = true;
+  }
+  else
+  { //read without the file list lock; a DELETE waits for this to finish before freeing the node
+    TRACE_BEGIN(readHold);
+    int epoch = epochEnter(fileList->index->epochs);
 
-  snprintf(path, MAXPATHLENGTH, "file_%d", fileList->count);
+    FileNode *node = checkKey(msgIn->body, fileList);
 
-  if(writeFile(msgIn->body, msgIn->length, path))
-  {
-    FILE *hashStream;
-    char prog[] = "md5sum ";
-    char *command = calloc((strlen(prog) + strlen(path) + 1), sizeof(char));
-    snprintf(command, (strlen(prog) + strlen(path) + 1), "%s%s", prog, path);
+    if(node != NULL)
+    {
+      uint32_t now = time(NULL);
 
-    fileNode = calloc(1, sizeof(FileNode));
-    strcpy(fileNode->path, path);
+      if(__atomic_load_n(&(node->accessed), __ATOMIC_RELAXED) != now)
+      { //for eviction; written at most once a second, so busy files do not bounce their node between cores
+        __atomic_store_n(&(node->accessed), now, __ATOMIC_RELAXED);
+      }
 
-    hashStream = popen(command, "r");
+      CacheEntry *entry = cacheGet(fileList->cache, node->id);
+      int cached = entry != NULL;
+      int busy = false;
+      int damaged = false;
+      BlobRef blob;
 
-    free(command);
+      nodeBlob(fileList, node, &blob);
 
-    if(hashStream != NULL)
-    {
-      if(fscanf(hashStream, "%s ", fileNode->key) == 1)
+      if(!cached && !budgetAcquire(fileList->budget, blob.length, 0))
+      { //not waited for, as removals would wait on this read meanwhile
+        busy = true;
+      }
+      else if(!cached)
       {
-        if(strlen(fileNode->key) == (KEYLENGTH - 1)) //-1 to ignore expected '\0' which strlen does not count
+        char *contents;
+
+        *reserved += blob.length; //held until the response has been sent
+
+        if(blobRead(fileList->blobs, node->id, &blob, &contents))
         {
-          fileNode->history.head = NULL;
-          addHistory(&(fileNode->history), STORE, ip);
-          printf("SERVER Info: Stored file %s.\n", path);
-
-          fileNode->next = fileList->head;
-          fileList->head = fileNode;
-          fileList->count++;
-
-          char errorMsg[] = "Info: File has been stored with hash key: ";
-          msgOut->length = KEYLENGTH + sizeof(errorMsg);
-          msgOut->body = calloc(1, sizeof(fileNode->key) + sizeof(errorMsg));
-          memcpy(msgOut->body, errorMsg, sizeof(errorMsg));
-          memcpy(msgOut->body + sizeof(errorMsg) - 1, fileNode->key, sizeof(fileNode->key));
-        }
-        else
-        { //failed to read key of valid length
-          printf("SERVER Error: Failed to read valid hash from md5sum.");
-          char errorMsg[] = "Info: Error while trying to hash file.";
-          msgOut->length = sizeof(errorMsg);
-          msgOut->body = calloc(1, sizeof(errorMsg));
-          memcpy(msgOut->body, errorMsg, sizeof(errorMsg));
+          damaged = fileList->verify && !verifyFile(fileList, node, contents);
+
+          if(damaged)
+          {
+            free(contents);
+          }
+          else
+          {
+            entry = cacheInsert(fileList->cache, node->id, contents, blob.length);
+          }
         }
       }
+
+      if(busy)
+      {
+        logMsg(LOG_WARN, "server", "Memory budget exhausted, not reading file_%u.", node->id);
+        *msgOut = busyGetMsg;
+      }
+      else if(damaged)
+      { //logged by verifyFile()
+        *msgOut = corruptMsg;
+      }
+      else if(entry != NULL)
+      { //sent straight from the (possibly shared) entry, released once sent
+        msgOut->body = entry->data;
+        msgOut->length = entry->length;
+        msgOut->owner = BODY_SHARED;
+        msgOut->ref = entry;
+        msgOut->command = FILECONT;
+        error = false;
+        logMsg(LOG_INFO, "server", "Retrieved file_%u%s.", node->id, cached ? " from cache" : "");
+      }
       else
-      { //failed to read
-        printf("SERVER Error: Failed to read from md5sum.");
-        char errorMsg[] = "Info: Error while trying to hash file.";
-        msgOut->length = sizeof(errorMsg);
-        msgOut->body = calloc(1, sizeof(errorMsg));
-        memcpy(msgOut->body, errorMsg, sizeof(errorMsg));
+      { //failed to read file for valid key. should never happen
+        logMsg(LOG_ERROR, "server", "Failed to read file_%u.", node->id);
+        *msgOut = readFailedMsg;
+        error = false; //not the user's fault; system error
       }
 
-      pclose(hashStream);
+      addEvent(fileList, node, GET, ip, time(NULL));
     }
     else
-    { //failed to open process to md5sum
-      printf("SERVER Error: Failed to load md5sum to hash file.");
-      char errorMsg[] = "Info: Error while trying to hash file.";
-      msgOut->length = sizeof(errorMsg);
-      msgOut->body = calloc(1, sizeof(errorMsg));
+    { //key not found
+      logMsg(LOG_DEBUG, "server", "Key not found.");
+
+      if(fileList->index->filter != NULL)
+      { //let through by the filter
+        filterFalseHit(fileList->index->filter);
+      }
+
+      *msgOut = invalidKeyMsg;
+      error = true;
     }
-  }
-  else
-  { //failed to write
-    printf("SERVER Error: Failed to write to file %s for STORE operation.\n", path);
-    char msg[] = "Info: File failed to save. Please try again later.";
-    msgOut->length = sizeof(msg);
-    msgOut->body = calloc(1, sizeof(msg));
-    memcpy(msgOut->body, msg, sizeof(msg));
+
+    epochExit(fileList->index->epochs, epoch);
+    TRACE_END(readHold, "fileList read", "epoch");
   }
 
-  pthread_mutex_unlock(fileList->mutex);
+  return !error;
+}
 
-  return true; //no bannable offences possible with this function
+/* verifyFile
+*PURPOSE: Checks the contents of a file, read from disk, against the tree
+*  recorded when it was stored, hashing its segments on the pool. Files
+*  without a tree (packed, stored without --hash-threads, or replicated)
+*  cannot be checked, and pass. Returns 'true' if the contents match.
+*INPUT: FileList* file list, FileNode* file, char* contents
+*OUTPUTS: int matched (boolean)
+*/
+int verifyFile(FileList *fileList, const FileNode *node, const char *contents)
+{
+  char *cvs;
+  uint64_t bad;
+  int matched = true;
+
+  if(node->blob.pack == NO_PACK && blobReadTree(node->id, &cvs, treeSegments(node->blob.length) * BLAKE3_CV_LENGTH))
+  {
+    matched = treeVerify(fileList->hashes, contents, node->blob.length, (const uint8_t*)cvs, &bad);
+    free(cvs);
+
+    if(!matched)
+    {
+      logMsg(LOG_ERROR, "server", "file_%u is damaged: bytes %llu to %llu do not match its tree.", node->id,
+        (unsigned long long)(bad * TREE_SEGMENT), (unsigned long long)((bad + 1) * TREE_SEGMENT < node->blob.length ? (bad + 1) * TREE_SEGMENT : node->blob.length) - 1);
+    }
+  }
+
+  return matched;
 }
 
 //command function, see above
-int get(Message *msgIn, Message *msgOut, FileList *fileList, struct in6_addr ip)
+int delete(Message *msgIn, Message *msgOut, FileList *fileList, struct in6_addr ip)
 {
   int error = false;
 
-  pthread_mutex_lock(fileList->mutex);
-
-  FileNode *node = checkKey(msgIn->body, fileList);
+  msgOut->command = MESSAGE;
 
-  if(node != NULL)
+  if(!keyMayExist(fileList, msgIn->body))
+  { //refused without taking the lock
+    logMsg(LOG_DEBUG, "server", "Key not found.");
+    *msgOut = invalidKeyMsg;
+    error = true;
+  }
+  else
   {
-    if(readFile(&(msgOut->body), &(msgOut->length), node->path))
-    {
-      msgOut->command = FILECONT;
+    TRACE_BEGIN(lockWait);
+    arenaLock(fileList->mutex);
+    TRACE_END(lockWait, "fileList wait", "lock");
+    TRACE_BEGIN(lockHold);
+
+    FileNode *node = checkKey(msgIn->body, fileList);
+    KeyTreeNode *unlinked = NULL;
+    int buried = false;
+
+    if(node != NULL)
+    { //taken out of the index now, its contents are deleted by the reclaimer once no GET can still be reading them
+      logMsg(LOG_INFO, "server", "Deleted file_%u.", node->id);
+      buried = dropNode(node, fileList, ip, &unlinked);
+      *msgOut = deletedMsg;
       error = false;
-      printf("SERVER Info: Retrieved file %s.\n", node->path);
     }
     else
-    { //failed to read file for valid key. should never happen
-      printf("SERVER Error: Failed to read file %s.\n", node->path);
-      char msg[] = "Info: Key found, but the file cannot be read. Please try again later.";
-      msgOut->length = sizeof(msg);
-      msgOut->command = MESSAGE;
-      msgOut->body = calloc(1, sizeof(msg));
-      memcpy(msgOut->body, msg, sizeof(msg));
-      error = false; //not the user's fault; system error
+    { //key not found
+      logMsg(LOG_DEBUG, "server", "Key not found.");
+
+      if(fileList->index->filter != NULL)
+      { //let through by the filter
+        filterFalseHit(fileList->index->filter);
+      }
+
+      error = true;
+      *msgOut = invalidKeyMsg;
     }
 
-    addHistory(&(node->history), GET, ip);
-  }
-  else
-  { //key not found
-    char msg[] = "Error: Hash key not valid.";
-    msgOut->length = sizeof(msg);
-    msgOut->command = MESSAGE;
-    msgOut->body = calloc(1, sizeof(msg));
-    memcpy(msgOut->body, msg, sizeof(msg));
-    error = true;
-  }
+    TRACE_END(lockHold, "fileList hold", "lock");
+    pthread_mutex_unlock(fileList->mutex);
 
-  pthread_mutex_unlock(fileList->mutex);
+    if(node != NULL && !buried)
+    { //no room for a tombstone, so reclaimed now; logs its own errors, the key is already deleted
+      retireNode(node, unlinked, fileList);
+    }
+  }
 
   return !error;
 }
 
 //command function, see above
-int delete(Message *msgIn, Message *msgOut, FileList *fileList)
+int history(Message *msgIn, Message *msgOut, FileList *fileList, struct in6_addr ip, BufferPool *pool)
 {
   int error = false;
 
   msgOut->command = MESSAGE;
 
-  pthread_mutex_lock(fileList->mutex);
+  if(!keyMayExist(fileList, msgIn->body))
+  { //refused without taking the lock
+    logMsg(LOG_DEBUG, "server", "Key not found.");
+    *msgOut = unknownKeyMsg;
+    error = true;
+  }
+  else
+  { //read without the file list lock, like GET
+    TRACE_BEGIN(readHold);
+    int epoch = epochEnter(fileList->index->epochs);
 
-  FileNode *node = checkKey(msgIn->body, fileList);
+    FileNode *file = checkKey(msgIn->body, fileList);
 
-  if(node != NULL)
-  {
-    if(!remove(node->path))
+    if(file != NULL)
     {
-      printf("SERVER Info: Deleted file %s.\n", node->path);
-      removeNode(node, fileList);
-      char msg[] = "Info: File with hash key has been deleted.";
-      msgOut->length = sizeof(msg);
-      msgOut->body = calloc(1, sizeof(msg));
-      memcpy(msgOut->body, msg, sizeof(msg));
-      error = false;
+      uint64_t next = __atomic_load_n(&(file->events), __ATOMIC_ACQUIRE);
+      Event *found = (Event*)poolAlloc(pool, HISTORY_MAX * sizeof(Event)); //from the pool, like the response, so small requests allocate nothing
+      unsigned long entries = 0;
+
+      //newest first, back to its STORE, the oldest event still in the log, or the last for which there is room; any recorded meanwhile are left out
+      while(next != 0 && entries < HISTORY_MAX - 1 && eventRead(fileList->index->events, next - 1, &(found[entries])))
+      {
+        next = found[entries++].filePrev;
+      }
+
+      if(entries == 0 || found[entries - 1].command != STORE)
+      { //the rest have been overwritten in the log or left out, but the STORE is kept in the node
+        memset(&(found[entries]), 0, sizeof(Event));
+        found[entries].command = STORE;
+        found[entries].time = file->stored;
+        found[entries].file = file->id;
+        found[entries].ip = file->storer;
+        entries++;
+      }
+
+      msgOut->body = poolAlloc(pool, entries * EVENT_LINE_LENGTH);
+      msgOut->owner = BODY_POOL;
+      msgOut->length = 0;
+
+      for(unsigned long i = entries; i > 0; i--)
+      { //oldest first, with no newline after the last
+        msgOut->length += formatEvent(&(found[i - 1]), false, msgOut->body + msgOut->length);
+
+        if(i > 1)
+        {
+          msgOut->body[msgOut->length++] = '\n';
+        }
+      }
+
+      logMsg(LOG_INFO, "server", "Retrieved history for file_%u.", file->id);
+
+      poolFree(pool, (char*)found);
+      addEvent(fileList, file, HISTORY, ip, time(NULL));
     }
     else
-    { //failed to delete file for valid key. should never happen
-      printf("SERVER Error: Failed to delete file %s.\n", node->path);
-      char msg[] = "Info: Key found, but the file cannot be deleted.";
-      msgOut->length = sizeof(msg);
-      msgOut->body = calloc(1, sizeof(msg));
-      memcpy(msgOut->body, msg, sizeof(msg));
-      error = false; //not the user's fault; system error
+    { //key not found
+      logMsg(LOG_DEBUG, "server", "Key not found.");
+
+      if(fileList->index->filter != NULL)
+      { //let through by the filter
+        filterFalseHit(fileList->index->filter);
+      }
+
+      *msgOut = unknownKeyMsg;
+      error = true;
     }
-  }
-  else
-  { //key not found
-    error = true;
-    char msg[] = "Error: Hash key not valid.";
-    msgOut->length = sizeof(msg);
-    msgOut->body = calloc(1, sizeof(msg));
-    memcpy(msgOut->body, msg, sizeof(msg));
-  }
 
-  pthread_mutex_unlock(fileList->mutex);
+    epochExit(fileList->index->epochs, epoch);
+    TRACE_END(readHold, "fileList read", "epoch");
+  }
 
   return !error;
 }
 
 //command function, see above
-int history(Message *msgIn, Message *msgOut, FileList *fileList, struct in6_addr ip)
-{
+int listKeys(Message *msgIn, Message *msgOut, FileList *fileList, BufferPool *pool)
+{ //body is the limit, the prefix and the key to list after, each on its own line
   int error = false;
+  char *prefix = NULL;
+  char *after = NULL;
+  char *end;
+  unsigned long limit = strtoul(msgIn->body, &end, 10);
+  uint8_t afterBytes[HASH_KEY_BYTES];
 
   msgOut->command = MESSAGE;
 
-  pthread_mutex_lock(fileList->mutex);
+  if(end != msgIn->body && *end == '\n')
+  {
+    prefix = end + 1;
+    after = strchr(prefix, '\n');
+  }
 
-  FileNode *file = checkKey(msgIn->body, fileList);
+  if(after == NULL)
+  {
+    error = true;
+  }
+  else
+  {
+    *(after++) = '\0';
+    error = after[0] != '\0' && !hashKeyBytes(after, afterBytes);
+  }
 
-  if(file != NULL)
+  if(error)
   {
-    char ipBuff[INET6_ADDRSTRLEN];
-    char dateBuff[20]; //space of, eg "26-08-2020 22:59, "
+    logMsg(LOG_DEBUG, "server", "LIST request not valid.");
+    *msgOut = badListMsg;
+  }
+  else
+  {
+    unsigned long count = 0; //one more than the limit are looked for, to tell whether more follow
+    time_t now = time(NULL);
+    int more;
+    char footer[64];
+
+    if(limit == 0 || limit > LIST_MAX_KEYS)
+    {
+      limit = LIST_MAX_KEYS;
+    }
 
-    FileHistoryNode *node = file->history.head;
+    msgOut->body = poolAlloc(pool, limit * KEYLENGTH + sizeof(footer));
+    msgOut->owner = BODY_POOL;
     msgOut->length = 0;
 
-    while(node != NULL)
-    { //calculate length of body required
-      msgOut->length += strlen(commands[node->command - 1]) + 2; //space of, eg "STORE: "
+    for(int engine = 0; engine < HASH_ENGINES && count <= limit; engine++)
+    {
+      uint8_t prefixBytes[HASH_KEY_BYTES];
+      uint8_t lastBytes[HASH_KEY_BYTES];
+      const uint8_t *from = after[0] != '\0' ? afterBytes : NULL;
+      int bits;
+      int found = LIST_BATCH;
+
+      //the lock is only held for a batch at a time, so a long listing never stalls other requests for long
+      while(found > 0 && count <= limit && hashPrefixBytes(engine, prefix, prefixBytes, &bits))
+      {
+        FileNode *nodes[LIST_BATCH];
+        int wanted = limit + 1 - count < LIST_BATCH ? (int)(limit + 1 - count) : LIST_BATCH;
+
+        TRACE_BEGIN(lockWait);
+        arenaLock(fileList->mutex);
+        TRACE_END(lockWait, "fileList wait", "lock");
+        TRACE_BEGIN(lockHold);
 
-      strftime(dateBuff, sizeof(dateBuff), "%d-%m-%Y %H:%M, ", localtime(&(node->time)));
-      msgOut->length += strlen(dateBuff); //space of, eg "26-08-2020 22:59, "
+        found = keyTreeRange(&(fileList->index->keys), prefixBytes, bits, from, (void**)nodes, wanted);
 
-      inet_ntop(AF_INET6, &(node->ip), ipBuff, sizeof(ipBuff));
-      if(!strncmp("::ffff:", ipBuff, strlen("::ffff:")))
-      { //ipv4-mapped address
-        msgOut->length += strlen(ipBuff) + 1 - strlen("::ffff:"); //space of, eg "128.225.212.210\n"
-      }
-      else
-      { //actual ipv6 address
-        msgOut->length += strlen(ipBuff) + 1; //space of, eg "2001:0DB8:AC10:FE01::1A2F:1A2B\n"
+        for(int i = 0; i < found && count <= limit; i++)
+        {
+          uint32_t expires = nodes[i]->expires;
+
+          //an expired file is only waiting for the reclaimer to delete it, and is not found by GET either
+          if((expires == 0 || expires > now) && count++ < limit)
+          { //one key per line
+            hashBytesKey(nodes[i]->keyBytes, msgOut->body + msgOut->length);
+            msgOut->length += strlen(msgOut->body + msgOut->length);
+            msgOut->body[msgOut->length++] = '\n';
+          }
+        }
+
+        if(found > 0)
+        { //the next batch resumes after the last key, wherever the tree has changed meanwhile
+          memcpy(lastBytes, nodes[found - 1]->keyBytes, HASH_KEY_BYTES);
+          from = lastBytes;
+        }
+
+        TRACE_END(lockHold, "fileList hold", "lock");
+        pthread_mutex_unlock(fileList->mutex);
+
+        if(found < wanted)
+        { //no more with this engine
+          found = 0;
+        }
       }
+    }
+
+    more = count > limit;
+    count = more ? limit : count;
+    snprintf(footer, sizeof(footer), "Info: Listed %lu keys%s.", count, more ? ", more follow" : "");
+    memcpy(msgOut->body + msgOut->length, footer, strlen(footer) + 1);
+    msgOut->length += strlen(footer) + 1;
+    logMsg(LOG_INFO, "server", "Listed %lu keys.", count);
+  }
+
+  return !error;
+}
 
-      node = node->next;
+//command function, see above
+int events(Message *msgIn, Message *msgOut, FileList *fileList, BufferPool *pool)
+{ //body is the limit, the start and end of the time range, the address and the seq to list before, each on its own line, any of them empty
+  int error = false;
+  char *fields[5];
+  char *end;
+  long limit = 0;
+  EventQuery query;
+  time_t now = time(NULL);
+
+  msgOut->command = MESSAGE;
+  memset(&query, 0, sizeof(query));
+  query.to = UINT32_MAX;
+  query.before = UINT64_MAX;
+  fields[0] = msgIn->body;
+
+  for(int i = 1; !error && i < 5; i++)
+  {
+    fields[i] = strchr(fields[i - 1], '\n');
+    error = fields[i] == NULL;
+
+    if(!error)
+    {
+      *(fields[i]++) = '\0';
     }
+  }
+
+  if(!error)
+  {
+    limit = strtol(fields[0], &end, 10);
+    error = *end != '\0' || limit < 0;
+    error = error || !parseEventTime(fields[1], now, &(query.from)) || !parseEventTime(fields[2], now, &(query.to));
+    query.byAddress = fields[3][0] != '\0';
+    error = error || (query.byAddress && !parseAddress(fields[3], &(query.ip)));
 
-    if(msgOut->length != 0)
+    if(!error && fields[4][0] != '\0')
     {
-      node = file->history.head;
-      msgOut->body = calloc(msgOut->length, sizeof(char));
+      query.before = strtoull(fields[4], &end, 10);
+      error = *end != '\0';
+    }
+  }
 
-      while(node != NULL)
-      { //copy data into body
-        strcat(msgOut->body, commands[node->command - 1]);
-        strcat(msgOut->body, ": ");
+  if(error)
+  {
+    logMsg(LOG_DEBUG, "server", "EVENTS request not valid.");
+    *msgOut = badEventsMsg;
+  }
+  else
+  {
+    char footer[96];
+    int more;
 
-        strftime(dateBuff, sizeof(dateBuff), "%d-%m-%Y %H:%M, ", localtime(&(node->time)));
-        strcat(msgOut->body, dateBuff);
+    if(limit == 0 || limit > EVENTS_MAX)
+    {
+      limit = EVENTS_MAX;
+    }
 
-        inet_ntop(AF_INET6, &(node->ip), ipBuff, sizeof(ipBuff));
-        if(!strncmp("::ffff:", ipBuff, strlen("::ffff:")))
-        { //ipv4-mapped address
-          strcat((msgOut->body), ipBuff + strlen("::ffff:"));
-        }
-        else
-        { //actual ipv6 address
-          strcat(msgOut->body, ipBuff);
-        }
+    //one more than the limit is looked for, to tell whether more follow
+    Event *found = (Event*)poolAlloc(pool, (limit + 1) * sizeof(Event));
+    int count = eventQuery(fileList->index->events, &query, found, limit + 1);
 
-        node = node->next;
+    more = count > limit;
+    count = more ? limit : count;
+    msgOut->body = poolAlloc(pool, count * EVENT_LINE_LENGTH + sizeof(footer));
+    msgOut->owner = BODY_POOL;
+    msgOut->length = 0;
 
-        if(node != NULL)
-        { //avoids printing extra newline on last line of history output
-          strcat(msgOut->body, "\n");
-        }
-      }
+    for(int i = 0; i < count; i++)
+    { //one event per line, newest first
+      msgOut->length += formatEvent(&(found[i]), true, msgOut->body + msgOut->length);
+      msgOut->body[msgOut->length++] = '\n';
+    }
 
-      msgOut->length--; //as there is no newline on last line of output
-      printf("SERVER Info: Retrieved history for file %s.\n", file->path);
+    if(more)
+    { //the client asks again from there
+      snprintf(footer, sizeof(footer), "Info: Found %d events, more follow before #%llu.", count, (unsigned long long)found[count - 1].seq);
     }
     else
-    { //no history found; not an error but shouldn't happen
-      printf("SERVER Error: Missing history for file %s.\n", file->path);
-      char msg[] = "Info: File found, but no history recorded.";
-      msgOut->length = sizeof(msg);
-      msgOut->body = calloc(1, sizeof(msg));
-      memcpy(msgOut->body, msg, sizeof(msg));
+    {
+      snprintf(footer, sizeof(footer), "Info: Found %d events.", count);
     }
 
-    addHistory(&(file->history), HISTORY, ip);
+    memcpy(msgOut->body + msgOut->length, footer, strlen(footer) + 1);
+    msgOut->length += strlen(footer) + 1;
+    logMsg(LOG_INFO, "server", "Found %d events.", count);
+    poolFree(pool, (char*)found);
   }
-  else
-  { //key not found
-    char errorMsg[] = "Error: Key does not match any known file.";
+
+  return !error;
+}
+
+//command function, see above
+int expire(Message *msgIn, Message *msgOut, FileList *fileList, struct in6_addr ip)
+{ //body is the seconds the file is kept for from now (0 for until deleted), then its key, on its own line
+  int error = false;
+  char *end;
+  time_t now = time(NULL);
+  unsigned long long seconds = strtoull(msgIn->body, &end, 10);
+  char *key = end + 1;
+
+  msgOut->command = MESSAGE;
+
+  if(end == msgIn->body || *end != '\n' || msgIn->body[0] == '-' || seconds > UINT32_MAX - (uint64_t)now)
+  {
+    logMsg(LOG_DEBUG, "server", "EXPIRE request not valid.");
+    *msgOut = badExpireMsg;
+    error = true;
+  }
+  else if(!keyMayExist(fileList, key))
+  { //refused without taking the lock
+    logMsg(LOG_DEBUG, "server", "Key not found.");
+    *msgOut = invalidKeyMsg;
     error = true;
-    msgOut->length = sizeof(errorMsg);
-    msgOut->body = calloc(1, sizeof(errorMsg));
-    memcpy(msgOut->body, errorMsg, sizeof(errorMsg));
   }
+  else
+  {
+    TRACE_BEGIN(lockWait);
+    arenaLock(fileList->mutex);
+    TRACE_END(lockWait, "fileList wait", "lock");
+    TRACE_BEGIN(lockHold);
 
-  pthread_mutex_unlock(fileList->mutex);
+    FileNode *node = checkKey(key, fileList);
+    uint32_t expires = seconds > 0 ? now + seconds : 0;
+
+    if(node == NULL)
+    {
+      logMsg(LOG_DEBUG, "server", "Key not found.");
+      *msgOut = invalidKeyMsg;
+      error = true;
+    }
+    else if(expires != 0 && !expiryAdd(fileList->index->expiries, fileList->arena, node->id, node->keyBytes, expires))
+    { //only in prefork mode, once the shared arena is full
+      logMsg(LOG_ERROR, "server", "Shared memory is full, cannot expire file_%u.", node->id);
+      *msgOut = expireFailedMsg;
+    }
+    else
+    { //any earlier entry in the wheel no longer matches, and is dropped when it comes round
+      __atomic_store_n(&(node->expires), expires, __ATOMIC_RELAXED);
+      addEvent(fileList, node, EXPIRE, ip, now);
+
+      if(!journalNode(fileList, JOURNAL_EXPIRE, node, ip))
+      {
+        logMsg(LOG_ERROR, "server", "Failed to journal the expiry of file_%u.", node->id);
+      }
+
+      if(expires != 0)
+      {
+        logMsg(LOG_INFO, "server", "Set file_%u to expire in %llu seconds.", node->id, seconds);
+      }
+      else
+      {
+        logMsg(LOG_INFO, "server", "Set file_%u to never expire.", node->id);
+      }
+      *msgOut = expires != 0 ? expiresMsg : noExpireMsg;
+    }
+
+    TRACE_END(lockHold, "fileList hold", "lock");
+    pthread_mutex_unlock(fileList->mutex);
+  }
 
   return !error;
 }
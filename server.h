@@ -1,17 +1,98 @@
 /* server.h
 *AUTHOR: Jhi Morris (19173632)
-*MODIFIED: 2020-09-12
+*MODIFIED: 2026-10-19
 *PURPOSE: Header for server.c
 */
 
+#ifndef SERVER_H
+#define SERVER_H
+
 #include "common.h"
+#include "log.h"
+#include "cache.h"
+#include "blob.h"
+#include "hash.h"
+#include "commit.h"
+#include "ioengine.h"
+#include "budget.h"
+#include "timer.h"
+#include "registry.h"
+#include "arena.h"
+#include "journal.h"
+#include "treehash.h"
+#include "keytree.h"
+#include "filter.h"
+#include "epoch.h"
+#include "eventlog.h"
+#include "expiry.h"
+#include "upgrade.h"
 #include <time.h>
 #include <pthread.h>
 #include <poll.h>
 #include <errno.h>
 
 #define DEFAULT_PORT 52000
-#define MAX_BACKLOG 10 //max incoming client connections backlog length
+#define MAX_BACKLOG 128 //max incoming client connections backlog length, per acceptor
+#define MAX_ACCEPTORS 64
+#define MAX_PROCESSES 64
+#define RESPAWN_DELAY 1 //seconds a worker which crashed on startup is left before it is restarted
+#define REJECT_DRAIN_MAX (16 * 1024 * 1024) //bytes of a refused request's body read and discarded, so the client sees the rejection
+#define REJECT_DRAIN_TIME 2 //seconds
+#define REJECT_DRAIN_BUFFER 65536
+#define METRICS_INTERVAL 60 //seconds between the janitor's metrics log lines
+#define LIST_BATCH 128 //keys copied out of the index each time its lock is taken for LIST
+#define RECLAIM_TICK 100 //milliseconds between the reclaimer's passes
+#define RECLAIM_BATCH 256 //deleted files reclaimed in one pass at most
+#define DEFAULT_RECLAIM_RATE 256 //MiB per second of deleted files unlinked, 0 is unlimited
+#define EVICT_HIGH 95 //percent of the disk cap used before the least recently read files are evicted
+#define EVICT_LOW 90 //percent used once eviction stops
+#define EVICT_SAMPLES 16 //files looked at for each one evicted, the least recently read of them goes
+#define EVICT_BATCH 64 //files evicted in one pass at most
+#define EVENT_LINE_LENGTH 160 //longest line of HISTORY or EVENTS output, terminated
+#define DRAIN_POLL 10 //milliseconds between checks for the last connection closing, while draining for an upgrade
+
+//LIST and EVENTS access defines
+#define ACCESS_NONE 0
+#define ACCESS_LOCAL 1 //loopback addresses only
+#define ACCESS_ALL 2
+
+typedef struct ServerConfig
+{ //parsed from the command line, never written once the server starts
+  int attempts; //failed keys allowed before a ban
+  int lockout; //seconds
+  int timeout; //seconds idle before a connection is closed
+  uint64_t cacheSize; //bytes of file contents cached for GET, 0 disables
+  uint64_t packThreshold; //largest file stored in a pack rather than its own file
+  int durability; //DURABILITY_ define
+  unsigned int commitDelay; //microseconds
+  int acceptors; //listening sockets, each with its own thread
+  uint64_t maxRequest; //bytes, largest STORE accepted
+  uint64_t memoryBudget; //bytes held by requests in flight, 0 is unlimited
+  unsigned int admitWait; //milliseconds a request may queue for the budget
+  unsigned int requestTimeout; //seconds allowed for every request, on top of its size at minRate
+  uint64_t minRate; //bytes per second a request or response must be transferred at
+  int processes; //worker processes, 1 runs the server in this process
+  uint64_t sharedMemory; //bytes reserved for the shared index with more than one process
+  int ioEngine; //IO_ENGINE_ define requested
+  int hash; //HASH_ define new files' keys are computed with
+  int hashThreads; //hashing large STOREs as they arrive, 0 hashes them once received
+  int verifyReads; //boolean, files read from disk are checked against their trees
+  int listAccess; //ACCESS_ define
+  int eventAccess; //ACCESS_ define, for EVENTS
+  uint64_t eventCapacity; //events kept for HISTORY and EVENTS
+  uint64_t reclaimRate; //bytes per second of deleted files unlinked, 0 is unlimited
+  uint64_t diskCap; //bytes of file contents kept, 0 is unlimited
+  uint64_t filterKeys; //the key filter is sized for, 0 disables it
+  double filterRate; //false positive rate of the key filter
+  int logLevel;
+  int logFormat;
+  const char* journal; //path, NULL if the index is not journaled
+  int replicationSock; //listening socket replicas connect to, -1 if not a primary
+  const char* primaryHost; //NULL if not a replica
+  const char* primaryPort;
+  char* const* argv; //the server was started with, to start it again for an upgrade
+  int upgradeChannel; //Unix socket to the server this one is taking over from, -1 if not started by an upgrade
+} ServerConfig;
 
 typedef struct Connection
 {
@@ -19,6 +100,8 @@ typedef struct Connection
   struct sockaddr_in6 client;
   socklen_t len;
   int fails;
+  unsigned long id; //sequential, used to tell connections apart in the log
+  Session session; //registered by address from acceptance until the socket is closed
 } Connection;
 
 typedef struct AddressNode
@@ -32,63 +115,232 @@ typedef struct AddressList
 { //linked list of ip addresses
   pthread_mutex_t* mutex;
   AddressNode* head;
+  SharedArena* arena; //nodes are allocated from, NULL for the heap
+  unsigned long bans; //incremented on every ban, so workers can tell when to look for sessions to close
 } AddressList;
 
-typedef struct FileHistoryNode
-{
-  struct FileHistoryNode* next;
-  uint8_t command;
-  time_t time;
-  struct in6_addr ip;
-} FileHistoryNode;
-
-typedef struct FileHistory
-{ //linked list of file operations
-  FileHistoryNode *head;
-} FileHistory;
-
 typedef struct FileNode
-{
+{ //one is kept for every file, so it holds no text: its name and key are worked out from its id and keyBytes when needed
   struct FileNode* next;
-  char path[MAXPATHLENGTH];
-  char key[KEYLENGTH]; //128bit MD5 hash (as hex, 32 characters)
-  FileHistory history;
+  uint64_t events; //seq + 1 of its newest event in the event log, 0 if none
+  BlobRef blob; //where its contents are stored, and their length
+  unsigned int id; //number the file was stored as (file_<id>), also identifies it in the cache
+  uint32_t stored; //seconds since 1970 it was first stored
+  uint32_t accessed; //seconds since 1970 it was last stored or read, for eviction
+  uint32_t expires; //seconds since 1970 it expires at, 0 if never
+  struct in6_addr storer; //address it was stored from, so HISTORY keeps its STORE once the event log has dropped it
+  uint8_t keyBytes[HASH_KEY_BYTES]; //binary key, which the index's tree is ordered by, see hashKeyBytes()
 } FileNode;
 
-typedef struct FileList
-{ //linked list of file info
-  pthread_mutex_t* mutex;
+typedef struct Tombstone
+{ //a file taken out of the index by DELETE, whose contents and node are not reclaimed yet
+  struct Tombstone* next;
+  FileNode* node;
+  KeyTreeNode* unlinked; //tree node freed along with it, or NULL
+} Tombstone;
+
+typedef struct FileIndex
+{ //the part of the file list shared by every worker process
   unsigned int count; //used for naming files
   FileNode* head;
+  KeyTree keys; //the newest node of each key, in key order, read without the lock by GET and HISTORY
+  KeyFilter* filter; //every node's key, NULL if disabled
+  EpochDomain* epochs; //readers of the tree, which removed nodes are not freed until done with
+  EventLog* events; //every operation on every file, for HISTORY and EVENTS
+  ArenaSlab nodes; //every FileNode is allocated from
+  ExpiryWheel* expiries; //of the files given a time to live
+  FileNode* hand; //next node in the list eviction looks at, NULL for the head
+  uint64_t live; //bytes of the files in the index
+  uint64_t buriedBytes; //bytes of deleted files not yet taken by the reclaimer
+  uint64_t expired; //files deleted as they expired, statistics
+  uint64_t evicted; //files deleted to stay under the disk cap, statistics
+  uint64_t moves; //odd while compaction is changing a node's blob, see nodeBlob()
+  Tombstone* buried; //deleted files waiting for the reclaimer, oldest first
+  Tombstone* lastBuried;
+  uint64_t burying; //deleted files waiting, statistics
+  uint64_t reclaimed; //deleted files reclaimed, statistics
+} FileIndex;
+
+typedef struct FileList
+{ //linked list of file info, and this process's means of storing the files
+  pthread_mutex_t* mutex;
+  FileIndex* index;
+  SharedArena* arena; //nodes are allocated from, NULL for the heap
+  ObjectCache* cache; //NULL if caching is disabled
+  BlobStore* blobs;
+  CommitQueue* commits;
+  MemoryBudget* budget;
+  Journal* journal; //NULL if the index is not journaled
+  HashPool* hashes; //NULL unless hashing with threads or verifying reads
+  int verify; //boolean, see verifyFile()
+  uint64_t reclaimRate; //bytes per second this process's reclaimer unlinks, 0 is unlimited
+  uint64_t diskCap; //bytes of file contents kept, 0 is unlimited
+  int removes; //boolean, expired and evicted files are deleted here, false on a replica, which follows the primary
 } FileList;
 
+typedef struct SharedState
+{ //shared by every worker process in prefork mode, in the arena; otherwise on the heap
+  SharedArena* arena; //NULL in threaded mode
+  AddressList banList;
+  FileIndex index;
+  pthread_mutex_t banMutex;
+  pthread_mutex_t fileMutex;
+  unsigned long conCount; //used for connection ids in the log
+} SharedState;
+
 typedef struct ConnectionThread
 { //used for handleConnection() threads
   Connection* con;
   AddressList* banList;
   FileList* fileList;
-  int attempts;
-  int timeout;
+  TimerHeap* timers;
+  SessionRegistry* sessions;
+  const ServerConfig* config;
 } ConnectionThread;
 
-int server(const int attempts, const int lockout, const int timeout, int sock);
+typedef struct AcceptorStop
+{ //shared by every acceptor, so the upgrader can stop them
+  int stopped; //boolean, set once they should return
+  int running; //acceptors which have not returned yet
+  int wake[2]; //pipe, written once stopped is set, so acceptors waiting for a connection wake
+} AcceptorStop;
+
+typedef struct AcceptorThread
+{ //used for acceptor() threads
+  int sock; //listening socket
+  int core; //pinned to, -1 if not pinned
+  AcceptorStop* stop;
+  unsigned long* conCount;
+  AddressList* banList;
+  FileList* fileList;
+  TimerHeap* timers;
+  SessionRegistry* sessions;
+  const ServerConfig* config;
+} AcceptorThread;
+
+typedef struct JanitorThread
+{ //used for the janitor() thread
+  AddressList* banList;
+  FileList* fileList;
+  TimerHeap* timers;
+  SessionRegistry* sessions;
+  const ServerConfig* config;
+} JanitorThread;
+
+typedef struct UpgradeThread
+{ //used for the upgrader() thread
+  const int* socks; //listening sockets, one per acceptor
+  AcceptorStop* stop;
+  FileList* fileList;
+  TimerHeap* timers;
+  SessionRegistry* sessions;
+  const ServerConfig* config;
+} UpgradeThread;
+
+int openListener(int port, int reusePort);
+
+int inheritListeners(int channel, int acceptors, int replicating, int* socks, int* replicationSock);
+
+SharedState *sharedCreate(const ServerConfig* config);
+
+int supervise(const ServerConfig* config, const int* socks, SharedState* shared);
+
+int worker(const ServerConfig* config, const int* socks, SharedState* shared);
+
+int server(const ServerConfig* config, const int* socks, SharedState* shared);
+
+const Message *admitRequest(ConnectionThread* cont, const Message* msgIn, uint64_t* reserved);
+
+void rejectRequest(int sock, const Message* reject, uint64_t length);
+
+uint64_t transferDeadline(const ServerConfig* config, uint64_t length);
+
+void *acceptor(void *arg);
+
+void *janitor(void *arg);
+
+void *upgrader(void *arg);
+
+void drain(UpgradeThread* up);
+
+void takeOver(int channel);
 
 void *handleConnection(void *arg);
 
+void *compactor(void *arg);
+
+void compactPack(FileList* fileList, int pack);
+
+void *reclaimer(void *arg);
+
+int reclaimBatch(FileList* fileList, int64_t* allowance);
+
+int expireBatch(FileList* fileList);
+
+int evictBatch(FileList* fileList, uint64_t target);
+
+int commitBlob(FileList* fileList, unsigned int id, const BlobRef* ref, int created);
+
+int journalNode(FileList* fileList, uint32_t type, const FileNode* node, struct in6_addr ip);
+
+void releaseBody(Message* msg, BufferPool* pool);
+
+void addrString(struct in6_addr ip, char* buffer);
+
 int bannedAddr(AddressList *banList, struct in6_addr ip);
 
+unsigned long closeBannedSessions(AddressList* banList, SessionRegistry* sessions);
+
 void unbanAddrs(AddressList *banList, const int lockout);
 
 void banAddr(AddressList *banList, struct in6_addr ip);
 
-int store(Message* msgIn, Message* msgOut, FileList* fileList, struct in6_addr ip);
+int store(Message* msgIn, Message* msgOut, FileList* fileList, struct in6_addr ip, int hash, TreeHash* tree, BufferPool* pool);
+
+int get(Message* msgIn, Message* msgOut, FileList* fileList, struct in6_addr ip, uint64_t* reserved);
+
+int verifyFile(FileList* fileList, const FileNode* node, const char* contents);
+
+int delete(Message* msgIn, Message* msgOut, FileList* fileList, struct in6_addr ip);
+
+int history(Message* msgIn, Message* msgOut, FileList* fileList, struct in6_addr ip, BufferPool* pool);
+
+int accessAllowed(int access, struct in6_addr ip);
+
+int formatEvent(const Event* event, int full, char* line);
+
+int parseEventTime(const char* field, time_t now, uint32_t* bound);
+
+int parseAddress(const char* text, struct in6_addr* ip);
+
+int listKeys(Message* msgIn, Message* msgOut, FileList* fileList, BufferPool* pool);
+
+int events(Message* msgIn, Message* msgOut, FileList* fileList, BufferPool* pool);
+
+int expire(Message* msgIn, Message* msgOut, FileList* fileList, struct in6_addr ip);
+
+int keyMayExist(FileList* list, const char* key);
+
+FileNode *checkKey(char* key, FileList* list);
+
+void nodeBlob(FileList* list, const FileNode* node, BlobRef* ref);
+
+void moveBlob(FileList* list, FileNode* node, const BlobRef* ref);
+
+FileNode *checkId(unsigned int id, FileList* list);
+
+void addEvent(FileList* list, FileNode* node, uint8_t command, struct in6_addr ip, time_t when);
+
+int linkNode(FileNode* node, FileList* list);
+
+KeyTreeNode *removeNode(FileNode* node, FileList* list);
 
-int get(Message* msgIn, Message* msgOut, FileList* fileList, struct in6_addr ip);
+int buryNode(FileNode* node, KeyTreeNode* unlinked, FileList* list);
 
-int delete(Message* msgIn, Message* msgOut, FileList* fileList);
+int dropNode(FileNode* node, FileList* list, struct in6_addr ip, KeyTreeNode** unlinked);
 
-int history(Message* msgIn, Message* msgOut, FileList* fileList, struct in6_addr ip);
+int retireNode(FileNode* node, KeyTreeNode* unlinked, FileList* list);
 
-void addHistory(FileHistory* history, uint8_t command, struct in6_addr ip);
+void freeNode(FileNode* node, FileList* list);
 
-void removeNode(FileNode* node, FileList* list);
+#endif
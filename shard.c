@@ -0,0 +1,66 @@
+/* shard.c
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Maps keys to servers with jump consistent hashing (Lamping & Veach),
+*  so no table of key ranges has to be kept or agreed on: every client given
+*  the same list of servers sends a key to the same one. Adding a server to the
+*  end of the list moves only the keys that now belong on it, about 1/N of
+*  them, and leaves every other key where it was.
+*/
+
+#include "shard.h"
+#include "common.h"
+#include "hash.h"
+
+/* jumpHash
+*PURPOSE: Returns the bucket, from 0 to buckets - 1, of the key. The key
+*  jumps forward through the buckets with decreasing probability, so growing
+*  from N to N + 1 buckets moves each key to the new bucket with probability
+*  1/(N + 1), and never between the old ones.
+*INPUT: uint64_t key, int32_t buckets
+*OUTPUTS: int32_t bucket
+*/
+int32_t jumpHash(uint64_t key, int32_t buckets)
+{
+  int64_t bucket = -1;
+  int64_t next = 0;
+
+  while(next < buckets)
+  {
+    bucket = next;
+    key = key * 2862933555777941757ULL + 1;
+    next = (int64_t)((bucket + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1)));
+  }
+
+  return (int32_t)bucket;
+}
+
+/* shardForKey
+*PURPOSE: Returns the server, from 0 to count - 1, a file's key belongs on.
+*  The first 64 bits of the digest, after the key's algorithm tag, are
+*  already uniformly distributed, so are used as the hash. Anything which is
+*  not a valid key goes to the first server, to be refused there.
+*INPUT: char* key (tagged hex), int count of servers
+*OUTPUTS: int shard
+*/
+int shardForKey(const char *key, int count)
+{
+  int shard = 0;
+
+  if(hashKeyEngine(key) != -1)
+  {
+    const char *digits = hashKeyDigits(key);
+    uint64_t hash = 0;
+
+    for(int i = 0; i < 16; i++)
+    {
+      char c = digits[i] | 0x20; //lower case
+
+      hash = (hash << 4) | (uint64_t)(c <= '9' ? c - '0' : c - 'a' + 10);
+    }
+
+    shard = jumpHash(hash, count);
+  }
+
+  return shard;
+}
@@ -0,0 +1,33 @@
+/* shard.h
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Header for shard.c. Which of the servers given to the client each
+*  key is stored on.
+*/
+
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdint.h>
+
+#define MAX_SHARDS 64
+
+typedef struct Shard
+{ //one server, with the client's connection to it
+  const char* host;
+  const char* port;
+  int sock; //-1 if not connected
+  int hash; //HASH_ define the server computes keys with, from its welcome
+} Shard;
+
+typedef struct ShardSet
+{ //the servers, in the order given on the command line
+  int count;
+  Shard shards[MAX_SHARDS];
+} ShardSet;
+
+int32_t jumpHash(uint64_t key, int32_t buckets);
+
+int shardForKey(const char* key, int count);
+
+#endif
@@ -0,0 +1,331 @@
+/* timer.c
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Enforces deadlines on connections' sockets. Each connection thread
+*  arms its entry before every blocking receive or send, and a single reaper
+*  thread sleeps until the earliest deadline in the heap. If it passes, the
+*  reaper shuts the socket down, so the blocked recv()/send() returns and the
+*  thread can close the connection. Threads never poll or wake up on their own
+*  to check a timeout.
+*/
+
+#include "timer.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/socket.h>
+
+/* timerNow
+*PURPOSE: Returns a monotonic timestamp in milliseconds.
+*INPUT: -
+*OUTPUTS: uint64_t milliseconds
+*/
+static uint64_t timerNow(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/* heapSwap
+*PURPOSE: Swaps two entries of the heap, keeping their indexes up to date.
+*INPUT: TimerHeap* heap, int a, int b
+*OUTPUTS: -
+*/
+static void heapSwap(TimerHeap *heap, int a, int b)
+{
+  TimerEntry *entry = heap->entries[a];
+
+  heap->entries[a] = heap->entries[b];
+  heap->entries[b] = entry;
+  heap->entries[a]->index = a;
+  heap->entries[b]->index = b;
+}
+
+/* heapUp
+*PURPOSE: Moves the entry towards the top until its parent is no later.
+*INPUT: TimerHeap* heap, int index
+*OUTPUTS: -
+*/
+static void heapUp(TimerHeap *heap, int index)
+{
+  while(index > 0 && heap->entries[(index - 1) / 2]->deadline > heap->entries[index]->deadline)
+  {
+    heapSwap(heap, index, (index - 1) / 2);
+    index = (index - 1) / 2;
+  }
+}
+
+/* heapDown
+*PURPOSE: Moves the entry towards the bottom until neither child is earlier.
+*INPUT: TimerHeap* heap, int index
+*OUTPUTS: -
+*/
+static void heapDown(TimerHeap *heap, int index)
+{
+  int moved = true;
+
+  while(moved)
+  {
+    int earliest = index;
+    int left = index * 2 + 1;
+    int right = left + 1;
+
+    if(left < heap->count && heap->entries[left]->deadline < heap->entries[earliest]->deadline)
+    {
+      earliest = left;
+    }
+
+    if(right < heap->count && heap->entries[right]->deadline < heap->entries[earliest]->deadline)
+    {
+      earliest = right;
+    }
+
+    moved = earliest != index;
+
+    if(moved)
+    {
+      heapSwap(heap, index, earliest);
+      index = earliest;
+    }
+  }
+}
+
+/* heapRemove
+*PURPOSE: Removes an armed entry from the heap. Heap must be locked.
+*INPUT: TimerHeap* heap, TimerEntry* entry
+*OUTPUTS: -
+*/
+static void heapRemove(TimerHeap *heap, TimerEntry *entry)
+{
+  int index = entry->index;
+
+  heap->count--;
+
+  if(index != heap->count)
+  { //fill the gap with the last entry, then restore the order around it
+    heap->entries[index] = heap->entries[heap->count];
+    heap->entries[index]->index = index;
+    heapUp(heap, index);
+    heapDown(heap, heap->entries[index]->index);
+  }
+
+  entry->index = -1;
+}
+
+/* reaper
+*PURPOSE: Thread function which sleeps until the earliest deadline, and shuts
+*  down the socket of every entry whose deadline has passed.
+*INPUT: void* to the TimerHeap
+*OUTPUTS: -
+*/
+static void *reaper(void *arg)
+{
+  TimerHeap *heap = (TimerHeap*)arg;
+
+  pthread_mutex_lock(heap->mutex);
+
+  while(!heap->stop)
+  {
+    uint64_t now = timerNow();
+
+    if(heap->count == 0)
+    {
+      pthread_cond_wait(heap->changed, heap->mutex);
+    }
+    else if(heap->entries[0]->deadline <= now)
+    { //the owning thread cannot close the socket while it is locked here
+      TimerEntry *entry = heap->entries[0];
+
+      heapRemove(heap, entry);
+      entry->expired = entry->reason;
+      heap->expired[entry->reason]++;
+      shutdown(entry->sock, entry->reason == TIMER_DRAIN ? SHUT_RD : SHUT_RDWR); //a request already recieved is still answered
+    }
+    else
+    {
+      struct timespec wake;
+      uint64_t deadline = heap->entries[0]->deadline;
+
+      wake.tv_sec = deadline / 1000;
+      wake.tv_nsec = (long)(deadline % 1000) * 1000000;
+      pthread_cond_timedwait(heap->changed, heap->mutex, &wake);
+    }
+  }
+
+  pthread_mutex_unlock(heap->mutex);
+
+  return NULL;
+}
+
+/* timerCreate
+*PURPOSE: Allocates an empty heap and starts its reaper thread.
+*INPUT: -
+*OUTPUTS: TimerHeap* heap
+*/
+TimerHeap *timerCreate(void)
+{
+  TimerHeap *heap = calloc(1, sizeof(TimerHeap));
+  pthread_condattr_t attr;
+
+  heap->mutex = malloc(sizeof(pthread_mutex_t));
+  heap->changed = malloc(sizeof(pthread_cond_t));
+  pthread_mutex_init(heap->mutex, NULL);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC); //deadlines are monotonic
+  pthread_cond_init(heap->changed, &attr);
+  pthread_condattr_destroy(&attr);
+  heap->capacity = TIMER_INITIAL_CAPACITY;
+  heap->entries = calloc(heap->capacity, sizeof(TimerEntry*));
+
+  pthread_create(&(heap->thread), NULL, reaper, (void*)heap);
+
+  return heap;
+}
+
+/* timerDestroy
+*PURPOSE: Stops the reaper thread and frees the heap. Entries still armed are
+*  left to their owners.
+*INPUT: TimerHeap* heap
+*OUTPUTS: -
+*/
+void timerDestroy(TimerHeap *heap)
+{
+  pthread_mutex_lock(heap->mutex);
+  heap->stop = true;
+  pthread_cond_signal(heap->changed);
+  pthread_mutex_unlock(heap->mutex);
+  pthread_join(heap->thread, NULL);
+
+  pthread_cond_destroy(heap->changed);
+  pthread_mutex_destroy(heap->mutex);
+  free(heap->changed);
+  free(heap->mutex);
+  free(heap->entries);
+  free(heap);
+}
+
+/* timerInit
+*PURPOSE: Sets up a disarmed entry for the socket.
+*INPUT: TimerEntry* entry, int sock descriptor
+*OUTPUTS: -
+*/
+void timerInit(TimerEntry *entry, int sock)
+{
+  entry->deadline = 0;
+  entry->index = -1;
+  entry->sock = sock;
+  entry->reason = TIMER_NONE;
+  entry->expired = TIMER_NONE;
+}
+
+/* timerArm
+*PURPOSE: Sets (or moves) the entry's deadline to milliseconds from now.
+*INPUT: TimerHeap* heap, TimerEntry* entry, uint64_t milliseconds, int reason
+*  (TIMER_ define)
+*OUTPUTS: -
+*/
+void timerArm(TimerHeap *heap, TimerEntry *entry, uint64_t milliseconds, int reason)
+{
+  uint64_t deadline = timerNow() + milliseconds;
+
+  pthread_mutex_lock(heap->mutex);
+
+  if(heap->draining && reason == TIMER_IDLE)
+  { //no further request is waited for
+    reason = TIMER_DRAIN;
+    deadline = 0;
+  }
+
+  if(entry->index == -1)
+  {
+    if(heap->count == heap->capacity)
+    {
+      heap->capacity *= 2;
+      heap->entries = realloc(heap->entries, heap->capacity * sizeof(TimerEntry*));
+    }
+
+    entry->index = heap->count;
+    heap->entries[heap->count++] = entry;
+    entry->deadline = deadline;
+    heapUp(heap, entry->index);
+  }
+  else
+  {
+    entry->deadline = deadline;
+    heapUp(heap, entry->index);
+    heapDown(heap, entry->index);
+  }
+
+  entry->reason = reason;
+
+  if(entry->index == 0)
+  { //the reaper may be sleeping until a later deadline
+    pthread_cond_signal(heap->changed);
+  }
+
+  pthread_mutex_unlock(heap->mutex);
+}
+
+/* timerDisarm
+*PURPOSE: Removes the entry's deadline, if it has one. Once this returns, the
+*  reaper will not touch the entry's socket, so it may be closed.
+*INPUT: TimerHeap* heap, TimerEntry* entry
+*OUTPUTS: -
+*/
+void timerDisarm(TimerHeap *heap, TimerEntry *entry)
+{
+  pthread_mutex_lock(heap->mutex);
+
+  if(entry->index != -1)
+  {
+    heapRemove(heap, entry);
+  }
+
+  pthread_mutex_unlock(heap->mutex);
+}
+
+/* timerDrain
+*PURPOSE: Brings every deadline set while waiting for the next request, and
+*  every one set for that from now on, forward to now, so that idle
+*  connections are closed while those partway through a request finish it
+*  first. Their sockets are only shut down for reading.
+*INPUT: TimerHeap* heap
+*OUTPUTS: -
+*/
+void timerDrain(TimerHeap *heap)
+{
+  pthread_mutex_lock(heap->mutex);
+
+  heap->draining = true;
+
+  for(int i = 0; i < heap->count; i++)
+  { //moving an entry up only swaps it with entries already looked at
+    if(heap->entries[i]->reason == TIMER_IDLE)
+    {
+      heap->entries[i]->reason = TIMER_DRAIN;
+      heap->entries[i]->deadline = 0;
+      heapUp(heap, i);
+    }
+  }
+
+  pthread_cond_signal(heap->changed);
+  pthread_mutex_unlock(heap->mutex);
+}
+
+/* timerExpired
+*PURPOSE: Returns how many deadlines set for the reason have passed.
+*INPUT: TimerHeap* heap, int reason (TIMER_ define)
+*OUTPUTS: uint64_t count
+*/
+uint64_t timerExpired(TimerHeap *heap, int reason)
+{
+  uint64_t count;
+
+  pthread_mutex_lock(heap->mutex);
+  count = heap->expired[reason];
+  pthread_mutex_unlock(heap->mutex);
+
+  return count;
+}
@@ -0,0 +1,61 @@
+/* timer.h
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Header for timer.c. Deadlines for every connection's socket, kept in
+*  one shared heap and enforced by a single reaper thread.
+*/
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define DEFAULT_REQUEST_TIMEOUT 30 //seconds allowed for a request, on top of its size at the minimum rate
+#define DEFAULT_MIN_RATE 16384 //bytes per second a request or response must be transferred at
+#define TIMER_INITIAL_CAPACITY 64
+
+//reason defines, why a deadline was set
+#define TIMER_NONE 0 //not expired
+#define TIMER_IDLE 1 //waiting for the next request
+#define TIMER_SLOW 2 //transferring a request or response
+#define TIMER_DRAIN 3 //waiting for the next request while the server drains, see timerDrain()
+#define TIMER_REASONS 4
+
+typedef struct TimerEntry
+{ //one per connection, owned by its thread
+  uint64_t deadline; //milliseconds, monotonic
+  int index; //position in the heap, -1 if not armed
+  int sock; //shut down if the deadline passes
+  int reason; //TIMER_ define the entry was armed for
+  int expired; //TIMER_ define of the deadline which passed, or TIMER_NONE
+} TimerEntry;
+
+typedef struct TimerHeap
+{ //min-heap of armed entries, ordered by deadline
+  pthread_mutex_t* mutex;
+  pthread_cond_t* changed; //signalled when the earliest deadline moves forward
+  pthread_t thread;
+  int stop;
+  int draining; //boolean, see timerDrain()
+  TimerEntry** entries;
+  int count;
+  int capacity;
+  uint64_t expired[TIMER_REASONS]; //statistics, protected by mutex
+} TimerHeap;
+
+TimerHeap *timerCreate(void);
+
+void timerDestroy(TimerHeap* heap);
+
+void timerInit(TimerEntry* entry, int sock);
+
+void timerArm(TimerHeap* heap, TimerEntry* entry, uint64_t milliseconds, int reason);
+
+void timerDisarm(TimerHeap* heap, TimerEntry* entry);
+
+void timerDrain(TimerHeap* heap);
+
+uint64_t timerExpired(TimerHeap* heap, int reason);
+
+#endif
@@ -0,0 +1,171 @@
+/* trace.c
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Records timed spans (lock wait/hold, disk, hashing, socket I/O) into
+*  a fixed-size lock-free ring buffer, and dumps them as a Chrome-trace JSON
+*  file (loadable in Perfetto or chrome://tracing) when TRACE_SIGNAL arrives.
+*  The whole file is empty unless built with -DTRACE.
+*/
+
+#include "trace.h"
+
+#ifdef TRACE
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+static TraceEvent events[TRACE_EVENTS];
+static uint64_t head = 0; //total events ever recorded, slot is head % TRACE_EVENTS
+static const char *dumpPath = TRACE_DUMP_PATH;
+static __thread uint32_t threadId = 0;
+
+/* traceThread
+*PURPOSE: Thread function which waits for TRACE_SIGNAL and dumps the ring buffer
+*  each time it arrives. Dumping here, rather than in a signal handler, keeps
+*  stdio out of async-signal context.
+*INPUT: -
+*OUTPUTS: -
+*/
+static void *traceThread(void *arg)
+{
+  sigset_t set;
+  int sig;
+
+  sigemptyset(&set);
+  sigaddset(&set, TRACE_SIGNAL);
+
+  while(!sigwait(&set, &sig))
+  {
+    if(traceDump(dumpPath))
+    {
+      printf("TRACE Info: Dumped trace to %s.\n", dumpPath);
+    }
+    else
+    {
+      printf("TRACE Error: Failed to write trace to %s.\n", dumpPath);
+    }
+  }
+
+  return NULL;
+}
+
+/* traceInit
+*PURPOSE: Blocks TRACE_SIGNAL for the calling thread (and so every thread
+*  created after it) and starts the thread that dumps the trace. Must be called
+*  before any other thread is created.
+*INPUT: char* dump path, or NULL for the default
+*OUTPUTS: -
+*/
+void traceInit(const char *path)
+{
+  sigset_t set;
+  pthread_t thread;
+
+  if(path != NULL)
+  {
+    dumpPath = path;
+  }
+
+  sigemptyset(&set);
+  sigaddset(&set, TRACE_SIGNAL);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+  pthread_create(&thread, NULL, traceThread, NULL);
+  pthread_detach(thread);
+}
+
+/* traceNow
+*PURPOSE: Returns a monotonic timestamp in microseconds.
+*INPUT: -
+*OUTPUTS: uint64_t microseconds
+*/
+uint64_t traceNow(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* traceRecord
+*PURPOSE: Records a span from start until now into the ring buffer. Never
+*  blocks; if the buffer wraps, the oldest events are overwritten.
+*INPUT: char* name, char* category (both string literals), uint64_t start time
+*OUTPUTS: -
+*/
+void traceRecord(const char *name, const char *category, uint64_t start)
+{
+  uint64_t end = traceNow();
+  uint64_t index = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+  TraceEvent *event = &events[index & (TRACE_EVENTS - 1)];
+
+  if(threadId == 0)
+  {
+    threadId = (uint32_t)syscall(SYS_gettid);
+  }
+
+  __atomic_store_n(&(event->seq), 0, __ATOMIC_RELAXED); //mark slot as being rewritten
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  event->name = name;
+  event->category = category;
+  event->start = start;
+  event->duration = end - start;
+  event->tid = threadId;
+  __atomic_store_n(&(event->seq), index + 1, __ATOMIC_RELEASE);
+}
+
+/* traceDump
+*PURPOSE: Writes every complete event in the ring buffer to a Chrome-trace JSON
+*  file. Events being overwritten while the dump runs are skipped.
+*INPUT: char* path
+*OUTPUTS: int error occured (boolean)
+*/
+int traceDump(const char *path)
+{
+  FILE *file = fopen(path, "w");
+  int error = false;
+  int first = true;
+  int pid = getpid();
+
+  if(file != NULL)
+  {
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    for(int i = 0; i < TRACE_EVENTS; i++)
+    {
+      TraceEvent copy;
+      uint64_t seq = __atomic_load_n(&(events[i].seq), __ATOMIC_ACQUIRE);
+
+      copy = events[i];
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+      if(seq != 0 && seq == __atomic_load_n(&(events[i].seq), __ATOMIC_RELAXED))
+      { //slot was not rewritten while being copied
+        fprintf(file, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":%u}",
+          first ? "" : ",", copy.name, copy.category, (unsigned long long)copy.start,
+          (unsigned long long)copy.duration, pid, copy.tid);
+        first = false;
+      }
+    }
+
+    fprintf(file, "\n]}\n");
+
+    if(fclose(file))
+    {
+      error = true;
+    }
+  }
+  else
+  { //failed to open file
+    error = true;
+  }
+
+  return !error;
+}
+
+#endif
@@ -0,0 +1,49 @@
+/* trace.h
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Header for trace.c. Opt-in hot-path instrumentation, only compiled in
+*  when built with -DTRACE. Without it, every TRACE_ macro expands to nothing.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#ifdef TRACE
+
+#include <stdint.h>
+
+#define TRACE_EVENTS 65536 //ring buffer capacity (power of two), oldest events are overwritten
+#define TRACE_DUMP_PATH "trace.json" //written on SIGUSR1
+#define TRACE_SIGNAL SIGUSR1
+
+typedef struct TraceEvent
+{
+  const char* name; //string literals only, never freed
+  const char* category;
+  uint64_t start; //microseconds, CLOCK_MONOTONIC
+  uint64_t duration;
+  uint32_t tid;
+  uint64_t seq; //index+1 of the write that filled this slot, 0 if never written
+} TraceEvent;
+
+void traceInit(const char* path);
+
+uint64_t traceNow(void);
+
+void traceRecord(const char* name, const char* category, uint64_t start);
+
+int traceDump(const char* path);
+
+#define TRACE_INIT(path) traceInit(path)
+#define TRACE_BEGIN(var) uint64_t var = traceNow()
+#define TRACE_END(var, name, category) traceRecord(name, category, var)
+
+#else
+
+#define TRACE_INIT(path)
+#define TRACE_BEGIN(var)
+#define TRACE_END(var, name, category)
+
+#endif
+
+#endif
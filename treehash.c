@@ -0,0 +1,333 @@
+/* treehash.c
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Hashes large bodies on a pool of threads while they are still
+*  being received. BLAKE3 is already a tree of 1KiB chunks, so a body is cut
+*  into segments of TREE_SEGMENT_CHUNKS chunks, each a whole subtree, and as
+*  each segment arrives it is queued for any free thread to hash into its
+*  chaining value. Once the last byte has arrived, only the last segment
+*  and the few parent nodes above the segments are left, so the key is ready
+*  almost at once, rather than after the whole body has been hashed on the
+*  connection's thread. The key is the same as hashing the body serially.
+*  The segments' chaining values are kept, so parts of the file can later be
+*  checked against them without hashing the rest.
+*/
+
+#include "treehash.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+/* claim
+*PURPOSE: Takes the tree's next waiting segment, and takes the tree off the
+*  queue once none are left waiting. Pool must be locked, and the tree must
+*  have a segment waiting.
+*INPUT: TreeHash* tree
+*OUTPUTS: uint64_t segment
+*/
+static uint64_t claim(TreeHash *tree)
+{
+  HashPool *pool = tree->pool;
+  uint64_t segment = tree->claimed++;
+
+  if(tree->claimed == tree->submitted && tree->queued)
+  { //usually the head, unless its owner is helping with the queue behind others
+    TreeHash *prev = NULL;
+    TreeHash *node = pool->head;
+
+    while(node != tree)
+    {
+      prev = node;
+      node = node->next;
+    }
+
+    if(prev == NULL)
+    {
+      pool->head = tree->next;
+    }
+    else
+    {
+      prev->next = tree->next;
+    }
+
+    if(pool->tail == tree)
+    {
+      pool->tail = prev;
+    }
+
+    tree->queued = false;
+  }
+
+  return segment;
+}
+
+/* hashSegment
+*PURPOSE: Hashes a claimed segment into its chaining value, then counts it as
+*  done. Pool must be locked, and is unlocked while hashing.
+*INPUT: TreeHash* tree, uint64_t segment
+*OUTPUTS: -
+*/
+static void hashSegment(TreeHash *tree, uint64_t segment)
+{
+  uint64_t offset = segment * TREE_SEGMENT;
+  uint64_t length = tree->length - offset < TREE_SEGMENT ? tree->length - offset : TREE_SEGMENT;
+
+  pthread_mutex_unlock(tree->pool->mutex);
+  blake3Subtree(tree->data + offset, length, segment * TREE_SEGMENT_CHUNKS, tree->cvs[segment]);
+  pthread_mutex_lock(tree->pool->mutex);
+
+  tree->done++;
+  pthread_cond_broadcast(tree->pool->hashed);
+}
+
+/* hasher
+*PURPOSE: Thread function which hashes waiting segments, oldest body first.
+*INPUT: void* to the HashPool
+*OUTPUTS: -
+*/
+static void *hasher(void *arg)
+{
+  HashPool *pool = (HashPool*)arg;
+
+  pthread_mutex_lock(pool->mutex);
+
+  while(!pool->stop)
+  {
+    if(pool->head == NULL)
+    {
+      pthread_cond_wait(pool->work, pool->mutex);
+    }
+    else
+    {
+      TreeHash *tree = pool->head;
+
+      hashSegment(tree, claim(tree));
+    }
+  }
+
+  pthread_mutex_unlock(pool->mutex);
+
+  return NULL;
+}
+
+/* hashPoolCreate
+*PURPOSE: Starts the pool's threads.
+*INPUT: int threads, up to MAX_HASH_THREADS
+*OUTPUTS: HashPool* pool
+*/
+HashPool *hashPoolCreate(int threads)
+{
+  HashPool *pool = calloc(1, sizeof(HashPool));
+
+  pool->mutex = malloc(sizeof(pthread_mutex_t));
+  pool->work = malloc(sizeof(pthread_cond_t));
+  pool->hashed = malloc(sizeof(pthread_cond_t));
+  pthread_mutex_init(pool->mutex, NULL);
+  pthread_cond_init(pool->work, NULL);
+  pthread_cond_init(pool->hashed, NULL);
+  pool->threads = threads;
+
+  for(int i = 0; i < threads; i++)
+  {
+    pthread_create(&(pool->thread[i]), NULL, hasher, (void*)pool);
+  }
+
+  return pool;
+}
+
+/* hashPoolDestroy
+*PURPOSE: Stops the pool's threads and frees it. No body may still be being
+*  hashed.
+*INPUT: HashPool* pool
+*OUTPUTS: -
+*/
+void hashPoolDestroy(HashPool *pool)
+{
+  pthread_mutex_lock(pool->mutex);
+  pool->stop = true;
+  pthread_cond_broadcast(pool->work);
+  pthread_mutex_unlock(pool->mutex);
+
+  for(int i = 0; i < pool->threads; i++)
+  {
+    pthread_join(pool->thread[i], NULL);
+  }
+
+  pthread_cond_destroy(pool->hashed);
+  pthread_cond_destroy(pool->work);
+  pthread_mutex_destroy(pool->mutex);
+  free(pool->hashed);
+  free(pool->work);
+  free(pool->mutex);
+  free(pool);
+}
+
+/* treeSegments
+*PURPOSE: Returns the number of segments a body of the length is cut into.
+*INPUT: uint64_t length
+*OUTPUTS: uint64_t segments
+*/
+uint64_t treeSegments(uint64_t length)
+{
+  return length > TREE_SEGMENT ? (length + TREE_SEGMENT - 1) / TREE_SEGMENT : 1;
+}
+
+/* treeBegin
+*PURPOSE: Sets up a tree for a body of the length, none of which has arrived.
+*INPUT: TreeHash* tree, HashPool* pool, uint64_t length
+*OUTPUTS: -
+*/
+void treeBegin(TreeHash *tree, HashPool *pool, uint64_t length)
+{
+  tree->pool = pool;
+  tree->next = NULL;
+  tree->data = NULL;
+  tree->length = length;
+  tree->segments = treeSegments(length);
+  tree->submitted = 0;
+  tree->claimed = 0;
+  tree->done = 0;
+  tree->queued = false;
+  tree->cvs = malloc(tree->segments * BLAKE3_CV_LENGTH);
+}
+
+/* treeArrived
+*PURPOSE: Queues every segment which has now arrived in full. The last
+*  segment is queued once the whole body has arrived. A NULL body means the
+*  body will not arrive, and is about to be freed: segments not yet claimed
+*  are dropped, and this returns once those already claimed are hashed. Made
+*  to be passed to recieveBodyProgress().
+*INPUT: void* to the TreeHash, char* body, uint64_t bytes received
+*OUTPUTS: -
+*/
+void treeArrived(void *arg, const char *data, uint64_t received)
+{
+  TreeHash *tree = (TreeHash*)arg;
+  HashPool *pool = tree->pool;
+  uint64_t arrived = received == tree->length ? tree->segments : received / TREE_SEGMENT;
+
+  pthread_mutex_lock(pool->mutex);
+
+  if(data == NULL)
+  { //abandoned
+    while(tree->claimed < tree->submitted)
+    {
+      claim(tree);
+      tree->done++;
+    }
+
+    while(tree->done < tree->claimed)
+    {
+      pthread_cond_wait(pool->hashed, pool->mutex);
+    }
+  }
+  else if(arrived > tree->submitted)
+  {
+    tree->data = data;
+    tree->submitted = arrived;
+
+    if(!tree->queued)
+    {
+      tree->next = NULL;
+
+      if(pool->tail == NULL)
+      {
+        pool->head = tree;
+      }
+      else
+      {
+        pool->tail->next = tree;
+      }
+
+      pool->tail = tree;
+      tree->queued = true;
+    }
+
+    pthread_cond_broadcast(pool->work);
+  }
+
+  pthread_mutex_unlock(pool->mutex);
+}
+
+/* treeFinish
+*PURPOSE: Once the whole body has arrived, hashes any of its segments no
+*  thread has started on, waits for the rest, and writes out the digest
+*  from the segments' chaining values. The digest can only be written for
+*  bodies of more than one segment; pass NULL to only fill in the chaining
+*  values.
+*INPUT: TreeHash* tree, size_t length of digest
+*OUTPUTS: uint8_t digest[length]
+*/
+void treeFinish(TreeHash *tree, uint8_t *digest, size_t length)
+{
+  HashPool *pool = tree->pool;
+
+  pthread_mutex_lock(pool->mutex);
+
+  while(tree->claimed < tree->submitted)
+  { //rather than wait behind other bodies
+    hashSegment(tree, claim(tree));
+  }
+
+  while(tree->done < tree->segments)
+  {
+    pthread_cond_wait(pool->hashed, pool->mutex);
+  }
+
+  pthread_mutex_unlock(pool->mutex);
+
+  if(digest != NULL)
+  {
+    Blake3Context ctx;
+
+    blake3Init(&ctx);
+
+    for(uint64_t i = 0; i < tree->segments - 1; i++)
+    {
+      blake3PushSubtree(&ctx, tree->cvs[i], TREE_SEGMENT_CHUNKS);
+    }
+
+    blake3FinalSubtree(&ctx, tree->cvs[tree->segments - 1], digest, length);
+  }
+}
+
+/* treeFree
+*PURPOSE: Frees the tree's chaining values. It must be finished or abandoned.
+*INPUT: TreeHash* tree
+*OUTPUTS: -
+*/
+void treeFree(TreeHash *tree)
+{
+  free(tree->cvs);
+  tree->cvs = NULL;
+}
+
+/* treeVerify
+*PURPOSE: Hashes every segment of a stored body on the pool, and compares
+*  them with the chaining values recorded when it was stored. Returns 'true'
+*  if they all match, otherwise writes the first segment which does not.
+*INPUT: HashPool* pool, char* data, uint64_t length, uint8_t* chaining values
+*OUTPUTS: int matched (boolean), uint64_t* bad segment
+*/
+int treeVerify(HashPool *pool, const char *data, uint64_t length, const uint8_t *cvs, uint64_t *bad)
+{
+  TreeHash tree;
+  int matched = true;
+
+  treeBegin(&tree, pool, length);
+  treeArrived(&tree, data, length);
+  treeFinish(&tree, NULL, 0);
+
+  for(uint64_t i = 0; matched && i < tree.segments; i++)
+  {
+    if(memcmp(tree.cvs[i], cvs + i * BLAKE3_CV_LENGTH, BLAKE3_CV_LENGTH))
+    {
+      matched = false;
+      *bad = i;
+    }
+  }
+
+  treeFree(&tree);
+
+  return matched;
+}
@@ -0,0 +1,61 @@
+/* treehash.h
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Header for treehash.c. BLAKE3 keys of large bodies, hashed a
+*  segment at a time on a pool of threads as the body arrives.
+*/
+
+#ifndef TREEHASH_H
+#define TREEHASH_H
+
+#include "blake3.h"
+#include <stdint.h>
+#include <pthread.h>
+
+#define TREE_SEGMENT_CHUNKS 1024 //a power of two, so each segment is a subtree of the body's tree
+#define TREE_SEGMENT (TREE_SEGMENT_CHUNKS * BLAKE3_CHUNK_LENGTH) //bytes
+#define MAX_HASH_THREADS 64
+
+typedef struct TreeHash
+{ //one body being hashed
+  struct HashPool* pool;
+  struct TreeHash* next; //in the pool's queue, while it has segments waiting for a thread
+  const char* data;
+  uint64_t length;
+  uint64_t segments; //the last may be partial
+  uint64_t submitted; //segments which have arrived, and can be hashed
+  uint64_t claimed; //by a thread
+  uint64_t done;
+  int queued;
+  uint8_t (*cvs)[BLAKE3_CV_LENGTH]; //of every segment, filled in as they are hashed
+} TreeHash;
+
+typedef struct HashPool
+{
+  pthread_mutex_t* mutex;
+  pthread_cond_t* work; //signalled when segments are submitted
+  pthread_cond_t* hashed; //broadcast when a segment's chaining value is filled in
+  TreeHash* head; //bodies with segments waiting, oldest first
+  TreeHash* tail;
+  int stop;
+  int threads;
+  pthread_t thread[MAX_HASH_THREADS];
+} HashPool;
+
+HashPool *hashPoolCreate(int threads);
+
+void hashPoolDestroy(HashPool* pool);
+
+uint64_t treeSegments(uint64_t length);
+
+void treeBegin(TreeHash* tree, HashPool* pool, uint64_t length);
+
+void treeArrived(void* tree, const char* data, uint64_t received);
+
+void treeFinish(TreeHash* tree, uint8_t* digest, size_t length);
+
+void treeFree(TreeHash* tree);
+
+int treeVerify(HashPool* pool, const char* data, uint64_t length, const uint8_t* cvs, uint64_t* bad);
+
+#endif
@@ -0,0 +1,241 @@
+/* upgrade.c
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Restarts the server without closing its listening sockets. The old
+*  server starts its binary again with one end of a Unix socket pair, named in
+*  UPGRADE_ENV, and passes the listening sockets over it with SCM_RIGHTS, so
+*  both processes hold the same sockets and connections keep queueing on them
+*  throughout. The two then exchange notes over the same socket: the new server
+*  says when it is ready, and the old one stops accepting, drains, and says
+*  when it is done, after which the new server rebuilds the index and starts
+*  accepting. Either side sees the other exit as the socket closing.
+*/
+
+#define _GNU_SOURCE //execvpe(), MSG_CMSG_CLOEXEC
+#include "upgrade.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+extern char **environ;
+
+/* upgradeSpawn
+*PURPOSE: Starts the server's binary again with the same arguments, and
+*  returns its pid, or -1 if it could not be started. The environment it is
+*  given is built before forking, as only exec may follow the fork in a
+*  process with other threads.
+*INPUT: char** argv the server was started with
+*OUTPUTS: pid_t pid, int* channel (this server's end of the Unix socket)
+*/
+pid_t upgradeSpawn(char *const *argv, int *channel)
+{
+  int pair[2];
+  pid_t pid = -1;
+
+  if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) == 0)
+  {
+    int count = 0;
+    char variable[64];
+
+    while(environ[count] != NULL)
+    {
+      count++;
+    }
+
+    char **env = calloc(count + 2, sizeof(char*));
+    memcpy(env, environ, count * sizeof(char*));
+    snprintf(variable, sizeof(variable), "%s=%d", UPGRADE_ENV, pair[1]);
+    env[count] = variable;
+
+    if((pid = fork()) == 0)
+    { //the new server's end is the only descriptor it inherits
+      fcntl(pair[1], F_SETFD, 0);
+      execvpe(argv[0], argv, env);
+      _exit(EXIT_FAILURE);
+    }
+
+    free(env);
+    close(pair[1]);
+
+    if(pid > 0)
+    {
+      *channel = pair[0];
+    }
+    else
+    {
+      close(pair[0]);
+    }
+  }
+
+  return pid;
+}
+
+/* upgradeChannel
+*PURPOSE: Returns this server's end of the Unix socket to the server it is
+*  taking over from, or -1 if it was not started by an upgrade. The variable is
+*  removed, so it is not passed on to a later upgrade.
+*INPUT: -
+*OUTPUTS: int channel descriptor
+*/
+int upgradeChannel(void)
+{
+  int channel = -1;
+  const char *value = getenv(UPGRADE_ENV);
+
+  if(value != NULL)
+  {
+    char *end;
+    long fd = strtol(value, &end, 10);
+
+    if(end != value && *end == '\0' && fd >= 0 && fcntl(fd, F_SETFD, FD_CLOEXEC) == 0)
+    {
+      channel = fd;
+    }
+
+    unsetenv(UPGRADE_ENV);
+  }
+
+  return channel;
+}
+
+/* upgradeSendSocks
+*PURPOSE: Passes the sockets over the channel, in order. The receiver gets
+*  its own descriptors for them, which stay open after this server closes its
+*  own. Returns 'true' if an error occurs.
+*INPUT: int channel descriptor, int* sock descriptors, int count (at most
+*  UPGRADE_MAX_SOCKS)
+*OUTPUTS: int error occured (boolean)
+*/
+int upgradeSendSocks(int channel, const int *socks, int count)
+{
+  int error = false;
+  union
+  { //aligned for the control message header
+    char buffer[CMSG_SPACE(sizeof(int) * UPGRADE_MAX_SOCKS)];
+    struct cmsghdr align;
+  } control;
+  int32_t sent = count; //some data must go with the descriptors, so the count, checked by the receiver
+  struct iovec data = {&sent, sizeof(sent)};
+  struct msghdr msg;
+
+  memset(&msg, 0, sizeof(msg));
+  memset(&control, 0, sizeof(control));
+  msg.msg_iov = &data;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buffer;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+  struct cmsghdr *header = CMSG_FIRSTHDR(&msg);
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN(sizeof(int) * count);
+  memcpy(CMSG_DATA(header), socks, sizeof(int) * count);
+
+  ssize_t done;
+
+  do
+  {
+    done = sendmsg(channel, &msg, MSG_NOSIGNAL);
+  } while(done < 0 && errno == EINTR);
+
+  error = done != sizeof(sent);
+
+  return !error;
+}
+
+/* upgradeRecvSocks
+*PURPOSE: Recieves the sockets passed by upgradeSendSocks(), and returns how
+*  many there were, or -1 if an error occurs or there were more than max.
+*INPUT: int channel descriptor, int max
+*OUTPUTS: int count, int* sock descriptors (close on exec)
+*/
+int upgradeRecvSocks(int channel, int *socks, int max)
+{
+  int count = -1;
+  union
+  {
+    char buffer[CMSG_SPACE(sizeof(int) * UPGRADE_MAX_SOCKS)];
+    struct cmsghdr align;
+  } control;
+  int32_t sent = 0;
+  struct iovec data = {&sent, sizeof(sent)};
+  struct msghdr msg;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &data;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buffer;
+  msg.msg_controllen = sizeof(control.buffer);
+
+  ssize_t done;
+
+  do
+  {
+    done = recvmsg(channel, &msg, MSG_CMSG_CLOEXEC);
+  } while(done < 0 && errno == EINTR);
+
+  struct cmsghdr *header = done == sizeof(sent) ? CMSG_FIRSTHDR(&msg) : NULL;
+
+  if(header != NULL && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+  {
+    int got = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+    if(got == sent && got <= max && !(msg.msg_flags & MSG_CTRUNC))
+    {
+      memcpy(socks, CMSG_DATA(header), sizeof(int) * got);
+      count = got;
+    }
+    else
+    { //not what was sent, so none of them are used
+      int *fds = (int*)CMSG_DATA(header);
+
+      for(int i = 0; i < got; i++)
+      {
+        close(fds[i]);
+      }
+    }
+  }
+
+  return count;
+}
+
+/* upgradeSend
+*PURPOSE: Sends a note (UPGRADE_ define) to the other server. Returns 'true'
+*  if an error occurs, such as the other server having exited.
+*INPUT: int channel descriptor, char note
+*OUTPUTS: int error occured (boolean)
+*/
+int upgradeSend(int channel, char note)
+{
+  ssize_t done;
+
+  do
+  {
+    done = send(channel, &note, 1, MSG_NOSIGNAL);
+  } while(done < 0 && errno == EINTR);
+
+  return done == 1;
+}
+
+/* upgradeWait
+*PURPOSE: Waits for a note from the other server. Returns 'true' if the
+*  other server exits first.
+*INPUT: int channel descriptor
+*OUTPUTS: int error occured (boolean), char* note (UPGRADE_ define)
+*/
+int upgradeWait(int channel, char *note)
+{
+  ssize_t done;
+
+  do
+  {
+    done = recv(channel, note, 1, 0);
+  } while(done < 0 && errno == EINTR);
+
+  return done == 1;
+}
@@ -0,0 +1,35 @@
+/* upgrade.h
+*AUTHOR: Jhi Morris (19173632)
+*MODIFIED: 2026-10-19
+*PURPOSE: Header for upgrade.c. Hands a running server's listening sockets to
+*  a newly started copy of its binary, so it can be restarted without any
+*  connection being refused.
+*/
+
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#include <signal.h>
+#include <sys/types.h>
+
+#define UPGRADE_SIGNAL SIGUSR2 //starts an upgrade
+#define UPGRADE_ENV "SERVER_UPGRADE_FD" //set for the new server, its end of the Unix socket to the old one
+#define UPGRADE_MAX_SOCKS 253 //sockets passed in one message at most, SCM_MAX_FD
+
+//note defines, sent between the servers once the sockets are passed
+#define UPGRADE_READY 'R' //new to old: started, stop accepting and drain
+#define UPGRADE_DRAINED 'D' //old to new: every connection is closed and nothing more will be journaled
+
+pid_t upgradeSpawn(char* const* argv, int* channel);
+
+int upgradeChannel(void);
+
+int upgradeSendSocks(int channel, const int* socks, int count);
+
+int upgradeRecvSocks(int channel, int* socks, int max);
+
+int upgradeSend(int channel, char note);
+
+int upgradeWait(int channel, char* note);
+
+#endif